@@ -37,6 +37,9 @@ LOCAL_SRC_FILES := \
 	audio_hw.c \
 	voice.c \
 	platform_info.c \
+	snd_card.c \
+	name_index.c \
+	edid.c \
 	$(AUDIO_PLATFORM)/platform.c
 
 LOCAL_SRC_FILES += audio_extn/audio_extn.c
@@ -50,6 +53,7 @@ endif
 
 ifeq ($(strip $(AUDIO_FEATURE_ENABLED_PCM_OFFLOAD)),true)
     LOCAL_CFLAGS += -DPCM_OFFLOAD_ENABLED
+    LOCAL_SRC_FILES += audio_extn/pcm_offload.c
 endif
 
 ifeq ($(strip $(AUDIO_FEATURE_ENABLED_ANC_HEADSET)),true)
@@ -107,6 +111,21 @@ ifeq ($(strip $(AUDIO_FEATURE_ENABLED_SPKR_PROTECTION)),true)
     LOCAL_SRC_FILES += audio_extn/spkr_protection.c
 endif
 
+ifeq ($(strip $(AUDIO_FEATURE_ENABLED_LATENCY_CALIBRATION)),true)
+    LOCAL_CFLAGS += -DLATENCY_CALIBRATION_ENABLED
+    LOCAL_SRC_FILES += audio_extn/latency.c
+endif
+
+ifeq ($(strip $(AUDIO_FEATURE_ENABLED_LOCK_DEBUG)),true)
+    LOCAL_CFLAGS += -DLOCK_DEBUG_ENABLED
+    LOCAL_SRC_FILES += audio_extn/lock_debug.c
+endif
+
+ifeq ($(strip $(AUDIO_FEATURE_ENABLED_PERIOD_TUNER)),true)
+    LOCAL_CFLAGS += -DPERIOD_TUNER_ENABLED
+    LOCAL_SRC_FILES += audio_extn/period_tuner.c
+endif
+
 ifdef MULTIPLE_HW_VARIANTS_ENABLED
   LOCAL_CFLAGS += -DHW_VARIANTS_ENABLED
   LOCAL_SRC_FILES += $(AUDIO_PLATFORM)/hw_info.c
@@ -163,6 +182,19 @@ LOCAL_SHARED_LIBRARIES := \
 	libdl \
 	libexpat
 
+ifeq ($(strip $(AUDIO_FEATURE_ENABLED_SIMULATOR)),true)
+    # Replace the sound card with the userspace simulator in sim/
+    LOCAL_CFLAGS += -DAUDIO_SIMULATOR_ENABLED
+    LOCAL_SRC_FILES += sim/sim_clock.c \
+                       sim/sim_pcm.c \
+                       sim/sim_compress.c \
+                       sim/sim_mixer.c \
+                       sim/sim_audio_route.c \
+                       sim/sim_hwdep.c \
+                       sim/sim_card.c
+    LOCAL_SHARED_LIBRARIES := $(filter-out libtinyalsa libtinycompress libaudioroute,$(LOCAL_SHARED_LIBRARIES))
+endif
+
 LOCAL_C_INCLUDES += \
 	external/tinyalsa/include \
 	external/tinycompress/include \
@@ -201,6 +233,32 @@ LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 
 LOCAL_MODULE_TAGS := optional
 
+# the simulator tests are built from the same sources, with the same flags
+AUDIO_HAL_SRC_FILES := $(LOCAL_SRC_FILES)
+AUDIO_HAL_CFLAGS := $(LOCAL_CFLAGS)
+AUDIO_HAL_C_INCLUDES := $(LOCAL_C_INCLUDES)
+AUDIO_HAL_SHARED_LIBRARIES := $(LOCAL_SHARED_LIBRARIES)
+
+include $(BUILD_SHARED_LIBRARY)
+
+ifeq ($(strip $(AUDIO_FEATURE_ENABLED_SIMULATOR)),true)
+# ACDB loader stub, selected with audio_hal.acdb_loader=libacdbloader_sim.so
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := sim/sim_acdb_loader.c \
+                   sim/sim_clock.c
+
+LOCAL_SHARED_LIBRARIES := \
+	liblog \
+	libcutils
+
+LOCAL_MODULE := libacdbloader_sim
+
+LOCAL_MODULE_TAGS := optional
+
 include $(BUILD_SHARED_LIBRARY)
 
+include $(LOCAL_PATH)/sim/tests/Android.mk
+endif
+
 endif
@@ -53,6 +53,7 @@
 
 /* Query fm volume */
 #define AUDIO_PARAMETER_KEY_FM_VOLUME "fm_volume"
+#define AUDIO_PARAMETER_KEY_FM_MUTE "fm_mute"
 
 /* Query Fluence type */
 #define AUDIO_PARAMETER_KEY_FLUENCE "fluence"
@@ -77,4 +78,36 @@
 
 #define AUDIO_PARAMETER_IS_HW_DECODER_SESSION_ALLOWED  "is_hw_dec_session_allowed"
 
+/* Query stream or routing telemetry */
+#define AUDIO_PARAMETER_KEY_HAL_STATS "hal_stats"
+
+/* Playback is about to start on this output, route and prepare it now */
+#define AUDIO_PARAMETER_KEY_WARM_UP "warm_up"
+
+#define AUDIO_PARAMETER_KEY_ANC "anc_enabled"
+#define AUDIO_PARAMETER_KEY_WFD "wfd_channel_cap"
+
+#define AUDIO_PARAMETER_HFP_ENABLE "hfp_enable"
+#define AUDIO_PARAMETER_HFP_SET_SAMPLING_RATE "hfp_set_sampling_rate"
+#define AUDIO_PARAMETER_KEY_HFP_VOLUME "hfp_volume"
+
+#define AUDIO_PARAMETER_DDP_DEV          "ddp_device"
+#define AUDIO_PARAMETER_DDP_CH_CAP       "ddp_chancap"
+#define AUDIO_PARAMETER_DDP_MAX_OUT_CHAN "ddp_maxoutchan"
+#define AUDIO_PARAMETER_DDP_OUT_MODE     "ddp_outmode"
+#define AUDIO_PARAMETER_DDP_OUT_LFE_ON   "ddp_outlfeon"
+#define AUDIO_PARAMETER_DDP_COMP_MODE    "ddp_compmode"
+#define AUDIO_PARAMETER_DDP_STEREO_MODE  "ddp_stereomode"
+
+/* older audio.h versions lack the device connection keys */
+#ifndef AUDIO_PARAMETER_DEVICE_CONNECT
+#define AUDIO_PARAMETER_DEVICE_CONNECT "connect"
+#endif
+#ifndef AUDIO_PARAMETER_DEVICE_DISCONNECT
+#define AUDIO_PARAMETER_DEVICE_DISCONNECT "disconnect"
+#endif
+
+/* Measure the round trip latency of the given output device */
+#define AUDIO_PARAMETER_KEY_LATENCY_CALIBRATION "latency_calibration"
+
 #endif /* AUDIO_DEFS_H */
@@ -46,8 +46,6 @@ static struct audio_extn_module aextnmod = {
     .proxy_channel_num = 2,
 };
 
-#define AUDIO_PARAMETER_KEY_ANC        "anc_enabled"
-#define AUDIO_PARAMETER_KEY_WFD        "wfd_channel_cap"
 #define AUDIO_PARAMETER_CAN_OPEN_PROXY "can_open_proxy"
 #ifndef FM_POWER_OPT
 #define audio_extn_fm_set_parameters(adev, parms) (0)
@@ -61,6 +59,15 @@ void audio_extn_fm_set_parameters(struct audio_device *adev,
 void audio_extn_hfp_set_parameters(struct audio_device *adev,
                                            struct str_parms *parms);
 #endif
+#ifndef LATENCY_CALIBRATION_ENABLED
+#define audio_extn_latency_set_parameters(adev, parms)       (0)
+#define audio_extn_latency_get_parameters(query, reply)      (0)
+#else
+void audio_extn_latency_set_parameters(struct audio_device *adev,
+                                       struct str_parms *parms);
+void audio_extn_latency_get_parameters(struct str_parms *query,
+                                       struct str_parms *reply);
+#endif
 
 #ifndef ANC_HEADSET_ENABLED
 #define audio_extn_set_anc_parameters(adev, parms)       (0)
@@ -252,7 +259,7 @@ static int32_t afe_proxy_set_channel_mapping(struct audio_device *adev,
         return -EINVAL;
     }
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -289,7 +296,7 @@ int32_t audio_extn_set_afe_proxy_channel_mixer(struct audio_device *adev,
     }
 
     if(channel_count >= 2 && channel_count <= 8) {
-       ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+       ctl = get_mixer_ctl(adev, mixer_ctl_name);
        if (!ctl) {
             ALOGE("%s: could not get ctl for mixer cmd - %s",
                   __func__, mixer_ctl_name);
@@ -381,6 +388,49 @@ int32_t audio_extn_get_afe_proxy_channel_count()
 
 #endif /* AFE_PROXY_ENABLED */
 
+/* keys consumed by audio_extn_set_parameters(), see adev_set_parameters() */
+const char * const audio_extn_parameter_keys[] = {
+#ifdef ANC_HEADSET_ENABLED
+    AUDIO_PARAMETER_KEY_ANC,
+#endif
+#ifdef FLUENCE_ENABLED
+    AUDIO_PARAMETER_KEY_FLUENCE,
+#endif
+#ifdef AFE_PROXY_ENABLED
+    AUDIO_PARAMETER_KEY_WFD,
+#endif
+#ifdef FM_POWER_OPT
+    AUDIO_PARAMETER_KEY_SND_CARD_STATUS,
+    AUDIO_PARAMETER_STREAM_ROUTING,
+    AUDIO_PARAMETER_KEY_HANDLE_FM,
+    AUDIO_PARAMETER_KEY_FM_VOLUME,
+    AUDIO_PARAMETER_KEY_FM_MUTE,
+#endif
+#ifdef AUDIO_LISTEN_ENABLED
+    /* the listen library parses its own keys */
+    PARAM_KEY_ANY,
+#endif
+#ifdef HFP_ENABLED
+    AUDIO_PARAMETER_HFP_ENABLE,
+    AUDIO_PARAMETER_HFP_SET_SAMPLING_RATE,
+    AUDIO_PARAMETER_STREAM_ROUTING,
+    AUDIO_PARAMETER_KEY_HFP_VOLUME,
+#endif
+#ifdef DS1_DOLBY_DDP_ENABLED
+    AUDIO_PARAMETER_DDP_DEV,
+    AUDIO_PARAMETER_DDP_CH_CAP,
+    AUDIO_PARAMETER_DDP_MAX_OUT_CHAN,
+    AUDIO_PARAMETER_DDP_OUT_MODE,
+    AUDIO_PARAMETER_DDP_OUT_LFE_ON,
+    AUDIO_PARAMETER_DDP_COMP_MODE,
+    AUDIO_PARAMETER_DDP_STEREO_MODE,
+#endif
+#ifdef LATENCY_CALIBRATION_ENABLED
+    AUDIO_PARAMETER_KEY_LATENCY_CALIBRATION,
+#endif
+    NULL,
+};
+
 void audio_extn_set_parameters(struct audio_device *adev,
                                struct str_parms *parms)
 {
@@ -391,6 +441,7 @@ void audio_extn_set_parameters(struct audio_device *adev,
    audio_extn_listen_set_parameters(adev, parms);
    audio_extn_hfp_set_parameters(adev, parms);
    audio_extn_ddp_set_parameters(adev, parms);
+   audio_extn_latency_set_parameters(adev, parms);
 }
 
 void audio_extn_get_parameters(const struct audio_device *adev,
@@ -400,6 +451,7 @@ void audio_extn_get_parameters(const struct audio_device *adev,
     char *kv_pairs = NULL;
     audio_extn_get_afe_proxy_parameters(query, reply);
     audio_extn_get_fluence_parameters(adev, query, reply);
+    audio_extn_latency_get_parameters(query, reply);
 
     kv_pairs = str_parms_to_str(reply);
     ALOGD_IF(kv_pairs != NULL, "%s: returns %s", __func__, kv_pairs);
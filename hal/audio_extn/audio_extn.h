@@ -47,6 +47,7 @@
 
 void audio_extn_set_parameters(struct audio_device *adev,
                                struct str_parms *parms);
+extern const char * const audio_extn_parameter_keys[];
 
 void audio_extn_get_parameters(const struct audio_device *adev,
                                struct str_parms *query,
@@ -172,6 +173,36 @@ void audio_extn_spkr_prot_stop_processing();
 bool audio_extn_spkr_prot_is_enabled();
 #endif
 
+#ifndef PERIOD_TUNER_ENABLED
+#define audio_extn_period_tuner_init()                       do { } while (0)
+#define audio_extn_period_tuner_deinit()                     do { } while (0)
+#define audio_extn_period_tuner_open(adev, out)              do { } while (0)
+#define audio_extn_period_tuner_session_start(adev, out)     do { } while (0)
+#define audio_extn_period_tuner_session_end(out)             do { } while (0)
+#define audio_extn_period_tuner_dump(fd)                     do { } while (0)
+#else
+void audio_extn_period_tuner_init(void);
+void audio_extn_period_tuner_deinit(void);
+void audio_extn_period_tuner_open(struct audio_device *adev,
+                                  struct stream_out *out);
+void audio_extn_period_tuner_session_start(struct audio_device *adev,
+                                           struct stream_out *out);
+void audio_extn_period_tuner_session_end(struct stream_out *out);
+void audio_extn_period_tuner_dump(int fd);
+#endif
+
+#ifndef PCM_OFFLOAD_ENABLED
+#define audio_extn_pcm_offload_is_supported(format)          (false)
+#define audio_extn_pcm_offload_init(out, info)               (-ENOSYS)
+#define audio_extn_pcm_offload_write_l(out, buffer, bytes)   (-ENOSYS)
+#else
+bool audio_extn_pcm_offload_is_supported(audio_format_t format);
+int audio_extn_pcm_offload_init(struct stream_out *out,
+                                const audio_offload_info_t *info);
+ssize_t audio_extn_pcm_offload_write_l(struct stream_out *out,
+                                       const void *buffer, size_t bytes);
+#endif
+
 #ifndef COMPRESS_CAPTURE_ENABLED
 #define audio_extn_compr_cap_init(in)                     (0)
 #define audio_extn_compr_cap_enabled()                    (0)
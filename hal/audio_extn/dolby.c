@@ -36,14 +36,6 @@
 
 #ifdef DS1_DOLBY_DDP_ENABLED
 
-#define AUDIO_PARAMETER_DDP_DEV          "ddp_device"
-#define AUDIO_PARAMETER_DDP_CH_CAP       "ddp_chancap"
-#define AUDIO_PARAMETER_DDP_MAX_OUT_CHAN "ddp_maxoutchan"
-#define AUDIO_PARAMETER_DDP_OUT_MODE     "ddp_outmode"
-#define AUDIO_PARAMETER_DDP_OUT_LFE_ON   "ddp_outlfeon"
-#define AUDIO_PARAMETER_DDP_COMP_MODE    "ddp_compmode"
-#define AUDIO_PARAMETER_DDP_STEREO_MODE  "ddp_stereomode"
-
 #define PARAM_ID_MAX_OUTPUT_CHANNELS    0x00010DE2
 #define PARAM_ID_CTL_RUNNING_MODE       0x0
 #define PARAM_ID_CTL_ERROR_CONCEAL      0x00010DE3
@@ -220,7 +212,7 @@ void send_ddp_endp_params_stream(struct stream_out *out,
                                                        PCM_PLAYBACK);
         snprintf(mixer_ctl_name, sizeof(mixer_ctl_name),
                  "Audio Stream %d Dec Params", pcm_device_id);
-        ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+        ctl = get_mixer_ctl(adev, mixer_ctl_name);
         if (!ctl) {
             ALOGE("%s: Could not get ctl for mixer cmd - %s",
                   __func__, mixer_ctl_name);
@@ -414,7 +406,7 @@ void audio_extn_dolby_set_endpoint(struct audio_device *adev)
     if (!send)
         return;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -451,7 +443,7 @@ void audio_extn_dolby_set_dmid(struct audio_device *adev)
     property_get("dmid",c_dmid,"0");
     i_dmid = atoll(c_dmid);
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -32,9 +32,6 @@
 #include <cutils/str_parms.h>
 
 #ifdef FM_POWER_OPT
-#define AUDIO_PARAMETER_KEY_HANDLE_FM "handle_fm"
-#define AUDIO_PARAMETER_KEY_FM_VOLUME "fm_volume"
-#define AUDIO_PARAMETER_KEY_FM_MUTE "fm_mute"
 #define FM_LOOPBACK_DRAIN_TIME_MS 2
 
 static struct pcm_config pcm_config_fm = {
@@ -100,7 +97,7 @@ static int32_t fm_set_volume(struct audio_device *adev, float value, bool persis
     }
 
     ALOGD("%s: Setting FM volume to %d \n", __func__, vol);
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -144,7 +141,7 @@ static int32_t fm_stop(struct audio_device *adev)
     disable_snd_device(adev, uc_info->out_snd_device);
     disable_snd_device(adev, uc_info->in_snd_device);
 
-    list_remove(&uc_info->list);
+    usecase_list_remove(adev, uc_info);
     free(uc_info);
 
     ALOGD("%s: exit: status(%d)", __func__, ret);
@@ -171,7 +168,7 @@ static int32_t fm_start(struct audio_device *adev)
     uc_info->in_snd_device = SND_DEVICE_NONE;
     uc_info->out_snd_device = SND_DEVICE_NONE;
 
-    list_add_tail(&adev->usecase_list, &uc_info->list);
+    usecase_list_add(adev, uc_info);
 
     select_devices(adev, USECASE_AUDIO_PLAYBACK_FM);
 
@@ -41,9 +41,6 @@ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #include <cutils/str_parms.h>
 
 #ifdef HFP_ENABLED
-#define AUDIO_PARAMETER_HFP_ENABLE      "hfp_enable"
-#define AUDIO_PARAMETER_HFP_SET_SAMPLING_RATE "hfp_set_sampling_rate"
-#define AUDIO_PARAMETER_KEY_HFP_VOLUME "hfp_volume"
 
 static int32_t start_hfp(struct audio_device *adev,
                                struct str_parms *parms __unused);
@@ -105,7 +102,7 @@ static int32_t hfp_set_volume(struct audio_device *adev, float value)
     }
 
     ALOGD("%s: Setting HFP volume to %d \n", __func__, vol);
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -141,7 +138,7 @@ static int32_t start_hfp(struct audio_device *adev,
     uc_info->in_snd_device = SND_DEVICE_NONE;
     uc_info->out_snd_device = SND_DEVICE_NONE;
 
-    list_add_tail(&adev->usecase_list, &uc_info->list);
+    usecase_list_add(adev, uc_info);
 
     select_devices(adev, hfpmod.ucid);
 
@@ -255,7 +252,7 @@ static int32_t stop_hfp(struct audio_device *adev)
     disable_snd_device(adev, uc_info->out_snd_device);
     disable_snd_device(adev, uc_info->in_snd_device);
 
-    list_remove(&uc_info->list);
+    usecase_list_remove(adev, uc_info);
     free(uc_info);
 
     ALOGD("%s: exit: status(%d)", __func__, ret);
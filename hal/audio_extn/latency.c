@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_latency"
+/*#define LOG_NDEBUG 0*/
+#define LOG_NDDEBUG 0
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cutils/log.h>
+#include <cutils/str_parms.h>
+
+#include "audio_hw.h"
+#include "platform.h"
+#include "platform_api.h"
+
+#ifdef LATENCY_CALIBRATION_ENABLED
+/*
+ * Loopback latency calibration. Setting latency_calibration=<output device>
+ * while no stream is active plays an impulse on the low latency playback
+ * path and records it back through the handset mic on the record path.
+ * Half of the measured round trip, from the playback timestamp of the
+ * impulse to the capture timestamp of its onset, is stored as the render
+ * latency of the output sound device, which is what presentation positions
+ * are corrected by. Splitting the round trip in half assumes the capture
+ * path is as late as the render path; on hardware where it is not, the
+ * table in audio_platform_info.xml should be used instead.
+ *
+ * The measurement takes under a second and runs with adev->lock dropped, so
+ * that other parameters and streams are not held up for it. The loopback
+ * usecases stay in the list meanwhile: a second request is refused, and a
+ * stream started during the measurement may spoil it. On the simulator,
+ * audio.sim.loopback_us sets the round trip.
+ */
+
+#define CAL_SAMPLE_RATE      48000
+#define CAL_PERIOD_SIZE      240
+#define CAL_WARMUP_PERIODS   20
+#define CAL_TIMEOUT_PERIODS  100
+#define CAL_IMPULSE_FRAMES   48
+#define CAL_IMPULSE_LEVEL    0x4000
+#define CAL_ONSET_LEVEL      0x1000
+
+struct latency_module {
+    snd_device_t snd_device;
+    int64_t latency_us;     /* last result, -1 when none or failed */
+};
+
+static struct latency_module latmod = {
+    .snd_device = SND_DEVICE_NONE,
+    .latency_us = -1,
+};
+
+static struct pcm_config pcm_config_cal_playback = {
+    .channels = 2,
+    .rate = CAL_SAMPLE_RATE,
+    .period_size = CAL_PERIOD_SIZE,
+    .period_count = 4,
+    .format = PCM_FORMAT_S16_LE,
+    .start_threshold = CAL_PERIOD_SIZE,
+    .stop_threshold = INT_MAX,
+    .avail_min = CAL_PERIOD_SIZE,
+};
+
+static struct pcm_config pcm_config_cal_capture = {
+    .channels = 1,
+    .rate = CAL_SAMPLE_RATE,
+    .period_size = CAL_PERIOD_SIZE,
+    .period_count = 8,
+    .format = PCM_FORMAT_S16_LE,
+    .start_threshold = 0,
+    .stop_threshold = INT_MAX,
+    .avail_min = 0,
+};
+
+static int64_t timespec_to_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static int64_t frames_to_ns(int64_t frames)
+{
+    return frames * 1000000000LL / CAL_SAMPLE_RATE;
+}
+
+static int measure_round_trip(struct pcm *out_pcm, struct pcm *in_pcm,
+                              int64_t *round_trip_ns)
+{
+    const unsigned int out_bytes = pcm_frames_to_bytes(out_pcm, CAL_PERIOD_SIZE);
+    const unsigned int in_bytes = pcm_frames_to_bytes(in_pcm, CAL_PERIOD_SIZE);
+    const unsigned int buffer_size = pcm_get_buffer_size(out_pcm);
+    int16_t *out_buf, *in_buf;
+    int64_t t_out = -1;
+    struct timespec ts;
+    unsigned int avail;
+    int i, j, ret = -ETIMEDOUT;
+
+    out_buf = (int16_t *)calloc(1, out_bytes);
+    in_buf = (int16_t *)calloc(1, in_bytes);
+    if (!out_buf || !in_buf) {
+        ret = -ENOMEM;
+        goto exit;
+    }
+
+    /* keep playback a period ahead of each capture read */
+    for (i = 0; i < (int)pcm_config_cal_playback.period_count - 1; i++) {
+        if (pcm_write(out_pcm, out_buf, out_bytes) < 0) {
+            ALOGE("%s: playback prefill failed: %s", __func__,
+                  pcm_get_error(out_pcm));
+            ret = -EIO;
+            goto exit;
+        }
+    }
+
+    for (i = 0; i < CAL_WARMUP_PERIODS + CAL_TIMEOUT_PERIODS; i++) {
+        if (i == CAL_WARMUP_PERIODS) {
+            for (j = 0; j < CAL_IMPULSE_FRAMES; j++)
+                out_buf[2 * j] = out_buf[2 * j + 1] = CAL_IMPULSE_LEVEL;
+        } else if (i == CAL_WARMUP_PERIODS + 1) {
+            memset(out_buf, 0, out_bytes);
+        }
+        if (pcm_write(out_pcm, out_buf, out_bytes) < 0) {
+            ALOGE("%s: playback failed: %s", __func__, pcm_get_error(out_pcm));
+            ret = -EIO;
+            goto exit;
+        }
+        if (i == CAL_WARMUP_PERIODS) {
+            /* the impulse starts after everything queued before it */
+            if (pcm_get_htimestamp(out_pcm, &avail, &ts) < 0) {
+                ALOGE("%s: no playback timestamp", __func__);
+                ret = -EIO;
+                goto exit;
+            }
+            t_out = timespec_to_ns(&ts) +
+                    frames_to_ns((int64_t)buffer_size - avail - CAL_PERIOD_SIZE);
+        }
+
+        if (pcm_read(in_pcm, in_buf, in_bytes) < 0) {
+            ALOGE("%s: capture failed: %s", __func__, pcm_get_error(in_pcm));
+            ret = -EIO;
+            goto exit;
+        }
+        if (t_out < 0)
+            continue;
+        for (j = 0; j < CAL_PERIOD_SIZE; j++) {
+            if (in_buf[j] > CAL_ONSET_LEVEL || in_buf[j] < -CAL_ONSET_LEVEL)
+                break;
+        }
+        if (j == CAL_PERIOD_SIZE)
+            continue;
+
+        /* frame j was captured avail + (period - j) frames before tstamp */
+        if (pcm_get_htimestamp(in_pcm, &avail, &ts) < 0) {
+            ALOGE("%s: no capture timestamp", __func__);
+            ret = -EIO;
+            goto exit;
+        }
+        *round_trip_ns = timespec_to_ns(&ts) -
+                         frames_to_ns((int64_t)avail + CAL_PERIOD_SIZE - j) - t_out;
+        ret = 0;
+        break;
+    }
+    if (ret == -ETIMEDOUT)
+        ALOGE("%s: impulse not captured", __func__);
+
+exit:
+    free(out_buf);
+    free(in_buf);
+    return ret;
+}
+
+/*
+ * must be called with adev->lock held and no usecase active, the lock is
+ * dropped while measuring
+ */
+static int run_calibration(struct audio_device *adev, audio_devices_t device)
+{
+    struct stream_out out;
+    struct stream_in in;
+    struct audio_usecase *uc_out = NULL, *uc_in = NULL;
+    struct pcm *out_pcm = NULL, *in_pcm = NULL;
+    int out_id, in_id;
+    int64_t round_trip_ns = 0;
+    int ret;
+
+    memset(&out, 0, sizeof(out));
+    out.dev = adev;
+    out.devices = device;
+    out.usecase = USECASE_AUDIO_PLAYBACK_LOW_LATENCY;
+    out.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    out.sample_rate = CAL_SAMPLE_RATE;
+
+    memset(&in, 0, sizeof(in));
+    in.dev = adev;
+    in.device = AUDIO_DEVICE_IN_BUILTIN_MIC;
+    in.source = AUDIO_SOURCE_MIC;
+    in.usecase = USECASE_AUDIO_RECORD;
+    in.channel_mask = AUDIO_CHANNEL_IN_MONO;
+
+    out_id = platform_get_pcm_device_id(out.usecase, PCM_PLAYBACK);
+    in_id = platform_get_pcm_device_id(in.usecase, PCM_CAPTURE);
+    if (out_id < 0 || in_id < 0) {
+        ALOGE("%s: invalid PCM devices (out: %d in: %d)", __func__,
+              out_id, in_id);
+        return -EINVAL;
+    }
+
+    uc_out = (struct audio_usecase *)calloc(1, sizeof(struct audio_usecase));
+    uc_in = (struct audio_usecase *)calloc(1, sizeof(struct audio_usecase));
+    if (!uc_out || !uc_in) {
+        free(uc_out);
+        free(uc_in);
+        return -ENOMEM;
+    }
+
+    uc_out->id = out.usecase;
+    uc_out->type = PCM_PLAYBACK;
+    uc_out->stream.out = &out;
+    uc_out->devices = out.devices;
+    uc_out->out_snd_device = SND_DEVICE_NONE;
+    uc_out->in_snd_device = SND_DEVICE_NONE;
+    usecase_list_add(adev, uc_out);
+
+    uc_in->id = in.usecase;
+    uc_in->type = PCM_CAPTURE;
+    uc_in->stream.in = &in;
+    uc_in->devices = in.device;
+    uc_in->out_snd_device = SND_DEVICE_NONE;
+    uc_in->in_snd_device = SND_DEVICE_NONE;
+    usecase_list_add(adev, uc_in);
+
+    select_devices(adev, uc_out->id);
+    select_devices(adev, uc_in->id);
+
+    out_pcm = pcm_open(adev->snd_card, out_id, PCM_OUT | PCM_MONOTONIC,
+                       &pcm_config_cal_playback);
+    if (out_pcm == NULL || !pcm_is_ready(out_pcm)) {
+        ALOGE("%s: %s", __func__, out_pcm ? pcm_get_error(out_pcm) :
+              "cannot open playback");
+        ret = -EIO;
+        goto exit;
+    }
+    in_pcm = pcm_open(adev->snd_card, in_id, PCM_IN | PCM_MONOTONIC,
+                      &pcm_config_cal_capture);
+    if (in_pcm == NULL || !pcm_is_ready(in_pcm)) {
+        ALOGE("%s: %s", __func__, in_pcm ? pcm_get_error(in_pcm) :
+              "cannot open capture");
+        ret = -EIO;
+        goto exit;
+    }
+
+    pthread_mutex_unlock(&adev->lock);
+    ret = measure_round_trip(out_pcm, in_pcm, &round_trip_ns);
+    pthread_mutex_lock(&adev->lock);
+    if (ret == 0) {
+        latmod.snd_device = uc_out->out_snd_device;
+        latmod.latency_us = round_trip_ns / 2000;
+        platform_set_snd_device_render_latency(latmod.snd_device,
+                                               latmod.latency_us);
+        ALOGD("%s: %s round trip %lld us, render latency %lld us", __func__,
+              platform_get_snd_device_name(latmod.snd_device),
+              (long long)(round_trip_ns / 1000), (long long)latmod.latency_us);
+    }
+
+exit:
+    if (out_pcm)
+        pcm_close(out_pcm);
+    if (in_pcm)
+        pcm_close(in_pcm);
+
+    begin_routing_transaction(adev);
+    disable_audio_route(adev, uc_out);
+    disable_snd_device(adev, uc_out->out_snd_device);
+    disable_audio_route(adev, uc_in);
+    disable_snd_device(adev, uc_in->in_snd_device);
+    commit_routing_transaction(adev);
+
+    usecase_list_remove(adev, uc_out);
+    usecase_list_remove(adev, uc_in);
+    free(uc_out);
+    free(uc_in);
+    return ret;
+}
+
+void audio_extn_latency_set_parameters(struct audio_device *adev,
+                                       struct str_parms *parms)
+{
+    char value[32];
+    int ret;
+
+    ret = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_LATENCY_CALIBRATION,
+                            value, sizeof(value));
+    if (ret < 0)
+        return;
+
+    if (!list_empty(&adev->usecase_list)) {
+        ALOGW("%s: streams are active, calibration skipped", __func__);
+        latmod.latency_us = -1;
+        return;
+    }
+
+    ALOGD("%s: calibrating output device %#x", __func__, atoi(value));
+    if (run_calibration(adev, (audio_devices_t)atoi(value)) < 0)
+        latmod.latency_us = -1;
+}
+
+void audio_extn_latency_get_parameters(struct str_parms *query,
+                                       struct str_parms *reply)
+{
+    char value[64];
+    int ret;
+
+    ret = str_parms_get_str(query, AUDIO_PARAMETER_KEY_LATENCY_CALIBRATION,
+                            value, sizeof(value));
+    if (ret < 0)
+        return;
+
+    if (latmod.latency_us < 0)
+        snprintf(value, sizeof(value), "none");
+    else
+        snprintf(value, sizeof(value), "%s:%lld",
+                 platform_get_snd_device_name(latmod.snd_device),
+                 (long long)latmod.latency_us);
+    str_parms_add_str(reply, AUDIO_PARAMETER_KEY_LATENCY_CALIBRATION, value);
+}
+#endif /* LATENCY_CALIBRATION_ENABLED */
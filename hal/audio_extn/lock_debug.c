@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_lock_debug"
+/*#define LOG_NDEBUG 0*/
+#define LOG_NDDEBUG 0
+
+/* this file implements the wrappers, it calls the real functions */
+#define LOCK_DEBUG_NO_WRAP
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "audio_hw.h"
+
+#ifdef LOCK_DEBUG_ENABLED
+/*
+ * Run time check of the lock order documented in audio_hw.h. Mutexes are
+ * registered with their rank; each thread records the registered mutexes it
+ * holds, and taking one whose rank is not above all of them is reported
+ * once per pair of lock names. Only blocking locks are checked, a trylock
+ * cannot deadlock. Nothing is enforced, the locking itself is unchanged.
+ */
+
+#define LOCK_DEBUG_MAX_LOCKS    64
+#define LOCK_DEBUG_MAX_HELD     8
+#define LOCK_DEBUG_MAX_REPORTED 32
+
+struct lock_class {
+    pthread_mutex_t *mutex;
+    int rank;
+    const char *name;
+};
+
+struct held_lock {
+    pthread_mutex_t *mutex;
+    int rank;
+    const char *name;
+    const char *file;
+    int line;
+};
+
+struct held_locks {
+    unsigned int depth;
+    struct held_lock locks[LOCK_DEBUG_MAX_HELD];
+};
+
+struct reported_pair {
+    const char *held;
+    const char *taken;
+};
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct lock_class registry[LOCK_DEBUG_MAX_LOCKS];
+static struct reported_pair reported[LOCK_DEBUG_MAX_REPORTED];
+static unsigned int reported_count;
+static char last_report[160];
+static volatile int32_t violations;
+
+static pthread_once_t held_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t held_key;
+
+static void held_key_create(void)
+{
+    pthread_key_create(&held_key, free);
+}
+
+/* locks tracked for the calling thread, NULL if it never took one */
+static struct held_locks *peek_held_locks(void)
+{
+    pthread_once(&held_key_once, held_key_create);
+    return (struct held_locks *)pthread_getspecific(held_key);
+}
+
+static struct held_locks *get_held_locks(void)
+{
+    struct held_locks *held = peek_held_locks();
+
+    if (!held) {
+        held = (struct held_locks *)calloc(1, sizeof(struct held_locks));
+        if (held)
+            pthread_setspecific(held_key, held);
+    }
+    return held;
+}
+
+void lock_debug_register(pthread_mutex_t *mutex, int rank, const char *name)
+{
+    int i, free_slot = -1;
+
+    pthread_mutex_lock(&registry_lock);
+    for (i = 0; i < LOCK_DEBUG_MAX_LOCKS; i++) {
+        if (registry[i].mutex == mutex) {
+            free_slot = i;
+            break;
+        }
+        if (!registry[i].mutex && free_slot < 0)
+            free_slot = i;
+    }
+    if (free_slot >= 0) {
+        registry[free_slot].mutex = mutex;
+        registry[free_slot].rank = rank;
+        registry[free_slot].name = name;
+    } else {
+        ALOGW("%s: registry full, %s is not checked", __func__, name);
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+void lock_debug_unregister(pthread_mutex_t *mutex)
+{
+    int i;
+
+    pthread_mutex_lock(&registry_lock);
+    for (i = 0; i < LOCK_DEBUG_MAX_LOCKS; i++) {
+        if (registry[i].mutex == mutex) {
+            registry[i].mutex = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static bool lock_debug_find(pthread_mutex_t *mutex, struct lock_class *cls)
+{
+    bool found = false;
+    int i;
+
+    pthread_mutex_lock(&registry_lock);
+    for (i = 0; i < LOCK_DEBUG_MAX_LOCKS; i++) {
+        if (registry[i].mutex == mutex) {
+            *cls = registry[i];
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return found;
+}
+
+static void lock_debug_report(const struct held_lock *held,
+                              const struct lock_class *cls,
+                              const char *file, int line)
+{
+    unsigned int i;
+
+    android_atomic_inc(&violations);
+
+    pthread_mutex_lock(&registry_lock);
+    for (i = 0; i < reported_count; i++) {
+        if (reported[i].held == held->name && reported[i].taken == cls->name) {
+            pthread_mutex_unlock(&registry_lock);
+            return;
+        }
+    }
+    if (reported_count < LOCK_DEBUG_MAX_REPORTED) {
+        reported[reported_count].held = held->name;
+        reported[reported_count].taken = cls->name;
+        reported_count++;
+    }
+    snprintf(last_report, sizeof(last_report), "%s at %s:%d while holding "
+             "%s from %s:%d", cls->name, file, line, held->name, held->file,
+             held->line);
+    pthread_mutex_unlock(&registry_lock);
+
+    ALOGE("lock order violation: taking %s (rank %d) at %s:%d while holding "
+          "%s (rank %d) taken at %s:%d", cls->name, cls->rank, file, line,
+          held->name, held->rank, held->file, held->line);
+}
+
+static void lock_debug_push(struct held_locks *held, pthread_mutex_t *mutex,
+                            const struct lock_class *cls, const char *file,
+                            int line)
+{
+    struct held_lock *entry;
+
+    if (held->depth >= LOCK_DEBUG_MAX_HELD) {
+        ALOGW("%s: more than %d locks held, not tracking %s", __func__,
+              LOCK_DEBUG_MAX_HELD, cls->name);
+        return;
+    }
+    entry = &held->locks[held->depth++];
+    entry->mutex = mutex;
+    entry->rank = cls->rank;
+    entry->name = cls->name;
+    entry->file = file;
+    entry->line = line;
+}
+
+int lock_debug_mutex_lock(pthread_mutex_t *mutex, const char *file, int line)
+{
+    struct held_locks *held;
+    struct lock_class cls;
+    unsigned int i;
+    int ret;
+
+    if (!lock_debug_find(mutex, &cls) || !(held = get_held_locks()))
+        return pthread_mutex_lock(mutex);
+
+    for (i = 0; i < held->depth; i++) {
+        if (held->locks[i].rank >= cls.rank) {
+            lock_debug_report(&held->locks[i], &cls, file, line);
+            break;
+        }
+    }
+
+    ret = pthread_mutex_lock(mutex);
+    if (ret == 0)
+        lock_debug_push(held, mutex, &cls, file, line);
+    return ret;
+}
+
+int lock_debug_mutex_trylock(pthread_mutex_t *mutex, const char *file,
+                             int line)
+{
+    struct held_locks *held;
+    struct lock_class cls;
+    int ret;
+
+    ret = pthread_mutex_trylock(mutex);
+    if (ret == 0 && lock_debug_find(mutex, &cls) && (held = get_held_locks()))
+        lock_debug_push(held, mutex, &cls, file, line);
+    return ret;
+}
+
+int lock_debug_mutex_unlock(pthread_mutex_t *mutex)
+{
+    struct held_locks *held = peek_held_locks();
+    unsigned int i;
+
+    /* locks may be released out of order */
+    for (i = held ? held->depth : 0; i > 0; i--) {
+        if (held->locks[i - 1].mutex == mutex) {
+            memmove(&held->locks[i - 1], &held->locks[i],
+                    (held->depth - i) * sizeof(struct held_lock));
+            held->depth--;
+            break;
+        }
+    }
+    return pthread_mutex_unlock(mutex);
+}
+
+void lock_debug_dump(int fd)
+{
+    pthread_mutex_lock(&registry_lock);
+    dprintf(fd, "  lock order violations %d%s%s\n", violations,
+            violations ? ", last: " : "", violations ? last_report : "");
+    pthread_mutex_unlock(&registry_lock);
+}
+#endif /* LOCK_DEBUG_ENABLED */
@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_pcm_offload"
+/*#define LOG_NDEBUG 0*/
+#define LOG_NDDEBUG 0
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <sound/asound.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+#include "platform.h"
+#include "platform_api.h"
+
+#ifdef PCM_OFFLOAD_ENABLED
+/*
+ * Linear PCM played through the compress offload path, so that the DSP
+ * holds up to MAX_PCM_OFFLOAD_FRAGMENT_SIZE per fragment and the AP can
+ * sleep between writes. 16 bit, 8_24 bit, packed 24 bit and 32 bit PCM is
+ * handed to the driver as is. Float, which the DSP does not take, and mono,
+ * which is sent as stereo, are converted into a HAL owned buffer first; the
+ * driver may then accept part of a frame, the rest of which is skipped on the
+ * next write since the client only sees whole frames consumed.
+ */
+
+#define PCM_OFFLOAD_FLOAT_BITS_PROPERTY "audio.offload.pcm.float.bits"
+#define PCM_OFFLOAD_MAX_CHANNELS        8
+
+/* bytes per sample of the client format, 0 if it cannot be offloaded */
+static size_t src_sample_size(audio_format_t format)
+{
+    audio_format_t main = format & AUDIO_FORMAT_MAIN_MASK;
+
+    if (main == AUDIO_FORMAT_PCM_OFFLOAD) {
+        switch (format & AUDIO_FORMAT_SUB_MASK) {
+        case AUDIO_FORMAT_PCM_SUB_16_BIT:
+            return sizeof(int16_t);
+        case AUDIO_FORMAT_PCM_SUB_8_24_BIT:
+            return sizeof(int32_t);
+        }
+    } else if (main == AUDIO_FORMAT_PCM) {
+        switch (format) {
+        case AUDIO_FORMAT_PCM_16_BIT:
+            return sizeof(int16_t);
+        case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+            return 3;
+        case AUDIO_FORMAT_PCM_8_24_BIT:
+        case AUDIO_FORMAT_PCM_32_BIT:
+        case AUDIO_FORMAT_PCM_FLOAT:
+            return sizeof(int32_t);
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+/* width float is converted to, 16 unless the property asks for more */
+static audio_format_t float_dst_format(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get(PCM_OFFLOAD_FLOAT_BITS_PROPERTY, value, "16");
+    switch (atoi(value)) {
+    case 24:
+        return AUDIO_FORMAT_PCM_24_BIT_PACKED;
+    case 32:
+        return AUDIO_FORMAT_PCM_32_BIT;
+    default:
+        return AUDIO_FORMAT_PCM_16_BIT;
+    }
+}
+
+static uint32_t dsp_format_of(audio_format_t format)
+{
+    switch (format & AUDIO_FORMAT_SUB_MASK) {
+    case AUDIO_FORMAT_PCM_SUB_8_24_BIT:
+        return SNDRV_PCM_FORMAT_S24_LE;
+    case AUDIO_FORMAT_PCM_SUB_24_BIT_PACKED:
+        return SNDRV_PCM_FORMAT_S24_3LE;
+    case AUDIO_FORMAT_PCM_SUB_32_BIT:
+        return SNDRV_PCM_FORMAT_S32_LE;
+    default:
+        return SNDRV_PCM_FORMAT_S16_LE;
+    }
+}
+
+/*
+ * Conversion kernels. The scalar loops are kept free of calls and branches
+ * the compiler cannot turn into selects so that they vectorize; float to 16
+ * and 32 bit, the common cases, use NEON directly where it is available.
+ */
+
+static inline int32_t clamp_float(float f, float scale, int32_t max)
+{
+    f *= scale;
+    if (f >= (float)max)
+        return max;
+    if (!(f > -(float)max - 1.0f))
+        return -max - 1;
+    return (int32_t)(f + (f >= 0 ? 0.5f : -0.5f));
+}
+
+static void float_to_s16(int16_t *dst, const float *src, size_t count)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (; i + 4 <= count; i += 4) {
+        /* saturating Q31 conversion, then rounding narrow to Q15 */
+        int32x4_t v = vcvtq_n_s32_f32(vld1q_f32(src + i), 31);
+        vst1_s16(dst + i, vqrshrn_n_s32(v, 16));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = (int16_t)clamp_float(src[i], 32768.0f, INT16_MAX);
+}
+
+static void float_to_s24_packed(uint8_t *dst, const float *src, size_t count)
+{
+    size_t i;
+    int32_t v;
+
+    for (i = 0; i < count; i++) {
+        v = clamp_float(src[i], 8388608.0f, 0x7fffff);
+        dst[3 * i] = (uint8_t)v;
+        dst[3 * i + 1] = (uint8_t)(v >> 8);
+        dst[3 * i + 2] = (uint8_t)(v >> 16);
+    }
+}
+
+static void float_to_s32(int32_t *dst, const float *src, size_t count)
+{
+    size_t i = 0;
+    float f;
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (; i + 4 <= count; i += 4)
+        vst1q_s32(dst + i, vcvtq_n_s32_f32(vld1q_f32(src + i), 31));
+#endif
+    /* INT32_MAX is not a float, saturate before scaling */
+    for (; i < count; i++) {
+        f = src[i];
+        if (f >= 1.0f)
+            dst[i] = INT32_MAX;
+        else if (!(f > -1.0f))
+            dst[i] = INT32_MIN;
+        else
+            dst[i] = (int32_t)(f * 2147483648.0f);
+    }
+}
+
+/*
+ * Widens frames of src_channels to dst_channels, output channel n taking
+ * input channel n or the last one. dst may be src: frames are walked from
+ * the end so that no frame is overwritten before it is read.
+ */
+static void remap_channels(uint8_t *dst, const uint8_t *src, size_t frames,
+                           size_t sample_size, unsigned int src_channels,
+                           unsigned int dst_channels)
+{
+    size_t src_frame = sample_size * src_channels;
+    size_t dst_frame = sample_size * dst_channels;
+    uint8_t frame[PCM_OFFLOAD_MAX_CHANNELS * sizeof(int32_t)];
+    unsigned int ch;
+
+    while (frames-- > 0) {
+        memcpy(frame, src + frames * src_frame, src_frame);
+        for (ch = 0; ch < dst_channels; ch++)
+            memcpy(dst + frames * dst_frame + ch * sample_size,
+                   frame + (ch < src_channels ? ch : src_channels - 1) *
+                           sample_size,
+                   sample_size);
+    }
+}
+
+static void convert(struct pcm_offload_conv *conv, uint8_t *dst,
+                    const void *src, size_t frames)
+{
+    size_t samples = frames * conv->src_channels;
+    size_t sample_size = conv->dst_frame_size / conv->dst_channels;
+
+    if (conv->src_format == AUDIO_FORMAT_PCM_FLOAT) {
+        switch (conv->dsp_format) {
+        case SNDRV_PCM_FORMAT_S24_3LE:
+            float_to_s24_packed(dst, (const float *)src, samples);
+            break;
+        case SNDRV_PCM_FORMAT_S32_LE:
+            float_to_s32((int32_t *)dst, (const float *)src, samples);
+            break;
+        default:
+            float_to_s16((int16_t *)dst, (const float *)src, samples);
+            break;
+        }
+        src = dst;
+    }
+    if (conv->dst_channels != conv->src_channels)
+        remap_channels(dst, (const uint8_t *)src, frames, sample_size,
+                       conv->src_channels, conv->dst_channels);
+}
+
+bool audio_extn_pcm_offload_is_supported(audio_format_t format)
+{
+    return src_sample_size(format) != 0;
+}
+
+int audio_extn_pcm_offload_init(struct stream_out *out,
+                                const audio_offload_info_t *info)
+{
+    struct pcm_offload_conv *conv = &out->pcm_conv;
+    struct snd_codec *codec = out->compr_config.codec;
+    audio_offload_info_t dsp_info = *info;
+    size_t sample_size = src_sample_size(info->format);
+    unsigned int channels;
+
+    channels = audio_channel_count_from_out_mask(out->channel_mask);
+    if (sample_size == 0 || channels == 0 ||
+            channels > PCM_OFFLOAD_MAX_CHANNELS) {
+        ALOGE("%s: unsupported format %#x with %u channels", __func__,
+              info->format, channels);
+        return -EINVAL;
+    }
+
+    memset(conv, 0, sizeof(*conv));
+    /* the client may leave the mask out of info, the stream always has it */
+    dsp_info.channel_mask = out->channel_mask;
+    conv->src_format = info->format;
+    conv->src_channels = channels;
+    conv->src_frame_size = sample_size * channels;
+    if (info->format == AUDIO_FORMAT_PCM_FLOAT)
+        dsp_info.format = float_dst_format();
+    conv->dsp_format = dsp_format_of(dsp_info.format);
+    conv->dst_channels = channels;
+    if (channels == 1) {
+        conv->dst_channels = 2;
+        dsp_info.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    }
+    if (dsp_info.format != info->format)
+        sample_size = src_sample_size(dsp_info.format);
+    conv->dst_frame_size = sample_size * conv->dst_channels;
+    conv->active = info->format == AUDIO_FORMAT_PCM_FLOAT ||
+                   conv->dst_channels != conv->src_channels;
+
+    out->compr_config.fragment_size =
+            platform_get_pcm_offload_buffer_size(&dsp_info);
+    codec->id = SND_AUDIOCODEC_PCM;
+    codec->ch_in = conv->dst_channels;
+    codec->ch_out = conv->dst_channels;
+    codec->format = conv->dsp_format;
+
+    conv->client_buffer_size = out->compr_config.fragment_size /
+            conv->dst_frame_size * conv->src_frame_size;
+    if (conv->active) {
+        conv->buf = malloc(out->compr_config.fragment_size);
+        if (conv->buf == NULL)
+            return -ENOMEM;
+        conv->buf_size = out->compr_config.fragment_size;
+    }
+
+    ALOGV("%s: format %#x ch %u -> dsp format %u ch %u, fragment %u, %s",
+          __func__, info->format, channels, conv->dsp_format,
+          conv->dst_channels, out->compr_config.fragment_size,
+          conv->active ? "converted" : "passthrough");
+    return 0;
+}
+
+ssize_t audio_extn_pcm_offload_write_l(struct stream_out *out,
+                                       const void *buffer, size_t bytes)
+{
+    struct pcm_offload_conv *conv = &out->pcm_conv;
+    size_t frames = bytes / conv->src_frame_size;
+    size_t size = frames * conv->dst_frame_size;
+    size_t total;
+    uint8_t *buf;
+    int ret;
+
+    if (frames == 0)
+        return 0;
+
+    if (size > conv->buf_size) {
+        buf = (uint8_t *)realloc(conv->buf, size);
+        if (buf == NULL) {
+            ALOGE("%s: no memory for %zu bytes of conversion buffer",
+                  __func__, size);
+            return -ENOMEM;
+        }
+        conv->buf = buf;
+        conv->buf_size = size;
+    }
+    convert(conv, (uint8_t *)conv->buf, buffer, frames);
+
+    ret = compress_write(out->compr, (uint8_t *)conv->buf + conv->partial_bytes,
+                         size - conv->partial_bytes);
+    if (ret < 0)
+        return -errno;
+
+    total = conv->partial_bytes + ret;
+    conv->partial_bytes = total % conv->dst_frame_size;
+    return total / conv->dst_frame_size * conv->src_frame_size;
+}
+#endif /* PCM_OFFLOAD_ENABLED */
@@ -0,0 +1,651 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_period_tuner"
+/*#define LOG_NDEBUG 0*/
+#define LOG_NDDEBUG 0
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+#include "platform.h"
+#include "platform_api.h"
+
+#ifdef AUDIO_SIMULATOR_ENABLED
+#include "sim/sim.h"
+#endif
+
+#ifdef PERIOD_TUNER_ENABLED
+/*
+ * Period and fragment auto tuning for the PCM playback usecases. Each
+ * (usecase, output snd device) pair moves along a short ladder of period
+ * size and count multiples of the stock configuration. A session runs from
+ * the first write after standby to the next standby; at its end the xruns
+ * per minute and the writes per second it saw are folded into the figures
+ * of the level it ran at, and the pair moves to another level when that one
+ * is expected to cost clearly less. The cost weighs glitches
+ * against wakeups and latency, with latency counting more for short stock
+ * periods. Levels are only applied while the PCM is closed: the period
+ * count when the stream starts, the period size when it is opened, since
+ * the client sizes its writes from the buffer size read at open.
+ *
+ * Offload and the multichannel output are left alone: compress fragments
+ * are sized for the DSP by platform_get_compress_offload_buffer_size() and
+ * the HDMI multichannel period by the backend, neither from xruns seen here.
+ *
+ * What was learned is kept across reboots in TUNER_FILE. The file is
+ * written by a thread of its own, never from the standby that decided a
+ * move, since that holds the stream lock.
+ */
+
+#define TUNER_FILE          "/data/misc/audio/period_tuner.bin"
+#define TUNER_FILE_MAGIC    0x50545531 /* "PTU1" */
+#define TUNER_MAX_ENTRIES   32
+
+/* sessions shorter than this say little about the configuration */
+#define TUNER_MIN_SESSION_NS    (2 * 1000000000LL)
+/* sessions to spend on a level before moving away from it */
+#define TUNER_MIN_SESSIONS      3
+/* a neighbour must cost this much less (percent) to move there */
+#define TUNER_HYSTERESIS_PCT    10
+/* stock periods shorter than this are tuned for latency rather than power */
+#define TUNER_LATENCY_PERIOD_US 10000
+
+struct tuner_level {
+    unsigned int period_mult;
+    unsigned int extra_periods;
+};
+
+/* ordered by buffer depth, level 0 is the stock configuration */
+static const struct tuner_level tuner_levels[] = {
+    { 1, 0 },
+    { 1, 1 },   /* one more period of headroom, same wakeups */
+    { 2, 0 },   /* half the wakeups */
+    { 2, 1 },
+};
+
+#define TUNER_LEVELS (int)(sizeof(tuner_levels) / sizeof(tuner_levels[0]))
+
+/* cost = glitch * xruns/min + wakeup * wakeups/s + latency * ms, x100 */
+struct tuner_weights {
+    unsigned int glitch;
+    unsigned int wakeup;
+    unsigned int latency;
+};
+
+static const struct tuner_weights latency_weights = { 100000, 10, 1000 };
+static const struct tuner_weights power_weights   = { 100000, 100, 5 };
+
+struct tuner_level_stats {
+    uint32_t sessions;
+    float xruns_per_min;    /* moving averages over the sessions */
+    float wakeups_per_s;
+};
+
+struct tuner_entry {
+    int32_t usecase;        /* -1 for a free slot */
+    int32_t snd_device;
+    uint32_t base_period_size;
+    uint32_t base_period_count;
+    uint32_t rate;
+    int32_t level;
+    uint32_t dwell;         /* sessions at level since the last move */
+    uint32_t last_used;
+    struct tuner_level_stats levels[TUNER_LEVELS];
+};
+
+struct tuner_file_header {
+    uint32_t magic;
+    uint32_t entry_size;
+    uint32_t count;
+};
+
+static pthread_mutex_t tuner_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tuner_lock_once = PTHREAD_ONCE_INIT;
+static struct tuner_entry tuner_table[TUNER_MAX_ENTRIES];
+static bool tuner_loaded;
+static uint32_t tuner_clock;     /* orders entries by use, for replacement */
+static uint32_t tuner_moves;
+
+/* the writer thread, protected by tuner_lock */
+static pthread_t tuner_writer;
+static pthread_cond_t tuner_writer_cond = PTHREAD_COND_INITIALIZER;
+static bool tuner_writer_running;
+static bool tuner_writer_exit;
+static bool tuner_dirty;         /* tuner_table changed since last written */
+static uint32_t tuner_saves;
+static struct tuner_entry tuner_saved[TUNER_MAX_ENTRIES]; /* writer only */
+
+static void tuner_lock_register(void)
+{
+    lock_debug_register(&tuner_lock, LOCK_RANK_EXTN, "period_tuner");
+}
+
+static void tuner_lock_l(void)
+{
+    pthread_once(&tuner_lock_once, tuner_lock_register);
+    pthread_mutex_lock(&tuner_lock);
+}
+
+#ifdef AUDIO_SIMULATOR_ENABLED
+/* sessions run on the simulated card's clock, the file is kept by the tests */
+static int64_t tuner_now_ns(void)
+{
+    return sim_clock_now_ns();
+}
+
+static void tuner_file_path(char *path)
+{
+    sim_get_config("audio.sim.period_tuner_file", path, TUNER_FILE);
+}
+#else
+static int64_t tuner_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void tuner_file_path(char *path)
+{
+    strlcpy(path, TUNER_FILE, PROPERTY_VALUE_MAX);
+}
+#endif
+
+static void tuner_load_l(void)
+{
+    char path[PROPERTY_VALUE_MAX];
+    struct tuner_file_header hdr;
+    FILE *fp;
+    int i;
+
+    tuner_loaded = true;
+    for (i = 0; i < TUNER_MAX_ENTRIES; i++)
+        tuner_table[i].usecase = -1;
+
+    tuner_file_path(path);
+    fp = fopen(path, "rb");
+    if (!fp)
+        return;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+            hdr.magic != TUNER_FILE_MAGIC ||
+            hdr.entry_size != sizeof(struct tuner_entry) ||
+            hdr.count > TUNER_MAX_ENTRIES ||
+            fread(tuner_table, sizeof(struct tuner_entry), hdr.count, fp) !=
+                hdr.count) {
+        ALOGW("%s: ignoring invalid %s", __func__, path);
+        for (i = 0; i < TUNER_MAX_ENTRIES; i++)
+            tuner_table[i].usecase = -1;
+    } else {
+        for (i = 0; i < (int)hdr.count; i++) {
+            if (tuner_table[i].level < 0 || tuner_table[i].level >= TUNER_LEVELS)
+                tuner_table[i].level = 0;
+            if (tuner_table[i].last_used > tuner_clock)
+                tuner_clock = tuner_table[i].last_used;
+        }
+        ALOGV("%s: %u entries", __func__, hdr.count);
+    }
+    fclose(fp);
+}
+
+static int tuner_write_all(int fd, const void *buf, size_t bytes)
+{
+    const char *p = buf;
+    ssize_t ret;
+
+    while (bytes > 0) {
+        ret = write(fd, p, bytes);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        p += ret;
+        bytes -= ret;
+    }
+    return 0;
+}
+
+/*
+ * Written to a temporary file which is synced before it is renamed over the
+ * previous one, so that neither a crash nor a power cut leaves half a table.
+ */
+static int tuner_write_file(const struct tuner_entry *table, uint32_t count)
+{
+    char path[PROPERTY_VALUE_MAX], tmp[PROPERTY_VALUE_MAX + 4];
+    struct tuner_file_header hdr;
+    char *slash;
+    int fd;
+
+    tuner_file_path(path);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    hdr.magic = TUNER_FILE_MAGIC;
+    hdr.entry_size = sizeof(struct tuner_entry);
+    hdr.count = count;
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+    if (fd < 0) {
+        ALOGE("%s: open failed %s", __func__, strerror(errno));
+        return -errno;
+    }
+    if (tuner_write_all(fd, &hdr, sizeof(hdr)) != 0 ||
+            tuner_write_all(fd, table, count * sizeof(*table)) != 0 ||
+            fsync(fd) != 0) {
+        ALOGE("%s: write failed %s", __func__, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        return -EIO;
+    }
+    close(fd);
+    if (rename(tmp, path) != 0) {
+        ALOGE("%s: rename failed %s", __func__, strerror(errno));
+        unlink(tmp);
+        return -errno;
+    }
+
+    /* and the rename itself */
+    slash = strrchr(path, '/');
+    if (slash != NULL && slash != path) {
+        *slash = '\0';
+        fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+    }
+    return 0;
+}
+
+/* must be called with tuner_lock held */
+static uint32_t tuner_count_l(void)
+{
+    uint32_t count = 0;
+    int i;
+
+    for (i = 0; i < TUNER_MAX_ENTRIES; i++)
+        if (tuner_table[i].usecase >= 0)
+            count = i + 1;
+    return count;
+}
+
+/* writes the table each time it changed, until told to exit */
+static void *tuner_writer_loop(void *context __unused)
+{
+    uint32_t count;
+    int ret;
+
+    tuner_lock_l();
+    for (;;) {
+        while (!tuner_dirty && !tuner_writer_exit)
+            pthread_cond_wait(&tuner_writer_cond, &tuner_lock);
+        /* what is pending is still written on exit */
+        if (!tuner_dirty)
+            break;
+        tuner_dirty = false;
+        count = tuner_count_l();
+        memcpy(tuner_saved, tuner_table, count * sizeof(struct tuner_entry));
+        pthread_mutex_unlock(&tuner_lock);
+
+        ret = tuner_write_file(tuner_saved, count);
+
+        tuner_lock_l();
+        if (ret == 0)
+            tuner_saves++;
+    }
+    pthread_mutex_unlock(&tuner_lock);
+    return NULL;
+}
+
+/* must be called with tuner_lock held */
+static void tuner_save_l(void)
+{
+    uint32_t count;
+
+    tuner_dirty = true;
+    if (tuner_writer_running) {
+        pthread_cond_signal(&tuner_writer_cond);
+        return;
+    }
+    /* no writer thread to hand it to */
+    tuner_dirty = false;
+    count = tuner_count_l();
+    if (tuner_write_file(tuner_table, count) == 0)
+        tuner_saves++;
+}
+
+static struct tuner_entry *tuner_find_l(const struct stream_out *out,
+                                        snd_device_t snd_device, bool create)
+{
+    struct tuner_entry *entry, *victim = NULL;
+    int i;
+
+    if (!tuner_loaded)
+        tuner_load_l();
+
+    for (i = 0; i < TUNER_MAX_ENTRIES; i++) {
+        entry = &tuner_table[i];
+        if (entry->usecase == (int32_t)out->usecase &&
+                entry->snd_device == (int32_t)snd_device &&
+                entry->base_period_size == out->tuner.base_period_size &&
+                entry->base_period_count == out->tuner.base_period_count &&
+                entry->rate == out->config.rate) {
+            entry->last_used = ++tuner_clock;
+            return entry;
+        }
+        if (!victim || entry->usecase < 0 ||
+                (victim->usecase >= 0 && entry->last_used < victim->last_used))
+            victim = entry;
+    }
+    if (!create)
+        return NULL;
+
+    memset(victim, 0, sizeof(*victim));
+    victim->usecase = out->usecase;
+    victim->snd_device = snd_device;
+    victim->base_period_size = out->tuner.base_period_size;
+    victim->base_period_count = out->tuner.base_period_count;
+    victim->rate = out->config.rate;
+    victim->level = out->tuner.level;
+    victim->last_used = ++tuner_clock;
+    return victim;
+}
+
+static unsigned int level_period_size(const struct tuner_entry *entry,
+                                      int level)
+{
+    return entry->base_period_size * tuner_levels[level].period_mult;
+}
+
+static unsigned int level_period_count(const struct tuner_entry *entry,
+                                       int level)
+{
+    return entry->base_period_count + tuner_levels[level].extra_periods;
+}
+
+static unsigned int level_buffer_frames(const struct tuner_entry *entry,
+                                        int level)
+{
+    return level_period_size(entry, level) * level_period_count(entry, level);
+}
+
+/*
+ * Expected cost of a level. Levels without sessions of their own borrow the
+ * figures of the current one, with xruns scaled by the buffer depth and
+ * wakeups by the period size.
+ */
+static float level_cost(const struct tuner_entry *entry, int level)
+{
+    const struct tuner_level_stats *cur = &entry->levels[entry->level];
+    const struct tuner_level_stats *lvl = &entry->levels[level];
+    const struct tuner_weights *w;
+    float xruns, wakeups, latency_ms;
+
+    if (entry->base_period_size * 1000000LL / entry->rate <
+            TUNER_LATENCY_PERIOD_US)
+        w = &latency_weights;
+    else
+        w = &power_weights;
+
+    if (lvl->sessions) {
+        xruns = lvl->xruns_per_min;
+        wakeups = lvl->wakeups_per_s;
+    } else {
+        xruns = cur->xruns_per_min * level_buffer_frames(entry, entry->level) /
+                level_buffer_frames(entry, level);
+        wakeups = cur->wakeups_per_s * level_period_size(entry, entry->level) /
+                  level_period_size(entry, level);
+    }
+    latency_ms = level_buffer_frames(entry, level) * 1000.0f / entry->rate;
+
+    return w->glitch * xruns + w->wakeup * wakeups + w->latency * latency_ms;
+}
+
+static int tuner_choose_level(const struct tuner_entry *entry)
+{
+    float cost, best_cost = level_cost(entry, entry->level);
+    int best = entry->level;
+    int level;
+
+    if (entry->dwell < TUNER_MIN_SESSIONS)
+        return entry->level;
+
+    best_cost -= best_cost * TUNER_HYSTERESIS_PCT / 100;
+    for (level = 0; level < TUNER_LEVELS; level++) {
+        if (level == entry->level)
+            continue;
+        cost = level_cost(entry, level);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = level;
+        }
+    }
+    return best;
+}
+
+static bool out_is_tunable(const struct stream_out *out)
+{
+    return (out->usecase == USECASE_AUDIO_PLAYBACK_DEEP_BUFFER ||
+            out->usecase == USECASE_AUDIO_PLAYBACK_LOW_LATENCY) &&
+           !out->mmap_mode && out->config.rate != 0;
+}
+
+/* called with adev->lock held once the stream config is chosen */
+void audio_extn_period_tuner_open(struct audio_device *adev,
+                                  struct stream_out *out)
+{
+    struct tuner_entry *entry;
+    snd_device_t snd_device;
+
+    out->tuner.level = -1;
+    out->tuner.start_ns = 0;
+    if (!out_is_tunable(out))
+        return;
+
+    out->tuner.base_period_size = out->config.period_size;
+    out->tuner.base_period_count = out->config.period_count;
+    out->tuner.level = 0;
+    snd_device = platform_get_output_snd_device(adev->platform, out->devices);
+
+    tuner_lock_l();
+    entry = tuner_find_l(out, snd_device, false);
+    if (entry && entry->level != 0) {
+        out->tuner.level = entry->level;
+        out->config.period_size = level_period_size(entry, entry->level);
+        out->config.period_count = level_period_count(entry, entry->level);
+        out->config.start_threshold = out->config.period_size / 4;
+        out->config.avail_min = out->config.period_size / 4;
+        ALOGD("%s: usecase %d on %s opened with %u x %u", __func__,
+              out->usecase, platform_get_snd_device_name(snd_device),
+              out->config.period_size, out->config.period_count);
+    }
+    pthread_mutex_unlock(&tuner_lock);
+}
+
+/*
+ * Called with out->lock and adev->lock held once the stream is routed for
+ * the first write after standby. A cold start takes the period count of the
+ * learned level; the period size stays what the stream was opened with.
+ */
+void audio_extn_period_tuner_session_start(struct audio_device *adev,
+                                           struct stream_out *out)
+{
+    struct audio_usecase *usecase;
+    struct tuner_entry *entry;
+    unsigned int count;
+    int level;
+
+    out->tuner.start_ns = 0;
+    if (out->tuner.level < 0)
+        return;
+    usecase = get_usecase_from_list(adev, out->usecase);
+    if (!usecase || usecase->out_snd_device == SND_DEVICE_NONE)
+        return;
+
+    out->tuner.snd_device = usecase->out_snd_device;
+    tuner_lock_l();
+    entry = tuner_find_l(out, out->tuner.snd_device, false);
+    if (entry && !out->pcm) {
+        count = level_period_count(entry, entry->level);
+        for (level = 0; level < TUNER_LEVELS; level++) {
+            if (level_period_size(entry, level) == out->config.period_size &&
+                    level_period_count(entry, level) == count) {
+                out->config.period_count = count;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&tuner_lock);
+
+    /* the level the session is accounted to is what actually runs */
+    for (level = 0; level < TUNER_LEVELS; level++) {
+        if (out->tuner.base_period_size * tuner_levels[level].period_mult ==
+                out->config.period_size &&
+            out->tuner.base_period_count + tuner_levels[level].extra_periods ==
+                out->config.period_count)
+            break;
+    }
+    if (level == TUNER_LEVELS)
+        return;
+    out->tuner.level = level;
+    out->tuner.start_ns = tuner_now_ns();
+    out->tuner.start_calls = out->stats.calls;
+    out->tuner.start_xruns = out->stats.xruns;
+}
+
+/* called with out->lock held when the stream enters standby */
+void audio_extn_period_tuner_session_end(struct stream_out *out)
+{
+    struct tuner_level_stats *stats;
+    struct tuner_entry *entry;
+    int64_t duration_ns;
+    float xruns_per_min, wakeups_per_s;
+    int level;
+
+    if (out->tuner.start_ns == 0)
+        return;
+    duration_ns = tuner_now_ns() - out->tuner.start_ns;
+    out->tuner.start_ns = 0;
+    if (duration_ns < TUNER_MIN_SESSION_NS)
+        return;
+
+    xruns_per_min = (out->stats.xruns - out->tuner.start_xruns) *
+                    60000000000.0f / duration_ns;
+    wakeups_per_s = (out->stats.calls - out->tuner.start_calls) *
+                    1000000000.0f / duration_ns;
+
+    tuner_lock_l();
+    entry = tuner_find_l(out, out->tuner.snd_device, true);
+
+    stats = &entry->levels[out->tuner.level];
+    if (stats->sessions == 0) {
+        stats->xruns_per_min = xruns_per_min;
+        stats->wakeups_per_s = wakeups_per_s;
+    } else {
+        stats->xruns_per_min += (xruns_per_min - stats->xruns_per_min) / 4;
+        stats->wakeups_per_s += (wakeups_per_s - stats->wakeups_per_s) / 4;
+    }
+    stats->sessions++;
+    if (out->tuner.level != entry->level) {
+        /* opened before the last move, only decide on the current level */
+        pthread_mutex_unlock(&tuner_lock);
+        return;
+    }
+    entry->dwell++;
+
+    /* glitches seen elsewhere fade, so a level that failed is tried again */
+    for (level = 0; level < TUNER_LEVELS; level++)
+        if (level != entry->level)
+            entry->levels[level].xruns_per_min *= 0.875f;
+
+    level = tuner_choose_level(entry);
+    if (level != entry->level) {
+        ALOGI("%s: usecase %d on %s: level %d -> %d (%u x %u), %.1f xruns/min,"
+              " %.1f wakeups/s", __func__, out->usecase,
+              platform_get_snd_device_name(out->tuner.snd_device),
+              entry->level, level, level_period_size(entry, level),
+              level_period_count(entry, level), stats->xruns_per_min,
+              stats->wakeups_per_s);
+        entry->level = level;
+        entry->dwell = 0;
+        tuner_moves++;
+        tuner_save_l();
+    }
+    pthread_mutex_unlock(&tuner_lock);
+}
+
+void audio_extn_period_tuner_init(void)
+{
+    tuner_lock_l();
+    tuner_writer_exit = false;
+    if (pthread_create(&tuner_writer, (const pthread_attr_t *) NULL,
+                       tuner_writer_loop, NULL) == 0)
+        tuner_writer_running = true;
+    else
+        ALOGE("%s: no writer thread, saving from standby", __func__);
+    pthread_mutex_unlock(&tuner_lock);
+}
+
+/* writes what is pending before returning */
+void audio_extn_period_tuner_deinit(void)
+{
+    tuner_lock_l();
+    if (!tuner_writer_running) {
+        pthread_mutex_unlock(&tuner_lock);
+        return;
+    }
+    tuner_writer_exit = true;
+    pthread_cond_signal(&tuner_writer_cond);
+    pthread_mutex_unlock(&tuner_lock);
+    pthread_join(tuner_writer, (void **) NULL);
+
+    tuner_lock_l();
+    tuner_writer_running = false;
+    pthread_mutex_unlock(&tuner_lock);
+}
+
+void audio_extn_period_tuner_dump(int fd)
+{
+    const struct tuner_entry *entry;
+    int i;
+
+    tuner_lock_l();
+    dprintf(fd, "  period tuner: %u level changes, %u saves\n", tuner_moves,
+            tuner_saves);
+    for (i = 0; i < TUNER_MAX_ENTRIES; i++) {
+        entry = &tuner_table[i];
+        if (!tuner_loaded || entry->usecase < 0)
+            continue;
+        dprintf(fd, "    usecase %d on %s: %u x %u, %u sessions, "
+                "%.1f xruns/min, %.1f wakeups/s\n", entry->usecase,
+                platform_get_snd_device_name(entry->snd_device),
+                level_period_size(entry, entry->level),
+                level_period_count(entry, entry->level), entry->dwell,
+                entry->levels[entry->level].xruns_per_min,
+                entry->levels[entry->level].wakeups_per_s);
+    }
+    pthread_mutex_unlock(&tuner_lock);
+}
+#endif /* PERIOD_TUNER_ENABLED */
@@ -610,8 +610,7 @@ int audio_extn_spkr_prot_start_processing(snd_device_t snd_device)
     }
     spkr_prot_calib_cancel(adev);
     spkr_prot_set_spkrstatus(true);
-    if (platform_send_audio_calibration(adev->platform,
-        SND_DEVICE_OUT_SPEAKER_PROTECTED) < 0) {
+    if (send_snd_device_calibration(adev, SND_DEVICE_OUT_SPEAKER_PROTECTED) < 0) {
         adev->snd_dev_ref_cnt[snd_device]--;
         return -EINVAL;
     }
@@ -655,8 +654,7 @@ int audio_extn_spkr_prot_start_processing(snd_device_t snd_device)
 
 exit:
    /* Clear VI feedback cal and replace with handset MIC  */
-   platform_send_audio_calibration(adev->platform,
-        SND_DEVICE_IN_HANDSET_MIC);
+   send_snd_device_calibration(adev, SND_DEVICE_IN_HANDSET_MIC);
     if (ret) {
         if (handle.pcm_tx)
             pcm_close(handle.pcm_tx);
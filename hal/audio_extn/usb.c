@@ -33,6 +33,8 @@
 #include <system/audio.h>
 #include <tinyalsa/asoundlib.h>
 
+#include "audio_hw.h"
+
 #ifdef USB_HEADSET_ENABLED
 #define USB_LOW_LATENCY_OUTPUT_PERIOD_SIZE   512
 #define USB_LOW_LATENCY_OUTPUT_PERIOD_COUNT  8
@@ -590,11 +592,17 @@ void audio_extn_usb_init(void *adev)
                         (const pthread_mutexattr_t *) NULL);
      pthread_mutex_init(&usbmod->usb_record_lock,
                         (const pthread_mutexattr_t *) NULL);
+     lock_debug_register(&usbmod->usb_playback_lock, LOCK_RANK_EXTN,
+                         "usb_playback_lock");
+     lock_debug_register(&usbmod->usb_record_lock, LOCK_RANK_EXTN,
+                         "usb_record_lock");
 }
 
 void audio_extn_usb_deinit()
 {
     if (NULL != usbmod){
+        lock_debug_unregister(&usbmod->usb_playback_lock);
+        lock_debug_unregister(&usbmod->usb_record_lock);
         free(usbmod);
         usbmod = NULL;
     }
@@ -35,6 +35,9 @@
 #include <dlfcn.h>
 #include <sys/resource.h>
 #include <sys/prctl.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sched.h>
 
 #include <cutils/log.h>
 #include <cutils/str_parms.h>
@@ -64,6 +67,16 @@
 #define PROXY_OPEN_RETRY_COUNT           100
 #define PROXY_OPEN_WAIT_TIME             20
 
+/* capture engine ring depth in kernel periods, and its SCHED_FIFO priority */
+#define CAPTURE_RING_PERIODS             8
+#define CAPTURE_THREAD_PRIORITY          2
+
+/* how soon to look again at a warm output whose lock was busy */
+#define WARM_STANDBY_RETRY_NS            10000000LL
+
+/* a client that has not written or read for longer is left alone after SSR */
+#define SSR_CLIENT_IDLE_NS               100000000LL
+
 #ifdef USE_LL_AS_PRIMARY_OUTPUT
 #define USECASE_AUDIO_PLAYBACK_PRIMARY USECASE_AUDIO_PLAYBACK_LOW_LATENCY
 #define PCM_CONFIG_AUDIO_PLAYBACK_PRIMARY pcm_config_low_latency
@@ -75,6 +88,18 @@
 static unsigned int configured_low_latency_capture_period_size =
         LOW_LATENCY_CAPTURE_PERIOD_SIZE;
 
+/* set from audio_hal.ll_mmap, see adev_open() */
+static bool low_latency_mmap_enabled = false;
+
+/* set from audio_hal.capture_engine, see adev_open() */
+static bool capture_engine_enabled = true;
+
+/* set from audio_hal.warm_standby_ms, 0 disables warm standby */
+static int64_t warm_standby_ns = 0;
+
+/* set from audio_hal.offload_coalesce_ms, 0 disables offload write coalescing */
+static int64_t offload_coalesce_ns = 0;
+
 struct pcm_config pcm_config_deep_buffer = {
     .channels = 2,
     .rate = DEFAULT_OUTPUT_SAMPLING_RATE,
@@ -97,6 +122,25 @@ struct pcm_config pcm_config_low_latency = {
     .avail_min = LOW_LATENCY_OUTPUT_PERIOD_SIZE / 4,
 };
 
+/*
+ * Low latency playback through the mmap'ed DMA ring. Without period
+ * interrupts the periods can be shorter than what pcm_config_low_latency
+ * supports; tinyalsa paces writes from the rate instead.
+ */
+#define LOW_LATENCY_MMAP_PERIOD_SIZE  96
+#define LOW_LATENCY_MMAP_PERIOD_COUNT 2
+
+struct pcm_config pcm_config_low_latency_mmap = {
+    .channels = 2,
+    .rate = DEFAULT_OUTPUT_SAMPLING_RATE,
+    .period_size = LOW_LATENCY_MMAP_PERIOD_SIZE,
+    .period_count = LOW_LATENCY_MMAP_PERIOD_COUNT,
+    .format = PCM_FORMAT_S16_LE,
+    .start_threshold = LOW_LATENCY_MMAP_PERIOD_SIZE,
+    .stop_threshold = INT_MAX,
+    .avail_min = LOW_LATENCY_MMAP_PERIOD_SIZE,
+};
+
 struct pcm_config pcm_config_hdmi_multi = {
     .channels = HDMI_MULTI_DEFAULT_CHANNEL_COUNT, /* changed when the stream is opened */
     .rate = DEFAULT_OUTPUT_SAMPLING_RATE, /* changed when the stream is opened */
@@ -152,6 +196,13 @@ const char * const use_case_table[AUDIO_USECASE_MAX] = {
     [USECASE_AUDIO_PLAYBACK_LOW_LATENCY] = "low-latency-playback",
     [USECASE_AUDIO_PLAYBACK_MULTI_CH] = "multi-channel-playback",
     [USECASE_AUDIO_PLAYBACK_OFFLOAD] = "compress-offload-playback",
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD2] = "compress-offload-playback2",
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD3] = "compress-offload-playback3",
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD4] = "compress-offload-playback4",
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD5] = "compress-offload-playback5",
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD6] = "compress-offload-playback6",
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD7] = "compress-offload-playback7",
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD8] = "compress-offload-playback8",
     [USECASE_AUDIO_RECORD] = "audio-record",
     [USECASE_AUDIO_RECORD_COMPRESS] = "audio-record-compress",
     [USECASE_AUDIO_RECORD_LOW_LATENCY] = "low-latency-record",
@@ -196,6 +247,15 @@ static const struct string_to_enum out_channels_name_to_enum_table[] = {
     STRING_TO_ENUM(AUDIO_CHANNEL_OUT_7POINT1),
 };
 
+static const struct string_to_enum out_formats_name_to_enum_table[] = {
+    STRING_TO_ENUM(AUDIO_FORMAT_PCM_16_BIT),
+    STRING_TO_ENUM(AUDIO_FORMAT_PCM_8_24_BIT),
+    STRING_TO_ENUM(AUDIO_FORMAT_MP3),
+    STRING_TO_ENUM(AUDIO_FORMAT_AAC),
+    STRING_TO_ENUM(AUDIO_FORMAT_AC3),
+    STRING_TO_ENUM(AUDIO_FORMAT_E_AC3),
+};
+
 static struct audio_device *adev = NULL;
 static pthread_mutex_t adev_init_lock;
 static unsigned int audio_device_ref_count;
@@ -333,7 +393,7 @@ static int check_and_set_gapless_mode(struct audio_device *adev) {
     property_get("audio.offload.gapless.enabled", value, NULL);
     gapless_enabled = atoi(value) || !strncmp("true", value, 4);
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
                                __func__, mixer_ctl_name);
@@ -351,13 +411,10 @@ static int check_and_set_gapless_mode(struct audio_device *adev) {
 static bool is_supported_format(audio_format_t format)
 {
     if (format == AUDIO_FORMAT_MP3 ||
-#ifdef EXTN_OFFLOAD_ENABLED
-        format == AUDIO_FORMAT_PCM_16_BIT_OFFLOAD ||
-        format == AUDIO_FORMAT_PCM_24_BIT_OFFLOAD ||
-#endif
         format == AUDIO_FORMAT_AAC_LC ||
         format == AUDIO_FORMAT_AAC_HE_V1 ||
-        format == AUDIO_FORMAT_AAC_HE_V2 ){
+        format == AUDIO_FORMAT_AAC_HE_V2 ||
+        audio_extn_pcm_offload_is_supported(format)) {
         return true;
     }
     return false;
@@ -374,11 +431,10 @@ static int get_snd_codec_id(audio_format_t format)
     case AUDIO_FORMAT_AAC:
         id = SND_AUDIOCODEC_AAC;
         break;
-#ifdef EXTN_OFFLOAD_ENABLED
+    case AUDIO_FORMAT_PCM:
     case AUDIO_FORMAT_PCM_OFFLOAD:
         id = SND_AUDIOCODEC_PCM;
         break;
-#endif
     default:
         ALOGE("%s: Unsupported audio format :%x", __func__, format);
     }
@@ -386,10 +442,134 @@ static int get_snd_codec_id(audio_format_t format)
     return id;
 }
 
+_Static_assert(AUDIO_USECASE_MAX <= 64, "usecase_mask_t is too small");
+
+static void usecase_index_file(struct usecase_index *index,
+                               struct audio_usecase *usecase)
+{
+    usecase_mask_t bit = USECASE_BIT(usecase->id);
+
+    index->out_snd_device[usecase->id] = usecase->out_snd_device;
+    index->in_snd_device[usecase->id] = usecase->in_snd_device;
+    index->by_out_snd_device[usecase->out_snd_device] |= bit;
+    index->by_in_snd_device[usecase->in_snd_device] |= bit;
+    if (usecase->devices & AUDIO_DEVICE_OUT_ALL_CODEC_BACKEND)
+        index->codec_backend |= bit;
+    else
+        index->codec_backend &= ~bit;
+}
+
+static void usecase_index_unfile(struct usecase_index *index,
+                                 audio_usecase_t id)
+{
+    usecase_mask_t bit = USECASE_BIT(id);
+
+    index->by_out_snd_device[index->out_snd_device[id]] &= ~bit;
+    index->by_in_snd_device[index->in_snd_device[id]] &= ~bit;
+}
+
+static void usecase_index_insert(struct usecase_index *index,
+                                 struct audio_usecase *usecase)
+{
+    index->by_id[usecase->id] = usecase;
+    index->by_type[usecase->type] |= USECASE_BIT(usecase->id);
+    usecase_index_file(index, usecase);
+}
+
+/* must be called with adev->lock held */
+void usecase_list_add(struct audio_device *adev, struct audio_usecase *usecase)
+{
+    list_add_tail(&adev->usecase_list, &usecase->list);
+    /* like a list walk, lookups find the first usecase added with an id */
+    if (adev->usecases.by_id[usecase->id] != NULL) {
+        ALOGW("%s: usecase %s is already active", __func__,
+              use_case_table[usecase->id]);
+        return;
+    }
+    usecase_index_insert(&adev->usecases, usecase);
+}
+
+/* must be called with adev->lock held */
+void usecase_list_remove(struct audio_device *adev,
+                         struct audio_usecase *usecase)
+{
+    struct usecase_index *index = &adev->usecases;
+    usecase_mask_t bit = USECASE_BIT(usecase->id);
+    struct audio_usecase *other;
+    struct listnode *node;
+
+    list_remove(&usecase->list);
+    if (index->by_id[usecase->id] != usecase)
+        return;
+
+    usecase_index_unfile(index, usecase->id);
+    index->by_id[usecase->id] = NULL;
+    index->by_type[usecase->type] &= ~bit;
+    index->codec_backend &= ~bit;
+
+    /* promote a duplicate that was hidden behind the one removed */
+    list_for_each(node, &adev->usecase_list) {
+        other = node_to_item(node, struct audio_usecase, list);
+        if (other->id == usecase->id) {
+            usecase_index_insert(index, other);
+            break;
+        }
+    }
+}
+
+/* must be called with adev->lock held */
+void usecase_index_update(struct audio_device *adev,
+                          struct audio_usecase *usecase)
+{
+    if (adev->usecases.by_id[usecase->id] != usecase)
+        return;
+    usecase_index_unfile(&adev->usecases, usecase->id);
+    usecase_index_file(&adev->usecases, usecase);
+}
+
+/* removes the lowest usecase from mask and returns it */
+static struct audio_usecase *usecase_mask_pop(struct audio_device *adev,
+                                              usecase_mask_t *mask)
+{
+    int id;
+
+    if (!*mask)
+        return NULL;
+    id = __builtin_ctzll(*mask);
+    *mask &= *mask - 1;
+    return adev->usecases.by_id[id];
+}
+
+/*
+ * Picks the offload session of a new compress stream, among those with a
+ * compress device. Must be called with adev->lock held.
+ */
+static audio_usecase_t get_offload_usecase_l(struct audio_device *adev)
+{
+    audio_usecase_t uc_id;
+
+    for (uc_id = USECASE_AUDIO_PLAYBACK_OFFLOAD;
+         uc_id <= USECASE_AUDIO_PLAYBACK_OFFLOAD8; uc_id++) {
+        if ((adev->offload_sessions & USECASE_BIT(uc_id)) ||
+                platform_get_pcm_device_id(uc_id, PCM_PLAYBACK) < 0)
+            continue;
+        adev->offload_sessions |= USECASE_BIT(uc_id);
+        return uc_id;
+    }
+    return USECASE_INVALID;
+}
+
+/* must be called with adev->lock held */
+static void free_offload_usecase_l(struct audio_device *adev,
+                                   audio_usecase_t uc_id)
+{
+    adev->offload_sessions &= ~USECASE_BIT(uc_id);
+}
+
 static int enable_audio_route_for_voice_usecases(struct audio_device *adev,
                                                  struct audio_usecase *uc_info)
 {
-    struct listnode *node;
+    usecase_mask_t mask;
     struct audio_usecase *usecase;
 
     if (uc_info == NULL)
@@ -397,11 +577,9 @@ static int enable_audio_route_for_voice_usecases(struct audio_device *adev,
 
     /* Re-route all voice usecases on the shared backend other than the
        specified usecase to new snd devices */
-    list_for_each(node, &adev->usecase_list) {
-        usecase = node_to_item(node, struct audio_usecase, list);
-        if ((usecase->type == VOICE_CALL) && (usecase != uc_info))
-            enable_audio_route(adev, usecase);
-    }
+    mask = adev->usecases.by_type[VOICE_CALL] & ~USECASE_BIT(uc_info->id);
+    while ((usecase = usecase_mask_pop(adev, &mask)))
+        enable_audio_route(adev, usecase);
     return 0;
 }
 
@@ -421,16 +599,100 @@ int get_snd_card_state(struct audio_device *adev)
 
 static int set_snd_card_state(struct audio_device *adev, int snd_scard_state)
 {
+    bool changed;
+
     if (!adev)
         return -ENOSYS;
 
     pthread_mutex_lock(&adev->snd_card_status.lock);
+    changed = adev->snd_card_status.state != snd_scard_state;
     adev->snd_card_status.state = snd_scard_state;
     pthread_mutex_unlock(&adev->snd_card_status.lock);
 
+    /* controls may be re-registered when the card restarts */
+    if (changed)
+        invalidate_mixer_ctl_cache(adev);
+
     return 0;
 }
 
+/* FNV-1a */
+static unsigned int mixer_ctl_name_hash(const char *name)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void mixer_ctl_cache_clear_l(struct mixer_ctl_cache *cache)
+{
+    int i;
+
+    for (i = 0; i < MIXER_CTL_CACHE_SIZE; i++) {
+        free(cache->entries[i].name);
+        cache->entries[i].name = NULL;
+        cache->entries[i].ctl = NULL;
+    }
+    cache->count = 0;
+}
+
+void invalidate_mixer_ctl_cache(struct audio_device *adev)
+{
+    pthread_mutex_lock(&adev->ctl_cache.lock);
+    mixer_ctl_cache_clear_l(&adev->ctl_cache);
+    pthread_mutex_unlock(&adev->ctl_cache.lock);
+}
+
+/*
+ * mixer_get_ctl_by_name() scans every control of the card; use this instead
+ * for controls written repeatedly, e.g. on each volume step.
+ */
+struct mixer_ctl *get_mixer_ctl(struct audio_device *adev, const char *name)
+{
+    struct mixer_ctl_cache *cache = &adev->ctl_cache;
+    struct mixer_ctl_cache_entry *entry = NULL;
+    struct mixer_ctl *ctl;
+    unsigned int slot, probe;
+
+    if (!adev->mixer || !name)
+        return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->mixer != adev->mixer) {
+        mixer_ctl_cache_clear_l(cache);
+        cache->mixer = adev->mixer;
+    }
+
+    slot = mixer_ctl_name_hash(name);
+    for (probe = 0; probe < MIXER_CTL_CACHE_SIZE; probe++, slot++) {
+        entry = &cache->entries[slot & (MIXER_CTL_CACHE_SIZE - 1)];
+        if (!entry->name)
+            break;
+        if (!strcmp(entry->name, name)) {
+            ctl = entry->ctl;
+            pthread_mutex_unlock(&cache->lock);
+            return ctl;
+        }
+    }
+
+    /* missing controls are not cached, callers report them */
+    ctl = mixer_get_ctl_by_name(adev->mixer, name);
+    if (ctl && entry && !entry->name &&
+            cache->count < MIXER_CTL_CACHE_SIZE * 3 / 4) {
+        entry->name = strdup(name);
+        if (entry->name) {
+            entry->ctl = ctl;
+            cache->count++;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return ctl;
+}
+
 int pcm_ioctl(struct pcm *pcm, int request, ...)
 {
     va_list ap;
@@ -444,6 +706,307 @@ int pcm_ioctl(struct pcm *pcm, int request, ...)
     return ioctl(pcm_fd, request, arg);
 }
 
+static const uint32_t stats_hist_limits_us[HAL_STATS_HIST_BUCKETS - 1] = {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000
+};
+
+static int64_t stats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* must be called with the lock serializing updates of stats held */
+static void stats_begin_update_l(struct hal_stats *stats)
+{
+    stats->seq++;
+    android_memory_barrier();
+}
+
+static void stats_end_update_l(struct hal_stats *stats)
+{
+    android_atomic_release_store(stats->seq + 1, &stats->seq);
+}
+
+static void stats_record_call_l(struct hal_stats *stats, int64_t start_ns,
+                                int64_t blocked_ns, int ret)
+{
+    uint32_t call_us = (uint32_t)((stats_now_ns() - start_ns) / 1000);
+    int i;
+
+    for (i = 0; i < HAL_STATS_HIST_BUCKETS - 1; i++) {
+        if (call_us < stats_hist_limits_us[i])
+            break;
+    }
+
+    stats_begin_update_l(stats);
+    stats->calls++;
+    if (ret < 0)
+        stats->errors++;
+    stats->hist[i]++;
+    if (call_us > stats->max_call_us)
+        stats->max_call_us = call_us;
+    stats->total_call_us += call_us;
+    stats->blocked_us += blocked_ns / 1000;
+    stats_end_update_l(stats);
+}
+
+/*
+ * tinyalsa recovers from xruns without reporting them, so count a transfer
+ * starting more than a buffer duration after the previous one ended.
+ */
+static void stats_check_xrun_l(struct hal_stats *stats, int64_t io_start_ns,
+                               const struct pcm_config *config)
+{
+    int64_t buffer_ns = (int64_t)config->period_count * config->period_size *
+                        1000000000LL / config->rate;
+
+    if (stats->last_io_end_ns != 0 &&
+            io_start_ns - stats->last_io_end_ns > buffer_ns) {
+        stats_begin_update_l(stats);
+        stats->xruns++;
+        stats_end_update_l(stats);
+    }
+}
+
+static void stats_count_standby_l(struct hal_stats *stats)
+{
+    stats_begin_update_l(stats);
+    stats->standby_count++;
+    stats->last_io_end_ns = 0;
+    stats_end_update_l(stats);
+}
+
+static void stats_count_resume_l(struct hal_stats *stats)
+{
+    stats_begin_update_l(stats);
+    stats->resume_count++;
+    stats_end_update_l(stats);
+}
+
+/* lock free consistent copy, safe to call while the owner is updating */
+static void stats_snapshot(const struct hal_stats *stats, struct hal_stats *copy)
+{
+    int32_t seq;
+
+    do {
+        seq = android_atomic_acquire_load(&stats->seq);
+        memcpy(copy, (const void *)stats, sizeof(*copy));
+        android_memory_barrier();
+    } while ((seq & 1) || seq != stats->seq);
+}
+
+static void stats_to_str(const struct hal_stats *stats, char *value, size_t len)
+{
+    struct hal_stats snap;
+
+    stats_snapshot(stats, &snap);
+    snprintf(value, len, "calls:%u,errors:%u,xruns:%u,standby:%u,resume:%u,"
+             "avg_us:%u,max_us:%u,blocked_us:%llu,hist:%u|%u|%u|%u|%u|%u|%u|%u",
+             snap.calls, snap.errors, snap.xruns, snap.standby_count,
+             snap.resume_count,
+             snap.calls ? (uint32_t)(snap.total_call_us / snap.calls) : 0,
+             snap.max_call_us, (unsigned long long)snap.blocked_us,
+             snap.hist[0], snap.hist[1], snap.hist[2], snap.hist[3],
+             snap.hist[4], snap.hist[5], snap.hist[6], snap.hist[7]);
+}
+
+static void stats_dump(int fd, const char *prefix, const struct hal_stats *stats)
+{
+    struct hal_stats snap;
+
+    stats_snapshot(stats, &snap);
+    dprintf(fd, "%scalls %u, errors %u, xruns %u, standby %u, resume %u\n",
+            prefix, snap.calls, snap.errors, snap.xruns, snap.standby_count,
+            snap.resume_count);
+    dprintf(fd, "%savg %u us, max %u us, blocked in transfer %llu ms\n", prefix,
+            snap.calls ? (uint32_t)(snap.total_call_us / snap.calls) : 0,
+            snap.max_call_us, (unsigned long long)(snap.blocked_us / 1000));
+    dprintf(fd, "%sduration (ms) <1: %u, <2: %u, <5: %u, <10: %u, <20: %u, "
+            "<50: %u, <100: %u, >=100: %u\n", prefix,
+            snap.hist[0], snap.hist[1], snap.hist[2], snap.hist[3],
+            snap.hist[4], snap.hist[5], snap.hist[6], snap.hist[7]);
+}
+
+/* a reading this far off the fit restarts the estimate, e.g. after a stall */
+#define POSITION_EST_MAX_ERROR_US 20000
+#define POSITION_EST_MIN_SAMPLES  4
+/* drift is measured from the first reading, once it is this old */
+#define POSITION_EST_DRIFT_MIN_NS 1000000000LL
+
+static void pos_est_reset(struct position_estimator *est)
+{
+    if (est->count > 0)
+        est->restarts++;
+    est->count = 0;
+    est->next = 0;
+    est->last_reported = 0;
+}
+
+/*
+ * Adds a (frames, time) reading and returns the position the fit gives for
+ * that time. Reported positions never go backwards until the next reset.
+ */
+static uint64_t pos_est_update(struct position_estimator *est, uint64_t frames,
+                               int64_t time_ns, unsigned int rate)
+{
+    unsigned int i, n, newest;
+    double t, f, t_mean = 0, f_mean = 0, stt = 0, stf = 0, sq = 0;
+    double slope, fitted, max_error;
+
+    if (est->count > 0) {
+        newest = (est->next + POSITION_EST_SAMPLES - 1) % POSITION_EST_SAMPLES;
+        if (time_ns == est->time_ns[newest] && frames == est->frames[newest])
+            return est->last_reported;
+        if (time_ns < est->time_ns[newest] || frames < est->frames[newest])
+            pos_est_reset(est);
+    }
+
+    if (est->count == 0) {
+        est->anchor_frames = frames;
+        est->anchor_ns = time_ns;
+    }
+    est->frames[est->next] = frames;
+    est->time_ns[est->next] = time_ns;
+    est->next = (est->next + 1) % POSITION_EST_SAMPLES;
+    if (est->count < POSITION_EST_SAMPLES)
+        est->count++;
+
+    n = est->count;
+    if (n < POSITION_EST_MIN_SAMPLES || rate == 0)
+        goto raw;
+
+    /* relative to the newest reading to keep the doubles precise */
+    for (i = 0; i < n; i++) {
+        t_mean += (est->time_ns[i] - time_ns) / 1e9;
+        f_mean += (double)(int64_t)(est->frames[i] - frames);
+    }
+    t_mean /= n;
+    f_mean /= n;
+    for (i = 0; i < n; i++) {
+        t = (est->time_ns[i] - time_ns) / 1e9 - t_mean;
+        f = (double)(int64_t)(est->frames[i] - frames) - f_mean;
+        stt += t * t;
+        stf += t * f;
+    }
+    if (stt <= 0)
+        goto raw;
+
+    slope = stf / stt;
+    fitted = f_mean - slope * t_mean;
+    max_error = (double)rate * POSITION_EST_MAX_ERROR_US / 1e6;
+    if (fitted > max_error || fitted < -max_error) {
+        pos_est_reset(est);
+        est->frames[0] = frames;
+        est->time_ns[0] = time_ns;
+        est->next = 1;
+        est->count = 1;
+        est->anchor_frames = frames;
+        est->anchor_ns = time_ns;
+        goto raw;
+    }
+
+    for (i = 0; i < n; i++) {
+        t = (est->time_ns[i] - time_ns) / 1e9;
+        f = (double)(int64_t)(est->frames[i] - frames) - (fitted + slope * t);
+        sq += f * f;
+    }
+    if (time_ns - est->anchor_ns >= POSITION_EST_DRIFT_MIN_NS)
+        est->drift_ppm = (int32_t)(((double)(frames - est->anchor_frames) * 1e9 /
+                                    (time_ns - est->anchor_ns) / rate - 1.0) * 1e6);
+    est->jitter_us = (uint32_t)(sqrt(sq / n) * 1e6 / rate);
+
+    if (fitted < 0 && (uint64_t)(-fitted) > frames)
+        frames = 0;
+    else
+        frames += (int64_t)fitted;
+
+raw:
+    if (frames < est->last_reported)
+        frames = est->last_reported;
+    est->last_reported = frames;
+    return frames;
+}
+
+/* must be called with adev->lock held */
+void begin_routing_transaction(struct audio_device *adev)
+{
+    struct routing_txn *txn = &adev->route_txn;
+
+    if (txn->depth++ == 0) {
+        txn->path_ops = 0;
+        txn->last_path_ops = 0;
+        txn->last_cal_skips = 0;
+        txn->last_cal_saved_us = 0;
+        txn->start_ns = stats_now_ns();
+    }
+}
+
+/*
+ * Writes the changes staged so far while keeping the transaction open, for
+ * steps that need the hardware routed before they run (e.g. starting a pcm
+ * or notifying the modem).
+ */
+void flush_routing_transaction(struct audio_device *adev)
+{
+    struct routing_txn *txn = &adev->route_txn;
+
+    if (txn->depth == 0 || txn->path_ops == 0)
+        return;
+
+    audio_route_update_mixer(adev->audio_route);
+    txn->mixer_updates++;
+    txn->last_path_ops += txn->path_ops;
+    txn->total_path_ops += txn->path_ops;
+    txn->path_ops = 0;
+}
+
+void commit_routing_transaction(struct audio_device *adev)
+{
+    struct routing_txn *txn = &adev->route_txn;
+    uint32_t txn_us;
+
+    if (txn->depth <= 0) {
+        ALOGE("%s: no routing transaction open", __func__);
+        return;
+    }
+    if (--txn->depth > 0)
+        return;
+
+    txn->depth = 1;
+    flush_routing_transaction(adev);
+    txn->depth = 0;
+
+    txn_us = (uint32_t)((stats_now_ns() - txn->start_ns) / 1000);
+    txn->count++;
+    txn->last_us = txn_us;
+    if (txn_us > txn->max_us)
+        txn->max_us = txn_us;
+    ALOGV("%s: %u path(s) in %u us", __func__, txn->last_path_ops, txn_us);
+}
+
+static void route_apply_path(struct audio_device *adev, const char *path)
+{
+    if (adev->route_txn.depth > 0) {
+        audio_route_apply_path(adev->audio_route, path);
+        adev->route_txn.path_ops++;
+    } else {
+        audio_route_apply_and_update_path(adev->audio_route, path);
+    }
+}
+
+static void route_reset_path(struct audio_device *adev, const char *path)
+{
+    if (adev->route_txn.depth > 0) {
+        audio_route_reset_path(adev->audio_route, path);
+        adev->route_txn.path_ops++;
+    } else {
+        audio_route_reset_and_update_path(adev->audio_route, path);
+    }
+}
+
 int enable_audio_route(struct audio_device *adev,
                        struct audio_usecase *usecase)
 {
@@ -467,7 +1030,7 @@ int enable_audio_route(struct audio_device *adev,
     strcpy(mixer_path, use_case_table[usecase->id]);
     platform_add_backend_name(mixer_path, snd_device);
     ALOGV("%s: apply mixer and update path: %s", __func__, mixer_path);
-    audio_route_apply_and_update_path(adev->audio_route, mixer_path);
+    route_apply_path(adev, mixer_path);
     ALOGV("%s: exit", __func__);
     return 0;
 }
@@ -489,11 +1052,126 @@ int disable_audio_route(struct audio_device *adev,
     strcpy(mixer_path, use_case_table[usecase->id]);
     platform_add_backend_name(mixer_path, snd_device);
     ALOGV("%s: reset and update mixer path: %s", __func__, mixer_path);
-    audio_route_reset_and_update_path(adev->audio_route, mixer_path);
+    route_reset_path(adev, mixer_path);
     ALOGV("%s: exit", __func__);
     return 0;
 }
 
+/* must be called with adev->lock held */
+static void cal_state_invalidate_l(struct audio_device *adev)
+{
+    int dir;
+
+    for (dir = 0; dir < CAL_DIR_MAX; dir++)
+        adev->cal.live_acdb_id[dir] = -1;
+}
+
+static int cal_dir_of(snd_device_t snd_device)
+{
+    return (snd_device >= SND_DEVICE_OUT_BEGIN &&
+            snd_device < SND_DEVICE_OUT_END) ? CAL_DIR_OUT : CAL_DIR_IN;
+}
+
+/*
+ * Sends the audio calibration of snd_device, unless it is the one the ACDB
+ * loader already holds for that direction. Must be called with adev->lock
+ * held.
+ */
+int send_snd_device_calibration(struct audio_device *adev,
+                                snd_device_t snd_device)
+{
+    struct cal_state *cal = &adev->cal;
+    int dir = cal_dir_of(snd_device);
+    int acdb_id = platform_get_snd_device_acdb_id(snd_device);
+    uint32_t avg_us;
+    int64_t start_ns;
+    int ret;
+
+#ifdef AUDIO_LISTEN_ENABLED
+    /* sound trigger sends capture calibration of its own behind our back */
+    if (dir == CAL_DIR_IN)
+        cal->live_acdb_id[dir] = -1;
+#endif
+    if (acdb_id >= 0 && cal->live_acdb_id[dir] == acdb_id) {
+        avg_us = cal->sends ? (uint32_t)(cal->send_us / cal->sends) : 0;
+        cal->skips++;
+        cal->saved_us += avg_us;
+        if (adev->route_txn.depth > 0) {
+            adev->route_txn.last_cal_skips++;
+            adev->route_txn.last_cal_saved_us += avg_us;
+        }
+        ALOGV("%s: acdb_id(%d) of snd_device(%d) already sent", __func__,
+              acdb_id, snd_device);
+        return 0;
+    }
+
+    start_ns = stats_now_ns();
+    ret = platform_send_audio_calibration(adev->platform, snd_device);
+    if (ret < 0) {
+        cal->live_acdb_id[dir] = -1;
+        return ret;
+    }
+    cal->live_acdb_id[dir] = acdb_id;
+    cal->sends++;
+    cal->send_us += (uint64_t)(stats_now_ns() - start_ns) / 1000;
+    return 0;
+}
+
+/* whether a sound device of direction dir is enabled, adev->lock held */
+static bool cal_dir_busy_l(struct audio_device *adev, int dir)
+{
+    int snd_device = dir == CAL_DIR_OUT ? SND_DEVICE_OUT_BEGIN :
+                                          SND_DEVICE_IN_BEGIN;
+    int end = dir == CAL_DIR_OUT ? SND_DEVICE_OUT_END : SND_DEVICE_IN_END;
+
+    for (; snd_device < end; snd_device++) {
+        if (adev->snd_dev_ref_cnt[snd_device] > 0)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Sends the calibration of the device a newly connected accessory is most
+ * likely routed to, so that the routing change that follows finds it in
+ * place. A direction with a device enabled is left alone: the paths it
+ * opens next would get the accessory's calibration, and the device's own
+ * would not be sent again. Must be called with adev->lock held.
+ */
+static void prefetch_calibration_l(struct audio_device *adev,
+                                   audio_devices_t device)
+{
+    static const struct {
+        audio_devices_t device;
+        snd_device_t snd_devices[CAL_DIR_MAX];
+    } prefetch_table[] = {
+        { AUDIO_DEVICE_OUT_WIRED_HEADSET,
+          { SND_DEVICE_OUT_HEADPHONES, SND_DEVICE_IN_HEADSET_MIC } },
+        { AUDIO_DEVICE_OUT_WIRED_HEADPHONE,
+          { SND_DEVICE_OUT_HEADPHONES, SND_DEVICE_NONE } },
+    };
+    snd_device_t snd_device;
+    unsigned int i;
+    int dir;
+
+    if (!adev->cal.prefetch || adev->mode != AUDIO_MODE_NORMAL ||
+            (device & AUDIO_DEVICE_BIT_IN))
+        return;
+
+    for (i = 0; i < sizeof(prefetch_table) / sizeof(prefetch_table[0]); i++) {
+        if (!(device & prefetch_table[i].device))
+            continue;
+        for (dir = 0; dir < CAL_DIR_MAX; dir++) {
+            snd_device = prefetch_table[i].snd_devices[dir];
+            if (snd_device == SND_DEVICE_NONE || cal_dir_busy_l(adev, dir))
+                continue;
+            if (send_snd_device_calibration(adev, snd_device) == 0)
+                adev->cal.prefetches++;
+        }
+        break;
+    }
+}
+
 int enable_snd_device(struct audio_device *adev,
                       snd_device_t snd_device)
 {
@@ -528,6 +1206,8 @@ int enable_snd_device(struct audio_device *adev,
 
     if (snd_device == SND_DEVICE_OUT_SPEAKER &&
         audio_extn_spkr_prot_is_enabled()) {
+       /* the feedback path is started right away, route pending changes first */
+       flush_routing_transaction(adev);
        if (audio_extn_spkr_prot_start_processing(snd_device)) {
           ALOGE("%s: spkr_start_processing failed", __func__);
           return -EINVAL;
@@ -535,7 +1215,7 @@ int enable_snd_device(struct audio_device *adev,
     }  else {
         ALOGV("%s: snd_device(%d: %s)", __func__,
         snd_device, device_name);
-        if (platform_send_audio_calibration(adev->platform, snd_device) < 0) {
+        if (send_snd_device_calibration(adev, snd_device) < 0) {
             adev->snd_dev_ref_cnt[snd_device]--;
             return -EINVAL;
         }
@@ -543,7 +1223,7 @@ int enable_snd_device(struct audio_device *adev,
                 LISTEN_EVENT_SND_DEVICE_BUSY);
 
         amplifier_enable_devices(snd_device, true);
-        audio_route_apply_and_update_path(adev->audio_route, device_name);
+        route_apply_path(adev, device_name);
     }
     return 0;
 }
@@ -585,7 +1265,10 @@ int disable_snd_device(struct audio_device *adev,
             audio_extn_spkr_prot_is_enabled()) {
             audio_extn_spkr_prot_stop_processing();
         } else {
-            audio_route_reset_and_update_path(adev->audio_route, device_name);
+            route_reset_path(adev, device_name);
+            /* power the amplifier down only once the path is reset */
+            if (get_amplifier_device())
+                flush_routing_transaction(adev);
             amplifier_enable_devices(snd_device, false);
         }
 
@@ -600,10 +1283,9 @@ static void check_usecases_codec_backend(struct audio_device *adev,
                                           struct audio_usecase *uc_info,
                                           snd_device_t snd_device)
 {
-    struct listnode *node;
+    struct usecase_index *index = &adev->usecases;
     struct audio_usecase *usecase;
-    bool switch_device[AUDIO_USECASE_MAX];
-    int i, num_uc_to_switch = 0;
+    usecase_mask_t switch_mask, mask;
 
     /*
      * This function is to make sure that all the usecases that are active on
@@ -617,52 +1299,35 @@ static void check_usecases_codec_backend(struct audio_device *adev,
      */
     /* Disable all the usecases on the shared backend other than the
        specified usecase */
-    for (i = 0; i < AUDIO_USECASE_MAX; i++)
-        switch_device[i] = false;
-
-    list_for_each(node, &adev->usecase_list) {
-        usecase = node_to_item(node, struct audio_usecase, list);
-        if (usecase->type != PCM_CAPTURE &&
-                usecase != uc_info &&
-                usecase->out_snd_device != snd_device &&
-                usecase->devices & AUDIO_DEVICE_OUT_ALL_CODEC_BACKEND) {
-            ALOGV("%s: Usecase (%s) is active on (%s) - disabling ..",
-                  __func__, use_case_table[usecase->id],
-                  platform_get_snd_device_name(usecase->out_snd_device));
-            disable_audio_route(adev, usecase);
-            switch_device[usecase->id] = true;
-            num_uc_to_switch++;
-        }
+    switch_mask = index->codec_backend &
+                  ~index->by_type[PCM_CAPTURE] &
+                  ~index->by_out_snd_device[snd_device] &
+                  ~USECASE_BIT(uc_info->id);
+    if (!switch_mask)
+        return;
+
+    for (mask = switch_mask; (usecase = usecase_mask_pop(adev, &mask));) {
+        ALOGV("%s: Usecase (%s) is active on (%s) - disabling ..",
+              __func__, use_case_table[usecase->id],
+              platform_get_snd_device_name(usecase->out_snd_device));
+        disable_audio_route(adev, usecase);
     }
 
-    if (num_uc_to_switch) {
-        /* All streams have been de-routed. Disable the device */
+    /* All streams have been de-routed. Disable the device */
+    for (mask = switch_mask; (usecase = usecase_mask_pop(adev, &mask));)
+        disable_snd_device(adev, usecase->out_snd_device);
 
-        list_for_each(node, &adev->usecase_list) {
-            usecase = node_to_item(node, struct audio_usecase, list);
-            if (switch_device[usecase->id]) {
-                disable_snd_device(adev, usecase->out_snd_device);
-            }
-        }
+    for (mask = switch_mask; (usecase = usecase_mask_pop(adev, &mask));)
+        enable_snd_device(adev, snd_device);
 
-        list_for_each(node, &adev->usecase_list) {
-            usecase = node_to_item(node, struct audio_usecase, list);
-            if (switch_device[usecase->id]) {
-                enable_snd_device(adev, snd_device);
-            }
-        }
-
-        /* Re-route all the usecases on the shared backend other than the
-           specified usecase to new snd devices */
-        list_for_each(node, &adev->usecase_list) {
-            usecase = node_to_item(node, struct audio_usecase, list);
-            /* Update the out_snd_device only before enabling the audio route */
-            if (switch_device[usecase->id] ) {
-                usecase->out_snd_device = snd_device;
-                if (usecase->type != VOICE_CALL)
-                    enable_audio_route(adev, usecase);
-            }
-        }
+    /* Re-route all the usecases on the shared backend other than the
+       specified usecase to new snd devices */
+    for (mask = switch_mask; (usecase = usecase_mask_pop(adev, &mask));) {
+        /* Update the out_snd_device only before enabling the audio route */
+        usecase->out_snd_device = snd_device;
+        usecase_index_update(adev, usecase);
+        if (usecase->type != VOICE_CALL)
+            enable_audio_route(adev, usecase);
     }
 }
 
@@ -670,10 +1335,9 @@ static void check_and_route_capture_usecases(struct audio_device *adev,
                                              struct audio_usecase *uc_info,
                                              snd_device_t snd_device)
 {
-    struct listnode *node;
+    struct usecase_index *index = &adev->usecases;
     struct audio_usecase *usecase;
-    bool switch_device[AUDIO_USECASE_MAX];
-    int i, num_uc_to_switch = 0;
+    usecase_mask_t switch_mask, mask;
 
     /*
      * This function is to make sure that all the active capture usecases
@@ -685,60 +1349,64 @@ static void check_and_route_capture_usecases(struct audio_device *adev,
      * because of the limitation that two devices cannot be enabled
      * at the same time if they share the same backend.
      */
-    for (i = 0; i < AUDIO_USECASE_MAX; i++)
-        switch_device[i] = false;
-
-    list_for_each(node, &adev->usecase_list) {
-        usecase = node_to_item(node, struct audio_usecase, list);
-        if (usecase->type != PCM_PLAYBACK &&
-                usecase != uc_info &&
-                usecase->in_snd_device != snd_device &&
-                (usecase->devices & AUDIO_DEVICE_OUT_ALL_CODEC_BACKEND)) {
-            ALOGV("%s: Usecase (%s) is active on (%s) - disabling ..",
-                  __func__, use_case_table[usecase->id],
-                  platform_get_snd_device_name(usecase->in_snd_device));
-            disable_audio_route(adev, usecase);
-            switch_device[usecase->id] = true;
-            num_uc_to_switch++;
-        }
+    switch_mask = index->codec_backend &
+                  ~index->by_type[PCM_PLAYBACK] &
+                  ~index->by_in_snd_device[snd_device] &
+                  ~USECASE_BIT(uc_info->id);
+    if (!switch_mask)
+        return;
+
+    for (mask = switch_mask; (usecase = usecase_mask_pop(adev, &mask));) {
+        ALOGV("%s: Usecase (%s) is active on (%s) - disabling ..",
+              __func__, use_case_table[usecase->id],
+              platform_get_snd_device_name(usecase->in_snd_device));
+        disable_audio_route(adev, usecase);
     }
 
-    if (num_uc_to_switch) {
-        /* All streams have been de-routed. Disable the device */
+    /* All streams have been de-routed. Disable the device */
+    for (mask = switch_mask; (usecase = usecase_mask_pop(adev, &mask));)
+        disable_snd_device(adev, usecase->in_snd_device);
 
-        list_for_each(node, &adev->usecase_list) {
-            usecase = node_to_item(node, struct audio_usecase, list);
-            if (switch_device[usecase->id]) {
-                disable_snd_device(adev, usecase->in_snd_device);
-            }
-        }
+    for (mask = switch_mask; (usecase = usecase_mask_pop(adev, &mask));)
+        enable_snd_device(adev, snd_device);
 
-        list_for_each(node, &adev->usecase_list) {
-            usecase = node_to_item(node, struct audio_usecase, list);
-            if (switch_device[usecase->id]) {
-                enable_snd_device(adev, snd_device);
-            }
-        }
+    /* Re-route all the usecases on the shared backend other than the
+       specified usecase to new snd devices */
+    for (mask = switch_mask; (usecase = usecase_mask_pop(adev, &mask));) {
+        /* Update the in_snd_device only before enabling the audio route */
+        usecase->in_snd_device = snd_device;
+        usecase_index_update(adev, usecase);
+        if (usecase->type != VOICE_CALL)
+            enable_audio_route(adev, usecase);
+    }
+}
 
-        /* Re-route all the usecases on the shared backend other than the
-           specified usecase to new snd devices */
-        list_for_each(node, &adev->usecase_list) {
-            usecase = node_to_item(node, struct audio_usecase, list);
-            /* Update the in_snd_device only before enabling the audio route */
-            if (switch_device[usecase->id] ) {
-                usecase->in_snd_device = snd_device;
-                if (usecase->type != VOICE_CALL)
-                    enable_audio_route(adev, usecase);
-            }
-        }
+static const uint32_t edid_sample_rates[] = EDID_SAMPLE_RATES;
+
+/*
+ * Capabilities of the connected HDMI sink. Reading the EDID control and
+ * parsing it is left to the first caller after an HDMI connection change;
+ * a read that fails is retried by the next one. adev->lock held.
+ */
+static const struct edid_audio_caps *edid_caps_get_l(struct audio_device *adev)
+{
+    if (!adev->edid.valid) {
+        adev->edid.reads++;
+        if (platform_edid_get_caps(adev->platform, &adev->edid.caps) == 0)
+            adev->edid.valid = true;
+        ALOGV("%s: max channels %d, rates %#x, bit depths %#x, formats %#x",
+              __func__, adev->edid.caps.max_channels,
+              adev->edid.caps.sample_rates, adev->edid.caps.bit_depths,
+              adev->edid.caps.formats);
     }
+    return &adev->edid.caps;
 }
 
 /* must be called with hw device mutex locked */
 static int read_hdmi_channel_masks(struct stream_out *out)
 {
     int ret = 0;
-    int channels = platform_edid_get_max_channels(out->dev->platform);
+    int channels = edid_caps_get_l(out->dev)->max_channels;
 
     switch (channels) {
         /*
@@ -762,11 +1430,19 @@ static int read_hdmi_channel_masks(struct stream_out *out)
     return ret;
 }
 
+/* the first voice call started, as the list walk this replaces returned */
 static audio_usecase_t get_voice_usecase_id_from_list(struct audio_device *adev)
 {
+    usecase_mask_t voice = adev->usecases.by_type[VOICE_CALL];
     struct audio_usecase *usecase;
     struct listnode *node;
 
+    if (!voice)
+        return USECASE_INVALID;
+    /* only with several voice sessions is the order of the list needed */
+    if ((voice & (voice - 1)) == 0)
+        return (audio_usecase_t)__builtin_ctzll(voice);
+
     list_for_each(node, &adev->usecase_list) {
         usecase = node_to_item(node, struct audio_usecase, list);
         if (usecase->type == VOICE_CALL) {
@@ -780,18 +1456,12 @@ static audio_usecase_t get_voice_usecase_id_from_list(struct audio_device *adev)
 struct audio_usecase *get_usecase_from_list(struct audio_device *adev,
                                             audio_usecase_t uc_id)
 {
-    struct audio_usecase *usecase;
-    struct listnode *node;
-
-    list_for_each(node, &adev->usecase_list) {
-        usecase = node_to_item(node, struct audio_usecase, list);
-        if (usecase->id == uc_id)
-            return usecase;
-    }
-    return NULL;
+    if (uc_id < 0 || uc_id >= AUDIO_USECASE_MAX)
+        return NULL;
+    return adev->usecases.by_id[uc_id];
 }
 
-int select_devices(struct audio_device *adev, audio_usecase_t uc_id)
+static int do_select_devices(struct audio_device *adev, audio_usecase_t uc_id)
 {
     snd_device_t out_snd_device = SND_DEVICE_NONE;
     snd_device_t in_snd_device = SND_DEVICE_NONE;
@@ -882,6 +1552,7 @@ int select_devices(struct audio_device *adev, audio_usecase_t uc_id)
         }
     }
 
+    usecase_index_update(adev, usecase);
     if (out_snd_device == usecase->out_snd_device &&
         in_snd_device == usecase->in_snd_device) {
         return 0;
@@ -926,6 +1597,7 @@ int select_devices(struct audio_device *adev, audio_usecase_t uc_id)
     }
 
     if (usecase->type == VOICE_CALL || usecase->type == VOIP_CALL) {
+        flush_routing_transaction(adev);
         status = platform_switch_voice_call_device_post(adev->platform,
                                                         out_snd_device,
                                                         in_snd_device);
@@ -934,6 +1606,10 @@ int select_devices(struct audio_device *adev, audio_usecase_t uc_id)
 
     usecase->in_snd_device = in_snd_device;
     usecase->out_snd_device = out_snd_device;
+    usecase_index_update(adev, usecase);
+    if (usecase->type == PCM_PLAYBACK && usecase->stream.out != NULL)
+        usecase->stream.out->device_latency_us =
+                (int32_t)platform_get_snd_device_render_latency(out_snd_device);
 
     enable_audio_route(adev, usecase);
 
@@ -945,22 +1621,39 @@ int select_devices(struct audio_device *adev, audio_usecase_t uc_id)
      * Enable device command should be sent to modem only after
      * enabling voice call mixer controls
      */
-    if (usecase->type == VOICE_CALL)
+    if (usecase->type == VOICE_CALL) {
+        flush_routing_transaction(adev);
         status = platform_switch_voice_call_usecase_route_post(adev->platform,
                                                                out_snd_device,
                                                                in_snd_device);
+    }
     ALOGD("%s: done",__func__);
 
     return status;
 }
 
+/* must be called with adev->lock held */
+int select_devices(struct audio_device *adev, audio_usecase_t uc_id)
+{
+    int64_t start_ns = stats_now_ns();
+    int ret;
+
+    begin_routing_transaction(adev);
+    ret = do_select_devices(adev, uc_id);
+    commit_routing_transaction(adev);
+    stats_record_call_l(&adev->routing_stats, start_ns, 0, ret);
+    return ret;
+}
+
 static int stop_input_stream(struct stream_in *in)
 {
     int i, ret = 0;
     struct audio_usecase *uc_info;
     struct audio_device *adev = in->dev;
 
-    adev->active_input = NULL;
+    /* another input may have started since, its routing is still needed */
+    if (adev->active_input == in)
+        adev->active_input = NULL;
 
     ALOGV("%s: enter: usecase(%d: %s)", __func__,
           in->usecase, use_case_table[in->usecase]);
@@ -974,13 +1667,17 @@ static int stop_input_stream(struct stream_in *in)
     /* Close in-call recording streams */
     voice_check_and_stop_incall_rec_usecase(adev, in);
 
+    begin_routing_transaction(adev);
+
     /* 1. Disable stream specific mixer controls */
     disable_audio_route(adev, uc_info);
 
     /* 2. Disable the tx device */
     disable_snd_device(adev, uc_info->in_snd_device);
 
-    list_remove(&uc_info->list);
+    commit_routing_transaction(adev);
+
+    usecase_list_remove(adev, uc_info);
     free(uc_info);
 
     ALOGV("%s: exit: status(%d)", __func__, ret);
@@ -1044,15 +1741,35 @@ int start_input_stream(struct stream_in *in)
     uc_info->in_snd_device = SND_DEVICE_NONE;
     uc_info->out_snd_device = SND_DEVICE_NONE;
 
-    list_add_tail(&adev->usecase_list, &uc_info->list);
+    usecase_list_add(adev, uc_info);
     select_devices(adev, in->usecase);
 
-    ALOGV("%s: Opening PCM device card_id(%d) device_id(%d), channels %d",
-          __func__, adev->snd_card, in->pcm_device_id, in->config.channels);
+    /* the PCM is opened by open_input_pcm(), without adev->lock */
+    ALOGV("%s: exit", __func__);
+    return ret;
 
+error_config:
+    if (adev->active_input == in)
+        adev->active_input = NULL;
+    ALOGD("%s: exit: status(%d)", __func__, ret);
+
+    return ret;
+}
+
+/*
+ * Opens the PCM of a usecase start_input_stream() routed. Only needs
+ * in->lock; on failure the caller undoes the routing with
+ * stop_input_stream().
+ */
+static int open_input_pcm(struct stream_in *in)
+{
+    struct audio_device *adev = in->dev;
     unsigned int flags = PCM_IN | PCM_MONOTONIC;
     unsigned int pcm_open_retry_entry_count = 0;
 
+    ALOGV("%s: Opening PCM device card_id(%d) device_id(%d), channels %d",
+          __func__, adev->snd_card, in->pcm_device_id, in->config.channels);
+
     if (in->usecase == USECASE_AUDIO_RECORD_AFE_PROXY) {
         flags |= PCM_MMAP | PCM_NOIRQ;
         pcm_open_retry_entry_count = PROXY_OPEN_RETRY_COUNT;
@@ -1067,27 +1784,14 @@ int start_input_stream(struct stream_in *in)
                pcm_close(in->pcm);
                in->pcm = NULL;
            }
-           if (pcm_open_retry_entry_count-- == 0) {
-               ret = -EIO;
-               goto error_open;
-           }
+           if (pcm_open_retry_entry_count-- == 0)
+               return -EIO;
            usleep(PROXY_OPEN_WAIT_TIME * 1000);
            continue;
         }
         break;
     }
-
-    ALOGV("%s: exit", __func__);
-    return ret;
-
-error_open:
-    stop_input_stream(in);
-
-error_config:
-    adev->active_input = NULL;
-    ALOGD("%s: exit: status(%d)", __func__, ret);
-
-    return ret;
+    return 0;
 }
 
 void lock_input_stream(struct stream_in *in)
@@ -1105,29 +1809,257 @@ void lock_output_stream(struct stream_out *out)
 }
 
 /* must be called with out->lock locked */
-static int send_offload_cmd_l(struct stream_out* out, int command)
+static int wake_offload_thread_l(struct stream_out *out)
 {
-    struct offload_cmd *cmd = (struct offload_cmd *)calloc(1, sizeof(struct offload_cmd));
+    uint64_t event = 1;
 
-    if (!cmd) {
-        ALOGE("failed to allocate mem for command 0x%x", command);
-        return -ENOMEM;
+    if (write(out->offload_cmd_event_fd, &event, sizeof(event)) < 0) {
+        ALOGE("%s: failed to wake offload thread: %s", __func__, strerror(errno));
+        return -errno;
     }
+    return 0;
+}
+
+/* must be called with out->lock locked */
+static int send_offload_cmd_l(struct stream_out* out, int command)
+{
+    uint32_t tail = (uint32_t)out->offload_cmd_tail;
+    uint32_t head = (uint32_t)android_atomic_acquire_load(&out->offload_cmd_head);
 
     ALOGVV("%s %d", __func__, command);
 
-    cmd->cmd = command;
-    list_add_tail(&out->offload_cmd_list, &cmd->node);
-    pthread_cond_signal(&out->offload_cond);
+    if (command == OFFLOAD_CMD_EXIT) {
+        /* not queued, so that a full ring cannot keep the thread alive */
+        android_atomic_release_store(1, &out->offload_cmd_exit);
+    } else if (tail != head && command == OFFLOAD_CMD_WAIT_FOR_BUFFER &&
+            out->offload_cmd_ring[(tail - 1) & (OFFLOAD_CMD_RING_SIZE - 1)] ==
+            OFFLOAD_CMD_WAIT_FOR_BUFFER) {
+        /* the pending wait reports the same free space */
+        return 0;
+    } else {
+        while (tail - head >= OFFLOAD_CMD_RING_SIZE) {
+            ALOGW("%s: command ring full, waiting to post 0x%x", __func__, command);
+            pthread_cond_wait(&out->cond, &out->lock);
+            tail = (uint32_t)out->offload_cmd_tail;
+            head = (uint32_t)android_atomic_acquire_load(&out->offload_cmd_head);
+        }
+        out->offload_cmd_ring[tail & (OFFLOAD_CMD_RING_SIZE - 1)] = command;
+        android_atomic_release_store((int32_t)(tail + 1), &out->offload_cmd_tail);
+    }
+
+    return wake_offload_thread_l(out);
+}
+
+/* called from the offload thread with out->lock locked, returns -1 if no
+ * command is pending
+ */
+static int pop_offload_cmd(struct stream_out *out)
+{
+    uint32_t head = (uint32_t)out->offload_cmd_head;
+    uint32_t tail = (uint32_t)android_atomic_acquire_load(&out->offload_cmd_tail);
+    int command;
+
+    if (head == tail)
+        return -1;
+
+    command = out->offload_cmd_ring[head & (OFFLOAD_CMD_RING_SIZE - 1)];
+    android_atomic_release_store((int32_t)(head + 1), &out->offload_cmd_head);
+    if (tail - head == OFFLOAD_CMD_RING_SIZE)
+        pthread_cond_broadcast(&out->cond);
+    return command;
+}
+
+/* a compress fragment in the bytes the client writes */
+static size_t offload_client_fragment_size(const struct stream_out *out)
+{
+    return out->pcm_conv.client_buffer_size ? out->pcm_conv.client_buffer_size :
+                                              out->compr_config.fragment_size;
+}
+
+/* must be called with out->lock locked */
+static ssize_t offload_write_l(struct stream_out *out, const void *buffer,
+                               size_t bytes)
+{
+    ssize_t ret;
+
+    if (out->pcm_conv.active) {
+        ret = audio_extn_pcm_offload_write_l(out, buffer, bytes);
+    } else {
+        ret = compress_write(out->compr, buffer, bytes);
+        if (ret < 0)
+            ret = -errno;
+    }
+    if (!out->playback_started && ret >= 0) {
+        compress_start(out->compr);
+        out->playback_started = 1;
+        out->offload_state = OFFLOAD_STATE_PLAYING;
+    }
+    return ret;
+}
+
+/*
+ * Offload write coalescing. Players writing a few milliseconds at a time
+ * would otherwise wake the DSP for each buffer; their data is gathered in
+ * out->coalesce and handed to the driver a fragment at a time. Whatever is
+ * held back is pushed out before a drain or a pause, before new gapless
+ * metadata, and by the offload thread once it is offload_coalesce_ns old,
+ * so the DSP does not starve on a slow client. Positions are rendered DSP
+ * frames and are not affected.
+ */
+
+/*
+ * Starts the offload_coalesce_ns countdown of the bytes held. The offload
+ * thread only computes its timeout when it wakes up, so it is woken to see
+ * the new deadline. Must be called with out->lock locked.
+ */
+static void offload_coalesce_arm_l(struct stream_out *out)
+{
+    out->coalesce.deadline_ns = stats_now_ns() + offload_coalesce_ns;
+    wake_offload_thread_l(out);
+}
+
+/*
+ * Hands the gathered bytes to the driver, keeping what it did not take.
+ * Unless may_block, a blocking stream is switched to non blocking for the
+ * write so that a full DSP does not stall pause or the offload thread.
+ * Must be called with out->lock locked.
+ */
+static int offload_coalesce_flush_l(struct stream_out *out, bool may_block)
+{
+    struct offload_coalescer *co = &out->coalesce;
+    bool nonblock = !may_block && !out->non_blocking;
+    ssize_t ret;
+
+    if (co->fill == 0 || out->compr == NULL)
+        return 0;
+
+    if (nonblock)
+        compress_nonblock(out->compr, 1);
+    ret = offload_write_l(out, co->buf, co->fill);
+    if (nonblock)
+        compress_nonblock(out->compr, 0);
+    if (ret < 0)
+        return ret;
+
+    co->flushes++;
+    co->bytes += ret;
+    co->fill -= ret;
+    if (co->fill > 0) {
+        memmove(co->buf, co->buf + ret, co->fill);
+        /* the DSP is full, there is no hurry until it asks for more */
+        offload_coalesce_arm_l(out);
+    } else {
+        co->deadline_ns = 0;
+    }
     return 0;
 }
 
+/* must be called with out->lock locked */
+static ssize_t offload_coalesce_write_l(struct stream_out *out,
+                                        const void *buffer, size_t bytes)
+{
+    struct offload_coalescer *co = &out->coalesce;
+    size_t done = 0, n;
+    ssize_t ret;
+    int err;
+
+    if (co->buf == NULL) {
+        co->size = offload_client_fragment_size(out);
+        co->buf = (uint8_t *)malloc(co->size);
+        if (co->buf == NULL) {
+            ALOGE("%s: no memory for %zu bytes, not coalescing", __func__,
+                  co->size);
+            co->size = 0;
+        }
+    }
+
+    co->writes++;
+    while (done < bytes) {
+        /* whole fragments gain nothing from a copy */
+        if (co->fill == 0 && bytes - done >= co->size) {
+            ret = offload_write_l(out, (const uint8_t *)buffer + done,
+                                  bytes - done);
+            if (ret < 0)
+                return ret;
+            co->flushes++;
+            co->bytes += ret;
+            return done + ret;
+        }
+
+        n = co->size - co->fill;
+        if (n > bytes - done)
+            n = bytes - done;
+        memcpy(co->buf + co->fill, (const uint8_t *)buffer + done, n);
+        if (co->fill == 0)
+            offload_coalesce_arm_l(out);
+        co->fill += n;
+        done += n;
+        if (co->fill < co->size)
+            break;
+
+        err = offload_coalesce_flush_l(out, true);
+        if (err < 0)
+            return err;
+        if (co->fill > 0)
+            break;
+    }
+    return done;
+}
+
+/* how long the offload thread may sleep before flushing, -1 for ever */
+static int offload_coalesce_timeout_ms_l(const struct stream_out *out)
+{
+    int64_t left_ns;
+
+    if (out->coalesce.fill == 0 || out->offload_state == OFFLOAD_STATE_PAUSED)
+        return -1;
+    left_ns = out->coalesce.deadline_ns - stats_now_ns();
+    return left_ns > 0 ? (int)((left_ns + 999999) / 1000000) : 0;
+}
+
+/* called by the offload thread with out->lock locked */
+static void offload_coalesce_expire_l(struct stream_out *out)
+{
+    struct offload_coalescer *co = &out->coalesce;
+
+    if (co->fill == 0 || out->offload_state == OFFLOAD_STATE_PAUSED ||
+            stats_now_ns() < co->deadline_ns)
+        return;
+    co->timeouts++;
+    if (offload_coalesce_flush_l(out, false) < 0)
+        co->deadline_ns = stats_now_ns() + offload_coalesce_ns;
+}
+
+/*
+ * Pushes everything gathered to the driver ahead of a drain, so that the
+ * track boundary falls after the last byte written. Called by the offload
+ * thread with out->lock unlocked and offload_thread_blocked set; a stop
+ * empties the coalescer and aborts the wait.
+ */
+static void offload_coalesce_drain(struct stream_out *out)
+{
+    size_t pending;
+
+    for (;;) {
+        lock_output_stream(out);
+        if (offload_coalesce_flush_l(out, false) < 0)
+            out->coalesce.fill = 0;
+        pending = out->coalesce.fill;
+        pthread_mutex_unlock(&out->lock);
+        if (pending == 0 || compress_wait(out->compr, -1) < 0)
+            break;
+    }
+}
+
 /* must be called iwth out->lock locked */
 static void stop_compressed_output_l(struct stream_out *out)
 {
     out->offload_state = OFFLOAD_STATE_IDLE;
     out->playback_started = 0;
     out->send_new_metadata = 1;
+    out->pcm_conv.partial_bytes = 0;
+    out->coalesce.fill = 0;
+    out->coalesce.deadline_ns = 0;
     if (out->compr != NULL) {
         compress_stop(out->compr);
         while (out->offload_thread_blocked) {
@@ -1139,7 +2071,7 @@ static void stop_compressed_output_l(struct stream_out *out)
 static void *offload_thread_loop(void *context)
 {
     struct stream_out *out = (struct stream_out *) context;
-    struct listnode *item;
+    uint64_t events;
     int ret = 0;
 
     setpriority(PRIO_PROCESS, 0, ANDROID_PRIORITY_AUDIO);
@@ -1149,47 +2081,67 @@ static void *offload_thread_loop(void *context)
     ALOGV("%s", __func__);
     lock_output_stream(out);
     for (;;) {
-        struct offload_cmd *cmd = NULL;
+        int cmd;
         stream_callback_event_t event;
         bool send_callback = false;
 
-        ALOGVV("%s offload_cmd_list %d out->offload_state %d",
-              __func__, list_empty(&out->offload_cmd_list),
-              out->offload_state);
-        if (list_empty(&out->offload_cmd_list)) {
+        cmd = pop_offload_cmd(out);
+        ALOGVV("%s cmd %d out->offload_state %d",
+              __func__, cmd, out->offload_state);
+        /* commands posted before the exit are still run, in order */
+        if (cmd < 0 && android_atomic_acquire_load(&out->offload_cmd_exit))
+            cmd = OFFLOAD_CMD_EXIT;
+        if (cmd < 0) {
+            int timeout_ms = offload_coalesce_timeout_ms_l(out);
+            struct pollfd pfd = {
+                .fd = out->offload_cmd_event_fd,
+                .events = POLLIN,
+            };
+
+            /* The eventfd counter latches wakeups posted after the ring was
+             * found empty, so it is safe to drop the lock before blocking.
+             */
+            pthread_mutex_unlock(&out->lock);
             ALOGV("%s SLEEPING", __func__);
-            pthread_cond_wait(&out->offload_cond, &out->lock);
+            ret = 1;
+            if (timeout_ms >= 0)
+                ret = poll(&pfd, 1, timeout_ms);
+            if (ret > 0)
+                ret = read(out->offload_cmd_event_fd, &events, sizeof(events));
+            if (ret < 0 && errno != EINTR) {
+                ALOGE("%s: failed to wait for commands: %s",
+                      __func__, strerror(errno));
+                lock_output_stream(out);
+                break;
+            }
             ALOGV("%s RUNNING", __func__);
+            lock_output_stream(out);
+            offload_coalesce_expire_l(out);
             continue;
         }
 
-        item = list_head(&out->offload_cmd_list);
-        cmd = node_to_item(item, struct offload_cmd, node);
-        list_remove(item);
-
         ALOGVV("%s STATE %d CMD %d out->compr %p",
-               __func__, out->offload_state, cmd->cmd, out->compr);
+               __func__, out->offload_state, cmd, out->compr);
 
-        if (cmd->cmd == OFFLOAD_CMD_EXIT) {
-            free(cmd);
+        if (cmd == OFFLOAD_CMD_EXIT)
             break;
-        }
 
         if (out->compr == NULL) {
             ALOGE("%s: Compress handle is NULL", __func__);
-            pthread_cond_signal(&out->cond);
+            pthread_cond_broadcast(&out->cond);
             continue;
         }
         out->offload_thread_blocked = true;
         pthread_mutex_unlock(&out->lock);
         send_callback = false;
-        switch(cmd->cmd) {
+        switch(cmd) {
         case OFFLOAD_CMD_WAIT_FOR_BUFFER:
             compress_wait(out->compr, -1);
             send_callback = true;
             event = STREAM_CBK_EVENT_WRITE_READY;
             break;
         case OFFLOAD_CMD_PARTIAL_DRAIN:
+            offload_coalesce_drain(out);
             ret = compress_next_track(out->compr);
             if(ret == 0)
                 compress_partial_drain(out->compr);
@@ -1202,29 +2154,26 @@ static void *offload_thread_loop(void *context)
             event = STREAM_CBK_EVENT_DRAIN_READY;
             break;
         case OFFLOAD_CMD_DRAIN:
+            offload_coalesce_drain(out);
             compress_drain(out->compr);
             send_callback = true;
             event = STREAM_CBK_EVENT_DRAIN_READY;
             break;
         default:
-            ALOGE("%s unknown command received: %d", __func__, cmd->cmd);
+            ALOGE("%s unknown command received: %d", __func__, cmd);
             break;
         }
         lock_output_stream(out);
         out->offload_thread_blocked = false;
-        pthread_cond_signal(&out->cond);
+        pthread_cond_broadcast(&out->cond);
         if (send_callback) {
             out->offload_callback(event, NULL, out->offload_cookie);
         }
-        free(cmd);
     }
 
-    pthread_cond_signal(&out->cond);
-    while (!list_empty(&out->offload_cmd_list)) {
-        item = list_head(&out->offload_cmd_list);
-        list_remove(item);
-        free(node_to_item(item, struct offload_cmd, node));
-    }
+    /* drop what is left if the thread could not wait, releasing senders */
+    android_atomic_release_store(out->offload_cmd_tail, &out->offload_cmd_head);
+    pthread_cond_broadcast(&out->cond);
     pthread_mutex_unlock(&out->lock);
 
     return NULL;
@@ -1232,8 +2181,14 @@ static void *offload_thread_loop(void *context)
 
 static int create_offload_callback_thread(struct stream_out *out)
 {
-    pthread_cond_init(&out->offload_cond, (const pthread_condattr_t *) NULL);
-    list_init(&out->offload_cmd_list);
+    out->offload_cmd_head = 0;
+    out->offload_cmd_tail = 0;
+    out->offload_cmd_exit = 0;
+    out->offload_cmd_event_fd = eventfd(0, EFD_CLOEXEC);
+    if (out->offload_cmd_event_fd < 0) {
+        ALOGE("%s: failed to create eventfd: %s", __func__, strerror(errno));
+        return -errno;
+    }
     pthread_create(&out->offload_thread, (const pthread_attr_t *) NULL,
                     offload_thread_loop, out);
     return 0;
@@ -1247,7 +2202,8 @@ static int destroy_offload_callback_thread(struct stream_out *out)
 
     pthread_mutex_unlock(&out->lock);
     pthread_join(out->offload_thread, (void **) NULL);
-    pthread_cond_destroy(&out->offload_cond);
+    close(out->offload_cmd_event_fd);
+    out->offload_cmd_event_fd = -1;
 
     return 0;
 }
@@ -1277,7 +2233,7 @@ static bool allow_hdmi_channel_config(struct audio_device *adev)
                       "no change in HDMI channels", __func__);
                 ret = false;
                 break;
-            } else if (usecase->id == USECASE_AUDIO_PLAYBACK_OFFLOAD &&
+            } else if (is_offload_usecase(usecase->id) &&
                        audio_channel_count_from_out_mask(usecase->stream.out->channel_mask) > 2) {
                 ALOGD("%s: multi-channel(%x) compress offload playback is active, "
                       "no change in HDMI channels", __func__, usecase->stream.out->channel_mask);
@@ -1292,8 +2248,8 @@ static bool allow_hdmi_channel_config(struct audio_device *adev)
 static int check_and_set_hdmi_channels(struct audio_device *adev,
                                        unsigned int channels)
 {
-    struct listnode *node;
     struct audio_usecase *usecase;
+    usecase_mask_t hdmi = 0, mask;
 
     /* Check if change in HDMI channel config is allowed */
     if (!allow_hdmi_channel_config(adev))
@@ -1312,25 +2268,22 @@ static int check_and_set_hdmi_channels(struct audio_device *adev,
      * the back end is deactivated. Note that backend will not
      * be deactivated if any one stream is connected to it.
      */
-    list_for_each(node, &adev->usecase_list) {
-        usecase = node_to_item(node, struct audio_usecase, list);
-        if (usecase->type == PCM_PLAYBACK &&
-                usecase->devices & AUDIO_DEVICE_OUT_AUX_DIGITAL) {
+    mask = adev->usecases.by_type[PCM_PLAYBACK];
+    while ((usecase = usecase_mask_pop(adev, &mask))) {
+        if (usecase->devices & AUDIO_DEVICE_OUT_AUX_DIGITAL) {
             disable_audio_route(adev, usecase);
+            hdmi |= USECASE_BIT(usecase->id);
         }
     }
+    /* the backend has to go down, do not let a transaction merge this away */
+    flush_routing_transaction(adev);
 
     /*
      * Enable all the streams disabled above. Now the HDMI backend
-     * will be activated with new channel configuration
-     */
-    list_for_each(node, &adev->usecase_list) {
-        usecase = node_to_item(node, struct audio_usecase, list);
-        if (usecase->type == PCM_PLAYBACK &&
-                usecase->devices & AUDIO_DEVICE_OUT_AUX_DIGITAL) {
-            enable_audio_route(adev, usecase);
-        }
-    }
+     * will be activated with new channel configuration
+     */
+    while ((usecase = usecase_mask_pop(adev, &hdmi)))
+        enable_audio_route(adev, usecase);
 
     return 0;
 }
@@ -1350,20 +2303,24 @@ static int stop_output_stream(struct stream_out *out)
         return -EINVAL;
     }
 
-    if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+    if (is_offload_usecase(out->usecase)) {
         if (adev->visualizer_stop_output != NULL)
             adev->visualizer_stop_output(out->handle, out->pcm_device_id);
         if (adev->offload_effects_stop_output != NULL)
             adev->offload_effects_stop_output(out->handle, out->pcm_device_id);
     }
 
+    begin_routing_transaction(adev);
+
     /* 1. Get and set stream specific mixer controls */
     disable_audio_route(adev, uc_info);
 
     /* 2. Disable the rx device */
     disable_snd_device(adev, uc_info->out_snd_device);
 
-    list_remove(&uc_info->list);
+    commit_routing_transaction(adev);
+
+    usecase_list_remove(adev, uc_info);
     free(uc_info);
 
     /* Must be called after removing the usecase from list */
@@ -1374,6 +2331,60 @@ static int stop_output_stream(struct stream_out *out)
     return ret;
 }
 
+/*
+ * Opens the visualizer and offload effects hooks on the first offload start,
+ * not in adev_open(), and tells them the sound card that was discovered.
+ * Must be called with adev->lock held.
+ */
+static void load_offload_effects_libs(struct audio_device *adev)
+{
+    void (*set_snd_card)(int);
+
+    if (adev->offload_libs_loaded)
+        return;
+    adev->offload_libs_loaded = true;
+
+    if (access(VISUALIZER_LIBRARY_PATH, R_OK) == 0) {
+        adev->visualizer_lib = dlopen(VISUALIZER_LIBRARY_PATH, RTLD_NOW);
+        if (adev->visualizer_lib == NULL) {
+            ALOGE("%s: DLOPEN failed for %s", __func__, VISUALIZER_LIBRARY_PATH);
+        } else {
+            ALOGV("%s: DLOPEN successful for %s", __func__, VISUALIZER_LIBRARY_PATH);
+            adev->visualizer_start_output =
+                        (int (*)(audio_io_handle_t, int))dlsym(adev->visualizer_lib,
+                                                        "visualizer_hal_start_output");
+            adev->visualizer_stop_output =
+                        (int (*)(audio_io_handle_t, int))dlsym(adev->visualizer_lib,
+                                                        "visualizer_hal_stop_output");
+            set_snd_card = (void (*)(int))dlsym(adev->visualizer_lib,
+                                                "visualizer_hal_set_snd_card");
+            if (set_snd_card)
+                set_snd_card(adev->snd_card);
+        }
+    }
+
+    if (access(OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH, R_OK) == 0) {
+        adev->offload_effects_lib = dlopen(OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH, RTLD_NOW);
+        if (adev->offload_effects_lib == NULL) {
+            ALOGE("%s: DLOPEN failed for %s", __func__,
+                  OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH);
+        } else {
+            ALOGV("%s: DLOPEN successful for %s", __func__,
+                  OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH);
+            adev->offload_effects_start_output =
+                        (int (*)(audio_io_handle_t, int))dlsym(adev->offload_effects_lib,
+                                         "offload_effects_bundle_hal_start_output");
+            adev->offload_effects_stop_output =
+                        (int (*)(audio_io_handle_t, int))dlsym(adev->offload_effects_lib,
+                                         "offload_effects_bundle_hal_stop_output");
+            set_snd_card = (void (*)(int))dlsym(adev->offload_effects_lib,
+                                     "offload_effects_bundle_hal_set_snd_card");
+            if (set_snd_card)
+                set_snd_card(adev->snd_card);
+        }
+    }
+}
+
 int start_output_stream(struct stream_out *out)
 {
     int ret = 0;
@@ -1424,52 +2435,24 @@ int start_output_stream(struct stream_out *out)
     if (out->devices & AUDIO_DEVICE_OUT_AUX_DIGITAL) {
         property_get("audio.use.hdmi.sink.cap", prop_value, NULL);
         if (!strncmp("true", prop_value, 4)) {
-            sink_channels = platform_edid_get_max_channels(out->dev->platform);
+            sink_channels = edid_caps_get_l(adev)->max_channels;
             ALOGD("%s: set HDMI channel count[%d] based on sink capability", __func__, sink_channels);
             check_and_set_hdmi_channels(adev, sink_channels);
         } else {
-            if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD)
+            if (is_offload_usecase(out->usecase))
                 check_and_set_hdmi_channels(adev, out->compr_config.codec->ch_in);
             else
                 check_and_set_hdmi_channels(adev, out->config.channels);
         }
     }
 
-    list_add_tail(&adev->usecase_list, &uc_info->list);
+    usecase_list_add(adev, uc_info);
 
     select_devices(adev, out->usecase);
 
-    ALOGV("%s: Opening PCM device card_id(%d) device_id(%d)",
-          __func__, 0, out->pcm_device_id);
-    if (out->usecase != USECASE_AUDIO_PLAYBACK_OFFLOAD) {
-        unsigned int flags = PCM_OUT;
-        unsigned int pcm_open_retry_count = 0;
-        if (out->usecase == USECASE_AUDIO_PLAYBACK_AFE_PROXY) {
-            flags |= PCM_MMAP | PCM_NOIRQ;
-            pcm_open_retry_count = PROXY_OPEN_RETRY_COUNT;
-        } else
-            flags |= PCM_MONOTONIC;
-
-        while (1) {
-            out->pcm = pcm_open(adev->snd_card, out->pcm_device_id,
-                               flags, &out->config);
-            if (out->pcm && !pcm_is_ready(out->pcm)) {
-                ALOGE("%s: %s", __func__, pcm_get_error(out->pcm));
-                if (out->pcm != NULL) {
-                    pcm_close(out->pcm);
-                    out->pcm = NULL;
-                }
-                if (pcm_open_retry_count-- == 0) {
-                    ret = -EIO;
-                    goto error_open;
-                }
-                usleep(PROXY_OPEN_WAIT_TIME * 1000);
-                continue;
-            }
-            break;
-        }
-    } else {
-        out->pcm = NULL;
+    /* PCM playback is opened by open_output_pcm(), without adev->lock */
+    out->pcm = NULL;
+    if (is_offload_usecase(out->usecase)) {
         out->compr = compress_open(adev->snd_card,
                                    out->pcm_device_id,
                                    COMPRESS_IN, &out->compr_config);
@@ -1488,6 +2471,7 @@ int start_output_stream(struct stream_out *out)
             audio_extn_dolby_send_ddp_endp_params(adev);
 #endif
 
+        load_offload_effects_libs(adev);
         if (adev->visualizer_start_output != NULL)
             adev->visualizer_start_output(out->handle, out->pcm_device_id);
         if (adev->offload_effects_start_output != NULL)
@@ -1501,6 +2485,295 @@ error_config:
     return ret;
 }
 
+/*
+ * Opens the PCM of a usecase start_output_stream() routed. Only needs
+ * out->lock, so that a slow open or the AFE proxy retries do not hold up
+ * routing for the other streams. On failure the caller undoes the routing
+ * with stop_output_stream().
+ */
+static int open_output_pcm(struct stream_out *out)
+{
+    struct audio_device *adev = out->dev;
+    unsigned int flags = PCM_OUT;
+    unsigned int pcm_open_retry_count = 0;
+
+    ALOGV("%s: Opening PCM device card_id(%d) device_id(%d)",
+          __func__, adev->snd_card, out->pcm_device_id);
+    if (out->usecase == USECASE_AUDIO_PLAYBACK_AFE_PROXY) {
+        flags |= PCM_MMAP | PCM_NOIRQ;
+        pcm_open_retry_count = PROXY_OPEN_RETRY_COUNT;
+    } else if (out->mmap_mode) {
+        flags |= PCM_MMAP | PCM_NOIRQ | PCM_MONOTONIC;
+        /* the ring pointers restart from 0 on every open */
+        out->mmap_appl_ptr = 0;
+    } else
+        flags |= PCM_MONOTONIC;
+
+    while (1) {
+        out->pcm = pcm_open(adev->snd_card, out->pcm_device_id,
+                           flags, &out->config);
+        if (out->pcm && !pcm_is_ready(out->pcm)) {
+            ALOGE("%s: %s", __func__, pcm_get_error(out->pcm));
+            if (out->pcm != NULL) {
+                pcm_close(out->pcm);
+                out->pcm = NULL;
+            }
+            if (pcm_open_retry_count-- == 0)
+                return -EIO;
+            usleep(PROXY_OPEN_WAIT_TIME * 1000);
+            continue;
+        }
+        break;
+    }
+    return 0;
+}
+
+static bool out_supports_warm_standby(const struct stream_out *out)
+{
+    return warm_standby_ns > 0 &&
+           !is_offload_usecase(out->usecase) &&
+           out->usecase != USECASE_AUDIO_PLAYBACK_AFE_PROXY &&
+           out->usecase != USECASE_COMPRESS_VOIP_CALL &&
+           !out->mmap_mode;
+}
+
+/* must be called with out->lock and adev->lock held, and out->pcm open */
+static int out_enter_warm_standby_l(struct stream_out *out)
+{
+    /* drop what is queued, and prepare now rather than on the next write */
+    if (pcm_stop(out->pcm) != 0 || pcm_prepare(out->pcm) != 0) {
+        ALOGW("%s: %s", __func__, pcm_get_error(out->pcm));
+        return -EIO;
+    }
+    out->warm = true;
+    out->warm_deadline_ns = stats_now_ns() + warm_standby_ns;
+    pthread_cond_signal(&out->dev->warm.cond);
+    return 0;
+}
+
+/* must be called with out->lock and adev->lock held */
+static void out_cool_down_l(struct stream_out *out)
+{
+    if (!out->warm)
+        return;
+
+    ALOGV("%s: usecase(%d: %s)", __func__, out->usecase,
+          use_case_table[out->usecase]);
+    out->warm = false;
+    if (out->pcm) {
+        pcm_close(out->pcm);
+        out->pcm = NULL;
+    }
+    stop_output_stream(out);
+}
+
+static void *warm_standby_thread_loop(void *context)
+{
+    struct audio_device *adev = (struct audio_device *)context;
+    struct audio_usecase *usecase;
+    struct stream_out *out;
+    struct listnode *node, *tmp;
+    struct timespec ts;
+    int64_t now, next;
+    bool offline;
+
+    setpriority(PRIO_PROCESS, 0, ANDROID_PRIORITY_AUDIO);
+    set_sched_policy(0, SP_FOREGROUND);
+    prctl(PR_SET_NAME, (unsigned long)"Warm Standby", 0, 0, 0);
+
+    pthread_mutex_lock(&adev->lock);
+    while (!adev->warm.exit) {
+        now = stats_now_ns();
+        next = INT64_MAX;
+        /* prepared PCMs do not survive a subsystem restart */
+        offline = SND_CARD_STATE_OFFLINE == get_snd_card_state(adev);
+
+        while (!list_empty(&adev->warm.requests)) {
+            node = list_head(&adev->warm.requests);
+            list_remove(node);
+            list_init(node);
+            out = node_to_item(node, struct stream_out, warm_node);
+            /* a busy stream is already being written to */
+            if (pthread_mutex_trylock(&out->lock) != 0)
+                continue;
+            if (out->standby && !out->warm && start_output_stream(out) == 0) {
+                if (open_output_pcm(out) == 0 && pcm_prepare(out->pcm) == 0) {
+                    out->warm = true;
+                    out->warm_deadline_ns = now + warm_standby_ns;
+                } else {
+                    ALOGW("%s: cannot prepare usecase(%d: %s)", __func__,
+                          out->usecase, use_case_table[out->usecase]);
+                    if (out->pcm) {
+                        pcm_close(out->pcm);
+                        out->pcm = NULL;
+                    }
+                    stop_output_stream(out);
+                }
+            }
+            pthread_mutex_unlock(&out->lock);
+        }
+
+        list_for_each_safe(node, tmp, &adev->usecase_list) {
+            usecase = node_to_item(node, struct audio_usecase, list);
+            if (usecase->type != PCM_PLAYBACK || usecase->stream.out == NULL ||
+                    !usecase->stream.out->warm)
+                continue;
+            out = usecase->stream.out;
+            if (out->warm_deadline_ns > now && !offline) {
+                if (out->warm_deadline_ns < next)
+                    next = out->warm_deadline_ns;
+                continue;
+            }
+            /* the owner may be waiting for adev->lock to resume it */
+            if (pthread_mutex_trylock(&out->lock) != 0) {
+                if (now + WARM_STANDBY_RETRY_NS < next)
+                    next = now + WARM_STANDBY_RETRY_NS;
+                continue;
+            }
+            out_cool_down_l(out);
+            pthread_mutex_unlock(&out->lock);
+        }
+
+        if (next == INT64_MAX) {
+            pthread_cond_wait(&adev->warm.cond, &adev->lock);
+        } else {
+            ts.tv_sec = next / 1000000000LL;
+            ts.tv_nsec = next % 1000000000LL;
+            pthread_cond_timedwait(&adev->warm.cond, &adev->lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&adev->lock);
+    return NULL;
+}
+
+static void warm_standby_init(struct audio_device *adev)
+{
+    pthread_condattr_t attr;
+
+    list_init(&adev->warm.requests);
+    if (warm_standby_ns == 0)
+        return;
+
+    /* deadlines are CLOCK_MONOTONIC, like stats_now_ns() */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&adev->warm.cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    adev->warm.exit = false;
+    if (pthread_create(&adev->warm.thread, (const pthread_attr_t *) NULL,
+                       warm_standby_thread_loop, adev) != 0) {
+        ALOGE("%s: no warm standby thread, warm standby disabled", __func__);
+        pthread_cond_destroy(&adev->warm.cond);
+        warm_standby_ns = 0;
+        return;
+    }
+    adev->warm.running = true;
+}
+
+static void warm_standby_deinit(struct audio_device *adev)
+{
+    if (!adev->warm.running)
+        return;
+
+    pthread_mutex_lock(&adev->lock);
+    adev->warm.exit = true;
+    pthread_cond_signal(&adev->warm.cond);
+    pthread_mutex_unlock(&adev->lock);
+    pthread_join(adev->warm.thread, (void **) NULL);
+    pthread_cond_destroy(&adev->warm.cond);
+    adev->warm.running = false;
+}
+
+/*
+ * must be called with the stream lock held, see struct ssr_snapshot. Queued
+ * streams are restarted by ssr_recover_l() if their client is still at it.
+ */
+static void ssr_snapshot_l(struct audio_device *adev, struct ssr_snapshot *ssr,
+                           bool queue)
+{
+    ALOGD("%s: sound card is not active/SSR state, %s %p to be %s",
+          __func__, ssr->input ? "input" : "output", ssr->stream,
+          queue ? "restarted" : "reopened by its client");
+    ssr->pending = true;
+    ssr->offline_ns = stats_now_ns();
+    ssr->silence_until_ns = ssr->offline_ns;
+    if (!queue)
+        return;
+
+    pthread_mutex_lock(&adev->lock);
+    if (list_empty(&ssr->node))
+        list_add_tail(&adev->ssr.streams, &ssr->node);
+    /* the card may be back already */
+    pthread_cond_broadcast(&adev->ssr.cond);
+    pthread_mutex_unlock(&adev->lock);
+}
+
+/* must be called with out->lock held */
+static void out_ssr_snapshot_l(struct stream_out *out)
+{
+    if (out->ssr.pending)
+        return;
+    /* cleared by standby */
+    out->ssr.gapless_mdata = out->gapless_mdata;
+    /* AudioFlinger tears compress sessions down on -ENETRESET */
+    ssr_snapshot_l(out->dev, &out->ssr, !is_offload_usecase(out->usecase));
+}
+
+/* must be called with in->lock held */
+static void in_ssr_snapshot_l(struct stream_in *in)
+{
+    if (in->ssr.pending)
+        return;
+    ssr_snapshot_l(in->dev, &in->ssr, true);
+}
+
+/*
+ * While the card is offline the stream consumes, or for capture produces
+ * silence, at its own rate. Returns when the caller should come back: the
+ * end of the previous buffer, so that a caller which is late or has just
+ * seen the card go down does not wait at all.
+ */
+static int64_t ssr_consume_l(struct ssr_snapshot *ssr, size_t frames,
+                             uint32_t rate)
+{
+    int64_t now = stats_now_ns();
+    int64_t duration_ns = rate ? (int64_t)frames * 1000000000LL / rate : 0;
+
+    if (ssr->silence_until_ns < now)
+        ssr->silence_until_ns = now;
+    ssr->silence_until_ns += duration_ns;
+    return ssr->silence_until_ns - duration_ns;
+}
+
+/*
+ * Whether the client kept writing or reading while the card was offline:
+ * its silence then runs up to now, while an idle client's ended a while ago.
+ */
+static bool ssr_client_active_l(const struct ssr_snapshot *ssr)
+{
+    return stats_now_ns() - ssr->silence_until_ns < SSR_CLIENT_IDLE_NS;
+}
+
+static void ssr_sleep_until(int64_t when_ns)
+{
+    int64_t now = stats_now_ns();
+
+    if (when_ns > now)
+        usleep((useconds_t)((when_ns - now) / 1000));
+}
+
+/* a stream being closed must not be restarted, nor freed while it is */
+static void ssr_forget(struct audio_device *adev, struct ssr_snapshot *ssr)
+{
+    pthread_mutex_lock(&adev->lock);
+    while (ssr->recovering)
+        pthread_cond_wait(&adev->ssr.cond, &adev->lock);
+    list_remove(&ssr->node);
+    list_init(&ssr->node);
+    pthread_mutex_unlock(&adev->lock);
+}
+
 static int check_input_parameters(uint32_t sample_rate,
                                   audio_format_t format,
                                   int channel_count)
@@ -1583,8 +2856,8 @@ static size_t out_get_buffer_size(const struct audio_stream *stream)
 {
     struct stream_out *out = (struct stream_out *)stream;
 
-    if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD)
-        return out->compr_config.fragment_size;
+    if (is_offload_usecase(out->usecase))
+        return offload_client_fragment_size(out);
     else if(out->usecase == USECASE_COMPRESS_VOIP_CALL)
         return voice_extn_compress_voip_out_get_buffer_size(out);
 
@@ -1612,9 +2885,9 @@ static int out_set_format(struct audio_stream *stream __unused,
     return -ENOSYS;
 }
 
-static int out_standby(struct audio_stream *stream)
+static int do_out_standby(struct stream_out *out)
 {
-    struct stream_out *out = (struct stream_out *)stream;
+    struct audio_stream *stream = &out->stream.common;
     struct audio_device *adev = out->dev;
 
     ALOGD("%s: enter: stream (%p) usecase(%d: %s)", __func__,
@@ -1629,12 +2902,24 @@ static int out_standby(struct audio_stream *stream)
 
     lock_output_stream(out);
     if (!out->standby) {
+        audio_extn_period_tuner_session_end(out);
         pthread_mutex_lock(&adev->lock);
 
         amplifier_output_stream_standby((struct audio_stream_out *) stream);
 
         out->standby = true;
-        if (out->usecase != USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+        stats_count_standby_l(&out->stats);
+        pos_est_reset(&out->pos_est);
+        if (out->pcm && out_supports_warm_standby(out) &&
+                SND_CARD_STATE_ONLINE == get_snd_card_state(adev) &&
+                out_enter_warm_standby_l(out) == 0) {
+            ALOGV("%s: warm standby for %lld ms", __func__,
+                  (long long)(warm_standby_ns / 1000000));
+            pthread_mutex_unlock(&adev->lock);
+            pthread_mutex_unlock(&out->lock);
+            return 0;
+        }
+        if (!is_offload_usecase(out->usecase)) {
             if (out->pcm) {
                 pcm_close(out->pcm);
                 out->pcm = NULL;
@@ -1650,15 +2935,51 @@ static int out_standby(struct audio_stream *stream)
         }
         stop_output_stream(out);
         pthread_mutex_unlock(&adev->lock);
+    } else if (out->warm) {
+        /* standby again, e.g. on close or after an error: really stop */
+        pthread_mutex_lock(&adev->lock);
+        out_cool_down_l(out);
+        pthread_mutex_unlock(&adev->lock);
     }
     pthread_mutex_unlock(&out->lock);
     ALOGV("%s: exit", __func__);
     return 0;
 }
 
-static int out_dump(const struct audio_stream *stream __unused,
-                    int fd __unused)
+static int out_standby(struct audio_stream *stream)
+{
+    struct stream_out *out = (struct stream_out *)stream;
+    int ret = do_out_standby(out);
+
+    /* the client is done with it, do not bring it back after SSR */
+    lock_output_stream(out);
+    out->ssr.pending = false;
+    pthread_mutex_unlock(&out->lock);
+    return ret;
+}
+
+static int out_dump(const struct audio_stream *stream, int fd)
 {
+    struct stream_out *out = (struct stream_out *)stream;
+
+    dprintf(fd, "  Output stream %p, usecase %s:\n", out,
+            use_case_table[out->usecase]);
+    stats_dump(fd, "    ", &out->stats);
+    dprintf(fd, "    position drift %d ppm, jitter %u us, restarts %u, "
+            "device latency %d us\n", out->pos_est.drift_ppm,
+            out->pos_est.jitter_us, out->pos_est.restarts,
+            out->device_latency_us);
+    dprintf(fd, "    resumes %u warm, %u cold, last took %u us%s\n",
+            out->warm_resumes, out->cold_resumes, out->last_resume_us,
+            out->warm ? ", in warm standby" : "");
+    dprintf(fd, "    SSR restarts %u, last took %u us%s\n",
+            out->ssr.recoveries, out->ssr.last_recovery_us,
+            out->ssr.pending ? ", pending" : "");
+    if (is_offload_usecase(out->usecase))
+        dprintf(fd, "    coalesced %u writes into %u driver writes, %u on "
+                "timeout, %llu bytes, %zu held\n", out->coalesce.writes,
+                out->coalesce.flushes, out->coalesce.timeouts,
+                (unsigned long long)out->coalesce.bytes, out->coalesce.fill);
     return 0;
 }
 
@@ -1781,7 +3102,7 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
         if (val != 0) {
             out->devices = val;
 
-            if (!out->standby)
+            if (!out->standby || out->warm)
                 select_devices(adev, out->usecase);
 
             if (output_drives_call(adev, out)) {
@@ -1808,12 +3129,21 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
         pthread_mutex_unlock(&out->lock);
     }
 
+    err = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_WARM_UP, value, sizeof(value));
+    if (err >= 0 && out_supports_warm_standby(out)) {
+        pthread_mutex_lock(&adev->lock);
+        if (list_empty(&out->warm_node))
+            list_add_tail(&adev->warm.requests, &out->warm_node);
+        pthread_cond_signal(&adev->warm.cond);
+        pthread_mutex_unlock(&adev->lock);
+    }
+
     if (out == adev->primary_output) {
         pthread_mutex_lock(&adev->lock);
         audio_extn_set_parameters(adev, parms);
         pthread_mutex_unlock(&adev->lock);
     }
-    if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+    if (is_offload_usecase(out->usecase)) {
         lock_output_stream(out);
         parse_compress_metadata(out, parms);
         pthread_mutex_unlock(&out->lock);
@@ -1825,16 +3155,64 @@ error:
     return ret;
 }
 
+/*
+ * The multichannel HDMI output plays any LPCM rate the sink lists, the
+ * other outputs only the rate they were opened with.
+ */
+static void out_sup_sample_rates_to_str(struct stream_out *out, char *value,
+                                        size_t len)
+{
+    struct edid_audio_caps caps;
+    size_t i, pos = 0;
+
+    value[0] = '\0';
+    if (out->usecase == USECASE_AUDIO_PLAYBACK_MULTI_CH) {
+        pthread_mutex_lock(&out->dev->lock);
+        caps = *edid_caps_get_l(out->dev);
+        pthread_mutex_unlock(&out->dev->lock);
+        for (i = 0; i < ARRAY_SIZE(edid_sample_rates) && pos < len; i++) {
+            if (caps.sample_rates & (1u << i))
+                pos += snprintf(value + pos, len - pos, "%s%u",
+                                pos ? "|" : "", edid_sample_rates[i]);
+        }
+    }
+    if (pos == 0)
+        snprintf(value, len, "%u", out->sample_rate);
+}
+
+/*
+ * The multichannel HDMI output is rendered as 16 bit LPCM whatever else
+ * the sink decodes; there is no compressed passthrough path.
+ */
+static void out_sup_formats_to_str(struct stream_out *out, char *value,
+                                   size_t len)
+{
+    audio_format_t format = out->format;
+    size_t i;
+
+    if (out->usecase == USECASE_AUDIO_PLAYBACK_MULTI_CH)
+        format = AUDIO_FORMAT_PCM_16_BIT;
+
+    value[0] = '\0';
+    for (i = 0; i < ARRAY_SIZE(out_formats_name_to_enum_table); i++) {
+        if (out_formats_name_to_enum_table[i].value == format) {
+            snprintf(value, len, "%s", out_formats_name_to_enum_table[i].name);
+            break;
+        }
+    }
+}
+
 static char* out_get_parameters(const struct audio_stream *stream, const char *keys)
 {
     struct stream_out *out = (struct stream_out *)stream;
     struct str_parms *query = str_parms_create_str(keys);
     char *str;
-    char value[256];
+    char value[512];
     struct str_parms *reply = str_parms_create();
     size_t i, j;
     int ret;
     bool first = true;
+    bool handled = false;
 
     if (!query || !reply) {
         ALOGE("out_get_parameters: failed to allocate mem for query or reply");
@@ -1842,6 +3220,22 @@ static char* out_get_parameters(const struct audio_stream *stream, const char *k
     }
 
     ALOGV("%s: enter: keys - %s", __func__, keys);
+    ret = str_parms_get_str(query, AUDIO_PARAMETER_KEY_HAL_STATS, value, sizeof(value));
+    if (ret >= 0) {
+        size_t len;
+
+        stats_to_str(&out->stats, value, sizeof(value));
+        len = strlen(value);
+        snprintf(value + len, sizeof(value) - len,
+                 ",drift_ppm:%d,jitter_us:%u,position_restarts:%u,"
+                 "warm_resumes:%u,cold_resumes:%u,resume_us:%u",
+                 out->pos_est.drift_ppm, out->pos_est.jitter_us,
+                 out->pos_est.restarts, out->warm_resumes, out->cold_resumes,
+                 out->last_resume_us);
+        str_parms_add_str(reply, AUDIO_PARAMETER_KEY_HAL_STATS, value);
+        handled = true;
+    }
+
     ret = str_parms_get_str(query, AUDIO_PARAMETER_STREAM_SUP_CHANNELS, value, sizeof(value));
     if (ret >= 0) {
         value[0] = '\0';
@@ -1860,6 +3254,27 @@ static char* out_get_parameters(const struct audio_stream *stream, const char *k
             i++;
         }
         str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_CHANNELS, value);
+        handled = true;
+    }
+
+    ret = str_parms_get_str(query, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES,
+                            value, sizeof(value));
+    if (ret >= 0) {
+        out_sup_sample_rates_to_str(out, value, sizeof(value));
+        str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES,
+                          value);
+        handled = true;
+    }
+
+    ret = str_parms_get_str(query, AUDIO_PARAMETER_STREAM_SUP_FORMATS, value,
+                            sizeof(value));
+    if (ret >= 0) {
+        out_sup_formats_to_str(out, value, sizeof(value));
+        str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_FORMATS, value);
+        handled = true;
+    }
+
+    if (handled) {
         str = str_parms_to_str(reply);
     } else {
         voice_extn_out_get_parameters(out, query, reply);
@@ -1875,32 +3290,154 @@ static char* out_get_parameters(const struct audio_stream *stream, const char *k
     return str;
 }
 
+/*
+ * Measures how far the hardware pointer trails the frames written so far,
+ * i.e. the latency added by the DMA ring, after each mmap write.
+ */
+static void out_update_mmap_latency_l(struct stream_out *out, size_t frames)
+{
+    unsigned int hw_ptr, queued;
+    struct timespec tstamp;
+
+    out->mmap_appl_ptr += frames;
+    if (pcm_mmap_get_hw_ptr(out->pcm, &hw_ptr, &tstamp) < 0)
+        return;
+
+    queued = out->mmap_appl_ptr - hw_ptr;
+    /* the hw pointer wrapped at the ring boundary or the stream underran */
+    if (queued > out->config.period_size * out->config.period_count)
+        return;
+
+    /* exponential average over 8 writes */
+    if (out->mmap_latency_frames == 0)
+        out->mmap_latency_frames = queued;
+    else
+        out->mmap_latency_frames += ((int)queued - (int)out->mmap_latency_frames) / 8;
+}
+
 static uint32_t out_get_latency(const struct audio_stream_out *stream)
 {
     struct stream_out *out = (struct stream_out *)stream;
 
-    if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD)
+    if (is_offload_usecase(out->usecase))
         return COMPRESS_OFFLOAD_PLAYBACK_LATENCY;
 
+    /* the DMA ring as measured, then the DSP path after it */
+    if (out->mmap_mode && out->mmap_latency_frames != 0)
+        return (out->mmap_latency_frames * 1000) / out->config.rate +
+               (uint32_t)((platform_render_latency(out->usecase) +
+                           out->device_latency_us) / 1000);
+
     return (out->config.period_count * out->config.period_size * 1000) /
            (out->config.rate);
 }
 
+/*
+ * Only the multichannel output takes its volume in the HAL. It keeps its
+ * usecase across routing changes, so the gain stays applied wherever it is
+ * routed; other PCM outputs leave the volume to AudioFlinger.
+ */
+static bool out_has_sw_gain(const struct stream_out *out)
+{
+    return out->usecase == USECASE_AUDIO_PLAYBACK_MULTI_CH;
+}
+
+/*
+ * Applies a gain ramping linearly from gain_from to gain_to over the buffer.
+ * Both loops are kept free of branches and aliasing so that the compiler can
+ * vectorize them.
+ */
+static void sw_gain_apply(int16_t *restrict dst, const int16_t *restrict src,
+                          size_t frames, unsigned int channels,
+                          int32_t gain_from, int32_t gain_to)
+{
+    size_t samples = frames * channels;
+    size_t i;
+    unsigned int ch;
+
+    if (gain_from == gain_to) {
+        for (i = 0; i < samples; i++)
+            dst[i] = (int16_t)((src[i] * gain_from) >> 15);
+        return;
+    }
+
+    for (i = 0; i < frames; i++) {
+        int32_t gain = gain_from +
+                (int32_t)((int64_t)(gain_to - gain_from) * (int64_t)i /
+                          (int64_t)frames);
+
+        for (ch = 0; ch < channels; ch++)
+            dst[i * channels + ch] =
+                    (int16_t)((src[i * channels + ch] * gain) >> 15);
+    }
+}
+
+/*
+ * Returns the buffer out_write() should hand to the driver: the client
+ * buffer at unity gain, otherwise a scaled copy in the stream's scratch
+ * buffer. The client buffer is never modified.
+ */
+static const void *out_apply_sw_gain_l(struct stream_out *out,
+                                       const void *buffer, size_t bytes)
+{
+    int32_t target = android_atomic_acquire_load(&out->sw_gain_target);
+    unsigned int channels = out->config.channels;
+    size_t frames = bytes / (channels * sizeof(int16_t));
+    size_t period_bytes, size;
+    int16_t *buf;
+
+    if (target == SW_GAIN_UNITY && out->sw_gain == SW_GAIN_UNITY)
+        return buffer;
+
+    if (bytes > out->sw_gain_buf_size) {
+        /* keep whole periods so that regular writes never reallocate */
+        period_bytes = out->config.period_size * channels * sizeof(int16_t);
+        if (period_bytes == 0)
+            period_bytes = bytes;
+        size = (bytes + period_bytes - 1) / period_bytes * period_bytes;
+        buf = realloc(out->sw_gain_buf, size);
+        if (buf == NULL) {
+            ALOGE("%s: no memory for %zu bytes of scratch buffer", __func__,
+                  size);
+            return buffer;
+        }
+        out->sw_gain_buf = buf;
+        out->sw_gain_buf_size = size;
+    }
+
+    if (target == 0 && out->sw_gain == 0)
+        memset(out->sw_gain_buf, 0, bytes);
+    else
+        sw_gain_apply(out->sw_gain_buf, buffer, frames, channels,
+                      out->sw_gain, target);
+    out->sw_gain = target;
+    return out->sw_gain_buf;
+}
+
 static int out_set_volume(struct audio_stream_out *stream, float left,
                           float right)
 {
     struct stream_out *out = (struct stream_out *)stream;
     int volume[2];
 
-    if (out->usecase == USECASE_AUDIO_PLAYBACK_MULTI_CH) {
+    if (out_has_sw_gain(out)) {
         /* only take left channel into account: the API is for stereo anyway */
-        out->muted = (left == 0.0f);
+        int32_t gain = SW_GAIN_UNITY;
+
+        if (left <= 0.0f)
+            gain = 0;
+        else if (left < 1.0f)
+            gain = (int32_t)(left * SW_GAIN_UNITY);
+        android_atomic_release_store(gain, &out->sw_gain_target);
         return 0;
-    } else if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+    } else if (is_offload_usecase(out->usecase)) {
         const char *mixer_ctl_name = "Compress Playback Volume";
         struct audio_device *adev = out->dev;
         struct mixer_ctl *ctl;
-        ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+        /* applied again after SSR */
+        out->volume_l = left;
+        out->volume_r = right;
+        ctl = get_mixer_ctl(adev, mixer_ctl_name);
         if (!ctl) {
             /* try with the control based on device id */
             int pcm_device_id = platform_get_pcm_device_id(out->usecase,
@@ -1908,7 +3445,7 @@ static int out_set_volume(struct audio_stream_out *stream, float left,
             char ctl_name[128] = {0};
             snprintf(mixer_ctl_name, sizeof(mixer_ctl_name),
                      "Compress Playback %d Volume", pcm_device_id);
-            ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+            ctl = get_mixer_ctl(adev, mixer_ctl_name);
             if (!ctl) {
                 ALOGE("%s: Could not get ctl for mixer cmd - %s",
                       __func__, mixer_ctl_name);
@@ -1921,7 +3458,64 @@ static int out_set_volume(struct audio_stream_out *stream, float left,
         return 0;
     }
 
-    return -ENOSYS;
+    return -ENOSYS;
+}
+
+/* must be called with out->lock held and the stream in standby */
+static int out_resume_l(struct stream_out *out)
+{
+    struct audio_device *adev = out->dev;
+    bool open_pcm = false;
+    int ret = 0;
+
+    out->standby = false;
+    pthread_mutex_lock(&adev->lock);
+    if (out->warm) {
+        /* still routed and prepared, see out_enter_warm_standby_l() */
+        out->warm = false;
+        out->warm_resumes++;
+    } else if (out->usecase == USECASE_COMPRESS_VOIP_CALL) {
+        ret = voice_extn_compress_voip_start_output_stream(out);
+        out->cold_resumes++;
+    } else {
+        ret = start_output_stream(out);
+        open_pcm = !is_offload_usecase(out->usecase);
+        out->cold_resumes++;
+    }
+    /* before open_output_pcm(), a cold start may change the period count */
+    if (ret == 0)
+        audio_extn_period_tuner_session_start(adev, out);
+    pthread_mutex_unlock(&adev->lock);
+
+    if (ret == 0 && open_pcm) {
+        ret = open_output_pcm(out);
+        if (ret != 0) {
+            pthread_mutex_lock(&adev->lock);
+            stop_output_stream(out);
+            pthread_mutex_unlock(&adev->lock);
+        }
+    }
+    if (ret == 0) {
+        pthread_mutex_lock(&adev->lock);
+        amplifier_output_stream_start(&out->stream, false);
+        pthread_mutex_unlock(&adev->lock);
+    }
+    if (ret != 0) {
+        out->standby = true;
+        return ret;
+    }
+    stats_count_resume_l(&out->stats);
+    if (out->ssr.pending) {
+        /* first start after SSR, put back what standby lost */
+        out->ssr.pending = false;
+        if (is_offload_usecase(out->usecase)) {
+            out->gapless_mdata = out->ssr.gapless_mdata;
+            out->send_new_metadata = 1;
+            if (out->volume_l >= 0.0f)
+                out_set_volume(&out->stream, out->volume_l, out->volume_r);
+        }
+    }
+    return 0;
 }
 
 static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
@@ -1930,83 +3524,95 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
     struct stream_out *out = (struct stream_out *)stream;
     struct audio_device *adev = out->dev;
     int snd_scard_state = get_snd_card_state(adev);
+    int64_t start_ns = stats_now_ns();
+    int64_t io_start_ns, blocked_ns = 0;
+    int64_t silence_ns = 0;
+    bool resuming = false;
     ssize_t ret = 0;
 
     lock_output_stream(out);
 
     if (SND_CARD_STATE_OFFLINE == snd_scard_state) {
-        if (out->pcm) {
-            ALOGD(" %s: sound card is not active/SSR state", __func__);
-            ret= -ENETRESET;
-            goto exit;
-        } else if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+        if (is_offload_usecase(out->usecase)) {
             //during SSR for compress usecase we should return error to flinger
             ALOGD(" copl %s: sound card is not active/SSR state", __func__);
+            out_ssr_snapshot_l(out);
             pthread_mutex_unlock(&out->lock);
+            do_out_standby(out);
             return -ENETRESET;
         }
+        ret = -ENETRESET;
+        goto exit;
     }
 
     if (out->standby) {
-        out->standby = false;
-        pthread_mutex_lock(&adev->lock);
-        if (out->usecase == USECASE_COMPRESS_VOIP_CALL)
-            ret = voice_extn_compress_voip_start_output_stream(out);
-        else
-            ret = start_output_stream(out);
-
-        if (ret == 0)
-            amplifier_output_stream_start(stream, false);
-
-        pthread_mutex_unlock(&adev->lock);
+        resuming = true;
+        ret = out_resume_l(out);
         /* ToDo: If use case is compress offload should return 0 */
-        if (ret != 0) {
-            out->standby = true;
+        if (ret != 0)
             goto exit;
-        }
     }
 
-    if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+    if (is_offload_usecase(out->usecase)) {
         ALOGVV("%s: writing buffer (%d bytes) to compress device", __func__, bytes);
-        if (out->send_new_metadata) {
-            ALOGVV("send new gapless metadata");
-            compress_set_gapless_metadata(out->compr, &out->gapless_mdata);
-            out->send_new_metadata = 0;
+        io_start_ns = stats_now_ns();
+        /* bytes gathered before new gapless metadata belong to the old track */
+        if (out->send_new_metadata && out->coalesce.fill > 0)
+            ret = offload_coalesce_flush_l(out, true);
+        if (ret == 0 && !(out->send_new_metadata && out->coalesce.fill > 0)) {
+            if (out->send_new_metadata) {
+                ALOGVV("send new gapless metadata");
+                compress_set_gapless_metadata(out->compr, &out->gapless_mdata);
+                out->send_new_metadata = 0;
+            }
+            if (offload_coalesce_ns > 0)
+                ret = offload_coalesce_write_l(out, buffer, bytes);
+            else
+                ret = offload_write_l(out, buffer, bytes);
         }
-
-        ret = compress_write(out->compr, buffer, bytes);
-        if (ret < 0)
-            ret = -errno;
+        blocked_ns = stats_now_ns() - io_start_ns;
         ALOGVV("%s: writing buffer (%d bytes) to compress device returned %d", __func__, bytes, ret);
         if (ret >= 0 && ret < (ssize_t)bytes) {
             send_offload_cmd_l(out, OFFLOAD_CMD_WAIT_FOR_BUFFER);
         } else if (-ENETRESET == ret) {
             ALOGE("copl %s: received sound card offline state on compress write", __func__);
             set_snd_card_state(adev,SND_CARD_STATE_OFFLINE);
+            out_ssr_snapshot_l(out);
+            stats_record_call_l(&out->stats, start_ns, blocked_ns, ret);
             pthread_mutex_unlock(&out->lock);
-            out_standby(&out->stream.common);
+            do_out_standby(out);
             return ret;
         }
-        if (!out->playback_started && ret >= 0) {
-            compress_start(out->compr);
-            out->playback_started = 1;
-            out->offload_state = OFFLOAD_STATE_PLAYING;
-        }
+        stats_record_call_l(&out->stats, start_ns, blocked_ns, ret);
         pthread_mutex_unlock(&out->lock);
         return ret;
     } else {
         if (out->pcm) {
-            if (out->muted)
-                memset((void *)buffer, 0, bytes);
+            const void *data = buffer;
+
+            if (out_has_sw_gain(out))
+                data = out_apply_sw_gain_l(out, buffer, bytes);
             ALOGVV("%s: writing buffer (%d bytes) to pcm device", __func__, bytes);
-            if (out->usecase == USECASE_AUDIO_PLAYBACK_AFE_PROXY)
-                ret = pcm_mmap_write(out->pcm, (void *)buffer, bytes);
+            io_start_ns = stats_now_ns();
+            stats_check_xrun_l(&out->stats, io_start_ns, &out->config);
+            if (out->usecase == USECASE_AUDIO_PLAYBACK_AFE_PROXY ||
+                    out->mmap_mode)
+                ret = pcm_mmap_write(out->pcm, (void *)data, bytes);
             else
-                ret = pcm_write(out->pcm, (void *)buffer, bytes);
+                ret = pcm_write(out->pcm, (void *)data, bytes);
+            out->stats.last_io_end_ns = stats_now_ns();
+            blocked_ns = out->stats.last_io_end_ns - io_start_ns;
             if (ret < 0)
                 ret = -errno;
-            else if (ret == 0)
+            else if (ret == 0) {
+                if (resuming)
+                    out->last_resume_us = (uint32_t)((out->stats.last_io_end_ns -
+                                                      start_ns) / 1000);
                 out->written += bytes / (out->config.channels * sizeof(short));
+                if (out->mmap_mode)
+                    out_update_mmap_latency_l(out,
+                            bytes / (out->config.channels * sizeof(short)));
+            }
         }
     }
 
@@ -2015,8 +3621,15 @@ exit:
        start/stop. Need to post different error to handle that. */
     if (-ENETRESET == ret) {
         set_snd_card_state(adev,SND_CARD_STATE_OFFLINE);
+        if (out->usecase != USECASE_COMPRESS_VOIP_CALL) {
+            out_ssr_snapshot_l(out);
+            silence_ns = ssr_consume_l(&out->ssr,
+                                       bytes / audio_stream_out_frame_size(stream),
+                                       out_get_sample_rate(&out->stream.common));
+        }
     }
 
+    stats_record_call_l(&out->stats, start_ns, blocked_ns, ret);
     pthread_mutex_unlock(&out->lock);
 
     if (ret != 0) {
@@ -2028,9 +3641,12 @@ exit:
             pthread_mutex_unlock(&adev->lock);
             out->standby = true;
         }
-        out_standby(&out->stream.common);
-        usleep(bytes * 1000000 / audio_stream_out_frame_size(stream) /
-                        out_get_sample_rate(&out->stream.common));
+        do_out_standby(out);
+        if (silence_ns)
+            ssr_sleep_until(silence_ns);
+        else
+            usleep(bytes * 1000000 / audio_stream_out_frame_size(stream) /
+                            out_get_sample_rate(&out->stream.common));
 
     }
     return bytes;
@@ -2040,7 +3656,7 @@ static int out_get_render_position(const struct audio_stream_out *stream,
                                    uint32_t *dsp_frames)
 {
     struct stream_out *out = (struct stream_out *)stream;
-    if ((out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) && (dsp_frames != NULL)) {
+    if (is_offload_usecase(out->usecase) && (dsp_frames != NULL)) {
         ssize_t ret = 0;
         *dsp_frames = 0;
         lock_output_stream(out);
@@ -2091,30 +3707,42 @@ static int out_get_presentation_position(const struct audio_stream_out *stream,
     struct stream_out *out = (struct stream_out *)stream;
     int ret = -1;
     unsigned long dsp_frames;
+    int64_t signed_frames;
 
     lock_output_stream(out);
 
-    if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+    if (is_offload_usecase(out->usecase)) {
         if (out->compr != NULL) {
             compress_get_tstamp(out->compr, &dsp_frames,
                     &out->sample_rate);
             ALOGVV("%s rendered frames %ld sample_rate %d",
                    __func__, dsp_frames, out->sample_rate);
-            *frames = dsp_frames;
-            ret = 0;
-            /* this is the best we can do */
+            /* the DSP position is coarse, the fit interpolates between updates */
             clock_gettime(CLOCK_MONOTONIC, timestamp);
+            signed_frames = pos_est_update(&out->pos_est, dsp_frames,
+                    (int64_t)timestamp->tv_sec * 1000000000LL + timestamp->tv_nsec,
+                    out->sample_rate);
+            signed_frames -= out->device_latency_us * (int64_t)out->sample_rate /
+                             1000000LL;
+            *frames = signed_frames > 0 ? signed_frames : 0;
+            ret = 0;
         }
     } else {
         if (out->pcm) {
             unsigned int avail;
             if (pcm_get_htimestamp(out->pcm, &avail, timestamp) == 0) {
                 size_t kernel_buffer_size = out->config.period_size * out->config.period_count;
-                int64_t signed_frames = out->written - kernel_buffer_size + avail;
+                signed_frames = out->written - kernel_buffer_size + avail;
+                if (signed_frames >= 0)
+                    signed_frames = pos_est_update(&out->pos_est, signed_frames,
+                            (int64_t)timestamp->tv_sec * 1000000000LL +
+                            timestamp->tv_nsec, out->sample_rate);
                 // This adjustment accounts for buffering after app processor.
-                // It is based on estimated DSP latency per use case, rather than exact.
+                // It is based on estimated DSP latency per use case and the
+                // latency configured or calibrated for the device.
                 signed_frames -=
-                    (platform_render_latency(out->usecase) * out->sample_rate / 1000000LL);
+                    ((platform_render_latency(out->usecase) + out->device_latency_us) *
+                     out->sample_rate / 1000000LL);
 
                 // It would be unusual for this value to be negative, but check just in case ...
                 if (signed_frames >= 0) {
@@ -2148,16 +3776,19 @@ static int out_pause(struct audio_stream_out* stream)
     struct stream_out *out = (struct stream_out *)stream;
     int status = -ENOSYS;
     ALOGV("%s", __func__);
-    if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+    if (is_offload_usecase(out->usecase)) {
         lock_output_stream(out);
         if (out->compr != NULL && out->offload_state == OFFLOAD_STATE_PLAYING) {
             struct audio_device *adev = out->dev;
             int snd_scard_state = get_snd_card_state(adev);
 
-            if (SND_CARD_STATE_ONLINE == snd_scard_state)
+            if (SND_CARD_STATE_ONLINE == snd_scard_state) {
+                offload_coalesce_flush_l(out, false);
                 status = compress_pause(out->compr);
+            }
 
             out->offload_state = OFFLOAD_STATE_PAUSED;
+            pos_est_reset(&out->pos_est);
         }
         pthread_mutex_unlock(&out->lock);
     }
@@ -2169,7 +3800,7 @@ static int out_resume(struct audio_stream_out* stream)
     struct stream_out *out = (struct stream_out *)stream;
     int status = -ENOSYS;
     ALOGV("%s", __func__);
-    if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+    if (is_offload_usecase(out->usecase)) {
         status = 0;
         lock_output_stream(out);
         if (out->compr != NULL && out->offload_state == OFFLOAD_STATE_PAUSED) {
@@ -2180,6 +3811,10 @@ static int out_resume(struct audio_stream_out* stream)
                 status = compress_resume(out->compr);
 
             out->offload_state = OFFLOAD_STATE_PLAYING;
+            pos_est_reset(&out->pos_est);
+            /* the offload thread does not time held bytes while paused */
+            if (out->coalesce.fill > 0)
+                offload_coalesce_arm_l(out);
         }
         pthread_mutex_unlock(&out->lock);
     }
@@ -2191,7 +3826,7 @@ static int out_drain(struct audio_stream_out* stream, audio_drain_type_t type )
     struct stream_out *out = (struct stream_out *)stream;
     int status = -ENOSYS;
     ALOGV("%s", __func__);
-    if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+    if (is_offload_usecase(out->usecase)) {
         lock_output_stream(out);
         if (type == AUDIO_DRAIN_EARLY_NOTIFY)
             status = send_offload_cmd_l(out, OFFLOAD_CMD_PARTIAL_DRAIN);
@@ -2206,9 +3841,10 @@ static int out_flush(struct audio_stream_out* stream)
 {
     struct stream_out *out = (struct stream_out *)stream;
     ALOGV("%s", __func__);
-    if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+    if (is_offload_usecase(out->usecase)) {
         lock_output_stream(out);
         stop_compressed_output_l(out);
+        pos_est_reset(&out->pos_est);
         pthread_mutex_unlock(&out->lock);
         return 0;
     }
@@ -2262,9 +3898,222 @@ static int in_set_format(struct audio_stream *stream __unused,
     return -ENOSYS;
 }
 
-static int in_standby(struct audio_stream *stream)
+static bool in_uses_capture_engine(const struct stream_in *in)
 {
-    struct stream_in *in = (struct stream_in *)stream;
+    if (!capture_engine_enabled)
+        return false;
+    /* these read the PCM themselves, in their own block sizes */
+    if (audio_extn_ssr_get_enabled() &&
+            audio_channel_count_from_in_mask(in->channel_mask) == 6)
+        return false;
+    return !audio_extn_compr_cap_usecase_supported(in->usecase) &&
+           in->usecase != USECASE_AUDIO_RECORD_AFE_PROXY &&
+           in->usecase != USECASE_COMPRESS_VOIP_CALL;
+}
+
+static void capture_engine_publish_position(struct capture_engine *eng,
+                                            int64_t frames, int64_t time_ns)
+{
+    eng->pos_seq++;
+    android_memory_barrier();
+    eng->pos_frames = frames;
+    eng->pos_time_ns = time_ns;
+    android_atomic_release_store(eng->pos_seq + 1, &eng->pos_seq);
+}
+
+static void *capture_thread_loop(void *context)
+{
+    struct stream_in *in = (struct stream_in *)context;
+    struct capture_engine *eng = &in->engine;
+    const uint32_t period = in->config.period_size;
+    struct sched_param param = { .sched_priority = CAPTURE_THREAD_PRIORITY };
+    int64_t delivered = 0, pulled = 0, hw_frames, last_hw_frames = -1;
+    int64_t time_ns, last_time_ns = 0, gap;
+    uint64_t event = 1;
+    struct timespec ts;
+    unsigned int avail;
+    uint32_t used;
+    char *dst;
+    int ret;
+
+    if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+        ALOGW("%s: no realtime priority: %s", __func__, strerror(errno));
+        setpriority(PRIO_PROCESS, 0, ANDROID_PRIORITY_URGENT_AUDIO);
+    }
+    prctl(PR_SET_NAME, (unsigned long)"Capture Engine", 0, 0, 0);
+
+    while (!android_atomic_acquire_load(&eng->exit)) {
+        used = (uint32_t)(eng->write_pos - android_atomic_acquire_load(&eng->read_pos));
+        if (used + period <= eng->ring_frames)
+            dst = eng->ring + (size_t)eng->write_offset * eng->frame_size;
+        else
+            dst = eng->scratch;
+
+        ret = pcm_read(in->pcm, dst, period * eng->frame_size);
+        if (ret != 0) {
+            if (!android_atomic_acquire_load(&eng->exit)) {
+                ALOGE("%s: %s", __func__, pcm_get_error(in->pcm));
+                android_atomic_release_store(errno ? -errno : -EIO, &eng->error);
+            }
+            break;
+        }
+
+        pulled += period;
+        if (dst == eng->scratch) {
+            /* the client fell a whole ring behind */
+            android_atomic_inc(&eng->overruns);
+            android_atomic_add(period, &eng->frames_lost);
+        } else {
+            delivered += period;
+            eng->write_offset = (eng->write_offset + period) % eng->ring_frames;
+            android_atomic_release_store(eng->write_pos + period, &eng->write_pos);
+        }
+
+        if (pcm_get_htimestamp(in->pcm, &avail, &ts) == 0) {
+            time_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+            hw_frames = pulled + avail;
+            /* tinyalsa restarts after a driver overrun without telling,
+             * the hardware position then falls behind the clock */
+            if (last_hw_frames >= 0) {
+                gap = (time_ns - last_time_ns) * in->config.rate / 1000000000LL -
+                      (hw_frames - last_hw_frames);
+                if (gap > period / 2) {
+                    android_atomic_inc(&eng->overruns);
+                    android_atomic_add((int32_t)gap, &eng->frames_lost);
+                }
+            }
+            last_hw_frames = hw_frames;
+            last_time_ns = time_ns;
+            capture_engine_publish_position(eng, eng->frames_base + delivered + avail,
+                                            time_ns);
+        }
+
+        if (write(eng->event_fd, &event, sizeof(event)) < 0)
+            ALOGE("%s: failed to wake reader: %s", __func__, strerror(errno));
+    }
+
+    /* wake a reader waiting for a period that will not come */
+    if (write(eng->event_fd, &event, sizeof(event)) < 0)
+        ALOGE("%s: failed to wake reader: %s", __func__, strerror(errno));
+    return NULL;
+}
+
+/* must be called with the stream lock held, after the PCM is opened */
+static int capture_engine_start(struct stream_in *in)
+{
+    struct capture_engine *eng = &in->engine;
+    int ret;
+
+    eng->frame_size = pcm_frames_to_bytes(in->pcm, 1);
+    eng->ring_frames = in->config.period_size * CAPTURE_RING_PERIODS;
+    eng->ring = (char *)malloc((size_t)eng->ring_frames * eng->frame_size);
+    eng->scratch = (char *)malloc((size_t)in->config.period_size * eng->frame_size);
+    eng->event_fd = eventfd(0, EFD_CLOEXEC);
+    if (eng->ring == NULL || eng->scratch == NULL || eng->event_fd < 0) {
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    eng->exit = 0;
+    eng->error = 0;
+    eng->write_offset = 0;
+    eng->read_offset = 0;
+    eng->write_pos = 0;
+    eng->read_pos = 0;
+    eng->pos_time_ns = 0;
+    eng->frames_base = in->frames_read;
+
+    ret = -pthread_create(&eng->thread, (const pthread_attr_t *) NULL,
+                          capture_thread_loop, in);
+    if (ret != 0)
+        goto error;
+    eng->running = true;
+    return 0;
+
+error:
+    if (eng->event_fd >= 0)
+        close(eng->event_fd);
+    eng->event_fd = -1;
+    free(eng->ring);
+    free(eng->scratch);
+    eng->ring = NULL;
+    eng->scratch = NULL;
+    return ret;
+}
+
+/* must be called with the stream lock held, before the PCM is closed */
+static void capture_engine_stop(struct stream_in *in)
+{
+    struct capture_engine *eng = &in->engine;
+
+    if (!eng->running)
+        return;
+
+    android_atomic_release_store(1, &eng->exit);
+    /* abort the read in progress rather than wait for the period */
+    pcm_stop(in->pcm);
+    pthread_join(eng->thread, (void **) NULL);
+
+    close(eng->event_fd);
+    eng->event_fd = -1;
+    free(eng->ring);
+    free(eng->scratch);
+    eng->ring = NULL;
+    eng->scratch = NULL;
+    eng->running = false;
+}
+
+/* must be called with the stream lock held, blocks until bytes are read */
+static int capture_engine_read(struct stream_in *in, void *buffer, size_t bytes)
+{
+    struct capture_engine *eng = &in->engine;
+    uint32_t frames = bytes / eng->frame_size;
+    uint32_t avail, chunk;
+    char *dst = (char *)buffer;
+    uint64_t events;
+    int32_t error;
+
+    while (frames > 0) {
+        avail = (uint32_t)(android_atomic_acquire_load(&eng->write_pos) - eng->read_pos);
+        if (avail == 0) {
+            error = android_atomic_acquire_load(&eng->error);
+            if (error != 0)
+                return error;
+            /* the eventfd counter latches periods posted since the check */
+            if (read(eng->event_fd, &events, sizeof(events)) < 0 && errno != EINTR)
+                return -errno;
+            continue;
+        }
+
+        chunk = avail < frames ? avail : frames;
+        if (chunk > eng->ring_frames - eng->read_offset)
+            chunk = eng->ring_frames - eng->read_offset;
+        memcpy(dst, eng->ring + (size_t)eng->read_offset * eng->frame_size,
+               (size_t)chunk * eng->frame_size);
+        dst += (size_t)chunk * eng->frame_size;
+        frames -= chunk;
+        eng->read_offset = (eng->read_offset + chunk) % eng->ring_frames;
+        android_atomic_release_store(eng->read_pos + chunk, &eng->read_pos);
+    }
+    return 0;
+}
+
+/* must be called with the stream lock held */
+static void capture_engine_count_overruns_l(struct stream_in *in)
+{
+    int32_t overruns = android_atomic_acquire_load(&in->engine.overruns);
+
+    if (overruns == in->engine.overruns_reported)
+        return;
+    stats_begin_update_l(&in->stats);
+    in->stats.xruns += overruns - in->engine.overruns_reported;
+    stats_end_update_l(&in->stats);
+    in->engine.overruns_reported = overruns;
+}
+
+static int do_in_standby(struct stream_in *in)
+{
+    struct audio_stream *stream = &in->stream.common;
     struct audio_device *adev = in->dev;
     int status = 0;
     ALOGD("%s: enter: stream (%p) usecase(%d: %s)", __func__,
@@ -2280,11 +4129,14 @@ static int in_standby(struct audio_stream *stream)
 
     lock_input_stream(in);
     if (!in->standby) {
+        /* joins the capture thread, no need to hold up routing meanwhile */
+        capture_engine_stop(in);
         pthread_mutex_lock(&adev->lock);
 
         amplifier_input_stream_standby((struct audio_stream_in *) stream);
 
         in->standby = true;
+        stats_count_standby_l(&in->stats);
         if (in->pcm) {
             pcm_close(in->pcm);
             in->pcm = NULL;
@@ -2298,9 +4150,32 @@ static int in_standby(struct audio_stream *stream)
     return status;
 }
 
-static int in_dump(const struct audio_stream *stream __unused,
-                   int fd __unused)
+static int in_standby(struct audio_stream *stream)
+{
+    struct stream_in *in = (struct stream_in *)stream;
+    int status = do_in_standby(in);
+
+    /* the client is done with it, do not bring it back after SSR */
+    lock_input_stream(in);
+    in->ssr.pending = false;
+    pthread_mutex_unlock(&in->lock);
+    return status;
+}
+
+static int in_dump(const struct audio_stream *stream, int fd)
 {
+    struct stream_in *in = (struct stream_in *)stream;
+
+    dprintf(fd, "  Input stream %p, usecase %s:\n", in,
+            use_case_table[in->usecase]);
+    stats_dump(fd, "    ", &in->stats);
+    if (in->engine.running)
+        dprintf(fd, "    capture engine ring %u frames, %d overruns\n",
+                in->engine.ring_frames,
+                android_atomic_acquire_load(&in->engine.overruns));
+    dprintf(fd, "    SSR restarts %u, last took %u us%s\n",
+            in->ssr.recoveries, in->ssr.last_recovery_us,
+            in->ssr.pending ? ", pending" : "");
     return 0;
 }
 
@@ -2378,6 +4253,12 @@ static char* in_get_parameters(const struct audio_stream *stream,
 
     ALOGV("%s: enter: keys - %s", __func__, keys);
 
+    if (str_parms_get_str(query, AUDIO_PARAMETER_KEY_HAL_STATS, value,
+                          sizeof(value)) >= 0) {
+        stats_to_str(&in->stats, value, sizeof(value));
+        str_parms_add_str(reply, AUDIO_PARAMETER_KEY_HAL_STATS, value);
+    }
+
     voice_extn_in_get_parameters(in, query, reply);
 
     str = str_parms_to_str(reply);
@@ -2394,6 +4275,58 @@ static int in_set_gain(struct audio_stream_in *stream __unused,
     return 0;
 }
 
+/* must be called with adev->lock held */
+static bool in_owns_usecase_l(struct stream_in *in)
+{
+    struct audio_usecase *usecase = get_usecase_from_list(in->dev, in->usecase);
+
+    return usecase != NULL && usecase->stream.in == in;
+}
+
+/* must be called with in->lock held and the stream in standby */
+static int in_resume_l(struct stream_in *in)
+{
+    struct audio_device *adev = in->dev;
+    bool open_pcm = false;
+    int ret;
+
+    pthread_mutex_lock(&adev->lock);
+    if (in->usecase == USECASE_COMPRESS_VOIP_CALL) {
+        ret = voice_extn_compress_voip_start_input_stream(in);
+    } else {
+        ret = start_input_stream(in);
+        /*
+         * Not when the usecase belongs to another stream. Decided here as
+         * adev->active_input can change as soon as adev->lock is dropped,
+         * while the usecase is only removed with in->lock, which is held.
+         */
+        open_pcm = ret == 0 && in_owns_usecase_l(in);
+    }
+    pthread_mutex_unlock(&adev->lock);
+
+    if (open_pcm) {
+        ret = open_input_pcm(in);
+        if (ret != 0) {
+            pthread_mutex_lock(&adev->lock);
+            stop_input_stream(in);
+            pthread_mutex_unlock(&adev->lock);
+        }
+    }
+    if (ret == 0) {
+        pthread_mutex_lock(&adev->lock);
+        amplifier_input_stream_start(&in->stream);
+        pthread_mutex_unlock(&adev->lock);
+    }
+    if (ret != 0)
+        return ret;
+    in->standby = 0;
+    in->ssr.pending = false;
+    stats_count_resume_l(&in->stats);
+    if (in->pcm && in_uses_capture_engine(in) && capture_engine_start(in) != 0)
+        ALOGW("%s: capture engine unavailable, reading directly", __func__);
+    return 0;
+}
+
 static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
                        size_t bytes)
 {
@@ -2401,46 +4334,44 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
     struct audio_device *adev = in->dev;
     int i, ret = -1;
     int snd_scard_state = get_snd_card_state(adev);
+    int64_t start_ns = stats_now_ns();
+    int64_t io_start_ns, blocked_ns = 0;
+    int64_t silence_ns = 0;
 
     lock_input_stream(in);
 
-    if (in->pcm) {
-        if(SND_CARD_STATE_OFFLINE == snd_scard_state) {
-            ALOGD(" %s: sound card is not active/SSR state", __func__);
-            ret= -ENETRESET;
-            goto exit;
-        }
+    if (SND_CARD_STATE_OFFLINE == snd_scard_state) {
+        ret = -ENETRESET;
+        goto exit;
     }
 
     if (in->standby) {
-        pthread_mutex_lock(&adev->lock);
-        if (in->usecase == USECASE_COMPRESS_VOIP_CALL)
-            ret = voice_extn_compress_voip_start_input_stream(in);
-        else
-            ret = start_input_stream(in);
-
-        if (ret == 0)
-            amplifier_input_stream_start(stream);
-
-        pthread_mutex_unlock(&adev->lock);
-        if (ret != 0) {
+        ret = in_resume_l(in);
+        if (ret != 0)
             goto exit;
-        }
-        in->standby = 0;
     }
 
     if (in->pcm) {
-        if (audio_extn_ssr_get_enabled() &&
-                audio_channel_count_from_in_mask(in->channel_mask) == 6)
-            ret = audio_extn_ssr_read(stream, buffer, bytes);
-        else if (audio_extn_compr_cap_usecase_supported(in->usecase))
-            ret = audio_extn_compr_cap_read(in, buffer, bytes);
-        else if (in->usecase == USECASE_AUDIO_RECORD_AFE_PROXY)
-            ret = pcm_mmap_read(in->pcm, buffer, bytes);
-        else
-            ret = pcm_read(in->pcm, buffer, bytes);
-        if (ret < 0)
-            ret = -errno;
+        io_start_ns = stats_now_ns();
+        if (in->engine.running) {
+            capture_engine_count_overruns_l(in);
+            ret = capture_engine_read(in, buffer, bytes);
+        } else {
+            stats_check_xrun_l(&in->stats, io_start_ns, &in->config);
+            if (audio_extn_ssr_get_enabled() &&
+                    audio_channel_count_from_in_mask(in->channel_mask) == 6)
+                ret = audio_extn_ssr_read(stream, buffer, bytes);
+            else if (audio_extn_compr_cap_usecase_supported(in->usecase))
+                ret = audio_extn_compr_cap_read(in, buffer, bytes);
+            else if (in->usecase == USECASE_AUDIO_RECORD_AFE_PROXY)
+                ret = pcm_mmap_read(in->pcm, buffer, bytes);
+            else
+                ret = pcm_read(in->pcm, buffer, bytes);
+            if (ret < 0)
+                ret = -errno;
+        }
+        in->stats.last_io_end_ns = stats_now_ns();
+        blocked_ns = in->stats.last_io_end_ns - io_start_ns;
     }
 
     /*
@@ -2457,7 +4388,14 @@ exit:
     if (-ENETRESET == ret) {
         set_snd_card_state(adev,SND_CARD_STATE_OFFLINE);
         memset(buffer, 0, bytes);
+        if (in->usecase != USECASE_COMPRESS_VOIP_CALL) {
+            in_ssr_snapshot_l(in);
+            silence_ns = ssr_consume_l(&in->ssr,
+                                       bytes / audio_stream_in_frame_size(stream),
+                                       in_get_sample_rate(&in->stream.common));
+        }
     }
+    stats_record_call_l(&in->stats, start_ns, blocked_ns, ret);
     pthread_mutex_unlock(&in->lock);
 
     if (ret != 0) {
@@ -2467,19 +4405,28 @@ exit:
             pthread_mutex_unlock(&adev->lock);
             in->standby = true;
         }
-        in_standby(&in->stream.common);
-        ALOGV("%s: read failed - sleeping for buffer duration", __func__);
-        usleep(bytes * 1000000 / audio_stream_in_frame_size(stream) /
-                                   in_get_sample_rate(&in->stream.common));
+        do_in_standby(in);
+        if (silence_ns) {
+            ssr_sleep_until(silence_ns);
+        } else {
+            ALOGV("%s: read failed - sleeping for buffer duration", __func__);
+            usleep(bytes * 1000000 / audio_stream_in_frame_size(stream) /
+                                       in_get_sample_rate(&in->stream.common));
+        }
     } else {
         in->frames_read += bytes / audio_stream_in_frame_size(stream);
     }
     return bytes;
 }
 
-static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream __unused)
+static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
 {
-    return 0;
+    struct stream_in *in = (struct stream_in *)stream;
+    int32_t lost = android_atomic_acquire_load(&in->engine.frames_lost);
+
+    /* frames lost meanwhile are left for the next call */
+    android_atomic_add(-lost, &in->engine.frames_lost);
+    return lost;
 }
 
 static int in_get_capture_position(const struct audio_stream_in *stream,
@@ -2492,7 +4439,23 @@ static int in_get_capture_position(const struct audio_stream_in *stream,
     int ret = -ENOSYS;
 
     lock_input_stream(in);
-    if (in->pcm) {
+    if (in->engine.running) {
+        struct capture_engine *eng = &in->engine;
+        int64_t pos_frames, pos_time_ns;
+        int32_t seq;
+
+        do {
+            seq = android_atomic_acquire_load(&eng->pos_seq);
+            pos_frames = eng->pos_frames;
+            pos_time_ns = eng->pos_time_ns;
+            android_memory_barrier();
+        } while ((seq & 1) || seq != eng->pos_seq);
+        if (pos_time_ns != 0) {
+            *frames = pos_frames;
+            *time = pos_time_ns;
+            ret = 0;
+        }
+    } else if (in->pcm) {
         struct timespec timestamp;
         unsigned int avail;
         if (pcm_get_htimestamp(in->pcm, &avail, &timestamp) == 0) {
@@ -2563,6 +4526,191 @@ static int in_remove_audio_effect(const struct audio_stream *stream,
     return add_remove_audio_effect(stream, effect, false);
 }
 
+/*
+ * -EALREADY when the client restarted the stream, or put it in standby,
+ * before the worker got to it. -EAGAIN when the client went idle: the
+ * stream stays pending and its next write restarts it.
+ */
+static int out_ssr_restart(struct stream_out *out)
+{
+    int ret = -EALREADY;
+
+    lock_output_stream(out);
+    if (out->ssr.pending && out->standby && !ssr_client_active_l(&out->ssr)) {
+        ret = -EAGAIN;
+    } else {
+        if (out->ssr.pending && out->standby)
+            ret = out_resume_l(out);
+        out->ssr.pending = false;
+    }
+    pthread_mutex_unlock(&out->lock);
+    return ret;
+}
+
+static int in_ssr_restart(struct stream_in *in)
+{
+    int ret = -EALREADY;
+
+    lock_input_stream(in);
+    if (in->ssr.pending && in->standby && !ssr_client_active_l(&in->ssr)) {
+        ret = -EAGAIN;
+    } else {
+        if (in->ssr.pending && in->standby)
+            ret = in_resume_l(in);
+        in->ssr.pending = false;
+    }
+    pthread_mutex_unlock(&in->lock);
+    return ret;
+}
+
+struct ssr_worker {
+    struct ssr_snapshot *ssr;
+    int64_t start_ns;
+    pthread_t thread;
+    bool started;
+    bool restarted;
+};
+
+static void *ssr_worker_loop(void *context)
+{
+    struct ssr_worker *worker = (struct ssr_worker *)context;
+    struct ssr_snapshot *ssr = worker->ssr;
+    int ret;
+
+    if (ssr->input)
+        ret = in_ssr_restart((struct stream_in *)ssr->stream);
+    else
+        ret = out_ssr_restart((struct stream_out *)ssr->stream);
+
+    if (ret == -EALREADY)
+        return NULL;
+    if (ret == -EAGAIN) {
+        ALOGD("%s: %s %p is idle, left for its client", __func__,
+              ssr->input ? "input" : "output", ssr->stream);
+        return NULL;
+    }
+    if (ret != 0) {
+        ALOGW("%s: cannot restart %s %p: %d, left for its client", __func__,
+              ssr->input ? "input" : "output", ssr->stream, ret);
+        return NULL;
+    }
+    worker->restarted = true;
+    ssr->recoveries++;
+    ssr->last_recovery_us = (uint32_t)((stats_now_ns() - worker->start_ns) / 1000);
+    ALOGI("%s: %s %p restarted in %u us", __func__,
+          ssr->input ? "input" : "output", ssr->stream, ssr->last_recovery_us);
+    return NULL;
+}
+
+/* restarts the streams seen while the card was offline, all at once */
+static void ssr_recover_l(struct audio_device *adev)
+{
+    struct ssr_worker *workers;
+    struct ssr_snapshot *ssr;
+    struct listnode *node;
+    int64_t start_ns;
+    size_t i, count = 0, restarted = 0;
+
+    list_for_each(node, &adev->ssr.streams)
+        count++;
+    workers = (struct ssr_worker *)calloc(count, sizeof(struct ssr_worker));
+    if (!workers) {
+        ALOGE("%s: cannot allocate workers, streams restart on first use",
+              __func__);
+        while (!list_empty(&adev->ssr.streams)) {
+            node = list_head(&adev->ssr.streams);
+            list_remove(node);
+            list_init(node);
+        }
+        return;
+    }
+
+    start_ns = adev->ssr.online_ns;
+    for (i = 0; i < count; i++) {
+        node = list_head(&adev->ssr.streams);
+        list_remove(node);
+        list_init(node);
+        ssr = node_to_item(node, struct ssr_snapshot, node);
+        ssr->recovering = true;
+        workers[i].ssr = ssr;
+        /* streams that saw the card offline after it came back */
+        workers[i].start_ns = ssr->offline_ns > start_ns ? ssr->offline_ns : start_ns;
+    }
+    pthread_mutex_unlock(&adev->lock);
+
+    /* routing is serialized by adev->lock, PCMs are opened in parallel */
+    for (i = 0; i < count; i++)
+        workers[i].started = pthread_create(&workers[i].thread,
+                                            (const pthread_attr_t *) NULL,
+                                            ssr_worker_loop, &workers[i]) == 0;
+    for (i = 0; i < count; i++) {
+        if (workers[i].started)
+            pthread_join(workers[i].thread, (void **) NULL);
+        else
+            ssr_worker_loop(&workers[i]);
+    }
+
+    pthread_mutex_lock(&adev->lock);
+    for (i = 0; i < count; i++) {
+        workers[i].ssr->recovering = false;
+        restarted += workers[i].restarted;
+    }
+    adev->ssr.recoveries++;
+    adev->ssr.last_recovery_us = (uint32_t)((stats_now_ns() - start_ns) / 1000);
+    ALOGI("%s: %zu of %zu streams restarted in %u us", __func__, restarted,
+          count, adev->ssr.last_recovery_us);
+    pthread_cond_broadcast(&adev->ssr.cond);
+    free(workers);
+}
+
+static void *ssr_recovery_thread_loop(void *context)
+{
+    struct audio_device *adev = (struct audio_device *)context;
+
+    setpriority(PRIO_PROCESS, 0, ANDROID_PRIORITY_AUDIO);
+    set_sched_policy(0, SP_FOREGROUND);
+    prctl(PR_SET_NAME, (unsigned long)"SSR Recovery", 0, 0, 0);
+
+    pthread_mutex_lock(&adev->lock);
+    while (!adev->ssr.exit) {
+        if (!list_empty(&adev->ssr.streams) &&
+                SND_CARD_STATE_ONLINE == get_snd_card_state(adev))
+            ssr_recover_l(adev);
+        else
+            pthread_cond_wait(&adev->ssr.cond, &adev->lock);
+    }
+    pthread_mutex_unlock(&adev->lock);
+    return NULL;
+}
+
+static void ssr_recovery_init(struct audio_device *adev)
+{
+    list_init(&adev->ssr.streams);
+    pthread_cond_init(&adev->ssr.cond, (const pthread_condattr_t *) NULL);
+
+    adev->ssr.exit = false;
+    if (pthread_create(&adev->ssr.thread, (const pthread_attr_t *) NULL,
+                       ssr_recovery_thread_loop, adev) != 0) {
+        ALOGE("%s: no SSR recovery thread, streams restart on first use",
+              __func__);
+        return;
+    }
+    adev->ssr.running = true;
+}
+
+static void ssr_recovery_deinit(struct audio_device *adev)
+{
+    if (adev->ssr.running) {
+        pthread_mutex_lock(&adev->lock);
+        adev->ssr.exit = true;
+        pthread_cond_broadcast(&adev->ssr.cond);
+        pthread_mutex_unlock(&adev->lock);
+        pthread_join(adev->ssr.thread, (void **) NULL);
+        adev->ssr.running = false;
+    }
+    pthread_cond_destroy(&adev->ssr.cond);
+}
+
 static int adev_open_output_stream(struct audio_hw_device *dev,
                                    audio_io_handle_t handle,
                                    audio_devices_t devices,
@@ -2595,7 +4743,15 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     }
 
     pthread_mutex_init(&out->lock, (const pthread_mutexattr_t *) NULL);
+    pthread_mutex_init(&out->pre_lock, (const pthread_mutexattr_t *) NULL);
     pthread_cond_init(&out->cond, (const pthread_condattr_t *) NULL);
+    lock_debug_register(&out->pre_lock, LOCK_RANK_STREAM_PRE, "out->pre_lock");
+    lock_debug_register(&out->lock, LOCK_RANK_STREAM, "out->lock");
+    list_init(&out->warm_node);
+    out->volume_l = -1.0f;
+    out->volume_r = -1.0f;
+    out->ssr.stream = out;
+    list_init(&out->ssr.node);
 
     if (devices == AUDIO_DEVICE_NONE)
         devices = AUDIO_DEVICE_OUT_SPEAKER;
@@ -2676,7 +4832,14 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
             goto error_open;
         }
 
-        out->usecase = USECASE_AUDIO_PLAYBACK_OFFLOAD;
+        pthread_mutex_lock(&adev->lock);
+        out->usecase = get_offload_usecase_l(adev);
+        pthread_mutex_unlock(&adev->lock);
+        if (out->usecase == USECASE_INVALID) {
+            ALOGE("%s: no free offload session", __func__);
+            ret = -EEXIST;
+            goto error_open;
+        }
         if (config->offload_info.channel_mask)
             out->channel_mask = config->offload_info.channel_mask;
         else if (config->channel_mask) {
@@ -2699,16 +4862,8 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
         else
             out->compr_config.codec->id =
                 get_snd_codec_id(config->offload_info.format);
-#ifdef EXTN_OFFLOAD_ENABLED
-        if (audio_is_offload_pcm(config->offload_info.format)) {
-            out->compr_config.fragment_size =
-                       platform_get_pcm_offload_buffer_size(&config->offload_info);
-        } else
-#endif
-        {
-            out->compr_config.fragment_size =
-                       platform_get_compress_offload_buffer_size(&config->offload_info);
-        }
+        out->compr_config.fragment_size =
+                   platform_get_compress_offload_buffer_size(&config->offload_info);
         out->compr_config.fragments = COMPRESS_OFFLOAD_NUM_FRAGMENTS;
         out->compr_config.codec->sample_rate =
                     compress_get_alsa_rate(config->offload_info.sample_rate);
@@ -2719,12 +4874,12 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
         out->compr_config.codec->ch_out = out->compr_config.codec->ch_in;
         out->compr_config.codec->format = SND_AUDIOSTREAMFORMAT_RAW;
 
-#ifdef EXTN_OFFLOAD_ENABLED
-        if (config->offload_info.format == AUDIO_FORMAT_PCM_16_BIT_OFFLOAD)
-            out->compr_config.codec->format = SNDRV_PCM_FORMAT_S16_LE;
-        else if(config->offload_info.format == AUDIO_FORMAT_PCM_24_BIT_OFFLOAD)
-            out->compr_config.codec->format = SNDRV_PCM_FORMAT_S24_LE;
-#endif
+        /* PCM sizes fragments, sample format and channels for the DSP side */
+        if (audio_extn_pcm_offload_is_supported(config->offload_info.format)) {
+            ret = audio_extn_pcm_offload_init(out, &config->offload_info);
+            if (ret != 0)
+                goto error_open;
+        }
 
         if (flags & AUDIO_OUTPUT_FLAG_NON_BLOCKING)
             out->non_blocking = 1;
@@ -2733,7 +4888,9 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
         out->offload_state = OFFLOAD_STATE_IDLE;
         out->playback_started = 0;
 
-        create_offload_callback_thread(out);
+        ret = create_offload_callback_thread(out);
+        if (ret != 0)
+            goto error_open;
         ALOGV("%s: offloaded output offload_info version %04x bit rate %d",
                 __func__, config->offload_info.version,
                 config->offload_info.bit_rate);
@@ -2773,7 +4930,11 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
         adev->voice_tx_output = out;
     } else if (out->flags & AUDIO_OUTPUT_FLAG_FAST) {
         out->usecase = USECASE_AUDIO_PLAYBACK_LOW_LATENCY;
-        out->config = pcm_config_low_latency;
+        if (low_latency_mmap_enabled) {
+            out->mmap_mode = true;
+            out->config = pcm_config_low_latency_mmap;
+        } else
+            out->config = pcm_config_low_latency;
         out->sample_rate = out->config.rate;
     } else if (out->flags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER) {
         out->usecase = USECASE_AUDIO_PLAYBACK_DEEP_BUFFER;
@@ -2807,6 +4968,7 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
         ret = -EEXIST;
         goto error_open;
     }
+    audio_extn_period_tuner_open(adev, out);
     pthread_mutex_unlock(&adev->lock);
 
     out->stream.common.get_sample_rate = out_get_sample_rate;
@@ -2829,7 +4991,8 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     out->stream.get_presentation_position = out_get_presentation_position;
 
     out->standby = 1;
-    /* out->muted = false; by calloc() */
+    out->sw_gain = SW_GAIN_UNITY;
+    out->sw_gain_target = SW_GAIN_UNITY;
     /* out->written = 0; by calloc() */
 
     config->format = out->stream.common.get_format(&out->stream.common);
@@ -2843,6 +5006,15 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     return 0;
 
 error_open:
+    if (is_offload_usecase(out->usecase)) {
+        pthread_mutex_lock(&adev->lock);
+        free_offload_usecase_l(adev, out->usecase);
+        pthread_mutex_unlock(&adev->lock);
+    }
+    free(out->compr_config.codec);
+    free(out->pcm_conv.buf);
+    lock_debug_unregister(&out->lock);
+    lock_debug_unregister(&out->pre_lock);
     free(out);
     *stream_out = NULL;
     ALOGD("%s: exit: ret %d", __func__, ret);
@@ -2858,6 +5030,7 @@ static void adev_close_output_stream(struct audio_hw_device *dev __unused,
 
     ALOGD("%s: enter:stream_handle(%p)",__func__, out);
 
+    ssr_forget(adev, &out->ssr);
     if (out->usecase == USECASE_COMPRESS_VOIP_CALL) {
         pthread_mutex_lock(&adev->lock);
         ret = voice_extn_compress_voip_close_output_stream(&stream->common);
@@ -2865,91 +5038,145 @@ static void adev_close_output_stream(struct audio_hw_device *dev __unused,
         if(ret != 0)
             ALOGE("%s: Compress voip output cannot be closed, error:%d",
                   __func__, ret);
-    } else
+    } else {
+        pthread_mutex_lock(&adev->lock);
+        list_remove(&out->warm_node);
+        list_init(&out->warm_node);
+        pthread_mutex_unlock(&adev->lock);
         out_standby(&stream->common);
 
-    if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+        lock_output_stream(out);
+        pthread_mutex_lock(&adev->lock);
+        out_cool_down_l(out);
+        pthread_mutex_unlock(&adev->lock);
+        pthread_mutex_unlock(&out->lock);
+    }
+
+    if (is_offload_usecase(out->usecase)) {
         destroy_offload_callback_thread(out);
 
         if (out->compr_config.codec != NULL)
             free(out->compr_config.codec);
+
+        pthread_mutex_lock(&adev->lock);
+        free_offload_usecase_l(adev, out->usecase);
+        pthread_mutex_unlock(&adev->lock);
     }
+    free(out->sw_gain_buf);
+    free(out->pcm_conv.buf);
+    free(out->coalesce.buf);
+    lock_debug_unregister(&out->lock);
+    lock_debug_unregister(&out->pre_lock);
     pthread_cond_destroy(&out->cond);
     pthread_mutex_destroy(&out->lock);
     free(stream);
     ALOGV("%s: exit", __func__);
 }
 
-static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
+static int adev_set_snd_card_status(struct audio_device *adev,
+                                    struct str_parms *parms)
 {
-    struct audio_device *adev = (struct audio_device *)dev;
-    struct str_parms *parms;
-    char *str;
     char value[32];
-    int val;
     int ret;
-    int status = 0;
-
-    ALOGD("%s: enter: %s", __func__, kvpairs);
-    parms = str_parms_create_str(kvpairs);
 
-    if (!parms)
-        goto error;
-    ret = str_parms_get_str(parms, "SND_CARD_STATUS", value, sizeof(value));
+    ret = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_SND_CARD_STATUS,
+                            value, sizeof(value));
     if (ret >= 0) {
         char *snd_card_status = value+2;
         if (strstr(snd_card_status, "OFFLINE")) {
-            struct listnode *node;
             struct audio_usecase *usecase;
+            struct stream_out *out;
+            usecase_mask_t offload;
+            audio_usecase_t uc_id;
 
             ALOGD("Received sound card OFFLINE status");
             set_snd_card_state(adev,SND_CARD_STATE_OFFLINE);
 
             pthread_mutex_lock(&adev->lock);
-            //close compress session on OFFLINE status
-            usecase = get_usecase_from_list(adev,USECASE_AUDIO_PLAYBACK_OFFLOAD);
-            if (usecase && usecase->stream.out) {
-                ALOGD(" %s closing compress session on OFFLINE state", __func__);
-
-                struct stream_out *out = usecase->stream.out;
+            cal_state_invalidate_l(adev);
+            if (adev->warm.running)
+                pthread_cond_signal(&adev->warm.cond);
+            //close compress sessions on OFFLINE status
+            offload = adev->usecases.by_type[PCM_PLAYBACK] &
+                      OFFLOAD_USECASE_MASK;
+            pthread_mutex_unlock(&adev->lock);
+            while (offload) {
+                uc_id = __builtin_ctzll(offload);
+                offload &= offload - 1;
 
+                pthread_mutex_lock(&adev->lock);
+                usecase = get_usecase_from_list(adev, uc_id);
+                out = usecase ? usecase->stream.out : NULL;
                 pthread_mutex_unlock(&adev->lock);
-                out_standby(&out->stream.common);
-            } else
-                pthread_mutex_unlock(&adev->lock);
+                if (!out)
+                    continue;
+
+                ALOGD(" %s closing compress session %s on OFFLINE state",
+                      __func__, use_case_table[uc_id]);
+                lock_output_stream(out);
+                out_ssr_snapshot_l(out);
+                pthread_mutex_unlock(&out->lock);
+                do_out_standby(out);
+            }
         } else if (strstr(snd_card_status, "ONLINE")) {
             ALOGD("Received sound card ONLINE status");
             set_snd_card_state(adev,SND_CARD_STATE_ONLINE);
+            /* restart the streams that were cut off, see ssr_recover_l() */
+            pthread_mutex_lock(&adev->lock);
+            /* the DSP came back without the calibration sent before */
+            cal_state_invalidate_l(adev);
+            adev->ssr.online_ns = stats_now_ns();
+            pthread_cond_broadcast(&adev->ssr.cond);
+            pthread_mutex_unlock(&adev->lock);
         }
     }
+    return 0;
+}
 
-    pthread_mutex_lock(&adev->lock);
-    status = voice_set_parameters(adev, parms);
-    if (status != 0)
-        goto done;
+static int adev_set_platform_parameters(struct audio_device *adev,
+                                        struct str_parms *parms)
+{
+    return platform_set_parameters(adev->platform, parms);
+}
 
-    status = platform_set_parameters(adev->platform, parms);
-    if (status != 0)
-        goto done;
+/* atomic flags, routing picks up the new value on its next pass */
+static int adev_set_bt_nrec(struct audio_device *adev, struct str_parms *parms)
+{
+    char value[32];
+    int ret;
 
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_BT_NREC, value, sizeof(value));
     if (ret >= 0) {
         /* When set to false, HAL should disable EC and NS
          * But it is currently not supported.
          */
-        if (strcmp(value, AUDIO_PARAMETER_VALUE_ON) == 0)
-            adev->bluetooth_nrec = true;
-        else
-            adev->bluetooth_nrec = false;
+        android_atomic_release_store(
+                strcmp(value, AUDIO_PARAMETER_VALUE_ON) == 0,
+                &adev->bluetooth_nrec);
     }
+    return 0;
+}
+
+static int adev_set_screen_state(struct audio_device *adev,
+                                 struct str_parms *parms)
+{
+    char value[32];
+    int ret;
 
     ret = str_parms_get_str(parms, "screen_state", value, sizeof(value));
     if (ret >= 0) {
-        if (strcmp(value, AUDIO_PARAMETER_VALUE_ON) == 0)
-            adev->screen_off = false;
-        else
-            adev->screen_off = true;
+        android_atomic_release_store(
+                strcmp(value, AUDIO_PARAMETER_VALUE_ON) != 0,
+                &adev->screen_off);
     }
+    return 0;
+}
+
+static int adev_set_rotation(struct audio_device *adev, struct str_parms *parms)
+{
+    int val;
+    int ret;
+    int status = 0;
 
     ret = str_parms_get_int(parms, "rotation", &val);
     if (ret >= 0) {
@@ -2985,12 +5212,221 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
             }
         }
     }
+    return status;
+}
+
+/* an HDMI sink coming or going invalidates what was read from its EDID */
+static int adev_set_device_connection(struct audio_device *adev,
+                                      struct str_parms *parms)
+{
+    int val;
+
+    if (str_parms_get_int(parms, AUDIO_PARAMETER_DEVICE_CONNECT, &val) >= 0)
+        prefetch_calibration_l(adev, (audio_devices_t)val);
+    else if (str_parms_get_int(parms, AUDIO_PARAMETER_DEVICE_DISCONNECT,
+                               &val) < 0)
+        return 0;
+    if (!(val & AUDIO_DEVICE_BIT_IN) && (val & AUDIO_DEVICE_OUT_AUX_DIGITAL)) {
+        ALOGV("%s: HDMI connection changed, dropping EDID caps", __func__);
+        adev->edid.valid = false;
+        adev->edid.invalidations++;
+    }
+    return 0;
+}
 
+static int adev_set_extn_parameters(struct audio_device *adev,
+                                    struct str_parms *parms)
+{
     audio_extn_set_parameters(adev, parms);
+    return 0;
+}
 
-done:
+#define PARAM_HANDLER_LOCKED        0x1 /* called with adev->lock held */
+#define PARAM_HANDLER_STOP_ON_ERROR 0x2 /* a failure skips the later handlers */
+
+struct param_handler {
+    const char *name;
+    const char * const *keys;
+    int (*set_parameters)(struct audio_device *adev, struct str_parms *parms);
+    unsigned int flags;
+};
+
+static const char * const snd_card_status_keys[] = {
+    AUDIO_PARAMETER_KEY_SND_CARD_STATUS, NULL
+};
+static const char * const bt_nrec_keys[] = { AUDIO_PARAMETER_KEY_BT_NREC, NULL };
+static const char * const screen_state_keys[] = { "screen_state", NULL };
+static const char * const rotation_keys[] = { "rotation", NULL };
+static const char * const device_connection_keys[] = {
+    AUDIO_PARAMETER_DEVICE_CONNECT, AUDIO_PARAMETER_DEVICE_DISCONNECT, NULL
+};
+
+/*
+ * adev_set_parameters() handlers, called in this order. A handler only runs
+ * when kvpairs holds one of its keys, so a screen or BT update neither goes
+ * through every subsystem nor waits on adev->lock behind a routing change.
+ */
+static const struct param_handler param_handlers[] = {
+    { "snd_card_status", snd_card_status_keys, adev_set_snd_card_status, 0 },
+    { "voice", voice_parameter_keys, voice_set_parameters,
+      PARAM_HANDLER_LOCKED | PARAM_HANDLER_STOP_ON_ERROR },
+    { "platform", platform_parameter_keys, adev_set_platform_parameters,
+      PARAM_HANDLER_LOCKED | PARAM_HANDLER_STOP_ON_ERROR },
+    { "bt_nrec", bt_nrec_keys, adev_set_bt_nrec, 0 },
+    { "screen_state", screen_state_keys, adev_set_screen_state, 0 },
+    { "rotation", rotation_keys, adev_set_rotation, PARAM_HANDLER_LOCKED },
+    { "device_connection", device_connection_keys, adev_set_device_connection,
+      PARAM_HANDLER_LOCKED },
+    { "audio_extn", audio_extn_parameter_keys, adev_set_extn_parameters,
+      PARAM_HANDLER_LOCKED },
+};
+
+/* power of two, at least twice the number of registered keys */
+#define PARAM_KEY_TABLE_SIZE 128
+
+struct param_key_entry {
+    const char *key;
+    uint32_t handlers;      /* bit n set for param_handlers[n] */
+};
+
+/* built once by param_handlers_compile(), read only afterwards */
+static struct param_key_entry param_key_table[PARAM_KEY_TABLE_SIZE];
+static uint32_t param_any_handlers;
+static bool param_handlers_compiled;
+
+/* FNV-1a over the first len characters of key */
+static unsigned int param_key_hash(const char *key, size_t len)
+{
+    unsigned int hash = 2166136261u;
+
+    while (len--) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static struct param_key_entry *param_key_find(const char *key, size_t len)
+{
+    unsigned int i = param_key_hash(key, len) & (PARAM_KEY_TABLE_SIZE - 1);
+    unsigned int probes;
+    struct param_key_entry *entry;
+
+    for (probes = 0; probes < PARAM_KEY_TABLE_SIZE; probes++) {
+        entry = &param_key_table[i];
+        if (!entry->key || (strlen(entry->key) == len &&
+                            !strncmp(entry->key, key, len)))
+            return entry;
+        i = (i + 1) & (PARAM_KEY_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+static void param_handlers_compile(void)
+{
+    struct param_key_entry *entry;
+    const char * const *key;
+    uint32_t i;
+
+    if (param_handlers_compiled)
+        return;
+
+    for (i = 0; i < ARRAY_SIZE(param_handlers); i++) {
+        for (key = param_handlers[i].keys; *key; key++) {
+            if (!strcmp(*key, PARAM_KEY_ANY)) {
+                param_any_handlers |= 1u << i;
+                continue;
+            }
+            entry = param_key_find(*key, strlen(*key));
+            if (!entry) {
+                /* still correct, the handler just sees every call */
+                ALOGE("%s: key table full, adding %s to every call",
+                      __func__, param_handlers[i].name);
+                param_any_handlers |= 1u << i;
+                continue;
+            }
+            entry->key = *key;
+            entry->handlers |= 1u << i;
+        }
+    }
+    param_handlers_compiled = true;
+}
+
+/* handlers owning a key of kvpairs, split the way str_parms does */
+static uint32_t param_handlers_for(const char *kvpairs)
+{
+    uint32_t handlers = param_any_handlers;
+    struct param_key_entry *entry;
+    const char *pair = kvpairs;
+    size_t pair_len, key_len;
+
+    while (*pair) {
+        pair_len = strcspn(pair, ";");
+        key_len = strcspn(pair, "=;");
+        if (key_len > 0) {
+            entry = param_key_find(pair, key_len);
+            if (entry && entry->key)
+                handlers |= entry->handlers;
+        }
+        pair += pair_len;
+        if (*pair)
+            pair++;
+    }
+    return handlers;
+}
+
+static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
+{
+    struct audio_device *adev = (struct audio_device *)dev;
+    const struct param_handler *handler;
+    struct str_parms *parms;
+    uint32_t handlers;
+    uint32_t i;
+    bool locked = false, took_lock = false;
+    int ret;
+    int status = 0;
+
+    ALOGD("%s: enter: %s", __func__, kvpairs);
+    android_atomic_inc(&adev->param_stats.calls);
+
+    handlers = param_handlers_for(kvpairs);
+    if (!handlers) {
+        android_atomic_inc(&adev->param_stats.unmatched);
+        ALOGV("%s: no handler for %s", __func__, kvpairs);
+        return 0;
+    }
+
+    parms = str_parms_create_str(kvpairs);
+    if (!parms)
+        goto error;
+
+    for (i = 0; i < ARRAY_SIZE(param_handlers); i++) {
+        if (!(handlers & (1u << i)))
+            continue;
+        handler = &param_handlers[i];
+
+        if ((handler->flags & PARAM_HANDLER_LOCKED) && !locked) {
+            pthread_mutex_lock(&adev->lock);
+            locked = took_lock = true;
+        } else if (!(handler->flags & PARAM_HANDLER_LOCKED) && locked) {
+            pthread_mutex_unlock(&adev->lock);
+            locked = false;
+        }
+
+        ALOGV("%s: %s", __func__, handler->name);
+        ret = handler->set_parameters(adev, parms);
+        if (ret != 0) {
+            status = ret;
+            if (handler->flags & PARAM_HANDLER_STOP_ON_ERROR)
+                break;
+        }
+    }
+
+    if (locked)
+        pthread_mutex_unlock(&adev->lock);
+    if (took_lock)
+        android_atomic_inc(&adev->param_stats.locked);
     str_parms_destroy(parms);
-    pthread_mutex_unlock(&adev->lock);
 error:
     ALOGV("%s: exit with code(%d)", __func__, status);
     return status;
@@ -3003,7 +5439,7 @@ static char* adev_get_parameters(const struct audio_hw_device *dev,
     struct str_parms *reply = str_parms_create();
     struct str_parms *query = str_parms_create_str(keys);
     char *str;
-    char value[256] = {0};
+    char value[512] = {0};
     int ret = 0;
 
     if (!query || !reply) {
@@ -3023,6 +5459,36 @@ static char* adev_get_parameters(const struct audio_hw_device *dev,
         goto exit;
     }
 
+    ret = str_parms_get_str(query, AUDIO_PARAMETER_KEY_HAL_STATS, value,
+                            sizeof(value));
+    if (ret >= 0) {
+        size_t len;
+
+        stats_to_str(&adev->routing_stats, value, sizeof(value));
+        len = strlen(value);
+        snprintf(value + len, sizeof(value) - len,
+                 ",route_txns:%u,route_paths:%llu,mixer_updates:%u,"
+                 "last_txn_paths:%u,last_txn_us:%u,max_txn_us:%u",
+                 adev->route_txn.count,
+                 (unsigned long long)adev->route_txn.total_path_ops,
+                 adev->route_txn.mixer_updates, adev->route_txn.last_path_ops,
+                 adev->route_txn.last_us, adev->route_txn.max_us);
+        len = strlen(value);
+        snprintf(value + len, sizeof(value) - len,
+                 ",set_params:%d,set_params_unmatched:%d,set_params_locked:%d",
+                 adev->param_stats.calls, adev->param_stats.unmatched,
+                 adev->param_stats.locked);
+        len = strlen(value);
+        snprintf(value + len, sizeof(value) - len,
+                 ",cal_sends:%u,cal_skips:%u,cal_saved_us:%llu,"
+                 "last_txn_cal_skips:%u,last_txn_cal_saved_us:%u",
+                 adev->cal.sends, adev->cal.skips,
+                 (unsigned long long)adev->cal.saved_us,
+                 adev->route_txn.last_cal_skips,
+                 adev->route_txn.last_cal_saved_us);
+        str_parms_add_str(reply, AUDIO_PARAMETER_KEY_HAL_STATS, value);
+    }
+
     pthread_mutex_lock(&adev->lock);
 
     audio_extn_get_parameters(adev, query, reply);
@@ -3152,6 +5618,11 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
 
     pthread_mutex_init(&in->lock, (const pthread_mutexattr_t *) NULL);
     pthread_mutex_init(&in->pre_lock, (const pthread_mutexattr_t *) NULL);
+    lock_debug_register(&in->pre_lock, LOCK_RANK_STREAM_PRE, "in->pre_lock");
+    lock_debug_register(&in->lock, LOCK_RANK_STREAM, "in->lock");
+    in->ssr.input = true;
+    in->ssr.stream = in;
+    list_init(&in->ssr.node);
 
     in->stream.common.get_sample_rate = in_get_sample_rate;
     in->stream.common.set_sample_rate = in_set_sample_rate;
@@ -3250,6 +5721,8 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     return ret;
 
 err_open:
+    lock_debug_unregister(&in->lock);
+    lock_debug_unregister(&in->pre_lock);
     free(in);
     *stream_in = NULL;
     return ret;
@@ -3264,6 +5737,7 @@ static void adev_close_input_stream(struct audio_hw_device *dev __unused,
 
     ALOGD("%s: enter:stream_handle(%p)",__func__, in);
 
+    ssr_forget(adev, &in->ssr);
     if (in->usecase == USECASE_COMPRESS_VOIP_CALL) {
         pthread_mutex_lock(&adev->lock);
         ret = voice_extn_compress_voip_close_input_stream(&stream->common);
@@ -3278,6 +5752,8 @@ static void adev_close_input_stream(struct audio_hw_device *dev __unused,
             (audio_channel_count_from_in_mask(in->channel_mask) == 6)) {
         audio_extn_ssr_deinit();
     }
+    lock_debug_unregister(&in->lock);
+    lock_debug_unregister(&in->pre_lock);
     free(stream);
 
     if(audio_extn_compr_cap_enabled() &&
@@ -3286,9 +5762,62 @@ static void adev_close_input_stream(struct audio_hw_device *dev __unused,
     return;
 }
 
-static int adev_dump(const audio_hw_device_t *device __unused,
-                     int fd __unused)
+static int adev_dump(const audio_hw_device_t *device, int fd)
 {
+    struct audio_device *adev = (struct audio_device *)device;
+    struct audio_usecase *usecase;
+    struct listnode *node;
+    unsigned int i;
+
+    dprintf(fd, "\nAudio HAL:\n  select_devices:\n");
+    stats_dump(fd, "    ", &adev->routing_stats);
+    dprintf(fd, "  routing transactions %u, paths %llu, mixer updates %u\n",
+            adev->route_txn.count,
+            (unsigned long long)adev->route_txn.total_path_ops,
+            adev->route_txn.mixer_updates);
+    dprintf(fd, "    last %u paths in %u us, max %u us, %u calibration "
+            "sends skipped saving %u us\n", adev->route_txn.last_path_ops,
+            adev->route_txn.last_us, adev->route_txn.max_us,
+            adev->route_txn.last_cal_skips, adev->route_txn.last_cal_saved_us);
+    dprintf(fd, "  calibration sends %u in %llu us, skipped %u saving %llu us, "
+            "prefetched %u\n", adev->cal.sends,
+            (unsigned long long)adev->cal.send_us, adev->cal.skips,
+            (unsigned long long)adev->cal.saved_us, adev->cal.prefetches);
+    dprintf(fd, "  set_parameters %d, no handler %d, took device lock %d\n",
+            adev->param_stats.calls, adev->param_stats.unmatched,
+            adev->param_stats.locked);
+    lock_debug_dump(fd);
+    audio_extn_period_tuner_dump(fd);
+    dprintf(fd, "  adev_open %u us\n", adev->boot_us);
+    dprintf(fd, "  SSR recoveries %u, last took %u us\n",
+            adev->ssr.recoveries, adev->ssr.last_recovery_us);
+    for (i = 0; i < adev->boot_step_count; i++)
+        dprintf(fd, "    %s %u us%s\n", adev->boot_steps[i].name,
+                adev->boot_steps[i].us,
+                adev->boot_steps[i].parallel ? " (worker thread)" : "");
+    platform_dump(adev->platform, fd);
+
+    /* do not block dumpsys behind a stuck routing change */
+    if (pthread_mutex_trylock(&adev->lock) != 0) {
+        dprintf(fd, "  device lock busy, active streams not listed\n");
+        return 0;
+    }
+    dprintf(fd, "  HDMI EDID %s, %u reads, %u invalidations\n",
+            adev->edid.valid ? "cached" : "not read", adev->edid.reads,
+            adev->edid.invalidations);
+    if (adev->edid.valid)
+        dprintf(fd, "    max channels %d, rates %#x, bit depths %#x, "
+                "formats %#x\n", adev->edid.caps.max_channels,
+                adev->edid.caps.sample_rates, adev->edid.caps.bit_depths,
+                adev->edid.caps.formats);
+    list_for_each(node, &adev->usecase_list) {
+        usecase = node_to_item(node, struct audio_usecase, list);
+        if (usecase->type == PCM_PLAYBACK && usecase->stream.out)
+            out_dump(&usecase->stream.out->stream.common, fd);
+        else if (usecase->type == PCM_CAPTURE && usecase->stream.in)
+            in_dump(&usecase->stream.in->stream.common, fd);
+    }
+    pthread_mutex_unlock(&adev->lock);
     return 0;
 }
 
@@ -3302,12 +5831,25 @@ static int adev_close(hw_device_t *device)
     pthread_mutex_lock(&adev_init_lock);
 
     if ((--audio_device_ref_count) == 0) {
+        ssr_recovery_deinit(adev);
+        warm_standby_deinit(adev);
+        audio_extn_period_tuner_deinit();
         if (amplifier_close() != 0)
             ALOGE("Amplifier close failed");
         audio_extn_listen_deinit(adev);
         audio_route_free(adev->audio_route);
         free(adev->snd_dev_ref_cnt);
+        free(adev->usecases.by_out_snd_device);
+        free(adev->usecases.by_in_snd_device);
         platform_deinit(adev->platform);
+        /* opened by platform_init() */
+        if (adev->mixer)
+            mixer_close(adev->mixer);
+        mixer_ctl_cache_clear_l(&adev->ctl_cache);
+        lock_debug_unregister(&adev->lock);
+        lock_debug_unregister(&adev->snd_card_status.lock);
+        lock_debug_unregister(&adev->ctl_cache.lock);
+        pthread_mutex_destroy(&adev->ctl_cache.lock);
         free(device);
         adev = NULL;
     }
@@ -3332,10 +5874,107 @@ static int period_size_is_plausible_for_low_latency(int period_size)
     }
 }
 
+/* Period sizes worth trying without period interrupts: 1 to 5 ms at 48 kHz */
+static int period_size_is_plausible_for_low_latency_mmap(int period_size)
+{
+    switch (period_size) {
+    case 48:
+    case 96:
+    case 144:
+    case 192:
+    case 240:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * adev_open() steps that do not depend on the ones after them run on their
+ * own thread and are joined before adev_open() returns.
+ */
+struct boot_worker {
+    const char *name;
+    void (*run)(struct audio_device *adev);
+    struct audio_device *adev;
+    pthread_t thread;
+    bool started;
+    int64_t duration_ns;
+};
+
+static void boot_step_record(struct audio_device *adev, const char *name,
+                             int64_t duration_ns, bool parallel)
+{
+    struct boot_step_timing *step;
+    uint32_t us = (uint32_t)(duration_ns / 1000);
+
+    ALOGI("adev_open: %s took %u us%s", name, us,
+          parallel ? " on a worker thread" : "");
+    if (adev->boot_step_count >= BOOT_STEPS_MAX)
+        return;
+    step = &adev->boot_steps[adev->boot_step_count++];
+    step->name = name;
+    step->us = us;
+    step->parallel = parallel;
+}
+
+static void *boot_worker_loop(void *context)
+{
+    struct boot_worker *worker = (struct boot_worker *)context;
+    int64_t start_ns = stats_now_ns();
+
+    worker->run(worker->adev);
+    worker->duration_ns = stats_now_ns() - start_ns;
+    return NULL;
+}
+
+static void boot_worker_start(struct boot_worker *worker)
+{
+    worker->started = pthread_create(&worker->thread, (const pthread_attr_t *) NULL,
+                                     boot_worker_loop, worker) == 0;
+    if (!worker->started) {
+        ALOGW("%s: no thread for %s, running it inline", __func__, worker->name);
+        boot_worker_loop(worker);
+    }
+}
+
+static void boot_worker_join(struct boot_worker *worker)
+{
+    if (worker->started)
+        pthread_join(worker->thread, (void **) NULL);
+    boot_step_record(worker->adev, worker->name, worker->duration_ns,
+                     worker->started);
+}
+
+/* only touches adev->amp, nothing routes before adev_open() returns */
+static void boot_amplifier_open(struct audio_device *adev __unused)
+{
+    if (amplifier_open() != 0)
+        ALOGE("Amplifier initialization failed");
+}
+
+#ifdef AUDIO_LISTEN_ENABLED
+static void boot_listen_init(struct audio_device *adev)
+{
+    audio_extn_listen_init(adev, adev->snd_card);
+}
+#endif
+
 static int adev_open(const hw_module_t *module, const char *name,
                      hw_device_t **device)
 {
     int i, ret;
+    int64_t boot_start_ns, step_start_ns;
+    struct boot_worker amp_worker = {
+        .name = "amplifier_open",
+        .run = boot_amplifier_open,
+    };
+#ifdef AUDIO_LISTEN_ENABLED
+    struct boot_worker listen_worker = {
+        .name = "listen_init",
+        .run = boot_listen_init,
+    };
+#endif
 
     ALOGD("%s: enter", __func__);
     if (strcmp(name, AUDIO_HARDWARE_INTERFACE) != 0) return -EINVAL;
@@ -3350,6 +5989,7 @@ static int adev_open(const hw_module_t *module, const char *name,
             return 0;
     }
 
+    boot_start_ns = stats_now_ns();
     adev = calloc(1, sizeof(struct audio_device));
 
     if (!adev) {
@@ -3391,17 +6031,41 @@ static int adev_open(const hw_module_t *module, const char *name,
     adev->acdb_settings = TTY_MODE_OFF;
     /* adev->cur_hdmi_channels = 0;  by calloc() */
     adev->snd_dev_ref_cnt = calloc(SND_DEVICE_MAX, sizeof(int));
+    adev->usecases.by_out_snd_device = calloc(SND_DEVICE_MAX,
+                                              sizeof(usecase_mask_t));
+    adev->usecases.by_in_snd_device = calloc(SND_DEVICE_MAX,
+                                             sizeof(usecase_mask_t));
     voice_init(adev);
     list_init(&adev->usecase_list);
     adev->cur_wfd_channels = 2;
 
     pthread_mutex_init(&adev->snd_card_status.lock, (const pthread_mutexattr_t *) NULL);
+    pthread_mutex_init(&adev->ctl_cache.lock, (const pthread_mutexattr_t *) NULL);
     adev->snd_card_status.state = SND_CARD_STATE_OFFLINE;
+    cal_state_invalidate_l(adev);
+    lock_debug_register(&adev_init_lock, LOCK_RANK_INIT, "adev_init_lock");
+    lock_debug_register(&adev->lock, LOCK_RANK_DEVICE, "adev->lock");
+    lock_debug_register(&adev->snd_card_status.lock, LOCK_RANK_LEAF,
+                        "snd_card_status.lock");
+    lock_debug_register(&adev->ctl_cache.lock, LOCK_RANK_LEAF, "ctl_cache.lock");
+
+    amp_worker.adev = adev;
+    boot_worker_start(&amp_worker);
 
     /* Loads platform specific libraries dynamically */
+    step_start_ns = stats_now_ns();
     adev->platform = platform_init(adev);
+    boot_step_record(adev, "platform_init", stats_now_ns() - step_start_ns,
+                     false);
     if (!adev->platform) {
+        boot_worker_join(&amp_worker);
+        amplifier_close();
+        lock_debug_unregister(&adev->lock);
+        lock_debug_unregister(&adev->snd_card_status.lock);
+        lock_debug_unregister(&adev->ctl_cache.lock);
         free(adev->snd_dev_ref_cnt);
+        free(adev->usecases.by_out_snd_device);
+        free(adev->usecases.by_in_snd_device);
         free(adev);
         ALOGE("%s: Failed to init platform data, aborting.", __func__);
         *device = NULL;
@@ -3411,41 +6075,11 @@ static int adev_open(const hw_module_t *module, const char *name,
 
     adev->snd_card_status.state = SND_CARD_STATE_ONLINE;
 
-    if (access(VISUALIZER_LIBRARY_PATH, R_OK) == 0) {
-        adev->visualizer_lib = dlopen(VISUALIZER_LIBRARY_PATH, RTLD_NOW);
-        if (adev->visualizer_lib == NULL) {
-            ALOGE("%s: DLOPEN failed for %s", __func__, VISUALIZER_LIBRARY_PATH);
-        } else {
-            ALOGV("%s: DLOPEN successful for %s", __func__, VISUALIZER_LIBRARY_PATH);
-            adev->visualizer_start_output =
-                        (int (*)(audio_io_handle_t, int))dlsym(adev->visualizer_lib,
-                                                        "visualizer_hal_start_output");
-            adev->visualizer_stop_output =
-                        (int (*)(audio_io_handle_t, int))dlsym(adev->visualizer_lib,
-                                                        "visualizer_hal_stop_output");
-        }
-    }
-    audio_extn_listen_init(adev, adev->snd_card);
-
-    if (access(OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH, R_OK) == 0) {
-        adev->offload_effects_lib = dlopen(OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH, RTLD_NOW);
-        if (adev->offload_effects_lib == NULL) {
-            ALOGE("%s: DLOPEN failed for %s", __func__,
-                  OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH);
-        } else {
-            ALOGV("%s: DLOPEN successful for %s", __func__,
-                  OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH);
-            adev->offload_effects_start_output =
-                        (int (*)(audio_io_handle_t, int))dlsym(adev->offload_effects_lib,
-                                         "offload_effects_bundle_hal_start_output");
-            adev->offload_effects_stop_output =
-                        (int (*)(audio_io_handle_t, int))dlsym(adev->offload_effects_lib,
-                                         "offload_effects_bundle_hal_stop_output");
-        }
-    }
-
-    if (amplifier_open() != 0)
-        ALOGE("Amplifier initialization failed");
+#ifdef AUDIO_LISTEN_ENABLED
+    /* publishes its entry points in adev->device, so it cannot wait for use */
+    listen_worker.adev = adev;
+    boot_worker_start(&listen_worker);
+#endif
 
     adev->enable_voicerx = false;
 
@@ -3464,12 +6098,49 @@ static int adev_open(const hw_module_t *module, const char *name,
             configured_low_latency_capture_period_size = trial;
         }
     }
+    if (property_get("audio_hal.ll_mmap", value, NULL) > 0)
+        low_latency_mmap_enabled = atoi(value) || !strncmp("true", value, 4);
+    if (property_get("audio_hal.capture_engine", value, NULL) > 0)
+        capture_engine_enabled = atoi(value) || !strncmp("true", value, 4);
+    if (property_get("audio_hal.mmap_period_size", value, NULL) > 0) {
+        trial = atoi(value);
+        if (period_size_is_plausible_for_low_latency_mmap(trial)) {
+            pcm_config_low_latency_mmap.period_size = trial;
+            pcm_config_low_latency_mmap.start_threshold = trial;
+            pcm_config_low_latency_mmap.avail_min = trial;
+        }
+    }
     if (property_get("audio_hal.in_period_size", value, NULL) > 0) {
         trial = atoi(value);
         if (period_size_is_plausible_for_low_latency(trial)) {
             configured_low_latency_capture_period_size = trial;
         }
     }
+    warm_standby_ns = 0;
+    if (property_get("audio_hal.warm_standby_ms", value, NULL) > 0) {
+        trial = atoi(value);
+        if (trial > 0)
+            warm_standby_ns = (int64_t)trial * 1000000LL;
+    }
+    if (property_get("audio_hal.cal_prefetch", value, NULL) > 0)
+        adev->cal.prefetch = atoi(value) || !strncmp("true", value, 4);
+    offload_coalesce_ns = 0;
+    if (property_get("audio_hal.offload_coalesce_ms", value, NULL) > 0) {
+        trial = atoi(value);
+        if (trial > 0)
+            offload_coalesce_ns = (int64_t)trial * 1000000LL;
+    }
+    warm_standby_init(adev);
+    ssr_recovery_init(adev);
+    audio_extn_period_tuner_init();
+    param_handlers_compile();
+
+    boot_worker_join(&amp_worker);
+#ifdef AUDIO_LISTEN_ENABLED
+    boot_worker_join(&listen_worker);
+#endif
+    adev->boot_us = (uint32_t)((stats_now_ns() - boot_start_ns) / 1000);
+    ALOGI("%s: ready in %u us", __func__, adev->boot_us);
 
     pthread_mutex_unlock(&adev_init_lock);
 
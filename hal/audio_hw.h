@@ -29,6 +29,7 @@
 
 #include <audio_route/audio_route.h>
 #include "audio_defs.h"
+#include "edid.h"
 #include "voice.h"
 
 #define VISUALIZER_LIBRARY_PATH "/system/lib/soundfx/libqcomvisualizer.so"
@@ -67,7 +68,14 @@ enum {
     USECASE_AUDIO_PLAYBACK_LOW_LATENCY,
     USECASE_AUDIO_PLAYBACK_MULTI_CH,
     USECASE_AUDIO_PLAYBACK_OFFLOAD,
-    
+    USECASE_AUDIO_PLAYBACK_OFFLOAD2,
+    USECASE_AUDIO_PLAYBACK_OFFLOAD3,
+    USECASE_AUDIO_PLAYBACK_OFFLOAD4,
+    USECASE_AUDIO_PLAYBACK_OFFLOAD5,
+    USECASE_AUDIO_PLAYBACK_OFFLOAD6,
+    USECASE_AUDIO_PLAYBACK_OFFLOAD7,
+    USECASE_AUDIO_PLAYBACK_OFFLOAD8,
+
     /* FM usecase */
     USECASE_AUDIO_PLAYBACK_FM,
 
@@ -112,6 +120,20 @@ enum {
 
 const char * const use_case_table[AUDIO_USECASE_MAX];
 
+/*
+ * Concurrent compress offload sessions, each on its own compress device.
+ * Only the first one has a default device; the others are usable once
+ * audio_platform_info.xml gives them a pcm id, and the target's
+ * mixer_paths.xml must then have a "compress-offload-playback2" to
+ * "compress-offload-playback8" path for each of them, routing its front end
+ * as "compress-offload-playback" does for the first.
+ */
+#define MAX_OFFLOAD_SESSIONS \
+    (USECASE_AUDIO_PLAYBACK_OFFLOAD8 - USECASE_AUDIO_PLAYBACK_OFFLOAD + 1)
+#define is_offload_usecase(uc_id) \
+    ((uc_id) >= USECASE_AUDIO_PLAYBACK_OFFLOAD && \
+     (uc_id) <= USECASE_AUDIO_PLAYBACK_OFFLOAD8)
+
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
 /*
@@ -136,10 +158,213 @@ enum {
     OFFLOAD_STATE_PAUSED,
 };
 
-struct offload_cmd {
-    struct listnode node;
-    int cmd;
-    int data[];
+/* Must be a power of two. Commands are posted by the stream writer with
+ * out->lock held and consumed by the offload callback thread. A sender finding
+ * the ring full waits for a slot rather than dropping the command.
+ */
+#define OFFLOAD_CMD_RING_SIZE 16
+
+/* unity for the Q15 software gain of multichannel outputs, see out_set_volume() */
+#define SW_GAIN_UNITY (1 << 15)
+
+/* call duration buckets, in ms: <1 <2 <5 <10 <20 <50 <100 and above */
+#define HAL_STATS_HIST_BUCKETS 8
+
+/*
+ * Telemetry reported by dump() and the "hal_stats" parameter. Updates are
+ * serialized by the owning lock (stream lock, or adev->lock for routing);
+ * readers do not take it and instead retry while seq is odd or changes.
+ */
+struct hal_stats {
+    volatile int32_t seq;
+    uint32_t calls;
+    uint32_t errors;
+    uint32_t xruns;            /* estimated from gaps longer than the buffer */
+    uint32_t standby_count;
+    uint32_t resume_count;
+    uint32_t hist[HAL_STATS_HIST_BUCKETS];
+    uint32_t max_call_us;
+    uint64_t total_call_us;
+    uint64_t blocked_us;       /* time spent inside the pcm/compress transfer */
+    int64_t last_io_end_ns;    /* 0 after standby */
+};
+
+/* a subsystem listing this key sees every adev_set_parameters() call */
+#define PARAM_KEY_ANY "*"
+
+#define BOOT_STEPS_MAX 8
+
+/* how long an adev_open() step took, for dump */
+struct boot_step_timing {
+    const char *name;
+    uint32_t us;
+    bool parallel;       /* ran on a worker thread, next to the others */
+};
+
+/* adev_set_parameters() dispatch counters, updated with atomics */
+struct param_dispatch_stats {
+    volatile int32_t calls;
+    volatile int32_t unmatched;    /* no handler for any of the keys */
+    volatile int32_t locked;       /* calls that needed adev->lock */
+};
+
+#define POSITION_EST_SAMPLES 32
+
+/*
+ * Rendered frames against time over the last presentation position
+ * readings, fitted by least squares to smooth out coarse DSP positions and
+ * timestamp jitter. Protected by the stream lock.
+ */
+struct position_estimator {
+    unsigned int count;
+    unsigned int next;
+    uint64_t frames[POSITION_EST_SAMPLES];
+    int64_t time_ns[POSITION_EST_SAMPLES];
+    uint64_t last_reported;
+    uint64_t anchor_frames;    /* first reading since the last restart */
+    int64_t anchor_ns;
+    int32_t drift_ppm;         /* measured rate against the nominal rate */
+    uint32_t jitter_us;        /* rms distance of the readings to the fit */
+    uint32_t restarts;
+};
+
+/*
+ * Routing changes made between begin_routing_transaction() and
+ * commit_routing_transaction() are staged in audio_route and written to the
+ * mixer by a single audio_route_update_mixer(), which only writes controls
+ * whose value differs from the current mixer state. Protected by adev->lock.
+ */
+struct routing_txn {
+    int depth;                 /* nesting level, 0 when no transaction is open */
+    uint32_t path_ops;         /* paths applied or reset since the last flush */
+    int64_t start_ns;
+    uint32_t count;            /* committed transactions */
+    uint32_t mixer_updates;
+    uint64_t total_path_ops;
+    uint32_t last_path_ops;
+    uint32_t last_us;
+    uint32_t max_us;
+    uint32_t last_cal_skips;   /* calibration sends the last one did not need */
+    uint32_t last_cal_saved_us;
+};
+
+enum {
+    CAL_DIR_OUT,
+    CAL_DIR_IN,
+    CAL_DIR_MAX
+};
+
+/*
+ * The ACDB loader holds one audio calibration per direction, applied to the
+ * paths opened after it was sent. send_snd_device_calibration() remembers
+ * which ACDB id that is and does not send it again, as when a device is
+ * disabled and enabled again for a backend change. Forgotten when the DSP
+ * restarts. Protected by adev->lock.
+ */
+struct cal_state {
+    int live_acdb_id[CAL_DIR_MAX];  /* -1 when unknown */
+    bool prefetch;                  /* from audio_hal.cal_prefetch */
+    uint32_t sends;
+    uint32_t skips;
+    uint32_t prefetches;
+    uint64_t send_us;               /* spent in sends */
+    uint64_t saved_us;              /* skips times the average send */
+};
+
+#define MIXER_CTL_CACHE_SIZE 128 /* power of two */
+
+struct mixer_ctl_cache_entry {
+    char *name;
+    struct mixer_ctl *ctl;
+};
+
+/*
+ * Mixer controls already resolved by get_mixer_ctl(), hashed by name.
+ * Emptied when adev->mixer changes or the sound card goes offline/online.
+ */
+struct mixer_ctl_cache {
+    pthread_mutex_t lock;
+    struct mixer *mixer; /* mixer the cached controls belong to */
+    unsigned int count;
+    struct mixer_ctl_cache_entry entries[MIXER_CTL_CACHE_SIZE];
+};
+
+/*
+ * Parsed EDID, read on first use and dropped when an HDMI sink is connected
+ * or disconnected. Protected by adev->lock.
+ */
+struct edid_cache {
+    bool valid;
+    struct edid_audio_caps caps;
+    uint32_t reads;
+    uint32_t invalidations;
+};
+
+/*
+ * A stream written to or read from while the sound card is offline is
+ * restarted by the SSR recovery thread once the card is back. The snapshot
+ * keeps what standby loses; devices, effect flags and the like stay in the
+ * stream. pending is protected by the stream lock, node and recovering by
+ * adev->lock.
+ */
+struct ssr_snapshot {
+    bool input;
+    void *stream;                     /* stream_in or stream_out */
+    bool pending;                     /* to restart when the card is online */
+    bool recovering;                  /* being restarted, do not free */
+    struct listnode node;             /* in adev->ssr.streams */
+    struct compr_gapless_mdata gapless_mdata;
+    int64_t offline_ns;               /* when the stream saw the card offline */
+    int64_t silence_until_ns;         /* end of the data consumed while offline */
+    uint32_t recoveries;
+    uint32_t last_recovery_us;        /* from ONLINE to the stream restarted */
+};
+
+/*
+ * Stream side of audio_extn/period_tuner.c, protected by the stream lock.
+ * A session is one run from the first write after standby to standby.
+ */
+struct period_tuner_session {
+    int level;                        /* -1 when the stream is not tuned */
+    unsigned int base_period_size;    /* stock config the levels scale */
+    unsigned int base_period_count;
+    snd_device_t snd_device;
+    int64_t start_ns;                 /* 0 outside a session */
+    uint32_t start_calls;
+    uint32_t start_xruns;
+};
+
+/*
+ * Stream side of audio_extn/pcm_offload.c, protected by the stream lock.
+ * Sizes are in bytes; src is what the client writes, dst what the DSP reads.
+ */
+struct pcm_offload_conv {
+    bool active;                      /* converted, else written as is */
+    audio_format_t src_format;
+    unsigned int src_channels;
+    unsigned int dst_channels;
+    size_t src_frame_size;
+    size_t dst_frame_size;
+    uint32_t dsp_format;              /* SNDRV_PCM_FORMAT_* */
+    size_t client_buffer_size;        /* a fragment in client bytes */
+    void *buf;                        /* converted frames */
+    size_t buf_size;
+    size_t partial_bytes;             /* of a frame the driver took in part */
+};
+
+/*
+ * Offload writes gathered into whole fragments, see offload_coalesce_write_l()
+ * in audio_hw.c. Protected by the stream lock, sizes in client bytes.
+ */
+struct offload_coalescer {
+    uint8_t *buf;
+    size_t size;                      /* one fragment */
+    size_t fill;
+    int64_t deadline_ns;              /* flush by then if still held */
+    uint32_t writes;                  /* client writes */
+    uint32_t flushes;                 /* compress writes they turned into */
+    uint32_t timeouts;                /* flushes forced by the deadline */
+    uint64_t bytes;
 };
 
 struct stream_out {
@@ -162,26 +387,81 @@ struct stream_out {
     audio_usecase_t usecase;
     /* Array of supported channel mask configurations. +1 so that the last entry is always 0 */
     audio_channel_mask_t supported_channel_masks[MAX_SUPPORTED_CHANNEL_MASKS + 1];
-    bool muted;
+    volatile int32_t sw_gain_target; /* Q15, set by out_set_volume() */
+    int32_t sw_gain;                 /* Q15, gain the last buffer ended with */
+    int16_t *sw_gain_buf;            /* HAL owned copy the gain is applied to */
+    size_t sw_gain_buf_size;
     uint64_t written; /* total frames written, not cleared when entering standby */
+    bool mmap_mode;                   /* low latency output using PCM_MMAP | PCM_NOIRQ */
+    unsigned int mmap_appl_ptr;       /* frames written since the pcm was opened */
+    unsigned int mmap_latency_frames; /* measured depth of the DMA ring */
+    bool warm;                        /* standby, but still routed and prepared */
+    int64_t warm_deadline_ns;         /* when warm standby ends */
+    struct listnode warm_node;        /* in adev->warm.requests */
+    uint32_t warm_resumes;
+    uint32_t cold_resumes;
+    uint32_t last_resume_us;          /* first write after standby */
     audio_io_handle_t handle;
 
     int non_blocking;
     int playback_started;
     int offload_state;
-    pthread_cond_t offload_cond;
     pthread_t offload_thread;
-    struct listnode offload_cmd_list;
+    int offload_cmd_ring[OFFLOAD_CMD_RING_SIZE];
+    volatile int32_t offload_cmd_head; /* next slot read by offload thread */
+    volatile int32_t offload_cmd_tail; /* next slot written by sender */
+    volatile int32_t offload_cmd_exit; /* OFFLOAD_CMD_EXIT, never queued */
+    int offload_cmd_event_fd;          /* wakes up the offload thread */
     bool offload_thread_blocked;
 
     stream_callback_t offload_callback;
     void *offload_cookie;
     struct compr_gapless_mdata gapless_mdata;
     int send_new_metadata;
-
+    float volume_l, volume_r;         /* last offload volume, < 0 until set */
+    struct ssr_snapshot ssr;
+    struct period_tuner_session tuner;
+    struct pcm_offload_conv pcm_conv;
+    struct offload_coalescer coalesce;
+
+    struct hal_stats stats;
+    struct position_estimator pos_est;
+    volatile int32_t device_latency_us; /* DSP latency of out_snd_device */
     struct audio_device *dev;
 };
 
+/*
+ * Capture engine: a thread drains the PCM a period at a time into a single
+ * producer, single consumer ring that in_read() copies out of, so a late
+ * client costs ring space instead of a driver overrun. Positions are frame
+ * counters that wrap; each side only writes its own. Periods that do not fit
+ * in the ring, and gaps the hardware timestamps show were dropped by the
+ * driver, are counted as lost.
+ */
+struct capture_engine {
+    bool running;
+    pthread_t thread;
+    int event_fd;                 /* signalled for each period and on exit */
+    volatile int32_t exit;
+    volatile int32_t error;       /* negative errno the reader stopped on */
+    char *ring;
+    char *scratch;                /* destination of periods that are dropped */
+    uint32_t ring_frames;         /* multiple of the period size */
+    uint32_t frame_size;
+    uint32_t write_offset;        /* frames, owned by the thread */
+    uint32_t read_offset;         /* frames, owned by in_read() */
+    volatile int32_t write_pos;
+    volatile int32_t read_pos;
+    volatile int32_t frames_lost; /* not yet reported to the client */
+    volatile int32_t overruns;
+    int32_t overruns_reported;    /* protected by the stream lock */
+    /* last capture position, updated by the thread under a sequence count */
+    volatile int32_t pos_seq;
+    int64_t pos_frames;
+    int64_t pos_time_ns;
+    int64_t frames_base;          /* frames_read when the engine started */
+};
+
 struct stream_in {
     struct audio_stream_in stream;
     pthread_mutex_t lock; /* see note below on mutex acquisition order */
@@ -199,7 +479,10 @@ struct stream_in {
     bool enable_ns;
     audio_format_t format;
     int64_t frames_read; /* total frames read, not cleared when entering standby */
+    struct capture_engine engine;
+    struct ssr_snapshot ssr;
 
+    struct hal_stats stats;
     struct audio_device *dev;
 };
 
@@ -211,6 +494,8 @@ typedef enum {
     PCM_HFP_CALL
 } usecase_type_t;
 
+#define USECASE_TYPE_MAX (PCM_HFP_CALL + 1)
+
 union stream_ptr {
     struct stream_in *in;
     struct stream_out *out;
@@ -226,11 +511,69 @@ struct audio_usecase {
     union stream_ptr stream;
 };
 
+/*
+ * Index over adev->usecase_list so that routing does not walk the list.
+ * A usecase is bit (1 << id) of a mask. Usecases enter and leave the list
+ * through usecase_list_add() and usecase_list_remove(), and changes to their
+ * devices or sound devices are published with usecase_index_update().
+ * Protected by adev->lock, like the list.
+ */
+typedef uint64_t usecase_mask_t;
+#define USECASE_BIT(id) ((usecase_mask_t)1 << (id))
+#define OFFLOAD_USECASE_MASK \
+    (((USECASE_BIT(USECASE_AUDIO_PLAYBACK_OFFLOAD8) << 1) - 1) & \
+     ~(USECASE_BIT(USECASE_AUDIO_PLAYBACK_OFFLOAD) - 1))
+
+struct usecase_index {
+    struct audio_usecase *by_id[AUDIO_USECASE_MAX];
+    usecase_mask_t by_type[USECASE_TYPE_MAX];
+    usecase_mask_t codec_backend; /* devices on the hardware codec backend */
+    usecase_mask_t *by_out_snd_device; /* SND_DEVICE_MAX entries */
+    usecase_mask_t *by_in_snd_device;
+    /* sound devices each usecase is filed under in the masks above */
+    snd_device_t out_snd_device[AUDIO_USECASE_MAX];
+    snd_device_t in_snd_device[AUDIO_USECASE_MAX];
+};
+
 struct sound_card_status {
     pthread_mutex_t lock;
     int state;
 };
 
+/*
+ * Warm standby keeps an output that entered standby routed, with its PCM
+ * prepared, for a while so that a write soon after skips select_devices()
+ * and pcm_open(). The thread ends warm standby when it expires and warms up
+ * outputs that are told playback is coming. out->warm changes with both the
+ * stream lock and adev->lock held; the requests list and the condition are
+ * protected by adev->lock.
+ */
+struct warm_standby {
+    bool running;
+    bool exit;
+    pthread_t thread;
+    pthread_cond_t cond;
+    struct listnode requests;
+};
+
+/*
+ * Subsystem restart recovery. When the card comes back ONLINE the thread
+ * restarts the streams on the list whose client is still writing or reading,
+ * each on a worker of its own, so that PCMs are opened in parallel. The
+ * condition, signalled with adev->lock held, also wakes streams being closed
+ * that wait for their restart to end.
+ */
+struct ssr_recovery {
+    bool running;
+    bool exit;
+    pthread_t thread;
+    pthread_cond_t cond;
+    struct listnode streams;          /* struct ssr_snapshot.node */
+    int64_t online_ns;
+    uint32_t recoveries;
+    uint32_t last_recovery_us;        /* all streams of the last recovery */
+};
+
 struct audio_device {
     struct audio_hw_device device;
     pthread_mutex_t lock; /* see note below on mutex acquisition order */
@@ -241,21 +584,26 @@ struct audio_device {
     struct stream_out *primary_output;
     struct stream_out *voice_tx_output;
     struct stream_out *current_call_output;
-    bool bluetooth_nrec;
-    bool screen_off;
+    /* set by adev_set_parameters() without adev->lock, android_atomic */
+    volatile int32_t bluetooth_nrec;
+    volatile int32_t screen_off;
     int *snd_dev_ref_cnt;
     struct listnode usecase_list;
+    struct usecase_index usecases;
+    usecase_mask_t offload_sessions; /* offload usecases held by open streams */
     struct audio_route *audio_route;
     int acdb_settings;
     bool speaker_lr_swap;
     struct voice voice;
     unsigned int cur_hdmi_channels;
+    struct edid_cache edid;
     unsigned int cur_wfd_channels;
     bool enable_voicerx;
 
     int snd_card;
     void *platform;
 
+    bool offload_libs_loaded; /* visualizer and effects, on first offload */
     void *visualizer_lib;
     int (*visualizer_start_output)(audio_io_handle_t, int);
     int (*visualizer_stop_output)(audio_io_handle_t, int);
@@ -265,14 +613,30 @@ struct audio_device {
 
     struct sound_card_status snd_card_status;
     amplifier_device_t *amp;
+
+    struct hal_stats routing_stats; /* select_devices() calls */
+    struct param_dispatch_stats param_stats;
+    struct boot_step_timing boot_steps[BOOT_STEPS_MAX];
+    unsigned int boot_step_count;
+    uint32_t boot_us;
+    struct routing_txn route_txn;
+    struct cal_state cal;
+    struct mixer_ctl_cache ctl_cache;
+    struct warm_standby warm;
+    struct ssr_recovery ssr;
 };
 
 int select_devices(struct audio_device *adev,
                           audio_usecase_t uc_id);
 int disable_audio_route(struct audio_device *adev,
                         struct audio_usecase *usecase);
+void begin_routing_transaction(struct audio_device *adev);
+void flush_routing_transaction(struct audio_device *adev);
+void commit_routing_transaction(struct audio_device *adev);
 int disable_snd_device(struct audio_device *adev,
                        snd_device_t snd_device);
+int send_snd_device_calibration(struct audio_device *adev,
+                                snd_device_t snd_device);
 int enable_snd_device(struct audio_device *adev,
                       snd_device_t snd_device);
 
@@ -281,7 +645,14 @@ int enable_audio_route(struct audio_device *adev,
 
 struct audio_usecase *get_usecase_from_list(struct audio_device *adev,
                                                    audio_usecase_t uc_id);
-
+void usecase_list_add(struct audio_device *adev, struct audio_usecase *usecase);
+void usecase_list_remove(struct audio_device *adev,
+                         struct audio_usecase *usecase);
+void usecase_index_update(struct audio_device *adev,
+                          struct audio_usecase *usecase);
+
+struct mixer_ctl *get_mixer_ctl(struct audio_device *adev, const char *name);
+void invalidate_mixer_ctl_cache(struct audio_device *adev);
 int pcm_ioctl(struct pcm *pcm, int request, ...);
 int get_snd_card_state(struct audio_device *adev);
 
@@ -293,6 +664,59 @@ int get_snd_card_state(struct audio_device *adev);
 /*
  * NOTE: when multiple mutexes have to be acquired, always take the
  * stream_in or stream_out mutex first, followed by the audio_device mutex.
+ *
+ * The locks form these domains, taken in increasing rank:
+ *
+ * LOCK_RANK_INIT      adev_init_lock, open/close of the device.
+ * LOCK_RANK_STREAM_PRE stream pre_lock, only held to take the stream lock.
+ * LOCK_RANK_STREAM    stream_out/stream_in lock: the stream state, its PCM
+ *                     or compress handle and its stats. A PCM is opened,
+ *                     prepared and closed with this lock alone.
+ * LOCK_RANK_DEVICE    adev->lock: the usecase list and routing graph
+ *                     (snd device refcounts, audio_route, calibration), the
+ *                     voice session and the fm/hfp loopbacks, which route.
+ * LOCK_RANK_EXTN      extension state with its own lock, e.g. usb
+ *                     playback/record, taken from routing.
+ * LOCK_RANK_LEAF      sound card status and the mixer control cache. Held
+ *                     briefly, nothing is taken under them.
+ *
+ * Two locks of the same rank are never held together, except through
+ * trylock, which cannot deadlock: the warm standby thread trylocks stream
+ * locks while holding adev->lock.
+ *
+ * Builds with LOCK_DEBUG_ENABLED check this order at run time, see
+ * audio_extn/lock_debug.c.
  */
+enum {
+    LOCK_RANK_INIT,
+    LOCK_RANK_STREAM_PRE,
+    LOCK_RANK_STREAM,
+    LOCK_RANK_DEVICE,
+    LOCK_RANK_EXTN,
+    LOCK_RANK_LEAF,
+};
+
+#ifndef LOCK_DEBUG_ENABLED
+#define lock_debug_register(mutex, rank, name)              do { } while (0)
+#define lock_debug_unregister(mutex)                        do { } while (0)
+#define lock_debug_dump(fd)                                 do { } while (0)
+#else
+void lock_debug_register(pthread_mutex_t *mutex, int rank, const char *name);
+void lock_debug_unregister(pthread_mutex_t *mutex);
+void lock_debug_dump(int fd);
+int lock_debug_mutex_lock(pthread_mutex_t *mutex, const char *file, int line);
+int lock_debug_mutex_trylock(pthread_mutex_t *mutex, const char *file,
+                             int line);
+int lock_debug_mutex_unlock(pthread_mutex_t *mutex);
+
+/* registered mutexes are checked, the others pass straight through */
+#ifndef LOCK_DEBUG_NO_WRAP
+#define pthread_mutex_lock(mutex) \
+    lock_debug_mutex_lock(mutex, __FILE__, __LINE__)
+#define pthread_mutex_trylock(mutex) \
+    lock_debug_mutex_trylock(mutex, __FILE__, __LINE__)
+#define pthread_mutex_unlock(mutex) lock_debug_mutex_unlock(mutex)
+#endif
+#endif
 
 #endif // QCOM_AUDIO_HW_H
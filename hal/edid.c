@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "edid.h"
+
+void edid_caps_add_sad(struct edid_audio_caps *caps, const unsigned char *sad)
+{
+    unsigned int format = (sad[0] >> 3) & 0xf;
+    int channels = (sad[0] & 0x7) + 1;
+
+    caps->formats |= 1u << format;
+    if (format != EDID_FORMAT_LPCM)
+        return;
+    if (channels > caps->max_channels)
+        caps->max_channels = channels;
+    caps->sample_rates |= sad[1] & EDID_SAMPLE_RATE_BITS;
+    caps->bit_depths |= sad[2] & (EDID_BIT_DEPTH_16 | EDID_BIT_DEPTH_20 |
+                                  EDID_BIT_DEPTH_24);
+}
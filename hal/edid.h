@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EDID_H
+#define EDID_H
+
+#include <stdint.h>
+
+/* CEA-861 short audio descriptor format codes */
+#define EDID_FORMAT_LPCM    1
+#define EDID_FORMAT_AC3     2
+#define EDID_FORMAT_DTS     7
+#define EDID_FORMAT_EAC3    10
+
+/* sample rates of byte 1 of a short audio descriptor, bit n for entry n */
+#define EDID_SAMPLE_RATES   { 32000, 44100, 48000, 88200, 96000, 176400, 192000 }
+#define EDID_SAMPLE_RATE_BITS 0x7f
+
+/* LPCM sample sizes of byte 2 of a short audio descriptor */
+#define EDID_BIT_DEPTH_16   0x1
+#define EDID_BIT_DEPTH_20   0x2
+#define EDID_BIT_DEPTH_24   0x4
+
+/* what the HDMI sink supports, from the short audio descriptors of its EDID */
+struct edid_audio_caps {
+    int max_channels;          /* LPCM */
+    uint32_t sample_rates;     /* LPCM, EDID_SAMPLE_RATES bits */
+    uint32_t bit_depths;       /* LPCM, EDID_BIT_DEPTH_* */
+    uint32_t formats;          /* bit n set for format code n, LPCM included */
+};
+
+/*
+ * Folds one 3 byte short audio descriptor into caps. The platforms read the
+ * descriptors from their EDID control and call this for each of them.
+ */
+void edid_caps_add_sad(struct edid_audio_caps *caps, const unsigned char *sad);
+
+#endif /* EDID_H */
@@ -33,6 +33,9 @@
 #include "platform.h"
 #include "audio_extn.h"
 #include "voice_extn.h"
+#include "snd_card.h"
+#include "name_index.h"
+#include "edid.h"
 #include "sound/compress_params.h"
 #ifdef HWDEP_CAL_ENABLED
 #include "sound/msmcal-hwdep.h"
@@ -71,12 +74,7 @@
 #define MAX_SAD_BLOCKS      10
 #define SAD_BLOCK_SIZE      3
 
-/* EDID format ID for LPCM audio */
-#define EDID_FORMAT_LPCM    1
-
-/* Retry for delay in FW loading*/
-#define RETRY_NUMBER 10
-#define RETRY_US 500000
+/* cards above this are not considered, see snd_card_discover() */
 #define MAX_SND_CARD 8
 
 #define SAMPLE_RATE_8KHZ  8000
@@ -144,6 +142,14 @@ static int pcm_device_table[AUDIO_USECASE_MAX][2] = {
                                         MULTIMEDIA2_PCM_DEVICE},
     [USECASE_AUDIO_PLAYBACK_OFFLOAD] =
                      {PLAYBACK_OFFLOAD_DEVICE, PLAYBACK_OFFLOAD_DEVICE},
+    /* the other offload sessions get their device from audio_platform_info.xml */
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD2] = {-1, -1},
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD3] = {-1, -1},
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD4] = {-1, -1},
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD5] = {-1, -1},
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD6] = {-1, -1},
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD7] = {-1, -1},
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD8] = {-1, -1},
     [USECASE_AUDIO_RECORD] = {AUDIO_RECORD_PCM_DEVICE, AUDIO_RECORD_PCM_DEVICE},
     [USECASE_AUDIO_RECORD_COMPRESS] = {COMPRESS_CAPTURE_DEVICE, COMPRESS_CAPTURE_DEVICE},
     [USECASE_AUDIO_RECORD_LOW_LATENCY] = {LOWLATENCY_PCM_DEVICE,
@@ -344,13 +350,6 @@ static int acdb_device_table[SND_DEVICE_MAX] = {
     [SND_DEVICE_IN_CAPTURE_VI_FEEDBACK] = 102,
 };
 
-struct name_to_index {
-    char name[100];
-    unsigned int index;
-};
-
-#define TO_NAME_INDEX(X)   #X, X
-
 /* Used to get index from parsed sting */
 static struct name_to_index snd_device_name_index[SND_DEVICE_MAX] = {
     {TO_NAME_INDEX(SND_DEVICE_OUT_HANDSET)},
@@ -436,11 +435,22 @@ static struct name_to_index snd_device_name_index[SND_DEVICE_MAX] = {
 
 static char * backend_table[SND_DEVICE_MAX] = {0};
 
+/* DSP latency after the backend in Us, from audio_platform_info.xml or
+ * latency calibration */
+static int64_t render_latency_table[SND_DEVICE_MAX] = {0};
+
 static struct name_to_index usecase_name_index[AUDIO_USECASE_MAX] = {
     {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_DEEP_BUFFER)},
     {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_LOW_LATENCY)},
     {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_MULTI_CH)},
     {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD2)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD3)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD4)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD5)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD6)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD7)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD8)},
     {TO_NAME_INDEX(USECASE_AUDIO_RECORD)},
     {TO_NAME_INDEX(USECASE_AUDIO_RECORD_COMPRESS)},
     {TO_NAME_INDEX(USECASE_AUDIO_RECORD_LOW_LATENCY)},
@@ -731,6 +741,16 @@ static void set_platform_defaults(struct platform_data * my_data __unused)
     backend_table[SND_DEVICE_OUT_TRANSMISSION_FM] = strdup("transmission-fm");
 }
 
+/* the first card that registers is the one to use */
+static bool platform_match_snd_card(int card, const char *name, void *arg)
+{
+    struct platform_data *my_data = (struct platform_data *)arg;
+
+    ALOGD("%s: card %d snd_card_name: %s", __func__, card, name);
+    my_data->hw_info = hw_info_init(name);
+    return true;
+}
+
 void *platform_init(struct audio_device *adev)
 {
     char platform[PROPERTY_VALUE_MAX];
@@ -738,8 +758,7 @@ void *platform_init(struct audio_device *adev)
     char baseband_arch[PROPERTY_VALUE_MAX];
     char value[PROPERTY_VALUE_MAX];
     struct platform_data *my_data = NULL;
-    int retry_num = 0, snd_card_num = 0;
-    const char *snd_card_name;
+    int snd_card_num;
 
     my_data = calloc(1, sizeof(struct platform_data));
 
@@ -748,51 +767,33 @@ void *platform_init(struct audio_device *adev)
         return NULL;
     }
 
-    while (snd_card_num < MAX_SND_CARD) {
-        adev->mixer = mixer_open(snd_card_num);
-
-        while (!adev->mixer && retry_num < RETRY_NUMBER) {
-            usleep(RETRY_US);
-            adev->mixer = mixer_open(snd_card_num);
-            retry_num++;
-        }
-
-        if (!adev->mixer) {
-            ALOGE("%s: Unable to open the mixer card: %d", __func__,
-                   snd_card_num);
-            retry_num = 0;
-            snd_card_num++;
-            continue;
-        }
-
-        snd_card_name = mixer_get_name(adev->mixer);
-        ALOGD("%s: snd_card_name: %s", __func__, snd_card_name);
-
-        my_data->hw_info = hw_info_init(snd_card_name);
-
-        adev->audio_route = audio_route_init(snd_card_num,
-                                         MIXER_XML_PATH);
-        if (!adev->audio_route) {
-            ALOGE("%s: Failed to init audio route controls, aborting.",
-                   __func__);
-            free(my_data);
-            mixer_close(adev->mixer);
-            return NULL;
-        }
-        adev->snd_card = snd_card_num;
-        ALOGD("%s: Opened sound card:%d", __func__, snd_card_num);
-        break;
+    snd_card_num = snd_card_discover(platform_match_snd_card, my_data,
+                                     MAX_SND_CARD);
+    if (snd_card_num < 0) {
+        ALOGE("%s: Unable to find correct sound card, aborting.", __func__);
+        free(my_data);
+        return NULL;
+    }
 
-        retry_num = 0;
-        snd_card_num++;
-        mixer_close(adev->mixer);
+    adev->mixer = mixer_open(snd_card_num);
+    if (!adev->mixer) {
+        ALOGE("%s: Unable to open the mixer card: %d", __func__,
+               snd_card_num);
+        free(my_data);
+        return NULL;
     }
 
-    if (snd_card_num >= MAX_SND_CARD) {
-        ALOGE("%s: Unable to find correct sound card, aborting.", __func__);
+    adev->audio_route = audio_route_init(snd_card_num,
+                                     MIXER_XML_PATH);
+    if (!adev->audio_route) {
+        ALOGE("%s: Failed to init audio route controls, aborting.",
+               __func__);
         free(my_data);
+        mixer_close(adev->mixer);
         return NULL;
     }
+    adev->snd_card = snd_card_num;
+    ALOGD("%s: Opened sound card:%d", __func__, snd_card_num);
 
     //set max volume step for voice call
     property_get("ro.config.vc_call_vol_steps", value, TOSTRING(MAX_VOL_INDEX));
@@ -969,49 +970,22 @@ int platform_get_pcm_device_id(audio_usecase_t usecase, int device_type)
     return device_id;
 }
 
-static int find_index(struct name_to_index * table, int32_t len, const char * name)
-{
-    int ret = 0;
-    int32_t i;
-
-    if (table == NULL) {
-        ALOGE("%s: table is NULL", __func__);
-        ret = -ENODEV;
-        goto done;
-    }
-
-    if (name == NULL) {
-        ALOGE("null key");
-        ret = -ENODEV;
-        goto done;
-    }
+_Static_assert(NAME_INDEX_HASH_FITS(SND_DEVICE_MAX), "NAME_INDEX_HASH_SIZE is too small");
+_Static_assert(NAME_INDEX_HASH_FITS(AUDIO_USECASE_MAX), "NAME_INDEX_HASH_SIZE is too small");
 
-    for (i=0; i < len; i++) {
-        const char* tn = table[i].name;
-        size_t len = strlen(tn);
-        if (strncmp(tn, name, len) == 0) {
-            if (strlen(name) != len) {
-                continue; // substring
-            }
-            ret = table[i].index;
-            goto done;
-        }
-    }
-    ALOGE("%s: Could not find index for name = %s",
-            __func__, name);
-    ret = -ENODEV;
-done:
-    return ret;
-}
+static struct name_index_hash snd_device_name_hash;
+static struct name_index_hash usecase_name_hash;
 
 int platform_get_snd_device_index(char *device_name)
 {
-    return find_index(snd_device_name_index, SND_DEVICE_MAX, device_name);
+    return name_index_find(&snd_device_name_hash, snd_device_name_index,
+                           SND_DEVICE_MAX, device_name);
 }
 
 int platform_get_usecase_index(const char *usecase_name)
 {
-    return find_index(usecase_name_index, AUDIO_USECASE_MAX, usecase_name);
+    return name_index_find(&usecase_name_hash, usecase_name_index,
+                           AUDIO_USECASE_MAX, usecase_name);
 }
 
 int platform_set_snd_device_acdb_id(snd_device_t snd_device, unsigned int acdb_id)
@@ -1030,6 +1004,15 @@ done:
     return ret;
 }
 
+int platform_get_snd_device_acdb_id(snd_device_t snd_device)
+{
+    if ((snd_device < SND_DEVICE_MIN) || (snd_device >= SND_DEVICE_MAX)) {
+        ALOGE("%s: Invalid snd_device = %d", __func__, snd_device);
+        return -EINVAL;
+    }
+    return acdb_device_table[snd_device];
+}
+
 #ifdef FLUENCE_ENABLED
 int platform_set_fluence_type(void *platform, char *value)
 {
@@ -1240,7 +1223,7 @@ int platform_set_voice_volume(void *platform, int volume)
     // But this values don't changed in kernel. So, below change is need.
     vol_index = (int)percent_to_index(volume, MIN_VOL_INDEX, my_data->max_vol_index);
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1270,7 +1253,7 @@ int platform_set_mic_mute(void *platform, bool state)
     const char *mixer_ctl_name = "Voice Tx Mute";
     int ret = 0;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1313,7 +1296,7 @@ int platform_set_device_mute(void *platform, bool state, char *dir)
         return -EINVAL;
     }
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1354,7 +1337,7 @@ int set_emu_antipop(struct audio_device *adev, int emu_antipop)
 
     if (emu_antipop == emu_antipop_state) return 0;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1856,7 +1839,7 @@ int platform_set_hdmi_channels(void *platform,  int channel_count)
     default:
         channel_cnt_str = "Two"; break;
     }
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1867,99 +1850,83 @@ int platform_set_hdmi_channels(void *platform,  int channel_count)
     return 0;
 }
 
-/* Legacy EDID channel retrieval */
-#define MAX_EDID_BLOCKS             10
+/* Legacy EDID retrieval */
 #define MAX_SHORT_AUDIO_DESC_CNT    30
 #define MIN_AUDIO_DESC_LENGTH       3
-#define MAX_CHANNELS_SUPPORTED      8
 
-int legacy_edid_get_max_channels() {
-    unsigned char channels[16];
+static int legacy_edid_get_caps(struct edid_audio_caps *caps) {
     unsigned char* data = NULL;
+    unsigned char* sad;
     int i = 0;
     int count = 0;
-    int channel_count = 0;
     int length = 0;
-    int nCountDesc = 0;
-    unsigned int sad[MAX_SHORT_AUDIO_DESC_CNT];
+    long size;
 
     const char* file = "/sys/class/graphics/fb1/audio_data_block";
     FILE* fpaudiocaps = fopen(file, "rb");
     if (fpaudiocaps) {
         ALOGV("%s: Opened audio_data_block successfully\n", __func__);
         fseek(fpaudiocaps, 0, SEEK_END);
-        long size = ftell(fpaudiocaps);
+        size = ftell(fpaudiocaps);
         ALOGV("%s: audio_data_block size is %ld\n", __func__, size);
         data = (unsigned char*)malloc(size);
         if (data) {
             fseek(fpaudiocaps, 0, SEEK_SET);
-            fread(data, 1, size, fpaudiocaps);
+            size = fread(data, 1, size, fpaudiocaps);
         }
         fclose(fpaudiocaps);
     } else {
         ALOGE("%s: Failed to open audio_data_block", __func__);
-        return channel_count;
-    }
-
-    if (data) {
-        memcpy(&count, data, sizeof(int));
-        data += sizeof(int);
-        ALOGV("%s: Audio Block Count is %d\n", __func__, count);
-        memcpy(&length, data, sizeof(int));
-        data += sizeof(int);
-        ALOGV("%s: Total length is %d\n", __func__, length);
-
-        for (i = 0; length >= MIN_AUDIO_DESC_LENGTH
-                && count < MAX_SHORT_AUDIO_DESC_CNT; i++) {
-            sad[i] =    (unsigned int)data[0]
-                     + ((unsigned int)data[1] << 8)
-                     + ((unsigned int)data[2] << 16);
-            nCountDesc++;
-            length -= MIN_AUDIO_DESC_LENGTH;
-            data += MIN_AUDIO_DESC_LENGTH;
-        }
-        ALOGV("%s: Total # of audio descriptors is %d\n",
-                __func__, nCountDesc);
-
-        for (i = 0; i < nCountDesc; i++)
-            channels[i] = (sad[i] & 0x7) + 1;
+        return -ENODEV;
+    }
 
+    if (!data)
+        return -ENOMEM;
+    if (size < (long)(2 * sizeof(int))) {
         free(data);
+        return -EINVAL;
     }
 
-    for (i = 0; i < nCountDesc && i < MAX_EDID_BLOCKS; i++) {
-        if ((int)channels[i] > channel_count
-                && (int)channels[i] <= MAX_CHANNELS_SUPPORTED)
-            channel_count = (int)channels[i];
+    memcpy(&count, data, sizeof(int));
+    ALOGV("%s: Audio Block Count is %d\n", __func__, count);
+    memcpy(&length, data + sizeof(int), sizeof(int));
+    ALOGV("%s: Total length is %d\n", __func__, length);
+    if (length > size - (long)(2 * sizeof(int)))
+        length = size - 2 * sizeof(int);
+
+    sad = data + 2 * sizeof(int);
+    for (i = 0; length >= MIN_AUDIO_DESC_LENGTH &&
+                i < MAX_SHORT_AUDIO_DESC_CNT; i++) {
+        edid_caps_add_sad(caps, sad);
+        length -= MIN_AUDIO_DESC_LENGTH;
+        sad += MIN_AUDIO_DESC_LENGTH;
     }
+    free(data);
 
-    ALOGD("%s: Max channels reported by audio_data_block is: %d\n",
-            __func__, channel_count);
+    ALOGD("%s: %d audio descriptors, max channels %d\n",
+            __func__, i, caps->max_channels);
 
-    return channel_count;
+    return 0;
 }
 
-int platform_edid_get_max_channels(void *platform)
+int platform_edid_get_caps(void *platform, struct edid_audio_caps *caps)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
     struct audio_device *adev = my_data->adev;
-    char block[MAX_SAD_BLOCKS * SAD_BLOCK_SIZE];
-    char *sad = block;
+    unsigned char block[MAX_SAD_BLOCKS * SAD_BLOCK_SIZE];
     int num_audio_blocks;
-    int channel_count;
-    int max_channels = 0;
     int i, ret, count;
 
     struct mixer_ctl *ctl;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, AUDIO_DATA_BLOCK_MIXER_CTL);
+    memset(caps, 0, sizeof(*caps));
+    ctl = get_mixer_ctl(adev, AUDIO_DATA_BLOCK_MIXER_CTL);
     if (!ctl) {
         /* A-Family devices likely do not have HDMI EDID ctl,
          * attempt fall-back to legacy sysfs EDID retrieval.
          */
-        max_channels = legacy_edid_get_max_channels();
-        if (max_channels > 0)
-            return max_channels;
+        if (legacy_edid_get_caps(caps) == 0)
+            return 0;
 
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, AUDIO_DATA_BLOCK_MIXER_CTL);
@@ -1977,28 +1944,16 @@ int platform_edid_get_max_channels(void *platform)
     ret = mixer_ctl_get_array(ctl, block, count);
     if (ret != 0) {
         ALOGE("%s: mixer_ctl_get_array() failed to get EDID info", __func__);
-        return 0;
+        return -EIO;
     }
 
     /* Calculate the number of SAD blocks */
     num_audio_blocks = count / SAD_BLOCK_SIZE;
 
-    for (i = 0; i < num_audio_blocks; i++) {
-        /* Only consider LPCM blocks */
-        if ((sad[0] >> 3) != EDID_FORMAT_LPCM) {
-            sad += 3;
-            continue;
-        }
-
-        channel_count = (sad[0] & 0x7) + 1;
-        if (channel_count > max_channels)
-            max_channels = channel_count;
+    for (i = 0; i < num_audio_blocks; i++)
+        edid_caps_add_sad(caps, block + i * SAD_BLOCK_SIZE);
 
-        /* Advance to next block */
-        sad += 3;
-    }
-
-    return max_channels;
+    return 0;
 }
 
 static int platform_set_slowtalk(struct platform_data *my_data, bool state)
@@ -2011,7 +1966,7 @@ static int platform_set_slowtalk(struct platform_data *my_data, bool state)
                               ALL_SESSION_VSID};
 
     set_values[0] = state;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -2036,6 +1991,13 @@ static int platform_set_slowtalk(struct platform_data *my_data, bool state)
     return ret;
 }
 
+/* keys consumed by platform_set_parameters(), see adev_set_parameters() */
+const char * const platform_parameter_keys[] = {
+    AUDIO_PARAMETER_KEY_BTSCO,
+    AUDIO_PARAMETER_KEY_SLOWTALK,
+    NULL,
+};
+
 int platform_set_parameters(void *platform, struct str_parms *parms)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
@@ -2180,6 +2142,10 @@ void platform_get_parameters(void *platform,
     free(kv_pairs);
 }
 
+void platform_dump(void *platform __unused, int fd __unused)
+{
+}
+
 /* Delay in Us */
 int64_t platform_render_latency(audio_usecase_t usecase)
 {
@@ -2193,6 +2159,26 @@ int64_t platform_render_latency(audio_usecase_t usecase)
     }
 }
 
+int64_t platform_get_snd_device_render_latency(snd_device_t snd_device)
+{
+    if ((snd_device < SND_DEVICE_MIN) || (snd_device >= SND_DEVICE_MAX))
+        return 0;
+    return render_latency_table[snd_device];
+}
+
+int platform_set_snd_device_render_latency(snd_device_t snd_device,
+                                           int64_t latency_us)
+{
+    if ((snd_device < SND_DEVICE_MIN) || (snd_device >= SND_DEVICE_MAX) ||
+            latency_us < 0) {
+        ALOGE("%s: Invalid snd_device = %d or latency = %lld",
+              __func__, snd_device, (long long)latency_us);
+        return -EINVAL;
+    }
+    render_latency_table[snd_device] = latency_us;
+    return 0;
+}
+
 int platform_update_usecase_from_source(int source, int usecase)
 {
     ALOGV("%s: input source :%d", __func__, source);
@@ -2252,12 +2238,21 @@ uint32_t platform_get_pcm_offload_buffer_size(audio_offload_info_t* info)
 {
     uint32_t fragment_size = MIN_PCM_OFFLOAD_FRAGMENT_SIZE;
     uint32_t bits_per_sample = 16;
+    uint32_t channels = popcount(info->channel_mask);
 
-#ifdef EXTN_OFFLOAD_ENABLED
-    if (info->format == AUDIO_FORMAT_PCM_24_BIT_OFFLOAD) {
+    /* sized as stereo when the mask is missing rather than dividing by 0 */
+    if (channels == 0)
+        channels = 2;
+
+    switch (info->format & AUDIO_FORMAT_SUB_MASK) {
+    case AUDIO_FORMAT_PCM_SUB_8_24_BIT:
+    case AUDIO_FORMAT_PCM_SUB_32_BIT:
         bits_per_sample = 32;
+        break;
+    case AUDIO_FORMAT_PCM_SUB_24_BIT_PACKED:
+        bits_per_sample = 24;
+        break;
     }
-#endif
 
     if (!info->has_video) {
         fragment_size = MAX_PCM_OFFLOAD_FRAGMENT_SIZE;
@@ -2266,13 +2261,13 @@ uint32_t platform_get_pcm_offload_buffer_size(audio_offload_info_t* info)
         fragment_size = (PCM_OFFLOAD_BUFFER_DURATION_FOR_AV_STREAMING
                                      * info->sample_rate
                                      * (bits_per_sample >> 3)
-                                     * popcount(info->channel_mask))/1000;
+                                     * channels)/1000;
 
     } else if (info->has_video) {
         fragment_size = (PCM_OFFLOAD_BUFFER_DURATION_FOR_AV
                                      * info->sample_rate
                                      * (bits_per_sample >> 3)
-                                     * popcount(info->channel_mask))/1000;
+                                     * channels)/1000;
     }
 
     char value[PROPERTY_VALUE_MAX] = {0};
@@ -2289,6 +2284,10 @@ uint32_t platform_get_pcm_offload_buffer_size(audio_offload_info_t* info)
     else if(fragment_size > MAX_PCM_OFFLOAD_FRAGMENT_SIZE)
         fragment_size = MAX_PCM_OFFLOAD_FRAGMENT_SIZE;
 
+    /* packed 24 bit frames do not divide 1024, keep whole frames */
+    if (bits_per_sample == 24)
+        fragment_size -= fragment_size % (3 * channels);
+
     ALOGV("%s: fragment_size %d", __func__, fragment_size);
     return fragment_size;
 }
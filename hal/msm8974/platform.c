@@ -23,6 +23,8 @@
 
 #include <stdlib.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
 #include <fcntl.h>
 #include <cutils/log.h>
 #include <sys/ioctl.h>
@@ -33,10 +35,16 @@
 #include "platform.h"
 #include "audio_extn.h"
 #include "voice_extn.h"
+#include "snd_card.h"
+#include "name_index.h"
+#include "edid.h"
 #include "sound/compress_params.h"
 #ifdef HWDEP_CAL_ENABLED
 #include "sound/msmcal-hwdep.h"
 #endif
+#if defined(HWDEP_CAL_ENABLED) && defined(AUDIO_SIMULATOR_ENABLED)
+#include "sim/sim.h"
+#endif
 
 #define SOUND_TRIGGER_DEVICE_HANDSET_MONO_LOW_POWER_ACDB_ID (100)
 
@@ -73,12 +81,7 @@
 #define MAX_SAD_BLOCKS      10
 #define SAD_BLOCK_SIZE      3
 
-/* EDID format ID for LPCM audio */
-#define EDID_FORMAT_LPCM    1
-
-/* Retry for delay in FW loading*/
-#define RETRY_NUMBER 10
-#define RETRY_US 500000
+/* cards above this are not considered, see snd_card_discover() */
 #define MAX_SND_CARD 8
 
 #define SAMPLE_RATE_8KHZ  8000
@@ -150,6 +153,14 @@ static int pcm_device_table[AUDIO_USECASE_MAX][2] = {
                                         MULTIMEDIA2_PCM_DEVICE},
     [USECASE_AUDIO_PLAYBACK_OFFLOAD] =
                      {PLAYBACK_OFFLOAD_DEVICE, PLAYBACK_OFFLOAD_DEVICE},
+    /* the other offload sessions get their device from audio_platform_info.xml */
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD2] = {-1, -1},
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD3] = {-1, -1},
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD4] = {-1, -1},
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD5] = {-1, -1},
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD6] = {-1, -1},
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD7] = {-1, -1},
+    [USECASE_AUDIO_PLAYBACK_OFFLOAD8] = {-1, -1},
     [USECASE_AUDIO_RECORD] = {AUDIO_RECORD_PCM_DEVICE, AUDIO_RECORD_PCM_DEVICE},
     [USECASE_AUDIO_RECORD_COMPRESS] = {COMPRESS_CAPTURE_DEVICE, COMPRESS_CAPTURE_DEVICE},
     [USECASE_AUDIO_RECORD_LOW_LATENCY] = {LOWLATENCY_PCM_DEVICE,
@@ -348,13 +359,6 @@ static int acdb_device_table[SND_DEVICE_MAX] = {
     [SND_DEVICE_IN_CAPTURE_VI_FEEDBACK] = 102,
 };
 
-struct name_to_index {
-    char name[100];
-    unsigned int index;
-};
-
-#define TO_NAME_INDEX(X)   #X, X
-
 /* Used to get index from parsed sting */
 static struct name_to_index snd_device_name_index[SND_DEVICE_MAX] = {
     {TO_NAME_INDEX(SND_DEVICE_OUT_HANDSET)},
@@ -436,11 +440,22 @@ static struct name_to_index snd_device_name_index[SND_DEVICE_MAX] = {
 
 static char * backend_table[SND_DEVICE_MAX] = {0};
 
+/* DSP latency after the backend in Us, from audio_platform_info.xml or
+ * latency calibration */
+static int64_t render_latency_table[SND_DEVICE_MAX] = {0};
+
 static struct name_to_index usecase_name_index[AUDIO_USECASE_MAX] = {
     {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_DEEP_BUFFER)},
     {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_LOW_LATENCY)},
     {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_MULTI_CH)},
     {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD2)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD3)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD4)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD5)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD6)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD7)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD8)},
     {TO_NAME_INDEX(USECASE_AUDIO_RECORD)},
     {TO_NAME_INDEX(USECASE_AUDIO_RECORD_COMPRESS)},
     {TO_NAME_INDEX(USECASE_AUDIO_RECORD_LOW_LATENCY)},
@@ -472,67 +487,222 @@ static struct name_to_index usecase_name_index[AUDIO_USECASE_MAX] = {
 #define LOW_LATENCY_PLATFORM_DELAY (13*1000LL)
 
 #ifdef HWDEP_CAL_ENABLED
+/*
+ * Codec calibration is sent once per WCD9XXX calibration type at boot. The
+ * sizes are queried up front so that all types share one allocation, then
+ * the ACDB fetch of a type overlaps the hwdep ioctl of the previous one,
+ * which a worker thread issues in type order. The loader is only ever called
+ * from the thread running platform_init().
+ */
+#define HWDEP_CAL_ALIGN 8
+
+struct param_data {
+    int    use_case;
+    int    acdb_id;
+    int    get_size;
+    int    buff_size;
+    int    data_size;
+    void   *buff;
+};
+
+/* how long each step took for one calibration type, for dump */
+struct hwdep_cal_timing {
+    uint32_t bytes;
+    uint32_t size_us;
+    uint32_t fetch_us;
+    uint32_t ioctl_us;
+    int      status;    /* 0 if the ioctl succeeded, else a negative errno */
+};
+
+struct hwdep_cal_pipeline {
+    int fd;
+    int count;          /* types being sent, from WCD9XXX_ANC_CAL */
+    int fetched;        /* types ready for the ioctl */
+    bool fetch_done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct param_data calib[WCD9XXX_MAX_CAL];
+};
+
+static struct hwdep_cal_timing hwdep_cal_timing[WCD9XXX_MAX_CAL];
+static uint32_t hwdep_cal_total_us;
+static bool hwdep_cal_parallel;
+
+static uint32_t hwdep_cal_elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((now.tv_sec - start->tv_sec) * 1000000LL +
+                      (now.tv_nsec - start->tv_nsec) / 1000);
+}
+
 static int hw_util_open(int card_no)
 {
+#ifdef AUDIO_SIMULATOR_ENABLED
+    return sim_hwdep_open(card_no, WCD9XXX_CODEC_HWDEP_NODE);
+#else
     int fd = -1;
     char dev_name[256];
 
     snprintf(dev_name, sizeof(dev_name), "/dev/snd/hwC%uD%u",
                                card_no, WCD9XXX_CODEC_HWDEP_NODE);
-    ALOGE("%s Opening device %s\n", __func__, dev_name);
+    ALOGV("%s Opening device %s\n", __func__, dev_name);
     fd = open(dev_name, O_WRONLY);
     if (fd < 0) {
         ALOGE("%s: cannot open device '%s'\n", __func__, dev_name);
         return fd;
     }
-    ALOGE("%s success", __func__);
     return fd;
+#endif
 }
 
-struct param_data {
-    int    use_case;
-    int    acdb_id;
-    int    get_size;
-    int    buff_size;
-    int    data_size;
-    void   *buff;
-};
+static void hwdep_cal_ioctl(struct hwdep_cal_pipeline *pipe, int type)
+{
+    struct wcdcal_ioctl_buffer codec_buffer;
+    struct timespec start;
+    int ret;
 
-static int send_codec_cal(acdb_loader_get_calibration_t acdb_loader_get_calibration, int fd)
+    codec_buffer.buffer = pipe->calib[type].buff;
+    codec_buffer.size = pipe->calib[type].data_size;
+    codec_buffer.cal_type = type;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#ifdef AUDIO_SIMULATOR_ENABLED
+    ret = sim_hwdep_write(pipe->fd, type, codec_buffer.size);
+#else
+    ret = ioctl(pipe->fd, SNDRV_CTL_IOCTL_HWDEP_CAL_TYPE, &codec_buffer);
+#endif
+    hwdep_cal_timing[type].ioctl_us = hwdep_cal_elapsed_us(&start);
+    hwdep_cal_timing[type].status = ret < 0 ? -errno : 0;
+    if (ret < 0)
+        ALOGE("Failed to call ioctl  for %s err=%d",
+                              cal_name_info[type], errno);
+}
+
+/* issues the ioctls in type order as the fetches complete */
+static void *hwdep_cal_thread_loop(void *context)
 {
-    int ret = 0, type;
+    struct hwdep_cal_pipeline *pipe = (struct hwdep_cal_pipeline *)context;
+    int type = WCD9XXX_ANC_CAL;
+
+    pthread_mutex_lock(&pipe->lock);
+    for (;;) {
+        while (type >= pipe->fetched && !pipe->fetch_done)
+            pthread_cond_wait(&pipe->cond, &pipe->lock);
+        if (type >= pipe->fetched)
+            break;
+        pthread_mutex_unlock(&pipe->lock);
+        hwdep_cal_ioctl(pipe, type++);
+        pthread_mutex_lock(&pipe->lock);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+    return NULL;
+}
 
-    for (type = WCD9XXX_ANC_CAL; type < WCD9XXX_MAX_CAL; type++) {
-        struct wcdcal_ioctl_buffer codec_buffer;
-        struct param_data calib;
+/* sizes every type, stopping at the first the loader fails to size */
+static size_t hwdep_cal_query_sizes(struct hwdep_cal_pipeline *pipe,
+                                    acdb_loader_get_calibration_t get_cal)
+{
+    struct param_data *calib;
+    struct timespec start;
+    size_t total = 0;
+    int type;
 
+    for (type = WCD9XXX_ANC_CAL; type < WCD9XXX_MAX_CAL; type++) {
+        calib = &pipe->calib[type];
         if (!strcmp(cal_name_info[type], "mad_cal"))
-            calib.acdb_id = SOUND_TRIGGER_DEVICE_HANDSET_MONO_LOW_POWER_ACDB_ID;
-        calib.get_size = 1;
-        ret = acdb_loader_get_calibration(cal_name_info[type], sizeof(struct param_data),
-                                                                 &calib);
-        if (ret < 0) {
-            ALOGE("%s get_calibration failed\n", __func__);
-            return ret;
+            calib->acdb_id = SOUND_TRIGGER_DEVICE_HANDSET_MONO_LOW_POWER_ACDB_ID;
+        calib->get_size = 1;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (get_cal(cal_name_info[type], sizeof(struct param_data), calib) < 0 ||
+                calib->buff_size < 0) {
+            ALOGE("%s get_calibration failed for %s\n", __func__,
+                  cal_name_info[type]);
+            break;
         }
-        calib.get_size = 0;
-        calib.buff = malloc(calib.buff_size);
+        hwdep_cal_timing[type].size_us = hwdep_cal_elapsed_us(&start);
+        calib->get_size = 0;
+        total += ALIGN((size_t)calib->buff_size, HWDEP_CAL_ALIGN);
+    }
+    pipe->count = type;
+    return total;
+}
+
+static int send_codec_cal(acdb_loader_get_calibration_t acdb_loader_get_calibration, int fd)
+{
+    struct hwdep_cal_pipeline pipe;
+    struct timespec start, fetch_start;
+    pthread_t thread;
+    uint8_t *arena, *next;
+    size_t arena_size;
+    int ret = 0, type;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(&pipe, 0, sizeof(pipe));
+    memset(hwdep_cal_timing, 0, sizeof(hwdep_cal_timing));
+    pipe.fd = fd;
+
+    arena_size = hwdep_cal_query_sizes(&pipe, acdb_loader_get_calibration);
+    if (pipe.count == WCD9XXX_ANC_CAL)
+        return -EINVAL;
+    arena = (uint8_t *)malloc(arena_size);
+    if (arena == NULL) {
+        ALOGE("%s: no memory for %zu bytes of calibration", __func__,
+              arena_size);
+        return -ENOMEM;
+    }
+    for (next = arena, type = WCD9XXX_ANC_CAL; type < pipe.count; type++) {
+        pipe.calib[type].buff = next;
+        next += ALIGN((size_t)pipe.calib[type].buff_size, HWDEP_CAL_ALIGN);
+    }
+
+    pthread_mutex_init(&pipe.lock, (const pthread_mutexattr_t *) NULL);
+    pthread_cond_init(&pipe.cond, (const pthread_condattr_t *) NULL);
+    hwdep_cal_parallel = pthread_create(&thread, (const pthread_attr_t *) NULL,
+                                        hwdep_cal_thread_loop, &pipe) == 0;
+    if (!hwdep_cal_parallel)
+        ALOGW("%s: no thread for the ioctls, sending inline", __func__);
+
+    for (type = WCD9XXX_ANC_CAL; type < pipe.count; type++) {
+        clock_gettime(CLOCK_MONOTONIC, &fetch_start);
         ret = acdb_loader_get_calibration(cal_name_info[type],
-                              sizeof(struct param_data), &calib);
+                              sizeof(struct param_data), &pipe.calib[type]);
+        hwdep_cal_timing[type].fetch_us = hwdep_cal_elapsed_us(&fetch_start);
         if (ret < 0) {
-            ALOGE("%s get_calibration failed\n", __func__);
-            free(calib.buff);
-            return ret;
+            ALOGE("%s get_calibration failed for %s\n", __func__,
+                  cal_name_info[type]);
+            break;
         }
-        codec_buffer.buffer = calib.buff;
-        codec_buffer.size = calib.data_size;
-        codec_buffer.cal_type = type;
-        if (ioctl(fd, SNDRV_CTL_IOCTL_HWDEP_CAL_TYPE, &codec_buffer) < 0)
-            ALOGE("Failed to call ioctl  for %s err=%d",
-                                  cal_name_info[type], errno);
-        ALOGE(" %s cal sent for %s", __func__, cal_name_info[type]);
-        free(calib.buff);
-    }
+        hwdep_cal_timing[type].bytes = pipe.calib[type].data_size;
+        if (!hwdep_cal_parallel) {
+            hwdep_cal_ioctl(&pipe, type);
+            continue;
+        }
+        pthread_mutex_lock(&pipe.lock);
+        pipe.fetched = type + 1;
+        pthread_cond_signal(&pipe.cond);
+        pthread_mutex_unlock(&pipe.lock);
+    }
+
+    if (hwdep_cal_parallel) {
+        pthread_mutex_lock(&pipe.lock);
+        pipe.fetch_done = true;
+        pthread_cond_signal(&pipe.cond);
+        pthread_mutex_unlock(&pipe.lock);
+        pthread_join(thread, (void **) NULL);
+    }
+    pthread_cond_destroy(&pipe.cond);
+    pthread_mutex_destroy(&pipe.lock);
+    free(arena);
+
+    hwdep_cal_total_us = hwdep_cal_elapsed_us(&start);
+    for (type = WCD9XXX_ANC_CAL; type < WCD9XXX_MAX_CAL; type++)
+        ALOGI("%s: %s %u bytes, size %u us, fetch %u us, ioctl %u us%s",
+              __func__, cal_name_info[type], hwdep_cal_timing[type].bytes,
+              hwdep_cal_timing[type].size_us, hwdep_cal_timing[type].fetch_us,
+              hwdep_cal_timing[type].ioctl_us,
+              type < pipe.count ? "" : " (not sent)");
+    ALOGI("%s: codec calibration sent in %u us", __func__, hwdep_cal_total_us);
     return ret;
 }
 
@@ -540,6 +710,9 @@ static void audio_hwdep_send_cal(struct platform_data *plat_data)
 {
     int fd;
 
+    /* dlsym() would look the symbol up in the global scope instead */
+    if (plat_data->acdb_handle == NULL)
+        return;
     fd = hw_util_open(plat_data->adev->snd_card);
     if (fd == -1) {
         ALOGE("%s error open\n", __func__);
@@ -556,7 +729,24 @@ static void audio_hwdep_send_cal(struct platform_data *plat_data)
     }
     if (send_codec_cal(acdb_loader_get_calibration, fd) < 0)
         ALOGE("%s: Could not send anc cal", __FUNCTION__);
+    close(fd);
+}
+
+static void hwdep_cal_dump(int fd)
+{
+    int type;
+
+    dprintf(fd, "  codec calibration %u us%s\n", hwdep_cal_total_us,
+            hwdep_cal_parallel ? ", ioctls on a worker thread" : "");
+    for (type = WCD9XXX_ANC_CAL; type < WCD9XXX_MAX_CAL; type++)
+        dprintf(fd, "    %s %u bytes, size %u us, fetch %u us, ioctl %u us, "
+                "status %d\n", cal_name_info[type],
+                hwdep_cal_timing[type].bytes, hwdep_cal_timing[type].size_us,
+                hwdep_cal_timing[type].fetch_us,
+                hwdep_cal_timing[type].ioctl_us, hwdep_cal_timing[type].status);
 }
+#else
+#define hwdep_cal_dump(fd) do { } while (0)
 #endif
 
 static void set_echo_reference(struct audio_device *adev, bool enable)
@@ -723,13 +913,28 @@ static void set_platform_defaults(struct platform_data * my_data __unused)
     backend_table[SND_DEVICE_OUT_TRANSMISSION_FM] = strdup("transmission-fm");
 }
 
+/* the card to use is the first one the hardware variants know */
+static bool platform_match_snd_card(int card, const char *name, void *arg)
+{
+    struct platform_data *my_data = (struct platform_data *)arg;
+
+    ALOGD("%s: card %d snd_card_name: %s", __func__, card, name);
+    my_data->hw_info = hw_info_init(name);
+    if (!my_data->hw_info) {
+        ALOGE("%s: Failed to init hardware info", __func__);
+        return false;
+    }
+    return true;
+}
+
 void *platform_init(struct audio_device *adev)
 {
     char platform[PROPERTY_VALUE_MAX];
     char baseband[PROPERTY_VALUE_MAX];
     char value[PROPERTY_VALUE_MAX];
+    char acdb_lib[PROPERTY_VALUE_MAX];
     struct platform_data *my_data = NULL;
-    int retry_num = 0, snd_card_num = 0;
+    int snd_card_num;
     const char *snd_card_name;
 
     my_data = calloc(1, sizeof(struct platform_data));
@@ -739,61 +944,42 @@ void *platform_init(struct audio_device *adev)
         return NULL;
     }
 
-    while (snd_card_num < MAX_SND_CARD) {
-        adev->mixer = mixer_open(snd_card_num);
-
-        while (!adev->mixer && retry_num < RETRY_NUMBER) {
-            usleep(RETRY_US);
-            adev->mixer = mixer_open(snd_card_num);
-            retry_num++;
-        }
-
-        if (!adev->mixer) {
-            ALOGE("%s: Unable to open the mixer card: %d", __func__,
-                   snd_card_num);
-            retry_num = 0;
-            snd_card_num++;
-            continue;
-        }
-
-        snd_card_name = mixer_get_name(adev->mixer);
-        ALOGD("%s: snd_card_name: %s", __func__, snd_card_name);
+    snd_card_num = snd_card_discover(platform_match_snd_card, my_data,
+                                     MAX_SND_CARD);
+    if (snd_card_num < 0) {
+        ALOGE("%s: Unable to find correct sound card, aborting.", __func__);
+        free(my_data);
+        return NULL;
+    }
 
-        my_data->hw_info = hw_info_init(snd_card_name);
-        if (!my_data->hw_info) {
-            ALOGE("%s: Failed to init hardware info", __func__);
-        } else {
-            if (!strncmp(snd_card_name, "msm8226-tomtom-snd-card",
-                         sizeof("msm8226-tomtom-snd-card"))) {
-                ALOGE("%s: Call MIXER_XML_PATH_WCD9330", __func__);
-
-                adev->audio_route = audio_route_init(snd_card_num,
-                                                     MIXER_XML_PATH_WCD9330);
-            } else if (audio_extn_read_xml(adev, snd_card_num, MIXER_XML_PATH,
-                                    MIXER_XML_PATH_AUXPCM) == -ENOSYS)
-                adev->audio_route = audio_route_init(snd_card_num,
-                                                 MIXER_XML_PATH);
-            if (!adev->audio_route) {
-                ALOGE("%s: Failed to init audio route controls, aborting.",
-                       __func__);
-                free(my_data);
-                mixer_close(adev->mixer);
-                return NULL;
-            }
-            adev->snd_card = snd_card_num;
-            ALOGD("%s: Opened sound card:%d", __func__, snd_card_num);
-            break;
-        }
-        retry_num = 0;
-        snd_card_num++;
-        mixer_close(adev->mixer);
+    adev->mixer = mixer_open(snd_card_num);
+    if (!adev->mixer) {
+        ALOGE("%s: Unable to open the mixer card: %d", __func__,
+               snd_card_num);
+        free(my_data);
+        return NULL;
     }
 
-    if (snd_card_num >= MAX_SND_CARD) {
-        ALOGE("%s: Unable to find correct sound card, aborting.", __func__);
+    snd_card_name = mixer_get_name(adev->mixer);
+    if (!strncmp(snd_card_name, "msm8226-tomtom-snd-card",
+                 sizeof("msm8226-tomtom-snd-card"))) {
+        ALOGE("%s: Call MIXER_XML_PATH_WCD9330", __func__);
+
+        adev->audio_route = audio_route_init(snd_card_num,
+                                             MIXER_XML_PATH_WCD9330);
+    } else if (audio_extn_read_xml(adev, snd_card_num, MIXER_XML_PATH,
+                            MIXER_XML_PATH_AUXPCM) == -ENOSYS)
+        adev->audio_route = audio_route_init(snd_card_num,
+                                         MIXER_XML_PATH);
+    if (!adev->audio_route) {
+        ALOGE("%s: Failed to init audio route controls, aborting.",
+               __func__);
         free(my_data);
+        mixer_close(adev->mixer);
         return NULL;
     }
+    adev->snd_card = snd_card_num;
+    ALOGD("%s: Opened sound card:%d", __func__, snd_card_num);
 
     my_data->adev = adev;
     my_data->btsco_sample_rate = SAMPLE_RATE_8KHZ;
@@ -835,34 +1021,41 @@ void *platform_init(struct audio_device *adev)
     }
 
     my_data->voice_feature_set = VOICE_FEATURE_SET_DEFAULT;
-    my_data->acdb_handle = dlopen(LIB_ACDB_LOADER, RTLD_NOW);
+#ifdef AUDIO_SIMULATOR_ENABLED
+    /* a stub loader, such as libacdbloader_sim.so, can stand in off target */
+    property_get("audio_hal.acdb_loader", acdb_lib, LIB_ACDB_LOADER);
+#else
+    /* only simulator builds load a library named by a property */
+    strlcpy(acdb_lib, LIB_ACDB_LOADER, sizeof(acdb_lib));
+#endif
+    my_data->acdb_handle = dlopen(acdb_lib, RTLD_NOW);
     if (my_data->acdb_handle == NULL) {
-        ALOGE("%s: DLOPEN failed for %s", __func__, LIB_ACDB_LOADER);
+        ALOGE("%s: DLOPEN failed for %s", __func__, acdb_lib);
     } else {
-        ALOGV("%s: DLOPEN successful for %s", __func__, LIB_ACDB_LOADER);
+        ALOGV("%s: DLOPEN successful for %s", __func__, acdb_lib);
         my_data->acdb_deallocate = (acdb_deallocate_t)dlsym(my_data->acdb_handle,
                                                     "acdb_loader_deallocate_ACDB");
         if (!my_data->acdb_deallocate)
             ALOGE("%s: Could not find the symbol acdb_loader_deallocate_ACDB from %s",
-                  __func__, LIB_ACDB_LOADER);
+                  __func__, acdb_lib);
 
         my_data->acdb_send_audio_cal = (acdb_send_audio_cal_t)dlsym(my_data->acdb_handle,
                                                     "acdb_loader_send_audio_cal");
         if (!my_data->acdb_send_audio_cal)
             ALOGE("%s: Could not find the symbol acdb_send_audio_cal from %s",
-                  __func__, LIB_ACDB_LOADER);
+                  __func__, acdb_lib);
 
         my_data->acdb_send_voice_cal = (acdb_send_voice_cal_t)dlsym(my_data->acdb_handle,
                                                     "acdb_loader_send_voice_cal");
         if (!my_data->acdb_send_voice_cal)
             ALOGE("%s: Could not find the symbol acdb_loader_send_voice_cal from %s",
-                  __func__, LIB_ACDB_LOADER);
+                  __func__, acdb_lib);
 
         my_data->acdb_reload_vocvoltable = (acdb_reload_vocvoltable_t)dlsym(my_data->acdb_handle,
                                                     "acdb_loader_reload_vocvoltable");
         if (!my_data->acdb_reload_vocvoltable)
             ALOGE("%s: Could not find the symbol acdb_loader_reload_vocvoltable from %s",
-                  __func__, LIB_ACDB_LOADER);
+                  __func__, acdb_lib);
 
         my_data->acdb_init = (acdb_init_t)dlsym(my_data->acdb_handle,
                                                     "acdb_loader_init_ACDB");
@@ -971,49 +1164,22 @@ int platform_get_pcm_device_id(audio_usecase_t usecase, int device_type)
     return device_id;
 }
 
-static int find_index(struct name_to_index * table, int32_t len, const char * name)
-{
-    int ret = 0;
-    int32_t i;
-
-    if (table == NULL) {
-        ALOGE("%s: table is NULL", __func__);
-        ret = -ENODEV;
-        goto done;
-    }
+_Static_assert(NAME_INDEX_HASH_FITS(SND_DEVICE_MAX), "NAME_INDEX_HASH_SIZE is too small");
+_Static_assert(NAME_INDEX_HASH_FITS(AUDIO_USECASE_MAX), "NAME_INDEX_HASH_SIZE is too small");
 
-    if (name == NULL) {
-        ALOGE("null key");
-        ret = -ENODEV;
-        goto done;
-    }
-
-    for (i=0; i < len; i++) {
-        const char* tn = table[i].name;
-        size_t len = strlen(tn);
-        if (strncmp(tn, name, len) == 0) {
-            if (strlen(name) != len) {
-                continue; // substring
-            }
-            ret = table[i].index;
-            goto done;
-        }
-    }
-    ALOGE("%s: Could not find index for name = %s",
-            __func__, name);
-    ret = -ENODEV;
-done:
-    return ret;
-}
+static struct name_index_hash snd_device_name_hash;
+static struct name_index_hash usecase_name_hash;
 
 int platform_get_snd_device_index(char *device_name)
 {
-    return find_index(snd_device_name_index, SND_DEVICE_MAX, device_name);
+    return name_index_find(&snd_device_name_hash, snd_device_name_index,
+                           SND_DEVICE_MAX, device_name);
 }
 
 int platform_get_usecase_index(const char *usecase_name)
 {
-    return find_index(usecase_name_index, AUDIO_USECASE_MAX, usecase_name);
+    return name_index_find(&usecase_name_hash, usecase_name_index,
+                           AUDIO_USECASE_MAX, usecase_name);
 }
 
 int platform_set_snd_device_acdb_id(snd_device_t snd_device, unsigned int acdb_id)
@@ -1032,6 +1198,15 @@ done:
     return ret;
 }
 
+int platform_get_snd_device_acdb_id(snd_device_t snd_device)
+{
+    if ((snd_device < SND_DEVICE_MIN) || (snd_device >= SND_DEVICE_MAX)) {
+        ALOGE("%s: Invalid snd_device = %d", __func__, snd_device);
+        return -EINVAL;
+    }
+    return acdb_device_table[snd_device];
+}
+
 #ifdef FLUENCE_ENABLED
 int platform_set_fluence_type(void *platform, char *value)
 {
@@ -1228,7 +1403,7 @@ int platform_set_voice_volume(void *platform, int volume)
     vol_index = (int)percent_to_index(volume, MIN_VOL_INDEX, MAX_VOL_INDEX);
     set_values[0] = vol_index;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1258,7 +1433,7 @@ int platform_set_mic_mute(void *platform, bool state)
                               DEFAULT_VOLUME_RAMP_DURATION_MS};
 
     set_values[0] = state;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1300,7 +1475,7 @@ int platform_set_device_mute(void *platform, bool state, char *dir)
     }
 
     set_values[0] = state;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1740,7 +1915,7 @@ int platform_set_hdmi_channels(void *platform,  int channel_count)
     default:
         channel_cnt_str = "Two"; break;
     }
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1751,20 +1926,18 @@ int platform_set_hdmi_channels(void *platform,  int channel_count)
     return 0;
 }
 
-int platform_edid_get_max_channels(void *platform)
+int platform_edid_get_caps(void *platform, struct edid_audio_caps *caps)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
     struct audio_device *adev = my_data->adev;
-    char block[MAX_SAD_BLOCKS * SAD_BLOCK_SIZE];
-    char *sad = block;
+    unsigned char block[MAX_SAD_BLOCKS * SAD_BLOCK_SIZE];
     int num_audio_blocks;
-    int channel_count;
-    int max_channels = 0;
     int i, ret, count;
 
     struct mixer_ctl *ctl;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, AUDIO_DATA_BLOCK_MIXER_CTL);
+    memset(caps, 0, sizeof(*caps));
+    ctl = get_mixer_ctl(adev, AUDIO_DATA_BLOCK_MIXER_CTL);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, AUDIO_DATA_BLOCK_MIXER_CTL);
@@ -1782,28 +1955,16 @@ int platform_edid_get_max_channels(void *platform)
     ret = mixer_ctl_get_array(ctl, block, count);
     if (ret != 0) {
         ALOGE("%s: mixer_ctl_get_array() failed to get EDID info", __func__);
-        return 0;
+        return -EIO;
     }
 
     /* Calculate the number of SAD blocks */
     num_audio_blocks = count / SAD_BLOCK_SIZE;
 
-    for (i = 0; i < num_audio_blocks; i++) {
-        /* Only consider LPCM blocks */
-        if ((sad[0] >> 3) != EDID_FORMAT_LPCM) {
-            sad += 3;
-            continue;
-        }
-
-        channel_count = (sad[0] & 0x7) + 1;
-        if (channel_count > max_channels)
-            max_channels = channel_count;
+    for (i = 0; i < num_audio_blocks; i++)
+        edid_caps_add_sad(caps, block + i * SAD_BLOCK_SIZE);
 
-        /* Advance to next block */
-        sad += 3;
-    }
-
-    return max_channels;
+    return 0;
 }
 
 static int platform_set_slowtalk(struct platform_data *my_data, bool state)
@@ -1816,7 +1977,7 @@ static int platform_set_slowtalk(struct platform_data *my_data, bool state)
                               ALL_SESSION_VSID};
 
     set_values[0] = state;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1837,6 +1998,14 @@ static int platform_set_slowtalk(struct platform_data *my_data, bool state)
     return ret;
 }
 
+/* keys consumed by platform_set_parameters(), see adev_set_parameters() */
+const char * const platform_parameter_keys[] = {
+    AUDIO_PARAMETER_KEY_BTSCO,
+    AUDIO_PARAMETER_KEY_SLOWTALK,
+    AUDIO_PARAMETER_KEY_VOLUME_BOOST,
+    NULL,
+};
+
 int platform_set_parameters(void *platform, struct str_parms *parms)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
@@ -1907,7 +2076,7 @@ int platform_set_incall_recording_session_id(void *platform,
     int num_ctl_values;
     int i;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -2016,6 +2185,11 @@ void platform_get_parameters(void *platform,
     free(kv_pairs);
 }
 
+void platform_dump(void *platform __unused, int fd)
+{
+    hwdep_cal_dump(fd);
+}
+
 /* Delay in Us */
 int64_t platform_render_latency(audio_usecase_t usecase)
 {
@@ -2029,6 +2203,26 @@ int64_t platform_render_latency(audio_usecase_t usecase)
     }
 }
 
+int64_t platform_get_snd_device_render_latency(snd_device_t snd_device)
+{
+    if ((snd_device < SND_DEVICE_MIN) || (snd_device >= SND_DEVICE_MAX))
+        return 0;
+    return render_latency_table[snd_device];
+}
+
+int platform_set_snd_device_render_latency(snd_device_t snd_device,
+                                           int64_t latency_us)
+{
+    if ((snd_device < SND_DEVICE_MIN) || (snd_device >= SND_DEVICE_MAX) ||
+            latency_us < 0) {
+        ALOGE("%s: Invalid snd_device = %d or latency = %lld",
+              __func__, snd_device, (long long)latency_us);
+        return -EINVAL;
+    }
+    render_latency_table[snd_device] = latency_us;
+    return 0;
+}
+
 int platform_update_usecase_from_source(int source, int usecase)
 {
     ALOGV("%s: input source :%d", __func__, source);
@@ -2092,12 +2286,21 @@ uint32_t platform_get_pcm_offload_buffer_size(audio_offload_info_t* info)
 {
     uint32_t fragment_size = MIN_PCM_OFFLOAD_FRAGMENT_SIZE;
     uint32_t bits_per_sample = 16;
+    uint32_t channels = popcount(info->channel_mask);
+
+    /* sized as stereo when the mask is missing rather than dividing by 0 */
+    if (channels == 0)
+        channels = 2;
 
-#ifdef EXTN_OFFLOAD_ENABLED
-    if (info->format == AUDIO_FORMAT_PCM_24_BIT_OFFLOAD) {
+    switch (info->format & AUDIO_FORMAT_SUB_MASK) {
+    case AUDIO_FORMAT_PCM_SUB_8_24_BIT:
+    case AUDIO_FORMAT_PCM_SUB_32_BIT:
         bits_per_sample = 32;
+        break;
+    case AUDIO_FORMAT_PCM_SUB_24_BIT_PACKED:
+        bits_per_sample = 24;
+        break;
     }
-#endif
 
     if (!info->has_video) {
         fragment_size = MAX_PCM_OFFLOAD_FRAGMENT_SIZE;
@@ -2106,13 +2309,13 @@ uint32_t platform_get_pcm_offload_buffer_size(audio_offload_info_t* info)
         fragment_size = (PCM_OFFLOAD_BUFFER_DURATION_FOR_AV_STREAMING
                                      * info->sample_rate
                                      * (bits_per_sample >> 3)
-                                     * popcount(info->channel_mask))/1000;
+                                     * channels)/1000;
 
     } else if (info->has_video) {
         fragment_size = (PCM_OFFLOAD_BUFFER_DURATION_FOR_AV
                                      * info->sample_rate
                                      * (bits_per_sample >> 3)
-                                     * popcount(info->channel_mask))/1000;
+                                     * channels)/1000;
     }
 
     char value[PROPERTY_VALUE_MAX] = {0};
@@ -2129,6 +2332,10 @@ uint32_t platform_get_pcm_offload_buffer_size(audio_offload_info_t* info)
     else if(fragment_size > MAX_PCM_OFFLOAD_FRAGMENT_SIZE)
         fragment_size = MAX_PCM_OFFLOAD_FRAGMENT_SIZE;
 
+    /* packed 24 bit frames do not divide 1024, keep whole frames */
+    if (bits_per_sample == 24)
+        fragment_size -= fragment_size % (3 * channels);
+
     ALOGV("%s: fragment_size %d", __func__, fragment_size);
     return fragment_size;
 }
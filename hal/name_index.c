@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_name_index"
+/*#define LOG_NDEBUG 0*/
+#define LOG_NDDEBUG 0
+
+#include <errno.h>
+#include <string.h>
+#include <cutils/log.h>
+
+#include "name_index.h"
+
+static uint32_t name_hash_of(const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    while (*name)
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    return h;
+}
+
+static void name_hash_build(struct name_index_hash *hash,
+                            const struct name_to_index *table, int32_t len)
+{
+    uint32_t pos;
+    int32_t i;
+
+    for (i = 0; i < len; i++) {
+        /* entries of devices and usecases compiled out are left empty */
+        if (table[i].name[0] == '\0')
+            continue;
+        for (pos = name_hash_of(table[i].name); ; pos++) {
+            pos &= NAME_INDEX_HASH_SIZE - 1;
+            if (hash->slot[pos] == 0) {
+                hash->slot[pos] = i + 1;
+                break;
+            }
+            /* the first of duplicate names wins, as with a linear scan */
+            if (strcmp(table[hash->slot[pos] - 1].name, table[i].name) == 0)
+                break;
+        }
+    }
+    hash->built = true;
+}
+
+int name_index_find(struct name_index_hash *hash,
+                    const struct name_to_index *table, int32_t len,
+                    const char *name)
+{
+    int ret = 0;
+    uint32_t pos;
+
+    if (table == NULL) {
+        ALOGE("%s: table is NULL", __func__);
+        ret = -ENODEV;
+        goto done;
+    }
+
+    if (name == NULL) {
+        ALOGE("null key");
+        ret = -ENODEV;
+        goto done;
+    }
+
+    if (!hash->built)
+        name_hash_build(hash, table, len);
+
+    for (pos = name_hash_of(name); ; pos++) {
+        pos &= NAME_INDEX_HASH_SIZE - 1;
+        if (hash->slot[pos] == 0)
+            break;
+        if (strcmp(table[hash->slot[pos] - 1].name, name) == 0) {
+            ret = table[hash->slot[pos] - 1].index;
+            goto done;
+        }
+    }
+    ALOGE("%s: Could not find index for name = %s",
+            __func__, name);
+    ret = -ENODEV;
+done:
+    return ret;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* the names audio_platform_info.xml gives sound devices and usecases */
+struct name_to_index {
+    char name[100];
+    unsigned int index;
+};
+
+#define TO_NAME_INDEX(X)   #X, X
+
+/*
+ * Name lookups for platform_info.c go through an open addressed hash of each
+ * name_to_index table, built on first use and kept at most a quarter full so
+ * that a lookup hashes the name once and usually compares a single entry.
+ */
+#define NAME_INDEX_HASH_SIZE 512
+
+/* whether a table of len entries keeps the hash at most a quarter full */
+#define NAME_INDEX_HASH_FITS(len) ((len) * 4 <= NAME_INDEX_HASH_SIZE)
+
+struct name_index_hash {
+    bool built;
+    uint16_t slot[NAME_INDEX_HASH_SIZE];  /* table entry + 1, 0 when free */
+};
+
+/*
+ * The index of name in table, which has len entries, or -ENODEV. Entries
+ * with an empty name are skipped, and the first of duplicate names wins.
+ */
+int name_index_find(struct name_index_hash *hash,
+                    const struct name_to_index *table, int32_t len,
+                    const char *name);
+
+#endif /* NAME_INDEX_H */
@@ -31,6 +31,7 @@ int platform_set_fluence_type(void *platform, char *value);
 int platform_get_fluence_type(void *platform, char *value, uint32_t len);
 int platform_get_snd_device_index(char *snd_device_index_name);
 int platform_set_snd_device_acdb_id(snd_device_t snd_device, unsigned int acdb_id);
+int platform_get_snd_device_acdb_id(snd_device_t snd_device);
 int platform_send_audio_calibration(void *platform, snd_device_t snd_device);
 int platform_switch_voice_call_device_pre(void *platform);
 int platform_switch_voice_call_device_post(void *platform,
@@ -47,10 +48,13 @@ int platform_set_device_mute(void *platform, bool state, char *dir);
 snd_device_t platform_get_output_snd_device(void *platform, audio_devices_t devices);
 snd_device_t platform_get_input_snd_device(void *platform, audio_devices_t out_device);
 int platform_set_hdmi_channels(void *platform, int channel_count);
-int platform_edid_get_max_channels(void *platform);
+int platform_edid_get_caps(void *platform, struct edid_audio_caps *caps);
 void platform_get_parameters(void *platform, struct str_parms *query,
                              struct str_parms *reply);
 int platform_set_parameters(void *platform, struct str_parms *parms);
+/* appends platform state to adev_dump() */
+void platform_dump(void *platform, int fd);
+extern const char * const platform_parameter_keys[];
 int platform_set_incall_recording_session_id(void *platform, uint32_t session_id,
                                              int rec_mode);
 int platform_stop_incall_recording_usecase(void *platform);
@@ -58,6 +62,10 @@ int platform_start_incall_music_usecase(void *platform);
 int platform_stop_incall_music_usecase(void *platform);
 /* returns the latency for a usecase in Us */
 int64_t platform_render_latency(audio_usecase_t usecase);
+/* returns the DSP latency of a device in Us, 0 when unknown */
+int64_t platform_get_snd_device_render_latency(snd_device_t snd_device);
+int platform_set_snd_device_render_latency(snd_device_t snd_device,
+                                           int64_t latency_us);
 int platform_update_usecase_from_source(int source, audio_usecase_t usecase);
 
 bool platform_listen_update_status(snd_device_t snd_device);
@@ -31,22 +31,48 @@
 #define LOG_NDDEBUG 0
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <expat.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 #include <audio_hw.h>
 #include "platform_api.h"
 #include <platform.h>
 
+#ifdef AUDIO_SIMULATOR_ENABLED
+#include "sim/sim.h"
+#endif
+
 #define PLATFORM_INFO_XML_PATH      "/system/etc/audio_platform_info.xml"
 #define BUF_SIZE                    1024
 
+/*
+ * With audio_hal.platform_info_cache set, the elements dispatched while
+ * parsing PLATFORM_INFO_XML_PATH are recorded to PLATFORM_INFO_CACHE_PATH and
+ * replayed through the same process functions on the next start, as long as
+ * the xml file has not changed, so that expat is not run at all. Names are
+ * kept rather than indices so that the cache does not depend on the enums of
+ * the HAL that wrote it.
+ */
+#define PLATFORM_INFO_CACHE_PROPERTY "audio_hal.platform_info_cache"
+#define PLATFORM_INFO_CACHE_PATH    "/data/misc/audio/audio_platform_info.cache"
+#define PLATFORM_INFO_CACHE_MAGIC   0x41504943 /* "APIC" */
+#define PLATFORM_INFO_CACHE_VERSION 1
+#define PLATFORM_INFO_CACHE_MAX     (256 * 1024)
+#define MAX_CACHED_ATTRS            16
+
 typedef enum {
     ROOT,
     ACDB,
     PCM_ID,
     BACKEND_NAME,
     DEVICE_NAME,
+    RENDER_LATENCY,
 } section_t;
 
 typedef void (* section_process_fn)(const XML_Char **attr);
@@ -55,6 +81,7 @@ static void process_acdb_id(const XML_Char **attr);
 static void process_pcm_id(const XML_Char **attr);
 static void process_backend_name(const XML_Char **attr);
 static void process_device_name(const XML_Char **attr);
+static void process_render_latency(const XML_Char **attr);
 static void process_root(const XML_Char **attr);
 
 static section_process_fn section_table[] = {
@@ -63,10 +90,53 @@ static section_process_fn section_table[] = {
     [PCM_ID] = process_pcm_id,
     [BACKEND_NAME] = process_backend_name,
     [DEVICE_NAME] = process_device_name,
+    [RENDER_LATENCY] = process_render_latency,
 };
 
 static section_t section;
 
+struct platform_info_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    /* identity of the xml file the records were parsed from */
+    int64_t xml_mtime;
+    int64_t xml_size;
+    uint64_t xml_ino;
+    uint32_t count;
+    uint32_t bytes;
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+/*
+ * Records are a section byte, an attribute count byte and that many NUL
+ * terminated attribute names and values.
+ */
+static struct {
+    bool enabled;
+    bool overflow;
+    char path[PROPERTY_VALUE_MAX];
+    char *buf;
+    size_t bytes;
+    size_t size;
+    uint32_t count;
+} cache;
+
+#ifdef AUDIO_SIMULATOR_ENABLED
+/* the tests parse files of their own */
+static void platform_info_path(const char *key, char *path,
+                               const char *default_path)
+{
+    sim_get_config(key, path, default_path);
+}
+#else
+static void platform_info_path(const char *key __unused, char *path,
+                               const char *default_path)
+{
+    strlcpy(path, default_path, PROPERTY_VALUE_MAX);
+}
+#endif
+
 /*
  * <audio_platform_info>
  * <acdb_ids>
@@ -89,6 +159,11 @@ static section_t section;
  * ...
  * ...
  * </device_names>
+ * <render_latencies>
+ * <device name="???" latency_us="???"/>
+ * ...
+ * ...
+ * </render_latencies>
  * </audio_platform_info>
  */
 
@@ -243,6 +318,226 @@ done:
     return;
 }
 
+/* DSP latency of an output device, used for presentation positions */
+static void process_render_latency(const XML_Char **attr)
+{
+    int index;
+
+    if (strcmp(attr[0], "name") != 0) {
+        ALOGE("%s: 'name' not found, no render latency set!", __func__);
+        goto done;
+    }
+
+    index = platform_get_snd_device_index((char *)attr[1]);
+    if (index < 0) {
+        ALOGE("%s: Device %s in %s not found, no render latency set!",
+              __func__, attr[1], PLATFORM_INFO_XML_PATH);
+        goto done;
+    }
+
+    if (strcmp(attr[2], "latency_us") != 0) {
+        ALOGE("%s: Device %s in %s has no latency_us, no render latency set!",
+              __func__, attr[1], PLATFORM_INFO_XML_PATH);
+        goto done;
+    }
+
+    if (platform_set_snd_device_render_latency(index, atoll((char *)attr[3])) < 0) {
+        ALOGE("%s: Device %s, render latency %s was not set!",
+              __func__, attr[1], attr[3]);
+        goto done;
+    }
+
+done:
+    return;
+}
+
+static void cache_record(section_t sec, const XML_Char **attr)
+{
+    size_t need = 2;
+    size_t len;
+    char *buf;
+    int n;
+
+    if (!cache.enabled || cache.overflow)
+        return;
+
+    for (n = 0; attr[n] != NULL; n++)
+        need += strlen(attr[n]) + 1;
+    if (n > MAX_CACHED_ATTRS ||
+            cache.bytes + need > PLATFORM_INFO_CACHE_MAX) {
+        cache.overflow = true;
+        return;
+    }
+
+    if (cache.bytes + need > cache.size) {
+        len = cache.size ? cache.size * 2 : BUF_SIZE * 4;
+        while (len < cache.bytes + need)
+            len *= 2;
+        buf = realloc(cache.buf, len);
+        if (buf == NULL) {
+            cache.overflow = true;
+            return;
+        }
+        cache.buf = buf;
+        cache.size = len;
+    }
+
+    buf = cache.buf + cache.bytes;
+    *buf++ = (char)sec;
+    *buf++ = (char)n;
+    for (n = 0; attr[n] != NULL; n++) {
+        len = strlen(attr[n]) + 1;
+        memcpy(buf, attr[n], len);
+        buf += len;
+    }
+    cache.bytes += need;
+    cache.count++;
+}
+
+static uint32_t cache_checksum(const char *buf, size_t bytes)
+{
+    uint32_t h = 2166136261u;
+
+    while (bytes-- > 0)
+        h = (h ^ (uint8_t)*buf++) * 16777619u;
+    return h;
+}
+
+static void cache_header_init(struct platform_info_cache_header *hdr,
+                              const struct stat *st)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = PLATFORM_INFO_CACHE_MAGIC;
+    hdr->version = PLATFORM_INFO_CACHE_VERSION;
+    hdr->xml_mtime = st->st_mtime;
+    hdr->xml_size = st->st_size;
+    hdr->xml_ino = st->st_ino;
+}
+
+static int cache_next_record(char **pos, char *end, section_t *sec,
+                             const XML_Char **attr)
+{
+    char *p = *pos;
+    int n, i;
+
+    if (end - p < 2)
+        return -EINVAL;
+    *sec = (section_t)(unsigned char)*p++;
+    n = (unsigned char)*p++;
+    if (*sec <= ROOT || *sec > RENDER_LATENCY || n > MAX_CACHED_ATTRS)
+        return -EINVAL;
+    for (i = 0; i < n; i++) {
+        if (p >= end)
+            return -EINVAL;
+        attr[i] = p;
+        p += strlen(p) + 1;
+    }
+    if (p > end)
+        return -EINVAL;
+    attr[n] = NULL;
+    *pos = p;
+    return 0;
+}
+
+/* replays the cache if it was written for the xml file in st */
+static int cache_load(const struct stat *st)
+{
+    struct platform_info_cache_header expected, hdr;
+    const XML_Char *attr[MAX_CACHED_ATTRS + 1];
+    char *buf = NULL, *p, *end;
+    section_t sec;
+    uint32_t i;
+    int fd, a;
+    int ret = -EINVAL;
+
+    fd = open(cache.path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+
+    cache_header_init(&expected, st);
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+        goto done;
+    expected.count = hdr.count;
+    expected.bytes = hdr.bytes;
+    expected.checksum = hdr.checksum;
+    if (memcmp(&hdr, &expected, sizeof(hdr)) != 0 ||
+            hdr.bytes > PLATFORM_INFO_CACHE_MAX) {
+        ALOGD("%s: %s is stale", __func__, cache.path);
+        goto done;
+    }
+
+    /* one spare NUL so that a truncated last string stays in bounds */
+    buf = malloc(hdr.bytes + 1);
+    if (buf == NULL) {
+        ret = -ENOMEM;
+        goto done;
+    }
+    if (read(fd, buf, hdr.bytes) != (ssize_t)hdr.bytes ||
+            cache_checksum(buf, hdr.bytes) != hdr.checksum) {
+        ALOGE("%s: %s is corrupt", __func__, cache.path);
+        goto done;
+    }
+    buf[hdr.bytes] = '\0';
+
+    /* check every record before replaying any */
+    for (a = 0; a < 2; a++) {
+        p = buf;
+        end = buf + hdr.bytes;
+        for (i = 0; i < hdr.count; i++) {
+            if (cache_next_record(&p, end, &sec, attr) < 0) {
+                ALOGE("%s: %s is corrupt", __func__, cache.path);
+                goto done;
+            }
+            if (a == 1)
+                section_table[sec](attr);
+        }
+    }
+    ret = 0;
+done:
+    free(buf);
+    close(fd);
+    return ret;
+}
+
+/* written to a temporary file and renamed so that readers never see half */
+static void cache_store(const struct stat *st)
+{
+    struct platform_info_cache_header hdr;
+    char path[PROPERTY_VALUE_MAX + 4];
+    int fd;
+
+    if (cache.overflow) {
+        ALOGW("%s: platform info too large to cache", __func__);
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s.tmp", cache.path);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    if (fd < 0) {
+        ALOGW("%s: cannot create %s: %s", __func__, path, strerror(errno));
+        return;
+    }
+
+    cache_header_init(&hdr, st);
+    hdr.count = cache.count;
+    hdr.bytes = cache.bytes;
+    hdr.checksum = cache_checksum(cache.buf, cache.bytes);
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+            write(fd, cache.buf, cache.bytes) != (ssize_t)cache.bytes ||
+            fsync(fd) < 0) {
+        ALOGW("%s: cannot write %s: %s", __func__, path, strerror(errno));
+        close(fd);
+        unlink(path);
+        return;
+    }
+    close(fd);
+
+    if (rename(path, cache.path) < 0) {
+        ALOGW("%s: cannot rename %s: %s", __func__, path, strerror(errno));
+        unlink(path);
+    }
+}
+
 static void start_tag(void *userdata __unused, const XML_Char *tag_name,
                       const XML_Char **attr)
 {
@@ -258,15 +553,19 @@ static void start_tag(void *userdata __unused, const XML_Char *tag_name,
         section = BACKEND_NAME;
     } else if (strcmp(tag_name, "device_names") == 0) {
         section = DEVICE_NAME;
+    } else if (strcmp(tag_name, "render_latencies") == 0) {
+        section = RENDER_LATENCY;
     } else if (strcmp(tag_name, "device") == 0) {
         if ((section != ACDB) && (section != BACKEND_NAME)
-                && (section != DEVICE_NAME)) {
-            ALOGE("device tag only supported for acdb/backend/device names");
+                && (section != DEVICE_NAME) && (section != RENDER_LATENCY)) {
+            ALOGE("device tag only supported for acdb/backend/device names"
+                  " and render latencies");
             return;
         }
 
         /* call into process function for the current section */
         section_process_fn fn = section_table[section];
+        cache_record(section, attr);
         fn(attr);
     } else if (strcmp(tag_name, "usecase") == 0) {
         if (section != PCM_ID) {
@@ -275,6 +574,7 @@ static void start_tag(void *userdata __unused, const XML_Char *tag_name,
         }
 
         section_process_fn fn = section_table[PCM_ID];
+        cache_record(PCM_ID, attr);
         fn(attr);
     }
 
@@ -291,6 +591,8 @@ static void end_tag(void *userdata __unused, const XML_Char *tag_name)
         section = ROOT;
     } else if (strcmp(tag_name, "device_names") == 0) {
         section = ROOT;
+    } else if (strcmp(tag_name, "render_latencies") == 0) {
+        section = ROOT;
     }
 }
 
@@ -301,17 +603,33 @@ int platform_info_init(void)
     int             ret = 0;
     int             bytes_read;
     void            *buf;
+    struct stat     st;
+    char            value[PROPERTY_VALUE_MAX];
+    char            path[PROPERTY_VALUE_MAX];
 
-    file = fopen(PLATFORM_INFO_XML_PATH, "r");
+    platform_info_path("audio.sim.platform_info_xml", path,
+                       PLATFORM_INFO_XML_PATH);
+    file = fopen(path, "r");
     section = ROOT;
 
     if (!file) {
         ALOGD("%s: Failed to open %s, using defaults.",
-            __func__, PLATFORM_INFO_XML_PATH);
+            __func__, path);
         ret = -ENODEV;
         goto done;
     }
 
+    property_get(PLATFORM_INFO_CACHE_PROPERTY, value, "false");
+    memset(&cache, 0, sizeof(cache));
+    platform_info_path("audio.sim.platform_info_cache", cache.path,
+                       PLATFORM_INFO_CACHE_PATH);
+    cache.enabled = (!strcmp(value, "true") || !strcmp(value, "1")) &&
+                    fstat(fileno(file), &st) == 0;
+    if (cache.enabled && cache_load(&st) == 0) {
+        ALOGV("%s: platform info replayed from %s", __func__, cache.path);
+        goto err_close_file;
+    }
+
     parser = XML_ParserCreate(NULL);
     if (!parser) {
         ALOGE("%s: Failed to create XML parser!", __func__);
@@ -339,7 +657,7 @@ int platform_info_init(void)
         if (XML_ParseBuffer(parser, bytes_read,
                             bytes_read == 0) == XML_STATUS_ERROR) {
             ALOGE("%s: XML_ParseBuffer failed, for %s",
-                __func__, PLATFORM_INFO_XML_PATH);
+                __func__, path);
             ret = -EINVAL;
             goto err_free_parser;
         }
@@ -348,10 +666,15 @@ int platform_info_init(void)
             break;
     }
 
+    if (cache.enabled)
+        cache_store(&st);
+
 err_free_parser:
     XML_ParserFree(parser);
 err_close_file:
     fclose(file);
+    free(cache.buf);
+    cache.buf = NULL;
 done:
     return ret;
 }
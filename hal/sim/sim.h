@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_SIM_H
+#define AUDIO_SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Userspace sound card used in place of libtinyalsa, libtinycompress and
+ * libaudioroute when AUDIO_FEATURE_ENABLED_SIMULATOR is set. The HAL is
+ * tested and benchmarked on it by audio_sim_tests, see tests/sim_test.h.
+ *
+ * Configuration is read from system properties, falling back to environment
+ * variables (key upper-cased, '.' replaced by '_') on hosts without a
+ * property service:
+ *
+ * audio.sim.clock          "real" (default) or "virtual". The virtual clock
+ *                          only moves when a caller would otherwise sleep,
+ *                          which makes timing deterministic.
+ * audio.sim.card           sound card number, default 0
+ * audio.sim.card_name      card name reported by mixer_get_name()
+ * audio.sim.card_delay_ms  time after the first look at the card list before
+ *                          the card registers, as when the ADSP boots late
+ * audio.sim.mixer_paths    file used to build the mixer control namespace and
+ *                          the mixer paths, in place of the one the HAL names
+ * audio.sim.mixer_strict   when true, unknown controls are not created lazily
+ * audio.sim.ctl_write_us   simulated cost of a mixer control write
+ * audio.sim.hdmi_channels  LPCM channels advertised in the HDMI EDID control
+ * audio.sim.loopback_us    when set, channel 0 of S16 playback is captured
+ *                          again on channel 0 of S16 capture devices this
+ *                          long after the hardware pointer played it
+ * audio.sim.capture_counter  when true, channel 0 of S16 capture carries the
+ *                          low 16 bits of each frame's hardware position,
+ *                          so that a reader can tell which frames it lost
+ * audio.sim.hwdep_us       simulated cost of a codec calibration ioctl
+ * audio.sim.hwdep_us_per_kb  added cost per KB of calibration sent
+ * audio.sim.period_tuner_file  where the period tuner keeps what it learned,
+ *                          in place of /data/misc/audio/period_tuner.bin
+ */
+
+#define SIM_NSEC_PER_SEC    1000000000LL
+#define SIM_CARD_NAME       "msm8974-taiko-mtp-snd-card"
+#define SIM_MAX_DEVICES     64
+
+/* ns * rate / 1s without overflowing for long running streams */
+static inline uint64_t sim_ns_to_units(int64_t ns, uint64_t rate)
+{
+    return (uint64_t)(ns / SIM_NSEC_PER_SEC) * rate +
+           (uint64_t)(ns % SIM_NSEC_PER_SEC) * rate / SIM_NSEC_PER_SEC;
+}
+
+int sim_get_config(const char *key, char *value, const char *default_value);
+int sim_get_config_int(const char *key, int default_value);
+
+unsigned int sim_card_number(void);
+
+/* Subsystem restart. While the card is offline, devices cannot be opened and
+ * I/O on open ones fails with ENETRESET, as when the ADSP goes down. Like the
+ * daemon watching the ADSP, the caller also reports the change to the HAL
+ * with SND_CARD_STATUS=<card>,OFFLINE or ONLINE.
+ */
+void sim_card_set_online(bool online);
+bool sim_card_is_online(void);
+
+/* Card registration. sim_snd_card_list() formats the card like
+ * /proc/asound/cards, once it has registered, and sim_snd_card_wait() sleeps
+ * until it does or until until_ns, in place of watching /dev/snd.
+ * sim_card_reboot() starts audio.sim.card_delay_ms over from the next look.
+ */
+bool sim_card_is_registered(void);
+void sim_card_reboot(void);
+int sim_snd_card_list(char *buf, size_t size);
+void sim_snd_card_wait(int64_t until_ns);
+
+/* Compress offload device. sim_compress_last_request() names the last
+ * buffer wait or drain made on it, so that tests can tell which command the
+ * offload thread ran before its callback.
+ */
+struct compress;
+
+enum sim_compress_request {
+    SIM_COMPRESS_NONE,
+    SIM_COMPRESS_WAIT,
+    SIM_COMPRESS_DRAIN,
+    SIM_COMPRESS_PARTIAL_DRAIN,    /* from compress_next_track() on */
+};
+
+enum sim_compress_request sim_compress_last_request(struct compress *compress);
+
+/* Codec hwdep node. The HAL cannot route open() and ioctl() through the
+ * simulator, so the calibration path calls these in simulator builds.
+ * sim_hwdep_get_writes() returns the calibrations sent since the node was
+ * last opened, oldest first, with when each was sent on the sim clock.
+ */
+#define SIM_HWDEP_MAX_WRITES    16
+
+struct sim_hwdep_write {
+    int cal_type;
+    size_t bytes;
+    int64_t start_ns;
+    int64_t end_ns;
+};
+
+int sim_hwdep_open(unsigned int card, unsigned int device);
+int sim_hwdep_write(int fd, int cal_type, size_t bytes);
+unsigned int sim_hwdep_get_writes(struct sim_hwdep_write *writes,
+                                  unsigned int max);
+
+int64_t sim_clock_now_ns(void);
+void sim_clock_to_timespec(int64_t ns, struct timespec *ts);
+void sim_clock_sleep_until(int64_t when_ns);
+void sim_clock_cond_init(pthread_cond_t *cond);
+/* Waits on cond until when_ns, or until signalled if when_ns is negative.
+ * On the virtual clock a deadline is reached immediately.
+ */
+void sim_clock_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock,
+                         int64_t when_ns);
+
+#endif /* AUDIO_SIM_H */
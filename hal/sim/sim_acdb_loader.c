@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_sim_acdb"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include "sim.h"
+
+/*
+ * Stand in for libacdbloader.so, built as libacdbloader_sim.so and picked up
+ * by a simulator build of the HAL when audio_hal.acdb_loader names it; other
+ * builds always load libacdbloader.so. Sends only log; codec calibration is
+ * served from a pattern after a delay in real time, so that the boot
+ * calibration path can be timed without the ACDB files:
+ *
+ * audio.sim.acdb_cal_bytes       size of every codec calibration, default 4096
+ * audio.sim.acdb_fetch_us        cost of one fetch, default 500
+ * audio.sim.acdb_fetch_us_per_kb cost per KB fetched, default 100
+ */
+
+/* layout of the request the HAL passes to acdb_loader_get_calibration() */
+struct sim_acdb_cal_request {
+    int    use_case;
+    int    acdb_id;
+    int    get_size;
+    int    buff_size;
+    int    data_size;
+    void   *buff;
+};
+
+int acdb_loader_init_ACDB(void)
+{
+    ALOGI("%s: using the simulated ACDB loader", __func__);
+    return 0;
+}
+
+void acdb_loader_deallocate_ACDB(void)
+{
+}
+
+void acdb_loader_send_audio_cal(int acdb_id, int capability)
+{
+    ALOGV("%s: acdb id %d, capability %d", __func__, acdb_id, capability);
+}
+
+void acdb_loader_send_voice_cal(int rx_acdb_id, int tx_acdb_id)
+{
+    ALOGV("%s: rx acdb id %d, tx acdb id %d", __func__, rx_acdb_id,
+          tx_acdb_id);
+}
+
+int acdb_loader_reload_vocvoltable(int feature_set)
+{
+    ALOGV("%s: feature set %d", __func__, feature_set);
+    return 0;
+}
+
+int acdb_loader_get_calibration(char *attr, int size, void *data)
+{
+    struct sim_acdb_cal_request *req = (struct sim_acdb_cal_request *)data;
+    int bytes = sim_get_config_int("audio.sim.acdb_cal_bytes", 4096);
+    int64_t cost_us;
+
+    if (attr == NULL || req == NULL ||
+            size < (int)sizeof(struct sim_acdb_cal_request))
+        return -EINVAL;
+
+    if (req->get_size) {
+        req->buff_size = bytes;
+        return 0;
+    }
+    if (req->buff == NULL || req->buff_size < bytes)
+        return -EINVAL;
+
+    cost_us = sim_get_config_int("audio.sim.acdb_fetch_us", 500) +
+              (int64_t)bytes * sim_get_config_int("audio.sim.acdb_fetch_us_per_kb",
+                                                  100) / 1024;
+    usleep((useconds_t)cost_us);
+    memset(req->buff, attr[0], bytes);
+    req->data_size = bytes;
+    ALOGV("%s: %s, acdb id %d, %d bytes in %lld us", __func__, attr,
+          req->acdb_id, bytes, (long long)cost_us);
+    return 0;
+}
@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_sim_route"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <expat.h>
+#include <tinyalsa/asoundlib.h>
+#include <audio_route/audio_route.h>
+
+#include "sim.h"
+
+#define SIM_MIXER_PATHS     "/system/etc/mixer_paths.xml"
+#define SIM_BUF_SIZE        1024
+
+struct route_setting {
+    struct mixer_ctl *ctl;
+    int id;                 /* value index, or -1 for all values */
+    char *value;
+};
+
+struct route_path {
+    char *name;
+    struct route_setting *settings;
+    unsigned int num_settings;
+    unsigned int max_settings;
+};
+
+/*
+ * Like libaudioroute, applying or resetting a path only stages the new
+ * control values; they reach the simulated mixer on update, and a control is
+ * only written when its staged value differs from the mixer.
+ */
+struct audio_route {
+    struct mixer *mixer;
+    struct route_path defaults;
+    struct route_path pending;      /* staged values, one per control/id */
+    struct route_path *paths;
+    unsigned int num_paths;
+    unsigned int max_paths;
+    struct route_path *parse_path;  /* path being parsed */
+    unsigned int parse_depth;
+};
+
+static int path_add_setting(struct route_path *path, struct mixer_ctl *ctl,
+                            int id, const char *value)
+{
+    struct route_setting *setting;
+
+    if (path->num_settings == path->max_settings) {
+        unsigned int max = path->max_settings ? path->max_settings * 2 : 8;
+        struct route_setting *settings =
+                realloc(path->settings, max * sizeof(*settings));
+
+        if (!settings)
+            return -ENOMEM;
+        path->settings = settings;
+        path->max_settings = max;
+    }
+
+    setting = &path->settings[path->num_settings];
+    setting->ctl = ctl;
+    setting->id = id;
+    setting->value = strdup(value);
+    if (!setting->value)
+        return -ENOMEM;
+    path->num_settings++;
+    return 0;
+}
+
+static struct route_path *route_find_path(struct audio_route *ar, const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < ar->num_paths; i++) {
+        if (!strcmp(ar->paths[i].name, name))
+            return &ar->paths[i];
+    }
+    return NULL;
+}
+
+static struct route_path *route_add_path(struct audio_route *ar, const char *name)
+{
+    struct route_path *path;
+
+    if (ar->num_paths == ar->max_paths) {
+        unsigned int max = ar->max_paths ? ar->max_paths * 2 : 64;
+        struct route_path *paths = realloc(ar->paths, max * sizeof(*paths));
+
+        if (!paths)
+            return NULL;
+        ar->paths = paths;
+        ar->max_paths = max;
+    }
+
+    path = &ar->paths[ar->num_paths];
+    memset(path, 0, sizeof(*path));
+    path->name = strdup(name);
+    if (!path->name)
+        return NULL;
+    ar->num_paths++;
+    return path;
+}
+
+static bool setting_matches(struct route_setting *setting)
+{
+    struct mixer_ctl *ctl = setting->ctl;
+    unsigned int num_enums = mixer_ctl_get_num_enums(ctl);
+    unsigned int i, count;
+    int value;
+
+    if (num_enums > 0) {
+        value = mixer_ctl_get_value(ctl, 0);
+        return value >= 0 && (unsigned int)value < num_enums &&
+               !strcmp(mixer_ctl_get_enum_string(ctl, value), setting->value);
+    }
+
+    value = atoi(setting->value);
+    if (setting->id >= 0)
+        return mixer_ctl_get_value(ctl, setting->id) == value;
+
+    count = mixer_ctl_get_num_values(ctl);
+    for (i = 0; i < count; i++) {
+        if (mixer_ctl_get_value(ctl, i) != value)
+            return false;
+    }
+    return true;
+}
+
+static void apply_setting(struct route_setting *setting, const char *value)
+{
+    struct mixer_ctl *ctl = setting->ctl;
+    struct route_setting target = *setting;
+    unsigned int i, count;
+
+    target.value = (char *)value;
+    if (setting_matches(&target))
+        return;
+
+    if (mixer_ctl_get_num_enums(ctl) > 0) {
+        mixer_ctl_set_enum_by_string(ctl, value);
+    } else if (setting->id >= 0) {
+        mixer_ctl_set_value(ctl, setting->id, atoi(value));
+    } else {
+        count = mixer_ctl_get_num_values(ctl);
+        for (i = 0; i < count; i++)
+            mixer_ctl_set_value(ctl, i, atoi(value));
+    }
+}
+
+static int stage_setting(struct audio_route *ar, struct route_setting *setting,
+                         const char *value)
+{
+    struct route_path *pending = &ar->pending;
+    unsigned int i;
+    char *copy;
+
+    for (i = 0; i < pending->num_settings; i++) {
+        struct route_setting *staged = &pending->settings[i];
+
+        if (staged->ctl == setting->ctl && staged->id == setting->id) {
+            copy = strdup(value);
+            if (!copy)
+                return -ENOMEM;
+            free(staged->value);
+            staged->value = copy;
+            return 0;
+        }
+    }
+    return path_add_setting(pending, setting->ctl, setting->id, value);
+}
+
+/* writes the staged values, only those of path's controls when path is set */
+static void flush_pending(struct audio_route *ar, struct route_path *path)
+{
+    struct route_path *pending = &ar->pending;
+    unsigned int i, j, kept = 0;
+
+    for (i = 0; i < pending->num_settings; i++) {
+        struct route_setting *staged = &pending->settings[i];
+        bool flush = !path;
+
+        for (j = 0; path && j < path->num_settings; j++) {
+            if (path->settings[j].ctl == staged->ctl) {
+                flush = true;
+                break;
+            }
+        }
+
+        if (flush) {
+            apply_setting(staged, staged->value);
+            free(staged->value);
+        } else {
+            pending->settings[kept++] = *staged;
+        }
+    }
+    pending->num_settings = kept;
+}
+
+/* value a control returns to when a path using it is reset */
+static const char *default_value(struct audio_route *ar,
+                                 struct route_setting *setting)
+{
+    struct mixer_ctl *ctl = setting->ctl;
+    unsigned int i;
+
+    for (i = 0; i < ar->defaults.num_settings; i++) {
+        struct route_setting *def = &ar->defaults.settings[i];
+
+        if (def->ctl == ctl && (def->id < 0 || def->id == setting->id))
+            return def->value;
+    }
+
+    if (mixer_ctl_get_num_enums(ctl) > 0)
+        return mixer_ctl_get_enum_string(ctl, 0);
+    return "0";
+}
+
+static void route_start_tag(void *data, const XML_Char *tag_name,
+                            const XML_Char **attr)
+{
+    struct audio_route *ar = (struct audio_route *)data;
+    const char *name = NULL, *value = NULL;
+    int id = -1;
+    unsigned int i;
+
+    for (i = 0; attr[i]; i += 2) {
+        if (!strcmp(attr[i], "name"))
+            name = attr[i + 1];
+        else if (!strcmp(attr[i], "value"))
+            value = attr[i + 1];
+        else if (!strcmp(attr[i], "id"))
+            id = atoi(attr[i + 1]);
+    }
+
+    if (!strcmp(tag_name, "path")) {
+        if (!name) {
+            ALOGE("%s: path without a name", __func__);
+            return;
+        }
+        if (ar->parse_depth++ == 0) {
+            ar->parse_path = route_find_path(ar, name);
+            if (!ar->parse_path)
+                ar->parse_path = route_add_path(ar, name);
+        } else if (ar->parse_path) {
+            /* a nested path pulls in the settings of an earlier path */
+            struct route_path *sub = route_find_path(ar, name);
+
+            if (!sub) {
+                ALOGE("%s: unknown path '%s'", __func__, name);
+                return;
+            }
+            for (i = 0; i < sub->num_settings; i++)
+                path_add_setting(ar->parse_path, sub->settings[i].ctl,
+                                 sub->settings[i].id, sub->settings[i].value);
+        }
+    } else if (!strcmp(tag_name, "ctl")) {
+        struct mixer_ctl *ctl;
+        struct route_path *path;
+
+        if (!name || !value)
+            return;
+        ctl = mixer_get_ctl_by_name(ar->mixer, name);
+        if (!ctl) {
+            ALOGE("%s: unknown control '%s'", __func__, name);
+            return;
+        }
+        path = ar->parse_depth ? ar->parse_path : &ar->defaults;
+        if (path)
+            path_add_setting(path, ctl, id, value);
+    }
+}
+
+static void route_end_tag(void *data, const XML_Char *tag_name)
+{
+    struct audio_route *ar = (struct audio_route *)data;
+
+    if (!strcmp(tag_name, "path") && ar->parse_depth > 0 &&
+            --ar->parse_depth == 0)
+        ar->parse_path = NULL;
+}
+
+static int route_load_paths(struct audio_route *ar, const char *path)
+{
+    XML_Parser parser;
+    FILE *file;
+    int ret = 0;
+    int bytes_read;
+    void *buf;
+
+    file = fopen(path, "r");
+    if (!file) {
+        ALOGE("%s: failed to open %s", __func__, path);
+        return -ENODEV;
+    }
+
+    parser = XML_ParserCreate(NULL);
+    if (!parser) {
+        ALOGE("%s: failed to create XML parser", __func__);
+        ret = -ENODEV;
+        goto err_close_file;
+    }
+
+    XML_SetUserData(parser, ar);
+    XML_SetElementHandler(parser, route_start_tag, route_end_tag);
+
+    while (1) {
+        buf = XML_GetBuffer(parser, SIM_BUF_SIZE);
+        if (buf == NULL) {
+            ALOGE("%s: XML_GetBuffer failed", __func__);
+            ret = -ENOMEM;
+            goto err_free_parser;
+        }
+
+        bytes_read = fread(buf, 1, SIM_BUF_SIZE, file);
+        if (bytes_read < 0) {
+            ALOGE("%s: fread failed, bytes read = %d", __func__, bytes_read);
+            ret = bytes_read;
+            goto err_free_parser;
+        }
+
+        if (XML_ParseBuffer(parser, bytes_read, bytes_read == 0) == XML_STATUS_ERROR) {
+            ALOGE("%s: XML_ParseBuffer failed, for %s", __func__, path);
+            ret = -EINVAL;
+            goto err_free_parser;
+        }
+
+        if (bytes_read == 0)
+            break;
+    }
+
+err_free_parser:
+    XML_ParserFree(parser);
+err_close_file:
+    fclose(file);
+    return ret;
+}
+
+static void free_path(struct route_path *path)
+{
+    unsigned int i;
+
+    for (i = 0; i < path->num_settings; i++)
+        free(path->settings[i].value);
+    free(path->settings);
+    free(path->name);
+}
+
+void audio_route_free(struct audio_route *ar)
+{
+    unsigned int i;
+
+    if (!ar)
+        return;
+
+    for (i = 0; i < ar->num_paths; i++)
+        free_path(&ar->paths[i]);
+    free(ar->paths);
+    free_path(&ar->defaults);
+    free_path(&ar->pending);
+    mixer_close(ar->mixer);
+    free(ar);
+}
+
+void audio_route_reset(struct audio_route *ar)
+{
+    unsigned int i;
+
+    for (i = 0; i < ar->defaults.num_settings; i++)
+        apply_setting(&ar->defaults.settings[i], ar->defaults.settings[i].value);
+}
+
+struct audio_route *audio_route_init(unsigned int card, const char *xml_path)
+{
+    char path[PROPERTY_VALUE_MAX];
+    struct audio_route *ar;
+
+    ar = calloc(1, sizeof(struct audio_route));
+    if (!ar)
+        return NULL;
+
+    ar->mixer = mixer_open(card);
+    if (!ar->mixer) {
+        ALOGE("%s: unable to open the mixer, aborting.", __func__);
+        free(ar);
+        return NULL;
+    }
+
+    /* the file the mixer namespace was built from, wherever the HAL looks */
+    if (sim_get_config("audio.sim.mixer_paths", path, NULL) > 0)
+        xml_path = path;
+    else if (!xml_path)
+        xml_path = SIM_MIXER_PATHS;
+    if (route_load_paths(ar, xml_path) != 0) {
+        audio_route_free(ar);
+        return NULL;
+    }
+
+    audio_route_reset(ar);
+    ALOGV("%s: %u paths, %u default settings from %s", __func__,
+          ar->num_paths, ar->defaults.num_settings, xml_path);
+    return ar;
+}
+
+static struct route_path *route_stage_path(struct audio_route *ar,
+                                           const char *name, bool reset)
+{
+    struct route_path *path;
+    unsigned int i;
+
+    if (!ar || !name)
+        return NULL;
+
+    path = route_find_path(ar, name);
+    if (!path) {
+        ALOGE("%s: unable to find path '%s'", __func__, name);
+        return NULL;
+    }
+
+    for (i = 0; i < path->num_settings; i++) {
+        struct route_setting *setting = &path->settings[i];
+
+        if (stage_setting(ar, setting, reset ? default_value(ar, setting) :
+                                              setting->value) < 0) {
+            ALOGE("%s: out of memory staging path '%s'", __func__, name);
+            return NULL;
+        }
+    }
+    return path;
+}
+
+int audio_route_apply_path(struct audio_route *ar, const char *name)
+{
+    return route_stage_path(ar, name, false) ? 0 : -1;
+}
+
+int audio_route_reset_path(struct audio_route *ar, const char *name)
+{
+    return route_stage_path(ar, name, true) ? 0 : -1;
+}
+
+int audio_route_update_mixer(struct audio_route *ar)
+{
+    if (!ar)
+        return -1;
+
+    flush_pending(ar, NULL);
+    return 0;
+}
+
+int audio_route_apply_and_update_path(struct audio_route *ar, const char *name)
+{
+    struct route_path *path = route_stage_path(ar, name, false);
+
+    if (!path)
+        return -1;
+
+    flush_pending(ar, path);
+    return 0;
+}
+
+int audio_route_reset_and_update_path(struct audio_route *ar, const char *name)
+{
+    struct route_path *path = route_stage_path(ar, name, true);
+
+    if (!path)
+        return -1;
+
+    flush_pending(ar, path);
+    return 0;
+}
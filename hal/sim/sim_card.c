@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_sim_card"
+/*#define LOG_NDEBUG 0*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "sim.h"
+
+/* length of the id field of /proc/asound/cards */
+#define SIM_CARD_ID_LEN     15
+
+static pthread_mutex_t sim_card_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool sim_card_boot_started;
+static int64_t sim_card_registered_ns;
+
+/* the delay runs from the first look at the card, like a boot in progress */
+static int64_t sim_card_registration_ns(void)
+{
+    int64_t delay_ms, ns;
+
+    pthread_mutex_lock(&sim_card_lock);
+    if (!sim_card_boot_started) {
+        delay_ms = sim_get_config_int("audio.sim.card_delay_ms", 0);
+        sim_card_registered_ns = sim_clock_now_ns() + delay_ms * 1000000;
+        sim_card_boot_started = true;
+        ALOGI("%s: card %u registers in %lld ms", __func__, sim_card_number(),
+              (long long)delay_ms);
+    }
+    ns = sim_card_registered_ns;
+    pthread_mutex_unlock(&sim_card_lock);
+    return ns;
+}
+
+bool sim_card_is_registered(void)
+{
+    int64_t registered_ns = sim_card_registration_ns();
+
+    return sim_clock_now_ns() >= registered_ns;
+}
+
+void sim_card_reboot(void)
+{
+    pthread_mutex_lock(&sim_card_lock);
+    sim_card_boot_started = false;
+    pthread_mutex_unlock(&sim_card_lock);
+}
+
+int sim_snd_card_list(char *buf, size_t size)
+{
+    char name[PROPERTY_VALUE_MAX];
+    char id[SIM_CARD_ID_LEN + 1];
+    size_t i, j;
+
+    if (!sim_card_is_registered())
+        return snprintf(buf, size, "--- no soundcards ---\n");
+
+    /* ALSA makes the id from the name's alphanumerics */
+    sim_get_config("audio.sim.card_name", name, SIM_CARD_NAME);
+    for (i = 0, j = 0; name[i] != '\0' && j < SIM_CARD_ID_LEN; i++) {
+        if ((name[i] >= 'a' && name[i] <= 'z') ||
+                (name[i] >= 'A' && name[i] <= 'Z') ||
+                (name[i] >= '0' && name[i] <= '9'))
+            id[j++] = name[i];
+    }
+    id[j] = '\0';
+
+    return snprintf(buf, size, "%2u [%-15s]: %.15s - %s\n%22s%s\n",
+                    sim_card_number(), id, name, name, "", name);
+}
+
+void sim_snd_card_wait(int64_t until_ns)
+{
+    int64_t registered_ns = sim_card_registration_ns();
+
+    if (sim_clock_now_ns() < registered_ns && registered_ns < until_ns)
+        until_ns = registered_ns;
+    sim_clock_sleep_until(until_ns);
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_sim_clock"
+/*#define LOG_NDEBUG 0*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "sim.h"
+
+/* virtual time starts away from zero so that timestamps look valid */
+#define SIM_VIRTUAL_CLOCK_START_NS  SIM_NSEC_PER_SEC
+
+static pthread_once_t sim_clock_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t sim_clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool sim_virtual_clock;
+static int64_t sim_virtual_now_ns;
+
+int sim_get_config(const char *key, char *value, const char *default_value)
+{
+    char env_key[PROPERTY_KEY_MAX];
+    const char *env;
+    size_t i;
+
+    if (property_get(key, value, NULL) > 0)
+        return strlen(value);
+
+    for (i = 0; key[i] != '\0' && i < sizeof(env_key) - 1; i++)
+        env_key[i] = (key[i] == '.') ? '_' : toupper((unsigned char)key[i]);
+    env_key[i] = '\0';
+
+    env = getenv(env_key);
+    if (env == NULL)
+        env = default_value ? default_value : "";
+    snprintf(value, PROPERTY_VALUE_MAX, "%s", env);
+    return strlen(value);
+}
+
+int sim_get_config_int(const char *key, int default_value)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    if (sim_get_config(key, value, NULL) == 0)
+        return default_value;
+    return atoi(value);
+}
+
+unsigned int sim_card_number(void)
+{
+    return (unsigned int)sim_get_config_int("audio.sim.card", 0);
+}
+
+static volatile bool sim_card_offline;
+
+void sim_card_set_online(bool online)
+{
+    ALOGI("%s: sound card %s", __func__, online ? "ONLINE" : "OFFLINE");
+    sim_card_offline = !online;
+}
+
+bool sim_card_is_online(void)
+{
+    return !sim_card_offline;
+}
+
+static void sim_clock_init(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    sim_get_config("audio.sim.clock", value, "real");
+    sim_virtual_clock = !strcmp(value, "virtual");
+    sim_virtual_now_ns = SIM_VIRTUAL_CLOCK_START_NS;
+    ALOGI("%s: using %s clock", __func__, sim_virtual_clock ? "virtual" : "real");
+}
+
+int64_t sim_clock_now_ns(void)
+{
+    struct timespec ts;
+    int64_t now;
+
+    pthread_once(&sim_clock_once, sim_clock_init);
+    if (sim_virtual_clock) {
+        pthread_mutex_lock(&sim_clock_lock);
+        now = sim_virtual_now_ns;
+        pthread_mutex_unlock(&sim_clock_lock);
+        return now;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * SIM_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+void sim_clock_to_timespec(int64_t ns, struct timespec *ts)
+{
+    ts->tv_sec = ns / SIM_NSEC_PER_SEC;
+    ts->tv_nsec = ns % SIM_NSEC_PER_SEC;
+}
+
+/* the virtual clock never goes backwards, whichever thread moves it */
+static void sim_clock_advance_to(int64_t when_ns)
+{
+    pthread_mutex_lock(&sim_clock_lock);
+    if (when_ns > sim_virtual_now_ns)
+        sim_virtual_now_ns = when_ns;
+    pthread_mutex_unlock(&sim_clock_lock);
+}
+
+void sim_clock_sleep_until(int64_t when_ns)
+{
+    struct timespec ts;
+
+    pthread_once(&sim_clock_once, sim_clock_init);
+    if (sim_virtual_clock) {
+        sim_clock_advance_to(when_ns);
+        return;
+    }
+
+    sim_clock_to_timespec(when_ns, &ts);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+void sim_clock_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+void sim_clock_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock,
+                         int64_t when_ns)
+{
+    struct timespec ts;
+
+    pthread_once(&sim_clock_once, sim_clock_init);
+    if (when_ns < 0) {
+        pthread_cond_wait(cond, lock);
+        return;
+    }
+
+    if (sim_virtual_clock) {
+        sim_clock_advance_to(when_ns);
+        return;
+    }
+
+    sim_clock_to_timespec(when_ns, &ts);
+    pthread_cond_timedwait(cond, lock, &ts);
+}
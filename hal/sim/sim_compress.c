@@ -0,0 +1,526 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_sim_compress"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <sound/asound.h>
+#include <tinycompress/tinycompress.h>
+
+#include "sim.h"
+
+/* assumed when the client does not provide a bit rate */
+#define SIM_COMPRESS_DEFAULT_BIT_RATE   128000
+
+/*
+ * Simulated compress offload device. The DSP consumes the ring buffer at the
+ * stream byte rate while running, and renders PCM frames for as long as it
+ * has data. Playback time is tracked in nanoseconds so that both the
+ * consumed byte count and the rendered frame count derive from it without
+ * accumulating rounding errors.
+ */
+struct compress {
+    int fd; /* always -1, kept first for callers peeking at the descriptor */
+    unsigned int flags;
+    unsigned int device;
+    struct compr_config config;
+    struct snd_codec codec;
+    bool ready;
+    bool running;
+    bool paused;
+    int nonblocking;
+    unsigned int generation; /* bumped on stop to abort pending waits */
+    uint64_t buffer_size;
+    uint64_t byte_rate;
+    unsigned int sample_rate;
+    uint64_t written;
+    uint64_t consumed;
+    uint64_t track_end;      /* end of the current track for partial drain */
+    int64_t played_ns;
+    int64_t last_update_ns;
+    uint32_t writes;         /* compress_write() calls that moved data */
+    uint64_t total_written;  /* not cleared by stop */
+    int64_t open_ns;
+    enum sim_compress_request last_request;
+    struct compr_gapless_mdata gapless_mdata;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char error[128];
+};
+
+static struct compress bad_compress = {
+    .fd = -1,
+    .error = "cannot allocate compress",
+};
+
+static pthread_mutex_t sim_compress_devices_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct compress *sim_compress_devices[SIM_MAX_DEVICES];
+
+static const unsigned int sim_alsa_rates[] = {
+    5512, 8000, 11025, 16000, 22050, 32000, 44100,
+    48000, 64000, 88200, 96000, 176400, 192000
+};
+
+static int oops(struct compress *compress, int e, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(compress->error, sizeof(compress->error), fmt, ap);
+    va_end(ap);
+    errno = e;
+    return -1;
+}
+
+int compress_get_alsa_rate(unsigned int rate)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(sim_alsa_rates) / sizeof(sim_alsa_rates[0]); i++) {
+        if (sim_alsa_rates[i] == rate)
+            return 1 << i;
+    }
+    return 0;
+}
+
+/* the codec sample rate is either an SNDRV_PCM_RATE_* bit or a rate in Hz */
+static unsigned int sim_codec_rate(unsigned int rate)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(sim_alsa_rates) / sizeof(sim_alsa_rates[0]); i++) {
+        if (rate == (1u << i))
+            return sim_alsa_rates[i];
+    }
+    return rate ? rate : 48000;
+}
+
+static uint64_t sim_codec_byte_rate(const struct snd_codec *codec,
+                                    unsigned int sample_rate)
+{
+    unsigned int channels = codec->ch_in ? codec->ch_in : 2;
+
+    if (codec->id == SND_AUDIOCODEC_PCM) {
+        unsigned int bytes;
+
+        switch (codec->format) {
+        case SNDRV_PCM_FORMAT_S24_LE:
+        case SNDRV_PCM_FORMAT_S32_LE:
+            bytes = 4;
+            break;
+        case SNDRV_PCM_FORMAT_S24_3LE:
+            bytes = 3;
+            break;
+        default:
+            bytes = 2;
+            break;
+        }
+        return (uint64_t)sample_rate * channels * bytes;
+    }
+    return (codec->bit_rate ? codec->bit_rate : SIM_COMPRESS_DEFAULT_BIT_RATE) / 8;
+}
+
+/* must be called with compress->lock held */
+static void compress_update_l(struct compress *compress, int64_t now)
+{
+    int64_t delta, left_ns;
+
+    if (compress->running && !compress->paused && now > compress->last_update_ns) {
+        delta = now - compress->last_update_ns;
+        left_ns = (int64_t)((compress->written - compress->consumed) *
+                            SIM_NSEC_PER_SEC / compress->byte_rate);
+        if (delta > left_ns)
+            delta = left_ns;
+        compress->played_ns += delta;
+        compress->consumed = sim_ns_to_units(compress->played_ns,
+                                             compress->byte_rate);
+        if (compress->consumed > compress->written)
+            compress->consumed = compress->written;
+    }
+    compress->last_update_ns = now;
+}
+
+/* time at which the DSP will have consumed up to the given byte offset */
+static int64_t compress_time_at_l(struct compress *compress, uint64_t offset,
+                                  int64_t now)
+{
+    if (!compress->running || compress->paused)
+        return -1;
+    if (offset <= compress->consumed)
+        return now;
+    return now + (int64_t)((offset - compress->consumed) * SIM_NSEC_PER_SEC /
+                           compress->byte_rate) + 1;
+}
+
+struct compress *compress_open(unsigned int card, unsigned int device,
+                               unsigned int flags, struct compr_config *config)
+{
+    struct compress *compress;
+
+    compress = calloc(1, sizeof(struct compress));
+    if (!compress)
+        return &bad_compress;
+
+    compress->fd = -1;
+    compress->flags = flags;
+    compress->device = device;
+    pthread_mutex_init(&compress->lock, (const pthread_mutexattr_t *) NULL);
+    sim_clock_cond_init(&compress->cond);
+
+    if (!(flags & COMPRESS_IN)) {
+        oops(compress, EINVAL, "compressed capture is not simulated");
+        return compress;
+    }
+    if (config == NULL || config->codec == NULL ||
+            config->fragment_size == 0 || config->fragments == 0) {
+        oops(compress, EINVAL, "invalid compress config");
+        return compress;
+    }
+    if (card != sim_card_number() || device >= SIM_MAX_DEVICES) {
+        oops(compress, ENODEV, "cannot open device (%u:%u)", card, device);
+        return compress;
+    }
+    if (!sim_card_is_online()) {
+        oops(compress, ENETRESET, "cannot open device (%u:%u): sound card is "
+             "offline", card, device);
+        return compress;
+    }
+
+    pthread_mutex_lock(&sim_compress_devices_lock);
+    if (sim_compress_devices[device] != NULL) {
+        pthread_mutex_unlock(&sim_compress_devices_lock);
+        oops(compress, EBUSY, "cannot open device (%u:%u): busy", card, device);
+        return compress;
+    }
+    sim_compress_devices[device] = compress;
+    pthread_mutex_unlock(&sim_compress_devices_lock);
+
+    compress->codec = *config->codec;
+    compress->config = *config;
+    compress->config.codec = &compress->codec;
+    compress->buffer_size = (uint64_t)config->fragment_size * config->fragments;
+    compress->sample_rate = sim_codec_rate(compress->codec.sample_rate);
+    compress->byte_rate = sim_codec_byte_rate(&compress->codec, compress->sample_rate);
+    compress->ready = true;
+    compress->open_ns = sim_clock_now_ns();
+
+    ALOGV("%s: device %u codec %u rate %u byte rate %llu, %u x %u bytes",
+          __func__, device, compress->codec.id, compress->sample_rate,
+          (unsigned long long)compress->byte_rate,
+          config->fragment_size, config->fragments);
+    return compress;
+}
+
+void compress_close(struct compress *compress)
+{
+    if (compress == &bad_compress)
+        return;
+
+    if (compress->ready) {
+        int64_t open_ms = (sim_clock_now_ns() - compress->open_ns) / 1000000;
+
+        /* each write that moved data wakes the DSP on a real device */
+        ALOGI("%s: device %u: %u writes, %llu bytes in %lld ms", __func__,
+              compress->device, compress->writes,
+              (unsigned long long)compress->total_written, (long long)open_ms);
+
+        pthread_mutex_lock(&sim_compress_devices_lock);
+        sim_compress_devices[compress->device] = NULL;
+        pthread_mutex_unlock(&sim_compress_devices_lock);
+    }
+
+    pthread_cond_destroy(&compress->cond);
+    pthread_mutex_destroy(&compress->lock);
+    free(compress);
+}
+
+int is_compress_ready(struct compress *compress)
+{
+    return compress->ready;
+}
+
+int is_compress_running(struct compress *compress)
+{
+    return compress->ready && compress->running;
+}
+
+const char *compress_get_error(struct compress *compress)
+{
+    return compress->error;
+}
+
+void compress_nonblock(struct compress *compress, int nonblock)
+{
+    compress->nonblocking = !!nonblock;
+}
+
+int compress_write(struct compress *compress, const void *buf __unused,
+                   unsigned int size)
+{
+    unsigned int total = 0;
+    unsigned int generation;
+
+    if (!compress->ready)
+        return oops(compress, ENODEV, "device not ready");
+    if (!sim_card_is_online())
+        return oops(compress, ENETRESET, "sound card is offline");
+
+    pthread_mutex_lock(&compress->lock);
+    generation = compress->generation;
+    while (size > 0) {
+        int64_t now = sim_clock_now_ns();
+        uint64_t avail;
+        unsigned int chunk;
+
+        compress_update_l(compress, now);
+        avail = compress->buffer_size - (compress->written - compress->consumed);
+
+        /* like the driver, only accept data once a fragment is free */
+        if (avail < compress->config.fragment_size) {
+            int64_t when = compress_time_at_l(compress,
+                    compress->written + compress->config.fragment_size -
+                    compress->buffer_size, now);
+
+            if (compress->nonblocking || when < 0)
+                break;
+            sim_clock_cond_wait(&compress->cond, &compress->lock, when);
+            if (generation != compress->generation)
+                break;
+            continue;
+        }
+
+        chunk = (avail < size) ? (unsigned int)avail : size;
+        compress->written += chunk;
+        total += chunk;
+        size -= chunk;
+    }
+    if (total > 0) {
+        compress->writes++;
+        compress->total_written += total;
+    }
+    pthread_mutex_unlock(&compress->lock);
+    return total;
+}
+
+int compress_start(struct compress *compress)
+{
+    if (!compress->ready)
+        return oops(compress, ENODEV, "device not ready");
+
+    pthread_mutex_lock(&compress->lock);
+    compress->running = true;
+    compress->paused = false;
+    compress->last_update_ns = sim_clock_now_ns();
+    pthread_cond_broadcast(&compress->cond);
+    pthread_mutex_unlock(&compress->lock);
+    return 0;
+}
+
+int compress_stop(struct compress *compress)
+{
+    if (!compress->ready)
+        return oops(compress, ENODEV, "device not ready");
+
+    pthread_mutex_lock(&compress->lock);
+    compress->running = false;
+    compress->paused = false;
+    compress->generation++;
+    compress->written = 0;
+    compress->consumed = 0;
+    compress->track_end = 0;
+    compress->played_ns = 0;
+    pthread_cond_broadcast(&compress->cond);
+    pthread_mutex_unlock(&compress->lock);
+    return 0;
+}
+
+int compress_pause(struct compress *compress)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&compress->lock);
+    if (compress->running) {
+        compress_update_l(compress, sim_clock_now_ns());
+        compress->paused = true;
+    } else {
+        ret = oops(compress, EPERM, "pause while not running");
+    }
+    pthread_mutex_unlock(&compress->lock);
+    return ret;
+}
+
+int compress_resume(struct compress *compress)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&compress->lock);
+    if (compress->running && compress->paused) {
+        compress->paused = false;
+        compress->last_update_ns = sim_clock_now_ns();
+        pthread_cond_broadcast(&compress->cond);
+    } else {
+        ret = oops(compress, EPERM, "resume while not paused");
+    }
+    pthread_mutex_unlock(&compress->lock);
+    return ret;
+}
+
+/* waits until the DSP has consumed the track or the whole buffer, aborted
+ * by compress_stop()
+ */
+static int compress_wait_consumed(struct compress *compress, bool partial)
+{
+    unsigned int generation;
+    uint64_t offset;
+    int ret = 0;
+
+    pthread_mutex_lock(&compress->lock);
+    if (!partial)
+        compress->last_request = SIM_COMPRESS_DRAIN;
+    if (!compress->running) {
+        pthread_mutex_unlock(&compress->lock);
+        return oops(compress, EPERM, "drain while not running");
+    }
+
+    generation = compress->generation;
+    offset = partial ? compress->track_end : compress->written;
+    for (;;) {
+        int64_t now = sim_clock_now_ns();
+
+        compress_update_l(compress, now);
+        if (generation != compress->generation) {
+            ret = oops(compress, EINTR, "drain aborted by stop");
+            break;
+        }
+        if (compress->consumed >= offset)
+            break;
+        sim_clock_cond_wait(&compress->cond, &compress->lock,
+                            compress_time_at_l(compress, offset, now));
+    }
+    pthread_mutex_unlock(&compress->lock);
+    return ret;
+}
+
+int compress_drain(struct compress *compress)
+{
+    return compress_wait_consumed(compress, false);
+}
+
+int compress_next_track(struct compress *compress)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&compress->lock);
+    compress->last_request = SIM_COMPRESS_PARTIAL_DRAIN;
+    if (compress->running)
+        compress->track_end = compress->written;
+    else
+        ret = oops(compress, EPERM, "next track while not running");
+    pthread_mutex_unlock(&compress->lock);
+    return ret;
+}
+
+int compress_partial_drain(struct compress *compress)
+{
+    return compress_wait_consumed(compress, true);
+}
+
+int compress_set_gapless_metadata(struct compress *compress,
+                                  struct compr_gapless_mdata *mdata)
+{
+    pthread_mutex_lock(&compress->lock);
+    compress->gapless_mdata = *mdata;
+    pthread_mutex_unlock(&compress->lock);
+    return 0;
+}
+
+int compress_wait(struct compress *compress, int timeout_ms)
+{
+    int64_t deadline = -1;
+    unsigned int generation;
+    int ret = 0;
+
+    if (!compress->ready)
+        return oops(compress, ENODEV, "device not ready");
+
+    pthread_mutex_lock(&compress->lock);
+    compress->last_request = SIM_COMPRESS_WAIT;
+    generation = compress->generation;
+    if (timeout_ms >= 0)
+        deadline = sim_clock_now_ns() + (int64_t)timeout_ms * 1000000;
+
+    for (;;) {
+        int64_t now = sim_clock_now_ns();
+        int64_t when;
+
+        compress_update_l(compress, now);
+        if (generation != compress->generation) {
+            ret = oops(compress, EBADFD, "wait aborted by stop");
+            break;
+        }
+        if (compress->buffer_size - (compress->written - compress->consumed) >=
+                compress->config.fragment_size)
+            break;
+        if (deadline >= 0 && now >= deadline) {
+            ret = oops(compress, ETIME, "poll timed out");
+            break;
+        }
+
+        when = compress_time_at_l(compress, compress->written +
+                compress->config.fragment_size - compress->buffer_size, now);
+        if (deadline >= 0 && (when < 0 || when > deadline))
+            when = deadline;
+        sim_clock_cond_wait(&compress->cond, &compress->lock, when);
+    }
+    pthread_mutex_unlock(&compress->lock);
+    return ret;
+}
+
+enum sim_compress_request sim_compress_last_request(struct compress *compress)
+{
+    enum sim_compress_request request;
+
+    pthread_mutex_lock(&compress->lock);
+    request = compress->last_request;
+    pthread_mutex_unlock(&compress->lock);
+    return request;
+}
+
+int compress_get_tstamp(struct compress *compress, unsigned long *samples,
+                        unsigned int *sampling_rate)
+{
+    if (!compress->ready)
+        return oops(compress, ENODEV, "device not ready");
+    if (!sim_card_is_online())
+        return oops(compress, ENETRESET, "sound card is offline");
+
+    pthread_mutex_lock(&compress->lock);
+    compress_update_l(compress, sim_clock_now_ns());
+    *samples = (unsigned long)sim_ns_to_units(compress->played_ns,
+                                              compress->sample_rate);
+    *sampling_rate = compress->sample_rate;
+    pthread_mutex_unlock(&compress->lock);
+    return 0;
+}
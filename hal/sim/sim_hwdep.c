@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_sim_hwdep"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include "sim.h"
+
+static pthread_mutex_t sim_hwdep_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sim_hwdep_write sim_hwdep_writes[SIM_HWDEP_MAX_WRITES];
+static unsigned int sim_hwdep_write_count;
+
+/* descriptor of /dev/null so that the caller can close() it as usual */
+int sim_hwdep_open(unsigned int card, unsigned int device)
+{
+    int fd;
+
+    if (card != sim_card_number() || !sim_card_is_online()) {
+        errno = ENODEV;
+        return -1;
+    }
+    fd = open("/dev/null", O_WRONLY);
+    pthread_mutex_lock(&sim_hwdep_lock);
+    sim_hwdep_write_count = 0;
+    pthread_mutex_unlock(&sim_hwdep_lock);
+    ALOGV("%s: hwC%uD%u as fd %d", __func__, card, device, fd);
+    return fd;
+}
+
+int sim_hwdep_write(int fd, int cal_type, size_t bytes)
+{
+    struct sim_hwdep_write entry;
+    int64_t cost_us;
+
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    if (!sim_card_is_online()) {
+        errno = ENETRESET;
+        return -1;
+    }
+    cost_us = sim_get_config_int("audio.sim.hwdep_us", 200) +
+              (int64_t)bytes * sim_get_config_int("audio.sim.hwdep_us_per_kb",
+                                                  20) / 1024;
+    entry.cal_type = cal_type;
+    entry.bytes = bytes;
+    entry.start_ns = sim_clock_now_ns();
+    sim_clock_sleep_until(entry.start_ns + cost_us * 1000);
+    entry.end_ns = sim_clock_now_ns();
+
+    pthread_mutex_lock(&sim_hwdep_lock);
+    if (sim_hwdep_write_count < SIM_HWDEP_MAX_WRITES)
+        sim_hwdep_writes[sim_hwdep_write_count++] = entry;
+    pthread_mutex_unlock(&sim_hwdep_lock);
+    return 0;
+}
+
+unsigned int sim_hwdep_get_writes(struct sim_hwdep_write *writes,
+                                  unsigned int max)
+{
+    unsigned int count;
+
+    pthread_mutex_lock(&sim_hwdep_lock);
+    count = sim_hwdep_write_count < max ? sim_hwdep_write_count : max;
+    memcpy(writes, sim_hwdep_writes, count * sizeof(*writes));
+    pthread_mutex_unlock(&sim_hwdep_lock);
+    return count;
+}
@@ -0,0 +1,551 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_sim_mixer"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <expat.h>
+#include <tinyalsa/asoundlib.h>
+
+#include "sim.h"
+
+#define SIM_MIXER_PATHS         "/system/etc/mixer_paths.xml"
+#define SIM_HDMI_EDID_CTL       "HDMI EDID"
+/* values given to controls that are created on first lookup */
+#define SIM_LAZY_CTL_VALUES     128
+#define SIM_BUF_SIZE            1024
+
+enum {
+    SIM_CTL_INT,
+    SIM_CTL_ENUM,
+    SIM_CTL_BYTE,
+};
+
+struct mixer_ctl {
+    struct mixer *mixer;
+    char *name;
+    int type;
+    unsigned int num_values;
+    long *values;          /* integer values, or enum indexes */
+    unsigned char *bytes;
+    char **enums;
+    unsigned int num_enums;
+    bool lazy;             /* created on lookup, not listed in mixer paths */
+};
+
+/*
+ * All mixer_open() calls on the simulated card share one control namespace,
+ * so that audio_route and the HAL observe each other's writes as they would
+ * on a real card.
+ */
+struct mixer {
+    unsigned int card;
+    char name[PROPERTY_VALUE_MAX];
+    struct mixer_ctl **ctls;
+    unsigned int num_ctls;
+    unsigned int max_ctls;
+    bool strict;
+    int64_t write_cost_ns;
+    unsigned int writes;
+    int refs;
+};
+
+static pthread_mutex_t sim_mixer_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mixer *sim_mixer;
+
+static struct mixer_ctl *mixer_add_ctl(struct mixer *mixer, const char *name,
+                                       int type, unsigned int num_values)
+{
+    struct mixer_ctl *ctl;
+
+    if (mixer->num_ctls == mixer->max_ctls) {
+        unsigned int max = mixer->max_ctls ? mixer->max_ctls * 2 : 256;
+        struct mixer_ctl **ctls = realloc(mixer->ctls, max * sizeof(*ctls));
+
+        if (!ctls)
+            return NULL;
+        mixer->ctls = ctls;
+        mixer->max_ctls = max;
+    }
+
+    ctl = calloc(1, sizeof(struct mixer_ctl));
+    if (!ctl)
+        return NULL;
+
+    ctl->mixer = mixer;
+    ctl->name = strdup(name);
+    ctl->type = type;
+    ctl->num_values = num_values;
+    if (type == SIM_CTL_BYTE)
+        ctl->bytes = calloc(num_values, sizeof(*ctl->bytes));
+    else
+        ctl->values = calloc(num_values, sizeof(*ctl->values));
+    if (!ctl->name || (!ctl->bytes && !ctl->values)) {
+        free(ctl->name);
+        free(ctl->bytes);
+        free(ctl->values);
+        free(ctl);
+        return NULL;
+    }
+
+    mixer->ctls[mixer->num_ctls++] = ctl;
+    return ctl;
+}
+
+static struct mixer_ctl *mixer_find_ctl(struct mixer *mixer, const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < mixer->num_ctls; i++) {
+        if (!strcmp(mixer->ctls[i]->name, name))
+            return mixer->ctls[i];
+    }
+    return NULL;
+}
+
+static int mixer_ctl_find_enum(struct mixer_ctl *ctl, const char *string)
+{
+    unsigned int i;
+
+    for (i = 0; i < ctl->num_enums; i++) {
+        if (!strcmp(ctl->enums[i], string))
+            return i;
+    }
+    return -1;
+}
+
+static int mixer_ctl_add_enum(struct mixer_ctl *ctl, const char *string)
+{
+    char **enums;
+    int index = mixer_ctl_find_enum(ctl, string);
+
+    if (index >= 0)
+        return index;
+
+    enums = realloc(ctl->enums, (ctl->num_enums + 1) * sizeof(*enums));
+    if (!enums)
+        return -ENOMEM;
+    ctl->enums = enums;
+    ctl->enums[ctl->num_enums] = strdup(string);
+    if (!ctl->enums[ctl->num_enums])
+        return -ENOMEM;
+    return ctl->num_enums++;
+}
+
+static int mixer_ctl_resize(struct mixer_ctl *ctl, unsigned int num_values)
+{
+    long *values;
+
+    if (num_values <= ctl->num_values || ctl->type == SIM_CTL_BYTE)
+        return 0;
+
+    values = realloc(ctl->values, num_values * sizeof(*values));
+    if (!values)
+        return -ENOMEM;
+    memset(values + ctl->num_values, 0,
+           (num_values - ctl->num_values) * sizeof(*values));
+    ctl->values = values;
+    ctl->num_values = num_values;
+    return 0;
+}
+
+static bool is_number(const char *str)
+{
+    char *end;
+
+    if (*str == '\0')
+        return false;
+    strtol(str, &end, 0);
+    return *end == '\0';
+}
+
+static void mixer_start_tag(void *data, const XML_Char *tag_name,
+                            const XML_Char **attr)
+{
+    struct mixer *mixer = (struct mixer *)data;
+    struct mixer_ctl *ctl;
+    const char *name = NULL, *value = NULL;
+    unsigned int id = 0;
+    unsigned int i;
+
+    if (strcmp(tag_name, "ctl"))
+        return;
+
+    for (i = 0; attr[i]; i += 2) {
+        if (!strcmp(attr[i], "name"))
+            name = attr[i + 1];
+        else if (!strcmp(attr[i], "value"))
+            value = attr[i + 1];
+        else if (!strcmp(attr[i], "id"))
+            id = atoi(attr[i + 1]);
+    }
+    if (!name || !value)
+        return;
+
+    ctl = mixer_find_ctl(mixer, name);
+    if (!ctl) {
+        ctl = mixer_add_ctl(mixer, name,
+                            is_number(value) ? SIM_CTL_INT : SIM_CTL_ENUM, id + 1);
+        if (!ctl)
+            return;
+    }
+
+    if (ctl->type == SIM_CTL_ENUM)
+        mixer_ctl_add_enum(ctl, value);
+    else
+        mixer_ctl_resize(ctl, id + 1);
+}
+
+static void mixer_end_tag(void *data __unused, const XML_Char *tag_name __unused)
+{
+}
+
+static int mixer_load_paths(struct mixer *mixer, const char *path)
+{
+    XML_Parser parser;
+    FILE *file;
+    int ret = 0;
+    int bytes_read;
+    void *buf;
+
+    file = fopen(path, "r");
+    if (!file) {
+        ALOGW("%s: failed to open %s, starting with an empty namespace",
+              __func__, path);
+        return -ENODEV;
+    }
+
+    parser = XML_ParserCreate(NULL);
+    if (!parser) {
+        ALOGE("%s: failed to create XML parser", __func__);
+        ret = -ENODEV;
+        goto err_close_file;
+    }
+
+    XML_SetUserData(parser, mixer);
+    XML_SetElementHandler(parser, mixer_start_tag, mixer_end_tag);
+
+    while (1) {
+        buf = XML_GetBuffer(parser, SIM_BUF_SIZE);
+        if (buf == NULL) {
+            ALOGE("%s: XML_GetBuffer failed", __func__);
+            ret = -ENOMEM;
+            goto err_free_parser;
+        }
+
+        bytes_read = fread(buf, 1, SIM_BUF_SIZE, file);
+        if (bytes_read < 0) {
+            ALOGE("%s: fread failed, bytes read = %d", __func__, bytes_read);
+            ret = bytes_read;
+            goto err_free_parser;
+        }
+
+        if (XML_ParseBuffer(parser, bytes_read, bytes_read == 0) == XML_STATUS_ERROR) {
+            ALOGE("%s: XML_ParseBuffer failed, for %s", __func__, path);
+            ret = -EINVAL;
+            goto err_free_parser;
+        }
+
+        if (bytes_read == 0)
+            break;
+    }
+
+err_free_parser:
+    XML_ParserFree(parser);
+err_close_file:
+    fclose(file);
+    return ret;
+}
+
+/* a single LPCM short audio descriptor, so HDMI reports a sink */
+static void mixer_add_hdmi_edid(struct mixer *mixer)
+{
+    struct mixer_ctl *ctl;
+    int channels = sim_get_config_int("audio.sim.hdmi_channels", 2);
+
+    if (channels < 1 || channels > 8)
+        channels = 2;
+
+    ctl = mixer_add_ctl(mixer, SIM_HDMI_EDID_CTL, SIM_CTL_BYTE, 3);
+    if (!ctl)
+        return;
+    ctl->bytes[0] = (1 << 3) | (channels - 1);
+    ctl->bytes[1] = 0x07; /* 32, 44.1 and 48 kHz */
+    ctl->bytes[2] = 0x01; /* 16 bit */
+}
+
+static void mixer_free(struct mixer *mixer)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < mixer->num_ctls; i++) {
+        struct mixer_ctl *ctl = mixer->ctls[i];
+
+        for (j = 0; j < ctl->num_enums; j++)
+            free(ctl->enums[j]);
+        free(ctl->enums);
+        free(ctl->values);
+        free(ctl->bytes);
+        free(ctl->name);
+        free(ctl);
+    }
+    free(mixer->ctls);
+    free(mixer);
+}
+
+struct mixer *mixer_open(unsigned int card)
+{
+    struct mixer *mixer;
+    char path[PROPERTY_VALUE_MAX];
+    char value[PROPERTY_VALUE_MAX];
+
+    if (card != sim_card_number() || !sim_card_is_registered())
+        return NULL;
+
+    pthread_mutex_lock(&sim_mixer_lock);
+    if (sim_mixer) {
+        sim_mixer->refs++;
+        pthread_mutex_unlock(&sim_mixer_lock);
+        return sim_mixer;
+    }
+
+    mixer = calloc(1, sizeof(struct mixer));
+    if (!mixer) {
+        pthread_mutex_unlock(&sim_mixer_lock);
+        return NULL;
+    }
+
+    mixer->card = card;
+    mixer->refs = 1;
+    sim_get_config("audio.sim.card_name", mixer->name, SIM_CARD_NAME);
+    sim_get_config("audio.sim.mixer_strict", value, "false");
+    mixer->strict = !strcmp(value, "true") || !strcmp(value, "1");
+    mixer->write_cost_ns = (int64_t)sim_get_config_int("audio.sim.ctl_write_us", 0) * 1000;
+
+    mixer_add_hdmi_edid(mixer);
+    sim_get_config("audio.sim.mixer_paths", path, SIM_MIXER_PATHS);
+    mixer_load_paths(mixer, path);
+
+    ALOGI("%s: card %u '%s' with %u controls from %s", __func__, card,
+          mixer->name, mixer->num_ctls, path);
+    sim_mixer = mixer;
+    pthread_mutex_unlock(&sim_mixer_lock);
+    return mixer;
+}
+
+void mixer_close(struct mixer *mixer)
+{
+    if (!mixer)
+        return;
+
+    pthread_mutex_lock(&sim_mixer_lock);
+    if (--mixer->refs == 0) {
+        ALOGV("%s: %u control writes", __func__, mixer->writes);
+        sim_mixer = NULL;
+        mixer_free(mixer);
+    }
+    pthread_mutex_unlock(&sim_mixer_lock);
+}
+
+const char *mixer_get_name(struct mixer *mixer)
+{
+    return mixer->name;
+}
+
+unsigned int mixer_get_num_ctls(struct mixer *mixer)
+{
+    return mixer->num_ctls;
+}
+
+struct mixer_ctl *mixer_get_ctl(struct mixer *mixer, unsigned int id)
+{
+    struct mixer_ctl *ctl = NULL;
+
+    pthread_mutex_lock(&sim_mixer_lock);
+    if (id < mixer->num_ctls)
+        ctl = mixer->ctls[id];
+    pthread_mutex_unlock(&sim_mixer_lock);
+    return ctl;
+}
+
+struct mixer_ctl *mixer_get_ctl_by_name(struct mixer *mixer, const char *name)
+{
+    struct mixer_ctl *ctl;
+
+    pthread_mutex_lock(&sim_mixer_lock);
+    ctl = mixer_find_ctl(mixer, name);
+    if (!ctl && !mixer->strict) {
+        ALOGV("%s: creating control '%s'", __func__, name);
+        ctl = mixer_add_ctl(mixer, name, SIM_CTL_INT, SIM_LAZY_CTL_VALUES);
+        if (ctl)
+            ctl->lazy = true;
+    }
+    pthread_mutex_unlock(&sim_mixer_lock);
+    return ctl;
+}
+
+void mixer_ctl_update(struct mixer_ctl *ctl __unused)
+{
+}
+
+const char *mixer_ctl_get_name(struct mixer_ctl *ctl)
+{
+    return ctl ? ctl->name : NULL;
+}
+
+unsigned int mixer_ctl_get_num_values(struct mixer_ctl *ctl)
+{
+    return ctl ? ctl->num_values : 0;
+}
+
+unsigned int mixer_ctl_get_num_enums(struct mixer_ctl *ctl)
+{
+    return ctl ? ctl->num_enums : 0;
+}
+
+const char *mixer_ctl_get_enum_string(struct mixer_ctl *ctl,
+                                      unsigned int enum_id)
+{
+    if (!ctl || enum_id >= ctl->num_enums)
+        return NULL;
+    return ctl->enums[enum_id];
+}
+
+/* must be called with sim_mixer_lock held */
+static void mixer_ctl_written_l(struct mixer_ctl *ctl)
+{
+    ctl->mixer->writes++;
+    if (ctl->mixer->write_cost_ns)
+        sim_clock_sleep_until(sim_clock_now_ns() + ctl->mixer->write_cost_ns);
+}
+
+int mixer_ctl_get_value(struct mixer_ctl *ctl, unsigned int id)
+{
+    int value;
+
+    if (!ctl || id >= ctl->num_values)
+        return -EINVAL;
+
+    pthread_mutex_lock(&sim_mixer_lock);
+    if (ctl->type == SIM_CTL_BYTE)
+        value = ctl->bytes[id];
+    else
+        value = (int)ctl->values[id];
+    pthread_mutex_unlock(&sim_mixer_lock);
+    return value;
+}
+
+int mixer_ctl_set_value(struct mixer_ctl *ctl, unsigned int id, int value)
+{
+    int ret = 0;
+
+    if (!ctl || id >= ctl->num_values)
+        return -EINVAL;
+
+    pthread_mutex_lock(&sim_mixer_lock);
+    if (ctl->type == SIM_CTL_BYTE)
+        ctl->bytes[id] = (unsigned char)value;
+    else if (ctl->type == SIM_CTL_ENUM && (value < 0 || (unsigned int)value >= ctl->num_enums))
+        ret = -EINVAL;
+    else
+        ctl->values[id] = value;
+    if (ret == 0)
+        mixer_ctl_written_l(ctl);
+    pthread_mutex_unlock(&sim_mixer_lock);
+    return ret;
+}
+
+int mixer_ctl_get_array(struct mixer_ctl *ctl, void *array, size_t count)
+{
+    if (!ctl || !array || count == 0 || count > ctl->num_values)
+        return -EINVAL;
+
+    pthread_mutex_lock(&sim_mixer_lock);
+    if (ctl->type == SIM_CTL_BYTE)
+        memcpy(array, ctl->bytes, count);
+    else
+        memcpy(array, ctl->values, count * sizeof(long));
+    pthread_mutex_unlock(&sim_mixer_lock);
+    return 0;
+}
+
+int mixer_ctl_set_array(struct mixer_ctl *ctl, const void *array, size_t count)
+{
+    int ret = 0;
+
+    if (!ctl || !array || count == 0)
+        return -EINVAL;
+
+    pthread_mutex_lock(&sim_mixer_lock);
+    if (ctl->type == SIM_CTL_BYTE) {
+        if (count > ctl->num_values)
+            ret = -EINVAL;
+        else
+            memcpy(ctl->bytes, array, count);
+    } else {
+        ret = mixer_ctl_resize(ctl, count);
+        if (ret == 0)
+            memcpy(ctl->values, array, count * sizeof(long));
+    }
+    if (ret == 0)
+        mixer_ctl_written_l(ctl);
+    pthread_mutex_unlock(&sim_mixer_lock);
+    return ret;
+}
+
+int mixer_ctl_set_enum_by_string(struct mixer_ctl *ctl, const char *string)
+{
+    int index;
+    int ret = 0;
+
+    if (!ctl || !string)
+        return -EINVAL;
+
+    pthread_mutex_lock(&sim_mixer_lock);
+    if (ctl->lazy && ctl->type == SIM_CTL_INT) {
+        /* lazily created controls learn their type from the first write */
+        ctl->type = SIM_CTL_ENUM;
+        ctl->num_values = 1;
+    }
+
+    if (ctl->type != SIM_CTL_ENUM) {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    index = mixer_ctl_find_enum(ctl, string);
+    if (index < 0 && !ctl->mixer->strict)
+        index = mixer_ctl_add_enum(ctl, string);
+    if (index < 0) {
+        ret = -EINVAL;
+        goto done;
+    }
+
+    ctl->values[0] = index;
+    mixer_ctl_written_l(ctl);
+done:
+    pthread_mutex_unlock(&sim_mixer_lock);
+    return ret;
+}
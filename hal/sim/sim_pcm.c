@@ -0,0 +1,529 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_sim_pcm"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <tinyalsa/asoundlib.h>
+
+#include "sim.h"
+
+/*
+ * Simulated PCM device. The hardware pointer advances one period at a time
+ * at the configured rate once the stream is started. Playback underruns when
+ * the hardware pointer passes the application pointer, capture overruns when
+ * more than a buffer of data is left unread. Both are counted and recovered
+ * from transparently, as tinyalsa does.
+ */
+struct pcm {
+    int fd; /* always -1, kept first for callers peeking at the descriptor */
+    unsigned int flags;
+    unsigned int device;
+    struct pcm_config config;
+    bool ready;
+    bool running;
+    unsigned int buffer_size;
+    unsigned int frame_size;
+    unsigned int start_threshold;
+    uint64_t appl_ptr;
+    uint64_t hw_ptr;
+    uint64_t hw_base;      /* hw_ptr when the stream was last started */
+    int64_t start_ns;
+    int64_t period_ns;
+    int64_t hw_tstamp_ns;  /* time of the last hw_ptr update */
+    unsigned int xruns;
+    int16_t *loopback_buf; /* channel 0 of the playback ring buffer */
+    bool loopback;         /* capture what the loopback played */
+    bool counter;          /* capture the frame position, see sim.h */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char error[128];
+};
+
+static struct pcm bad_pcm = {
+    .fd = -1,
+    .error = "cannot allocate pcm",
+};
+
+static pthread_mutex_t sim_pcm_devices_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pcm *sim_pcm_devices[2][SIM_MAX_DEVICES];
+
+/*
+ * Acoustic loopback shared by all devices. Played samples are stored by the
+ * time they left the speaker, on a fixed 48kHz grid covering one second, and
+ * captured samples are looked up by their capture time minus the delay.
+ * Lock order is pcm->lock, then sim_loopback.lock.
+ */
+#define SIM_LOOPBACK_RATE    48000
+#define SIM_LOOPBACK_SAMPLES SIM_LOOPBACK_RATE
+
+static struct {
+    pthread_mutex_t lock;
+    int64_t delay_ns;
+    int16_t sample[SIM_LOOPBACK_SAMPLES];
+    uint64_t slot[SIM_LOOPBACK_SAMPLES]; /* grid index + 1 held, 0 if none */
+} sim_loopback = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* audio.sim.loopback_us is read again by each device opened */
+static bool sim_loopback_configure(void)
+{
+    int delay_us = sim_get_config_int("audio.sim.loopback_us", 0);
+    int64_t delay_ns = delay_us > 0 ? (int64_t)delay_us * 1000 : 0;
+
+    pthread_mutex_lock(&sim_loopback.lock);
+    if (delay_ns != sim_loopback.delay_ns)
+        ALOGD("%s: loopback delay %d us", __func__, delay_us);
+    sim_loopback.delay_ns = delay_ns;
+    pthread_mutex_unlock(&sim_loopback.lock);
+    return delay_ns != 0;
+}
+
+/* time at which frame pos of a running stream reaches the hardware */
+static int64_t pcm_frame_time_ns(struct pcm *pcm, uint64_t pos)
+{
+    return pcm->start_ns +
+           (int64_t)(pos - pcm->hw_base) * SIM_NSEC_PER_SEC / pcm->config.rate;
+}
+
+/* must be called with pcm->lock held, frames [from, to) were just played */
+static void sim_loopback_play_l(struct pcm *pcm, uint64_t from, uint64_t to)
+{
+    uint64_t pos;
+
+    if (!pcm->loopback_buf)
+        return;
+
+    pthread_mutex_lock(&sim_loopback.lock);
+    for (pos = from; pos < to; pos++) {
+        int64_t t = pcm_frame_time_ns(pcm, pos);
+        uint64_t index;
+
+        if (t < 0)
+            continue;
+        index = sim_ns_to_units(t, SIM_LOOPBACK_RATE);
+        sim_loopback.sample[index % SIM_LOOPBACK_SAMPLES] =
+            pcm->loopback_buf[pos % pcm->buffer_size];
+        sim_loopback.slot[index % SIM_LOOPBACK_SAMPLES] = index + 1;
+    }
+    pthread_mutex_unlock(&sim_loopback.lock);
+}
+
+/* must be called with pcm->lock held, fills channel 0 of frames from pos */
+static void sim_loopback_capture_l(struct pcm *pcm, uint64_t pos,
+                                   int16_t *dst, unsigned int frames)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&sim_loopback.lock);
+    for (i = 0; i < frames; i++) {
+        int64_t t = pcm_frame_time_ns(pcm, pos + i) - sim_loopback.delay_ns;
+        uint64_t index;
+
+        if (t < 0)
+            continue;
+        index = sim_ns_to_units(t, SIM_LOOPBACK_RATE);
+        if (sim_loopback.slot[index % SIM_LOOPBACK_SAMPLES] == index + 1)
+            dst[i * pcm->config.channels] =
+                sim_loopback.sample[index % SIM_LOOPBACK_SAMPLES];
+    }
+    pthread_mutex_unlock(&sim_loopback.lock);
+}
+
+/* must be called with pcm->lock held, fills channel 0 of frames from pos */
+static void sim_counter_capture_l(struct pcm *pcm, uint64_t pos,
+                                  int16_t *dst, unsigned int frames)
+{
+    unsigned int i;
+
+    for (i = 0; i < frames; i++)
+        dst[i * pcm->config.channels] = (int16_t)(uint16_t)(pos + i);
+}
+
+unsigned int pcm_format_to_bits(enum pcm_format format)
+{
+    switch (format) {
+    case PCM_FORMAT_S32_LE:
+    case PCM_FORMAT_S24_LE:
+        return 32;
+    case PCM_FORMAT_S8:
+        return 8;
+    default:
+    case PCM_FORMAT_S16_LE:
+        return 16;
+    };
+}
+
+unsigned int pcm_frames_to_bytes(struct pcm *pcm, unsigned int frames)
+{
+    return frames * pcm->frame_size;
+}
+
+unsigned int pcm_bytes_to_frames(struct pcm *pcm, unsigned int bytes)
+{
+    return pcm->frame_size ? bytes / pcm->frame_size : 0;
+}
+
+unsigned int pcm_get_buffer_size(struct pcm *pcm)
+{
+    return pcm->buffer_size;
+}
+
+const char *pcm_get_error(struct pcm *pcm)
+{
+    return pcm->error;
+}
+
+int pcm_is_ready(struct pcm *pcm)
+{
+    return pcm->ready;
+}
+
+/* must be called with pcm->lock held */
+static void pcm_start_l(struct pcm *pcm, int64_t now)
+{
+    pcm->running = true;
+    pcm->start_ns = now;
+    pcm->hw_tstamp_ns = now;
+    pcm->hw_base = pcm->hw_ptr;
+}
+
+/* must be called with pcm->lock held */
+static void pcm_update_l(struct pcm *pcm, int64_t now)
+{
+    int64_t periods;
+    uint64_t pos;
+
+    if (!pcm->running || now < pcm->start_ns)
+        return;
+
+    periods = (now - pcm->start_ns) / pcm->period_ns;
+    pos = pcm->hw_base + (uint64_t)periods * pcm->config.period_size;
+    pcm->hw_tstamp_ns = pcm->start_ns + periods * pcm->period_ns;
+
+    if (pcm->flags & PCM_IN) {
+        pcm->hw_ptr = pos;
+        if (pcm->hw_ptr - pcm->appl_ptr > pcm->buffer_size) {
+            pcm->xruns++;
+            ALOGW("%s: overrun on capture device %u (%u total)",
+                  __func__, pcm->device, pcm->xruns);
+            pcm->appl_ptr = pcm->hw_ptr;
+            pcm_start_l(pcm, now);
+        }
+    } else if (pos > pcm->appl_ptr) {
+        pcm->xruns++;
+        ALOGW("%s: underrun on playback device %u (%u total)",
+              __func__, pcm->device, pcm->xruns);
+        sim_loopback_play_l(pcm, pcm->hw_ptr, pcm->appl_ptr);
+        pcm->hw_ptr = pcm->appl_ptr;
+        pcm->running = false;
+    } else {
+        sim_loopback_play_l(pcm, pcm->hw_ptr, pos);
+        pcm->hw_ptr = pos;
+    }
+}
+
+/* must be called with pcm->lock held and the stream running */
+static int64_t pcm_next_period_ns(struct pcm *pcm, int64_t now)
+{
+    return pcm->start_ns + ((now - pcm->start_ns) / pcm->period_ns + 1) * pcm->period_ns;
+}
+
+struct pcm *pcm_open(unsigned int card, unsigned int device,
+                     unsigned int flags, struct pcm_config *config)
+{
+    struct pcm *pcm;
+    int dir = (flags & PCM_IN) ? 1 : 0;
+
+    pcm = calloc(1, sizeof(struct pcm));
+    if (!pcm)
+        return &bad_pcm;
+
+    pcm->fd = -1;
+    pcm->flags = flags;
+    pcm->device = device;
+    pthread_mutex_init(&pcm->lock, (const pthread_mutexattr_t *) NULL);
+    sim_clock_cond_init(&pcm->cond);
+
+    if (config == NULL || config->rate == 0 || config->channels == 0 ||
+            config->period_size == 0 || config->period_count == 0) {
+        snprintf(pcm->error, sizeof(pcm->error), "invalid pcm config");
+        return pcm;
+    }
+
+    if (card != sim_card_number() || device >= SIM_MAX_DEVICES) {
+        snprintf(pcm->error, sizeof(pcm->error),
+                 "cannot open device (%u:%u): No such device", card, device);
+        return pcm;
+    }
+    if (!sim_card_is_online()) {
+        snprintf(pcm->error, sizeof(pcm->error),
+                 "cannot open device (%u:%u): sound card is offline",
+                 card, device);
+        return pcm;
+    }
+
+    pthread_mutex_lock(&sim_pcm_devices_lock);
+    if (sim_pcm_devices[dir][device] != NULL) {
+        pthread_mutex_unlock(&sim_pcm_devices_lock);
+        snprintf(pcm->error, sizeof(pcm->error),
+                 "cannot open device (%u:%u): Device or resource busy",
+                 card, device);
+        return pcm;
+    }
+    sim_pcm_devices[dir][device] = pcm;
+    pthread_mutex_unlock(&sim_pcm_devices_lock);
+
+    pcm->config = *config;
+    pcm->frame_size = config->channels * (pcm_format_to_bits(config->format) >> 3);
+    pcm->buffer_size = config->period_size * config->period_count;
+    pcm->period_ns = (int64_t)config->period_size * SIM_NSEC_PER_SEC / config->rate;
+    if (pcm->period_ns == 0)
+        pcm->period_ns = 1;
+
+    if (config->format == PCM_FORMAT_S16_LE && sim_loopback_configure()) {
+        if (flags & PCM_IN)
+            pcm->loopback = true;
+        else
+            pcm->loopback_buf = calloc(pcm->buffer_size, sizeof(int16_t));
+    }
+    if ((flags & PCM_IN) && config->format == PCM_FORMAT_S16_LE) {
+        char value[PROPERTY_VALUE_MAX];
+
+        sim_get_config("audio.sim.capture_counter", value, "false");
+        pcm->counter = !strcmp(value, "true") || !strcmp(value, "1");
+    }
+
+    pcm->start_threshold = config->start_threshold;
+    if (pcm->start_threshold == 0)
+        pcm->start_threshold = (flags & PCM_IN) ? 1 : pcm->buffer_size / 2;
+    if (pcm->start_threshold > pcm->buffer_size)
+        pcm->start_threshold = pcm->buffer_size;
+
+    pcm->ready = true;
+    ALOGV("%s: device %u %s rate %u channels %u period %u x %u", __func__,
+          device, dir ? "in" : "out", config->rate, config->channels,
+          config->period_size, config->period_count);
+    return pcm;
+}
+
+int pcm_close(struct pcm *pcm)
+{
+    int dir;
+
+    if (pcm == &bad_pcm)
+        return 0;
+
+    dir = (pcm->flags & PCM_IN) ? 1 : 0;
+    if (pcm->ready) {
+        pthread_mutex_lock(&sim_pcm_devices_lock);
+        sim_pcm_devices[dir][pcm->device] = NULL;
+        pthread_mutex_unlock(&sim_pcm_devices_lock);
+        ALOGV("%s: device %u closed after %u xruns", __func__,
+              pcm->device, pcm->xruns);
+    }
+
+    pthread_cond_destroy(&pcm->cond);
+    pthread_mutex_destroy(&pcm->lock);
+    free(pcm->loopback_buf);
+    free(pcm);
+    return 0;
+}
+
+int pcm_prepare(struct pcm *pcm)
+{
+    if (!pcm->ready)
+        return -1;
+
+    pthread_mutex_lock(&pcm->lock);
+    pcm->running = false;
+    if (pcm->flags & PCM_IN)
+        pcm->appl_ptr = pcm->hw_ptr;
+    else
+        pcm->hw_ptr = pcm->appl_ptr;
+    pthread_cond_broadcast(&pcm->cond);
+    pthread_mutex_unlock(&pcm->lock);
+    return 0;
+}
+
+int pcm_start(struct pcm *pcm)
+{
+    if (!pcm->ready)
+        return -1;
+
+    pthread_mutex_lock(&pcm->lock);
+    if (!pcm->running)
+        pcm_start_l(pcm, sim_clock_now_ns());
+    pthread_mutex_unlock(&pcm->lock);
+    return 0;
+}
+
+int pcm_stop(struct pcm *pcm)
+{
+    return pcm_prepare(pcm);
+}
+
+int pcm_write(struct pcm *pcm, const void *data, unsigned int count)
+{
+    unsigned int frames;
+    const int16_t *src = (const int16_t *)data;
+
+    if (!pcm->ready || (pcm->flags & PCM_IN))
+        return -EINVAL;
+    if (!sim_card_is_online()) {
+        errno = ENETRESET;
+        return -ENETRESET;
+    }
+
+    frames = count / pcm->frame_size;
+    pthread_mutex_lock(&pcm->lock);
+    while (frames > 0) {
+        int64_t now = sim_clock_now_ns();
+        unsigned int space, chunk;
+
+        pcm_update_l(pcm, now);
+        space = pcm->buffer_size - (unsigned int)(pcm->appl_ptr - pcm->hw_ptr);
+        if (space == 0) {
+            if (!pcm->running) {
+                /* start threshold above what fits in the buffer */
+                pcm_start_l(pcm, now);
+                continue;
+            }
+            sim_clock_cond_wait(&pcm->cond, &pcm->lock, pcm_next_period_ns(pcm, now));
+            continue;
+        }
+
+        chunk = frames < space ? frames : space;
+        if (pcm->loopback_buf) {
+            unsigned int i;
+
+            for (i = 0; i < chunk; i++, src += pcm->config.channels)
+                pcm->loopback_buf[(pcm->appl_ptr + i) % pcm->buffer_size] = *src;
+        }
+        pcm->appl_ptr += chunk;
+        frames -= chunk;
+        if (!pcm->running && pcm->appl_ptr - pcm->hw_ptr >= pcm->start_threshold)
+            pcm_start_l(pcm, now);
+    }
+    pthread_mutex_unlock(&pcm->lock);
+    return 0;
+}
+
+int pcm_read(struct pcm *pcm, void *data, unsigned int count)
+{
+    unsigned int frames;
+    char *dst = (char *)data;
+
+    if (!pcm->ready || !(pcm->flags & PCM_IN))
+        return -EINVAL;
+    if (!sim_card_is_online()) {
+        errno = ENETRESET;
+        return -ENETRESET;
+    }
+
+    frames = count / pcm->frame_size;
+    pthread_mutex_lock(&pcm->lock);
+    if (!pcm->running)
+        pcm_start_l(pcm, sim_clock_now_ns());
+    while (frames > 0) {
+        int64_t now = sim_clock_now_ns();
+        unsigned int avail, chunk;
+
+        pcm_update_l(pcm, now);
+        avail = (unsigned int)(pcm->hw_ptr - pcm->appl_ptr);
+        if (avail == 0) {
+            sim_clock_cond_wait(&pcm->cond, &pcm->lock, pcm_next_period_ns(pcm, now));
+            if (!pcm->running)
+                break;
+            continue;
+        }
+
+        /* the simulated microphone captures silence, or the loopback */
+        chunk = frames < avail ? frames : avail;
+        memset(dst, 0, chunk * pcm->frame_size);
+        if (pcm->counter)
+            sim_counter_capture_l(pcm, pcm->appl_ptr, (int16_t *)dst, chunk);
+        else if (pcm->loopback)
+            sim_loopback_capture_l(pcm, pcm->appl_ptr, (int16_t *)dst, chunk);
+        dst += chunk * pcm->frame_size;
+        pcm->appl_ptr += chunk;
+        frames -= chunk;
+    }
+    pthread_mutex_unlock(&pcm->lock);
+    return frames ? -EPIPE : 0;
+}
+
+int pcm_mmap_write(struct pcm *pcm, const void *data, unsigned int count)
+{
+    return pcm_write(pcm, data, count);
+}
+
+int pcm_mmap_read(struct pcm *pcm, void *data, unsigned int count)
+{
+    return pcm_read(pcm, data, count);
+}
+
+int pcm_mmap_get_hw_ptr(struct pcm *pcm, unsigned int *hw_ptr,
+                        struct timespec *tstamp)
+{
+    int ret = -1;
+
+    if (!pcm->ready || !hw_ptr || !tstamp)
+        return -1;
+
+    pthread_mutex_lock(&pcm->lock);
+    pcm_update_l(pcm, sim_clock_now_ns());
+    if (pcm->running) {
+        /* truncated like the kernel's pointer seen through tinyalsa */
+        *hw_ptr = (unsigned int)pcm->hw_ptr;
+        sim_clock_to_timespec(pcm->hw_tstamp_ns, tstamp);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&pcm->lock);
+    return ret;
+}
+
+int pcm_get_htimestamp(struct pcm *pcm, unsigned int *avail,
+                       struct timespec *tstamp)
+{
+    int ret = -1;
+
+    if (!pcm->ready)
+        return -1;
+
+    pthread_mutex_lock(&pcm->lock);
+    pcm_update_l(pcm, sim_clock_now_ns());
+    if (pcm->running) {
+        if (pcm->flags & PCM_IN)
+            *avail = (unsigned int)(pcm->hw_ptr - pcm->appl_ptr);
+        else
+            *avail = pcm->buffer_size - (unsigned int)(pcm->appl_ptr - pcm->hw_ptr);
+        sim_clock_to_timespec(pcm->hw_tstamp_ns, tstamp);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&pcm->lock);
+    return ret;
+}
@@ -0,0 +1,38 @@
+# Included from hal/Android.mk, LOCAL_PATH is the HAL directory
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	$(AUDIO_HAL_SRC_FILES) \
+	sim/tests/sim_test.c \
+	sim/tests/sim_card_test.c \
+	sim/tests/usecase_test.c \
+	sim/tests/offload_test.c \
+	sim/tests/latency_test.c \
+	sim/tests/stream_test.c \
+	sim/tests/tuner_test.c \
+	sim/tests/platform_info_test.c \
+	sim/tests/mixer_ctl_test.c \
+	sim/tests/params_test.c \
+	sim/tests/boot_test.c \
+	sim/tests/snd_card_test.c \
+	sim/tests/cal_test.c
+
+LOCAL_CFLAGS := $(AUDIO_HAL_CFLAGS)
+
+ifeq ($(AUDIO_PLATFORM),msm8974)
+    ifeq ($(strip $(AUDIO_FEATURE_ENABLED_HWDEP_CAL)),true)
+        LOCAL_CFLAGS += -DSIM_HWDEP_CAL_TESTS
+    endif
+endif
+
+LOCAL_C_INCLUDES := \
+	$(AUDIO_HAL_C_INCLUDES) \
+	$(LOCAL_PATH)/sim
+
+LOCAL_SHARED_LIBRARIES := $(AUDIO_HAL_SHARED_LIBRARIES)
+
+LOCAL_MODULE := audio_sim_tests
+
+LOCAL_MODULE_TAGS := optional tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/properties.h>
+
+#include "audio_hw.h"
+#include "sim.h"
+#include "sim_test.h"
+#ifdef SIM_HWDEP_CAL_TESTS
+#include "sound/msmcal-hwdep.h"
+#endif
+
+static const struct boot_step_timing *boot_step(struct audio_device *adev,
+                                                const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < adev->boot_step_count; i++) {
+        if (!strcmp(adev->boot_steps[i].name, name))
+            return &adev->boot_steps[i];
+    }
+    return NULL;
+}
+
+/*
+ * adev_open() times its steps, amplifier_open on a worker thread, and the
+ * effect libraries wait for the first offload stream to start.
+ */
+static void test_boot_steps(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_device *adev = (struct audio_device *)dev;
+    const struct boot_step_timing *step;
+    struct audio_stream_out *out;
+    struct audio_config config;
+    size_t bytes;
+    void *buf;
+
+    if (dev == NULL)
+        return;
+    SIM_CHECK(boot_step(adev, "platform_init") != NULL);
+    step = boot_step(adev, "amplifier_open");
+    SIM_CHECK(step != NULL && step->parallel);
+    SIM_CHECK(adev->boot_us > 0);
+    SIM_CHECK(!adev->offload_libs_loaded);
+
+    sim_test_pcm_config(&config);
+    out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                               AUDIO_DEVICE_OUT_SPEAKER, &config);
+    if (out == NULL)
+        goto done;
+    bytes = out->common.get_buffer_size(&out->common);
+    buf = calloc(1, bytes);
+    SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+    free(buf);
+    dev->close_output_stream(dev, out);
+    SIM_CHECK(!adev->offload_libs_loaded);
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = 44100;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = AUDIO_FORMAT_MP3;
+    config.offload_info = AUDIO_INFO_INITIALIZER;
+    config.offload_info.sample_rate = 44100;
+    config.offload_info.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.offload_info.format = AUDIO_FORMAT_MP3;
+    config.offload_info.bit_rate = 128000;
+    out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_DIRECT |
+                               AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD,
+                               AUDIO_DEVICE_OUT_SPEAKER, &config);
+    if (out == NULL)
+        goto done;
+    buf = calloc(1, 4096);
+    SIM_CHECK_EQ(out->write(out, buf, 4096), 4096);
+    free(buf);
+    SIM_CHECK(adev->offload_libs_loaded);
+    dev->close_output_stream(dev, out);
+
+done:
+    sim_test_close_device(dev);
+}
+
+#ifdef SIM_HWDEP_CAL_TESTS
+#define HWDEP_FETCH_US      2000
+#define HWDEP_IOCTL_US      4000
+
+/*
+ * With the stub ACDB loader, platform_init() sends every codec calibration
+ * in type order, each ioctl going out while the next type is fetched.
+ */
+static void test_boot_hwdep_cal(void)
+{
+    struct sim_hwdep_write writes[SIM_HWDEP_MAX_WRITES];
+    const struct boot_step_timing *step;
+    char value[PROPERTY_VALUE_MAX];
+    struct audio_hw_device *dev;
+    unsigned int i, count;
+    int64_t gap_ns;
+
+    /* the stub fetches in real time */
+    if (!sim_test_on_clock("real"))
+        return;
+    sim_test_set_config("audio_hal.acdb_loader", "libacdbloader_sim.so");
+    snprintf(value, sizeof(value), "%d", HWDEP_FETCH_US);
+    sim_test_set_config("audio.sim.acdb_fetch_us", value);
+    sim_test_set_config("audio.sim.acdb_fetch_us_per_kb", "0");
+    snprintf(value, sizeof(value), "%d", HWDEP_IOCTL_US);
+    sim_test_set_config("audio.sim.hwdep_us", value);
+    sim_test_set_config("audio.sim.hwdep_us_per_kb", "0");
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+
+    count = sim_hwdep_get_writes(writes, SIM_HWDEP_MAX_WRITES);
+    SIM_CHECK_EQ(count, WCD9XXX_MAX_CAL - WCD9XXX_ANC_CAL);
+    for (i = 0; i < count; i++) {
+        SIM_CHECK_EQ(writes[i].cal_type, (int)(WCD9XXX_ANC_CAL + i));
+        SIM_CHECK_EQ(writes[i].bytes, 4096);
+        if (i == 0)
+            continue;
+        /* serially, each ioctl would wait HWDEP_FETCH_US for its fetch */
+        gap_ns = writes[i].start_ns - writes[i - 1].end_ns;
+        SIM_CHECK(gap_ns < HWDEP_FETCH_US * 1000LL / 2);
+    }
+    step = boot_step((struct audio_device *)dev, "platform_init");
+    SIM_CHECK(step != NULL && count > 0 && step->us >=
+              (writes[count - 1].end_ns - writes[0].start_ns) / 1000);
+
+    sim_test_close_device(dev);
+}
+#endif
+
+#define BOOT_OPENS          50
+
+/*
+ * adev_open() on the real clock, in total and step by step, with the
+ * platform XML parsed and the codec calibration served by the stub ACDB
+ * loader at its default cost.
+ */
+static void bench_boot(void)
+{
+    static const char *const steps[] = {
+        "platform_init", "amplifier_open", "listen_init",
+    };
+    struct sim_samples total, step_samples[3];
+    const struct boot_step_timing *step;
+    struct audio_hw_device *dev;
+    struct audio_device *adev;
+    unsigned int i, n;
+
+    /* the steps are timed by the HAL on the real clock */
+    if (!sim_test_on_clock("real"))
+        return;
+    sim_test_set_config("audio_hal.acdb_loader", "libacdbloader_sim.so");
+    sim_samples_init(&total, BOOT_OPENS);
+    for (i = 0; i < 3; i++)
+        sim_samples_init(&step_samples[i], BOOT_OPENS);
+    for (n = 0; n < BOOT_OPENS; n++) {
+        dev = sim_test_open_device();
+        if (dev == NULL)
+            break;
+        adev = (struct audio_device *)dev;
+        sim_samples_add(&total, (int64_t)adev->boot_us * 1000);
+        for (i = 0; i < 3; i++) {
+            step = boot_step(adev, steps[i]);
+            if (step != NULL)
+                sim_samples_add(&step_samples[i], (int64_t)step->us * 1000);
+        }
+        sim_test_close_device(dev);
+    }
+    sim_samples_report(&total, "adev_open");
+    sim_samples_free(&total);
+    for (i = 0; i < 3; i++) {
+        if (step_samples[i].count > 0)
+            sim_samples_report(&step_samples[i], steps[i]);
+        sim_samples_free(&step_samples[i]);
+    }
+}
+
+const struct sim_test sim_boot_tests[] = {
+    SIM_TEST(test_boot_steps),
+#ifdef SIM_HWDEP_CAL_TESTS
+    SIM_TEST(test_boot_hwdep_cal),
+#endif
+    SIM_BENCH(bench_boot),
+    SIM_TEST_END
+};
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_hw.h"
+#include "platform.h"
+#include "platform_api.h"
+#include "sim.h"
+#include "sim_test.h"
+
+/* one buffer, which leaves the output started on its device */
+static void write_once(struct audio_stream_out *out)
+{
+    size_t bytes = out->common.get_buffer_size(&out->common);
+    void *buf = calloc(1, bytes);
+
+    SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+    free(buf);
+}
+
+/*
+ * A headset connected while nothing plays has its calibration sent ahead
+ * and not again when the output moves to it; connected while the speaker
+ * plays, playback is left with the speaker's calibration.
+ */
+static void test_cal_prefetch(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_device *adev;
+    struct audio_stream_out *out;
+    struct audio_config config;
+    uint32_t sends, skips, prefetches;
+
+    sim_test_set_config("audio_hal.cal_prefetch", "true");
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+    adev = (struct audio_device *)dev;
+    SIM_CHECK(adev->cal.prefetch);
+
+    /* nothing enabled: both directions are prefetched */
+    sends = adev->cal.sends;
+    prefetches = adev->cal.prefetches;
+    SIM_CHECK_EQ(dev->set_parameters(dev, "connect=4"), 0);
+    SIM_CHECK_EQ(adev->cal.prefetches, prefetches + 2);
+    SIM_CHECK_EQ(adev->cal.sends, sends + 2);
+    SIM_CHECK_EQ(adev->cal.live_acdb_id[CAL_DIR_OUT],
+                 platform_get_snd_device_acdb_id(SND_DEVICE_OUT_HEADPHONES));
+
+    sim_test_pcm_config(&config);
+    out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                               AUDIO_DEVICE_OUT_WIRED_HEADSET, &config);
+    if (out == NULL)
+        goto done;
+    sends = adev->cal.sends;
+    skips = adev->cal.skips;
+    write_once(out);
+    SIM_CHECK_EQ(adev->snd_dev_ref_cnt[SND_DEVICE_OUT_HEADPHONES], 1);
+    SIM_CHECK_EQ(adev->cal.sends, sends);
+    SIM_CHECK_EQ(adev->cal.skips, skips + 1);
+    out->common.standby(&out->common);
+    SIM_CHECK_EQ(dev->set_parameters(dev, "disconnect=4"), 0);
+
+    /* the speaker playing: only capture is prefetched */
+    SIM_CHECK_EQ(out->common.set_parameters(&out->common, "routing=2"), 0);
+    write_once(out);
+    SIM_CHECK_EQ(adev->cal.live_acdb_id[CAL_DIR_OUT],
+                 platform_get_snd_device_acdb_id(SND_DEVICE_OUT_SPEAKER));
+    prefetches = adev->cal.prefetches;
+    SIM_CHECK_EQ(dev->set_parameters(dev, "connect=4"), 0);
+    SIM_CHECK_EQ(adev->cal.prefetches, prefetches + 1);
+    SIM_CHECK_EQ(adev->cal.live_acdb_id[CAL_DIR_OUT],
+                 platform_get_snd_device_acdb_id(SND_DEVICE_OUT_SPEAKER));
+
+    /* the speaker started again still has its calibration in place */
+    out->common.standby(&out->common);
+    SIM_CHECK_EQ(adev->snd_dev_ref_cnt[SND_DEVICE_OUT_SPEAKER], 0);
+    sends = adev->cal.sends;
+    skips = adev->cal.skips;
+    write_once(out);
+    SIM_CHECK_EQ(adev->cal.sends, sends);
+    SIM_CHECK_EQ(adev->cal.skips, skips + 1);
+    dev->close_output_stream(dev, out);
+    SIM_CHECK_EQ(dev->set_parameters(dev, "disconnect=4"), 0);
+
+done:
+    sim_test_close_device(dev);
+}
+
+const struct sim_test sim_cal_tests[] = {
+    SIM_TEST(test_cal_prefetch),
+    SIM_TEST_END
+};
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/properties.h>
+
+#include "audio_hw.h"
+#include "platform.h"
+#include "platform_api.h"
+#include "sim.h"
+#include "sim_test.h"
+
+#define LATENCY_QUERIES     100000
+
+struct calibration {
+    struct audio_hw_device *dev;
+    volatile int done;
+    int64_t elapsed_ns;
+};
+
+static void *calibrate(void *context)
+{
+    struct calibration *cal = context;
+    int64_t start_ns = sim_test_now_ns();
+
+    sim_test_set_parameters(cal->dev, "latency_calibration=%u",
+                            AUDIO_DEVICE_OUT_SPEAKER);
+    cal->elapsed_ns = sim_test_now_ns() - start_ns;
+    __atomic_store_n(&cal->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * Parameter queries, which take adev->lock, keep being answered while the
+ * loopback is measured, rather than waiting for the whole calibration.
+ */
+static void test_latency_calibration_unlocked(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct calibration cal = { .dev = dev };
+    struct sim_samples samples;
+    pthread_t thread;
+    int64_t start_ns, max_ns;
+    char value[PROPERTY_VALUE_MAX];
+
+    if (dev == NULL)
+        return;
+    /* the measurement takes no time to wait for on the virtual clock */
+    if (!sim_test_on_clock("real")) {
+        sim_test_close_device(dev);
+        return;
+    }
+    sim_samples_init(&samples, LATENCY_QUERIES);
+    pthread_create(&thread, NULL, calibrate, &cal);
+    while (!__atomic_load_n(&cal.done, __ATOMIC_ACQUIRE) &&
+           samples.count < samples.max) {
+        start_ns = sim_test_now_ns();
+        sim_test_get_parameter(dev, "latency_calibration", value,
+                               sizeof(value));
+        sim_samples_add(&samples, sim_test_now_ns() - start_ns);
+        usleep(100);
+    }
+    pthread_join(thread, NULL);
+
+    max_ns = sim_samples_percentile(&samples, 100);
+    printf("  calibration took %.1f ms\n", cal.elapsed_ns / 1e6);
+    sim_samples_report(&samples, "queries meanwhile");
+    SIM_CHECK(max_ns < cal.elapsed_ns / 2);
+    sim_samples_free(&samples);
+    sim_test_close_device(dev);
+}
+
+#define MMAP_WARMUP_READS   10
+#define MMAP_MAX_READS      200
+#define MMAP_IMPULSES       8
+#define MMAP_IMPULSE_FRAMES 48
+#define MMAP_IMPULSE_LEVEL  0x4000
+#define MMAP_ONSET_LEVEL    0x1000
+
+struct mmap_writer {
+    struct audio_stream_out *out;
+    volatile int impulse;   /* asked for by the test, cleared once written */
+    volatile int exit;
+    int64_t impulse_ns;     /* when the write carrying it returned */
+};
+
+/* keeps the mmap output fed, with the impulse at the start of a buffer */
+static void *mmap_writer_loop(void *context)
+{
+    struct mmap_writer *writer = context;
+    struct audio_stream_out *out = writer->out;
+    size_t bytes = out->common.get_buffer_size(&out->common);
+    int16_t *buf = malloc(bytes);
+    int i;
+
+    while (!__atomic_load_n(&writer->exit, __ATOMIC_ACQUIRE)) {
+        memset(buf, 0, bytes);
+        if (__atomic_load_n(&writer->impulse, __ATOMIC_ACQUIRE)) {
+            for (i = 0; i < MMAP_IMPULSE_FRAMES; i++)
+                buf[2 * i] = buf[2 * i + 1] = MMAP_IMPULSE_LEVEL;
+        }
+        out->write(out, buf, bytes);
+        if (buf[0] != 0) {
+            writer->impulse_ns = sim_clock_now_ns();
+            __atomic_store_n(&writer->impulse, 0, __ATOMIC_RELEASE);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+/* time from the write of the impulse to its onset in buf, frame j */
+static int64_t mmap_impulse_delay_ns(struct audio_stream_in *in,
+                                     struct mmap_writer *writer,
+                                     size_t in_frames, size_t j)
+{
+    struct stream_in *stream = (struct stream_in *)in;
+    int64_t frames, time_ns, onset;
+
+    if (in->get_capture_position(in, &frames, &time_ns) != 0)
+        return -1;
+    /* the position counts the frames read so far */
+    onset = stream->frames_read - (int64_t)in_frames + (int64_t)j;
+    return time_ns - (frames - onset) * 1000000000LL /
+           in->common.get_sample_rate(&in->common) - writer->impulse_ns;
+}
+
+/*
+ * out_get_latency() of an mmap output, the DMA ring it measured plus the
+ * DSP path, matches the time impulses take from their write to the mic.
+ * The simulated loopback stands for that path with the platform's delay.
+ */
+static void test_mmap_latency_round_trip(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_in *in;
+    struct audio_config config;
+    struct mmap_writer writer;
+    char value[PROPERTY_VALUE_MAX];
+    int64_t path_us, delay_ns, total_ns = 0, measured_ns;
+    unsigned int found = 0;
+    uint32_t latency_ms;
+    bool pending = false;
+    pthread_t thread;
+    size_t in_frames, j;
+    int16_t *buf;
+    int i, idle = 0;
+
+    /* the writer and the reader have to run side by side */
+    if (!sim_test_on_clock("real"))
+        return;
+    path_us = platform_render_latency(USECASE_AUDIO_PLAYBACK_LOW_LATENCY) +
+              platform_get_snd_device_render_latency(SND_DEVICE_OUT_SPEAKER);
+    snprintf(value, sizeof(value), "%lld", (long long)path_us);
+    sim_test_set_config("audio.sim.loopback_us", value);
+    sim_test_set_config("audio_hal.ll_mmap", "true");
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+
+    memset(&writer, 0, sizeof(writer));
+    sim_test_pcm_config(&config);
+    writer.out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_FAST,
+                                      AUDIO_DEVICE_OUT_SPEAKER, &config);
+    sim_test_pcm_config(&config);
+    config.channel_mask = AUDIO_CHANNEL_IN_MONO;
+    in = sim_test_open_input(dev, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                             AUDIO_SOURCE_MIC, &config);
+    if (writer.out == NULL || in == NULL)
+        goto done;
+    SIM_CHECK(((struct stream_out *)writer.out)->mmap_mode);
+    in_frames = in->common.get_buffer_size(&in->common) / sizeof(*buf);
+    buf = malloc(in_frames * sizeof(*buf));
+
+    pthread_create(&thread, NULL, mmap_writer_loop, &writer);
+    for (i = 0; i < MMAP_MAX_READS && found < MMAP_IMPULSES; i++) {
+        /* an impulse at a time, after the previous one has died out */
+        if (i >= MMAP_WARMUP_READS && !pending && ++idle > 2) {
+            __atomic_store_n(&writer.impulse, 1, __ATOMIC_RELEASE);
+            pending = true;
+            idle = 0;
+        }
+        if (in->read(in, buf, in_frames * sizeof(*buf)) !=
+                (ssize_t)(in_frames * sizeof(*buf)))
+            break;
+        if (!pending || __atomic_load_n(&writer.impulse, __ATOMIC_ACQUIRE))
+            continue;
+        for (j = 0; j < in_frames; j++) {
+            if (buf[j] > MMAP_ONSET_LEVEL || buf[j] < -MMAP_ONSET_LEVEL)
+                break;
+        }
+        if (j == in_frames)
+            continue;
+        delay_ns = mmap_impulse_delay_ns(in, &writer, in_frames, j);
+        SIM_CHECK(delay_ns > 0);
+        total_ns += delay_ns;
+        found++;
+        pending = false;
+    }
+    latency_ms = writer.out->get_latency(writer.out);
+    __atomic_store_n(&writer.exit, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    free(buf);
+
+    SIM_CHECK_EQ(found, MMAP_IMPULSES);
+    if (found == 0)
+        goto done;
+    measured_ns = total_ns / found;
+    printf("  out_get_latency %u ms, measured %.2f ms, DSP path %.2f ms\n",
+           latency_ms, measured_ns / 1e6, path_us / 1e3);
+    /* the hardware pointer moves 2 ms at a time, the result is in ms */
+    SIM_CHECK(latency_ms * 1000000LL > measured_ns - 3000000LL &&
+              latency_ms * 1000000LL < measured_ns + 3000000LL);
+
+done:
+    if (in != NULL)
+        dev->close_input_stream(dev, in);
+    if (writer.out != NULL)
+        dev->close_output_stream(dev, writer.out);
+    sim_test_close_device(dev);
+}
+
+const struct sim_test sim_latency_tests[] = {
+    SIM_TEST(test_latency_calibration_unlocked),
+    SIM_TEST(test_mmap_latency_round_trip),
+    SIM_TEST_END
+};
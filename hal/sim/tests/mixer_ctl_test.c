@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/properties.h>
+#include <tinyalsa/asoundlib.h>
+
+#include "audio_hw.h"
+#include "sim.h"
+#include "sim_test.h"
+
+/* about as many controls as a WCD93xx card registers */
+#define MIXER_CTL_COUNT     800
+#define MIXER_CTL_STEPS     20000
+#define MIXER_CTL_VOLUME    "Compress Playback Volume"
+
+/*
+ * A mixer_paths.xml with MIXER_CTL_COUNT controls, the compress volume
+ * registered last as the DSP front end controls are on a real card.
+ */
+static bool write_mixer_paths(void)
+{
+    char path[PROPERTY_VALUE_MAX];
+    const char *dir = getenv("TMPDIR");
+    unsigned int i;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/mixer_ctl_paths.xml", dir ? dir : "/tmp");
+    fp = fopen(path, "w");
+    if (fp == NULL)
+        return false;
+    fprintf(fp, "<mixer>\n");
+    for (i = 0; i < MIXER_CTL_COUNT - 1; i++)
+        fprintf(fp, "<ctl name=\"RX%u MIX%u INP%u\" value=\"0\" />\n",
+                i / 9 + 1, i / 3 % 3 + 1, i % 3 + 1);
+    fprintf(fp, "<ctl name=\"%s\" value=\"0\" />\n</mixer>\n", MIXER_CTL_VOLUME);
+    if (fclose(fp) != 0)
+        return false;
+    sim_test_set_config("audio.sim.mixer_paths", path);
+    return true;
+}
+
+/* an MP3 offload output, whose volume is the compress volume control */
+static struct audio_stream_out *open_offload(struct audio_hw_device *dev)
+{
+    struct audio_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = 44100;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = AUDIO_FORMAT_MP3;
+    config.offload_info = AUDIO_INFO_INITIALIZER;
+    config.offload_info.sample_rate = 44100;
+    config.offload_info.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.offload_info.format = AUDIO_FORMAT_MP3;
+    config.offload_info.bit_rate = 128000;
+    return sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_DIRECT |
+                                AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD,
+                                AUDIO_DEVICE_OUT_SPEAKER, &config);
+}
+
+/*
+ * The cache hands out what mixer_get_ctl_by_name() would, and forgets it
+ * when the card goes offline and again when it comes back.
+ */
+static void test_mixer_ctl_cache(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_device *adev;
+    struct mixer_ctl *ctl;
+
+    if (!write_mixer_paths())
+        return;
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+    adev = (struct audio_device *)dev;
+
+    invalidate_mixer_ctl_cache(adev);
+    ctl = get_mixer_ctl(adev, MIXER_CTL_VOLUME);
+    SIM_CHECK(ctl != NULL);
+    SIM_CHECK(ctl == mixer_get_ctl_by_name(adev->mixer, MIXER_CTL_VOLUME));
+    SIM_CHECK(get_mixer_ctl(adev, MIXER_CTL_VOLUME) == ctl);
+    SIM_CHECK(get_mixer_ctl(adev, "RX1 MIX1 INP1") ==
+              mixer_get_ctl_by_name(adev->mixer, "RX1 MIX1 INP1"));
+    SIM_CHECK_EQ(adev->ctl_cache.count, 2);
+    SIM_CHECK(get_mixer_ctl(adev, NULL) == NULL);
+
+    sim_card_set_online(false);
+    sim_test_set_parameters(dev, "SND_CARD_STATUS=%u,OFFLINE",
+                            sim_card_number());
+    SIM_CHECK_EQ(adev->ctl_cache.count, 0);
+    SIM_CHECK(get_mixer_ctl(adev, MIXER_CTL_VOLUME) == ctl);
+    sim_card_set_online(true);
+    sim_test_set_parameters(dev, "SND_CARD_STATUS=%u,ONLINE",
+                            sim_card_number());
+    SIM_CHECK_EQ(adev->ctl_cache.count, 0);
+
+    sim_test_close_device(dev);
+}
+
+/*
+ * A volume ramp on an offload output: each step as the HAL did it before
+ * the cache, looking the control up by name, then through out_set_volume().
+ */
+static void bench_mixer_ctl_volume(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_device *adev;
+    struct audio_stream_out *out;
+    struct mixer_ctl *ctl;
+    int64_t start_ns, uncached_ns, cached_ns;
+    int volume[2];
+    float gain;
+    int i;
+
+    if (!write_mixer_paths())
+        return;
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+    adev = (struct audio_device *)dev;
+    out = open_offload(dev);
+    if (out == NULL)
+        goto done;
+
+    start_ns = sim_test_thread_cpu_ns();
+    for (i = 0; i < MIXER_CTL_STEPS; i++) {
+        gain = (float)(i % 100) / 100;
+        ctl = mixer_get_ctl_by_name(adev->mixer, MIXER_CTL_VOLUME);
+        volume[0] = volume[1] = (int)(gain * 0x2000);
+        mixer_ctl_set_array(ctl, volume, 2);
+    }
+    uncached_ns = sim_test_thread_cpu_ns() - start_ns;
+
+    start_ns = sim_test_thread_cpu_ns();
+    for (i = 0; i < MIXER_CTL_STEPS; i++) {
+        gain = (float)(i % 100) / 100;
+        SIM_CHECK_EQ(out->set_volume(out, gain, gain), 0);
+    }
+    cached_ns = sim_test_thread_cpu_ns() - start_ns;
+
+    printf("  %u controls: by name %.0f ns/step (%.0f k/s), "
+           "cached %.0f ns/step (%.0f k/s)\n", mixer_get_num_ctls(adev->mixer),
+           (double)uncached_ns / MIXER_CTL_STEPS,
+           (double)MIXER_CTL_STEPS * 1e6 / uncached_ns,
+           (double)cached_ns / MIXER_CTL_STEPS,
+           (double)MIXER_CTL_STEPS * 1e6 / cached_ns);
+
+    dev->close_output_stream(dev, out);
+done:
+    sim_test_close_device(dev);
+}
+
+const struct sim_test sim_mixer_ctl_tests[] = {
+    SIM_TEST(test_mixer_ctl_cache),
+    SIM_BENCH(bench_mixer_ctl_volume),
+    SIM_TEST_END
+};
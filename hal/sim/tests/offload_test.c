@@ -0,0 +1,848 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/properties.h>
+
+#include "audio_hw.h"
+#include "sim.h"
+#include "sim_test.h"
+
+/* a close that hangs kills the run rather than blocking it */
+#define OFFLOAD_WATCHDOG_S  10
+#define OFFLOAD_WRITE_SIZE  (32 * 1024)
+/* long enough for the offload thread to go to sleep */
+#define OFFLOAD_SETTLE_US   20000
+
+struct offload_client {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned int write_ready;
+    unsigned int drain_ready;
+    struct audio_stream_out *out;
+    unsigned int drains;    /* posted by drain_sender() */
+    int drain_errors;
+};
+
+static int offload_callback(stream_callback_event_t event, void *param __unused,
+                            void *cookie)
+{
+    struct offload_client *client = cookie;
+
+    pthread_mutex_lock(&client->lock);
+    if (event == STREAM_CBK_EVENT_WRITE_READY)
+        client->write_ready++;
+    else if (event == STREAM_CBK_EVENT_DRAIN_READY)
+        client->drain_ready++;
+    pthread_cond_broadcast(&client->cond);
+    pthread_mutex_unlock(&client->lock);
+    return 0;
+}
+
+static void client_init(struct offload_client *client)
+{
+    memset(client, 0, sizeof(*client));
+    pthread_mutex_init(&client->lock, NULL);
+    pthread_cond_init(&client->cond, NULL);
+}
+
+static void client_destroy(struct offload_client *client)
+{
+    pthread_cond_destroy(&client->cond);
+    pthread_mutex_destroy(&client->lock);
+}
+
+static void client_wait_write_ready(struct offload_client *client,
+                                    unsigned int count)
+{
+    pthread_mutex_lock(&client->lock);
+    while (client->write_ready < count)
+        pthread_cond_wait(&client->cond, &client->lock);
+    pthread_mutex_unlock(&client->lock);
+}
+
+/*
+ * The DSP plays what it is given in real time on the real clock, at MP3 bit
+ * rates that is seconds per fill: benchmarks of the HAL side only run on the
+ * virtual clock.
+ */
+static bool skip_on_real_clock(void)
+{
+    return !sim_test_on_clock("virtual");
+}
+
+/* an MP3 offload output, non blocking as AudioFlinger opens it with a callback */
+static struct audio_stream_out *open_offload_cb(struct audio_hw_device *dev,
+                                                stream_callback_t callback,
+                                                void *cookie)
+{
+    audio_output_flags_t flags = AUDIO_OUTPUT_FLAG_DIRECT |
+                                 AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD;
+    struct audio_stream_out *out;
+    struct audio_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = 44100;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = AUDIO_FORMAT_MP3;
+    config.offload_info = AUDIO_INFO_INITIALIZER;
+    config.offload_info.sample_rate = 44100;
+    config.offload_info.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.offload_info.format = AUDIO_FORMAT_MP3;
+    config.offload_info.bit_rate = 128000;
+    if (callback != NULL)
+        flags |= AUDIO_OUTPUT_FLAG_NON_BLOCKING;
+    out = sim_test_open_output(dev, flags, AUDIO_DEVICE_OUT_SPEAKER, &config);
+    if (out != NULL && callback != NULL)
+        out->set_callback(out, callback, cookie);
+    return out;
+}
+
+static struct audio_stream_out *open_offload(struct audio_hw_device *dev,
+                                             struct offload_client *client)
+{
+    return open_offload_cb(dev, client ? offload_callback : NULL, client);
+}
+
+/*
+ * Writes until the DSP buffer is full, which posts a wait for buffer, and
+ * returns when the last write started.
+ */
+static int64_t fill_dsp(struct audio_stream_out *out, const void *buf)
+{
+    int64_t start_ns;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        start_ns = sim_test_now_ns();
+        if (out->write(out, buf, OFFLOAD_WRITE_SIZE) < OFFLOAD_WRITE_SIZE)
+            return start_ns;
+    }
+    sim_test_fail(__FILE__, __LINE__, "DSP buffer never filled");
+    return start_ns;
+}
+
+static unsigned int pending_cmds(struct stream_out *out)
+{
+    unsigned int pending;
+
+    pthread_mutex_lock(&out->lock);
+    pending = (uint32_t)out->offload_cmd_tail - (uint32_t)out->offload_cmd_head;
+    pthread_mutex_unlock(&out->lock);
+    return pending;
+}
+
+/*
+ * Leaves the offload thread stuck in a drain of the paused stream, so that
+ * it takes no more commands until the stream is stopped.
+ */
+static void block_offload_thread(struct offload_client *client, void *buf)
+{
+    struct stream_out *out = (struct stream_out *)client->out;
+    bool blocked = false;
+    int i;
+
+    fill_dsp(client->out, buf);
+    client_wait_write_ready(client, 1);
+    SIM_CHECK_EQ(client->out->pause(client->out), 0);
+    SIM_CHECK_EQ(client->out->drain(client->out, AUDIO_DRAIN_ALL), 0);
+    for (i = 0; i < 1000 && !blocked; i++) {
+        usleep(1000);
+        pthread_mutex_lock(&out->lock);
+        blocked = out->offload_thread_blocked && out->offload_cmd_head ==
+                  out->offload_cmd_tail;
+        pthread_mutex_unlock(&out->lock);
+    }
+    SIM_CHECK(blocked);
+}
+
+/* closing with the command ring full runs what was queued, then exits */
+static void test_offload_close_full_ring(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct offload_client client;
+    void *buf;
+    int i;
+
+    if (dev == NULL)
+        return;
+    client_init(&client);
+    client.out = open_offload(dev, &client);
+    if (client.out == NULL)
+        goto done;
+
+    buf = calloc(1, OFFLOAD_WRITE_SIZE);
+    block_offload_thread(&client, buf);
+    for (i = 0; i < OFFLOAD_CMD_RING_SIZE; i++)
+        SIM_CHECK_EQ(client.out->drain(client.out, AUDIO_DRAIN_ALL), 0);
+    SIM_CHECK_EQ(pending_cmds((struct stream_out *)client.out),
+                 OFFLOAD_CMD_RING_SIZE);
+    free(buf);
+
+    alarm(OFFLOAD_WATCHDOG_S);
+    dev->close_output_stream(dev, client.out);
+    alarm(0);
+    /* each drain queued before the close still completed */
+    SIM_CHECK_EQ(client.drain_ready, OFFLOAD_CMD_RING_SIZE + 1);
+
+done:
+    client_destroy(&client);
+    sim_test_close_device(dev);
+}
+
+static void *drain_sender(void *context)
+{
+    struct offload_client *client = context;
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < 2 * OFFLOAD_CMD_RING_SIZE; i++) {
+        ret = client->out->drain(client->out, AUDIO_DRAIN_ALL);
+        pthread_mutex_lock(&client->lock);
+        client->drains++;
+        if (ret != 0)
+            client->drain_errors++;
+        pthread_mutex_unlock(&client->lock);
+    }
+    return NULL;
+}
+
+/* a sender finding the ring full waits for a slot instead of failing */
+static void test_offload_sender_waits(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct offload_client client;
+    pthread_t sender;
+    unsigned int drains = 0;
+    void *buf;
+    int i;
+
+    if (dev == NULL)
+        return;
+    client_init(&client);
+    client.out = open_offload(dev, &client);
+    if (client.out == NULL)
+        goto done;
+
+    buf = calloc(1, OFFLOAD_WRITE_SIZE);
+    block_offload_thread(&client, buf);
+    free(buf);
+    pthread_create(&sender, NULL, drain_sender, &client);
+    for (i = 0; i < 1000 && drains < OFFLOAD_CMD_RING_SIZE; i++) {
+        usleep(1000);
+        pthread_mutex_lock(&client.lock);
+        drains = client.drains;
+        pthread_mutex_unlock(&client.lock);
+    }
+    /* the sender filled the ring and is held on its next command */
+    usleep(20000);
+    SIM_CHECK_EQ(pending_cmds((struct stream_out *)client.out),
+                 OFFLOAD_CMD_RING_SIZE);
+    pthread_mutex_lock(&client.lock);
+    SIM_CHECK_EQ(client.drains, OFFLOAD_CMD_RING_SIZE);
+    pthread_mutex_unlock(&client.lock);
+
+    /* the stop releases the thread, which makes room for the sender */
+    alarm(OFFLOAD_WATCHDOG_S);
+    SIM_CHECK_EQ(client.out->flush(client.out), 0);
+    pthread_join(sender, NULL);
+    dev->close_output_stream(dev, client.out);
+    alarm(0);
+    SIM_CHECK_EQ(client.drains, 2 * OFFLOAD_CMD_RING_SIZE);
+    SIM_CHECK_EQ(client.drain_errors, 0);
+    SIM_CHECK_EQ(client.drain_ready, 2 * OFFLOAD_CMD_RING_SIZE + 1);
+
+done:
+    client_destroy(&client);
+    sim_test_close_device(dev);
+}
+
+#define OFFLOAD_WAKEUPS 2000
+
+/*
+ * Time from the start of a write the DSP could not take in full to the
+ * write ready callback, with the DSP making room at once on the virtual
+ * clock: the latency of the command ring and the offload thread wakeup.
+ */
+static void bench_offload_write_ready(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct offload_client client;
+    struct sim_samples samples;
+    int64_t start_ns;
+    void *buf;
+    int i;
+
+    if (dev == NULL)
+        return;
+    client_init(&client);
+    if (skip_on_real_clock())
+        goto done;
+    client.out = open_offload(dev, &client);
+    if (client.out == NULL)
+        goto done;
+
+    buf = calloc(1, OFFLOAD_WRITE_SIZE);
+    sim_samples_init(&samples, OFFLOAD_WAKEUPS);
+    for (i = 0; i < OFFLOAD_WAKEUPS; i++) {
+        start_ns = fill_dsp(client.out, buf);
+        client_wait_write_ready(&client, i + 1);
+        sim_samples_add(&samples, sim_test_now_ns() - start_ns);
+    }
+    sim_samples_report(&samples, "write ready callback");
+    sim_samples_free(&samples);
+    free(buf);
+
+    alarm(OFFLOAD_WATCHDOG_S);
+    dev->close_output_stream(dev, client.out);
+    alarm(0);
+
+done:
+    client_destroy(&client);
+    sim_test_close_device(dev);
+}
+
+#define OFFLOAD_RING_CMDS  2000000
+
+/* the commands posted to the offload thread, and what it ran of them */
+struct ring_stress {
+    pthread_mutex_t lock;
+    struct stream_out *out;
+    unsigned int max;
+    uint8_t *plan;
+    uint8_t *cmds;          /* as posted */
+    int64_t *post_ns;
+    unsigned int posted;
+    unsigned int ran;
+    unsigned int wrong;
+    unsigned int first_wrong;
+    struct sim_samples latency[3];  /* drain, partial drain, wait */
+};
+
+/* called by the offload thread with out->lock held, after each command */
+static int ring_stress_callback(stream_callback_event_t event,
+                                void *param __unused, void *cookie)
+{
+    struct ring_stress *stress = cookie;
+    int64_t now_ns = sim_test_now_ns();
+    enum sim_compress_request request;
+    int cmd = -1;
+    unsigned int i;
+
+    request = sim_compress_last_request(stress->out->compr);
+    if (event == STREAM_CBK_EVENT_WRITE_READY && request == SIM_COMPRESS_WAIT)
+        cmd = OFFLOAD_CMD_WAIT_FOR_BUFFER;
+    else if (event == STREAM_CBK_EVENT_DRAIN_READY &&
+             request == SIM_COMPRESS_DRAIN)
+        cmd = OFFLOAD_CMD_DRAIN;
+    else if (event == STREAM_CBK_EVENT_DRAIN_READY &&
+             request == SIM_COMPRESS_PARTIAL_DRAIN)
+        cmd = OFFLOAD_CMD_PARTIAL_DRAIN;
+
+    pthread_mutex_lock(&stress->lock);
+    i = stress->ran++;
+    if (i >= stress->max || cmd != stress->cmds[i]) {
+        if (stress->wrong++ == 0)
+            stress->first_wrong = i;
+    } else {
+        sim_samples_add(&stress->latency[cmd - OFFLOAD_CMD_DRAIN],
+                        now_ns - stress->post_ns[i]);
+    }
+    pthread_mutex_unlock(&stress->lock);
+    return 0;
+}
+
+/*
+ * A random mix of the three commands. Back to back waits would be merged
+ * into one by send_offload_cmd_l(), so a wait is always followed by a drain.
+ */
+static void ring_stress_plan(struct ring_stress *stress)
+{
+    uint32_t seed = 1;
+    unsigned int i;
+    int cmd;
+
+    stress->plan[0] = OFFLOAD_CMD_WAIT_FOR_BUFFER;
+    for (i = 1; i < stress->max; i++) {
+        seed = seed * 1103515245 + 12345;
+        cmd = OFFLOAD_CMD_DRAIN + (seed >> 16) % 3;
+        if (cmd == OFFLOAD_CMD_WAIT_FOR_BUFFER &&
+                stress->plan[i - 1] == OFFLOAD_CMD_WAIT_FOR_BUFFER)
+            cmd = OFFLOAD_CMD_DRAIN + (seed >> 16) % 2;
+        stress->plan[i] = cmd;
+    }
+}
+
+/* posts one command, returns whether it was posted */
+static bool ring_stress_post(struct ring_stress *stress, int cmd,
+                             const void *buf, size_t bytes)
+{
+    struct audio_stream_out *out = &stress->out->stream;
+    ssize_t ret;
+
+    /* read by the offload thread once the command is in the ring */
+    stress->cmds[stress->posted] = cmd;
+    stress->post_ns[stress->posted] = sim_test_now_ns();
+    switch (cmd) {
+    case OFFLOAD_CMD_WAIT_FOR_BUFFER:
+        /*
+         * Posted when the DSP takes less than it is given. A drain running
+         * on the offload thread moves the virtual clock on, and the DSP may
+         * then make room for all of it.
+         */
+        ret = out->write(out, buf, bytes);
+        SIM_CHECK(ret >= 0);
+        return ret >= 0 && ret < (ssize_t)bytes;
+    case OFFLOAD_CMD_PARTIAL_DRAIN:
+        SIM_CHECK_EQ(out->drain(out, AUDIO_DRAIN_EARLY_NOTIFY), 0);
+        return true;
+    default:
+        SIM_CHECK_EQ(out->drain(out, AUDIO_DRAIN_ALL), 0);
+        return true;
+    }
+}
+
+/*
+ * Millions of waits for buffer, drains and partial drains posted through
+ * the command ring as fast as the client can, which often finds it full:
+ * each must be run once, in the order posted. The latency is from the
+ * start of the write or drain that posted a command to its callback, with
+ * the DSP taking no time on the virtual clock.
+ */
+static void bench_offload_cmd_ring(void)
+{
+    static const char *const names[] = {
+        "drain callback", "partial drain callback", "write ready callback",
+    };
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_stream_out *out;
+    struct ring_stress stress;
+    unsigned int i, ran, idle_ms;
+    size_t bytes;
+    void *buf;
+
+    if (dev == NULL)
+        return;
+    if (skip_on_real_clock())
+        goto done;
+    memset(&stress, 0, sizeof(stress));
+    pthread_mutex_init(&stress.lock, NULL);
+    stress.max = OFFLOAD_RING_CMDS;
+    stress.plan = calloc(stress.max, sizeof(*stress.plan));
+    stress.cmds = calloc(stress.max, sizeof(*stress.cmds));
+    stress.post_ns = calloc(stress.max, sizeof(*stress.post_ns));
+    for (i = 0; i < 3; i++)
+        sim_samples_init(&stress.latency[i], stress.max);
+    ring_stress_plan(&stress);
+
+    out = open_offload_cb(dev, ring_stress_callback, &stress);
+    if (out == NULL)
+        goto release;
+    stress.out = (struct stream_out *)out;
+    /* several times what the DSP holds */
+    bytes = 4 * stress.out->compr_config.fragments *
+            stress.out->compr_config.fragment_size;
+    buf = calloc(1, bytes);
+
+    for (i = 0; i < stress.max; i++) {
+        if (ring_stress_post(&stress, stress.plan[i], buf, bytes))
+            stress.posted++;
+    }
+
+    /* a lost command leaves the thread idle short of the count */
+    pthread_mutex_lock(&stress.lock);
+    for (idle_ms = 0; stress.ran < stress.posted && idle_ms < 1000;) {
+        ran = stress.ran;
+        pthread_mutex_unlock(&stress.lock);
+        usleep(1000);
+        pthread_mutex_lock(&stress.lock);
+        idle_ms = stress.ran == ran ? idle_ms + 1 : 0;
+    }
+    pthread_mutex_unlock(&stress.lock);
+    alarm(OFFLOAD_WATCHDOG_S);
+    dev->close_output_stream(dev, out);
+    alarm(0);
+    free(buf);
+
+    SIM_CHECK_EQ(stress.ran, stress.posted);
+    SIM_CHECK_EQ(stress.wrong, 0);
+    if (stress.wrong > 0)
+        printf("  first command run out of order: %u\n", stress.first_wrong);
+    /* only writes the DSP took in full go without a wait */
+    SIM_CHECK(stress.posted > stress.max * 9 / 10);
+    for (i = 0; i < 3; i++)
+        sim_samples_report(&stress.latency[i], names[i]);
+
+release:
+    for (i = 0; i < 3; i++)
+        sim_samples_free(&stress.latency[i]);
+    free(stress.post_ns);
+    free(stress.cmds);
+    free(stress.plan);
+    pthread_mutex_destroy(&stress.lock);
+done:
+    sim_test_close_device(dev);
+}
+
+static struct offload_coalescer coalescer(struct audio_stream_out *stream)
+{
+    struct stream_out *out = (struct stream_out *)stream;
+    struct offload_coalescer co;
+
+    pthread_mutex_lock(&out->lock);
+    co = out->coalesce;
+    pthread_mutex_unlock(&out->lock);
+    return co;
+}
+
+/* waits up to ms for the offload thread to give up on held bytes */
+static bool wait_coalesce_timeout(struct audio_stream_out *out,
+                                  uint32_t timeouts, int ms)
+{
+    for (; ms > 0; ms--) {
+        if (coalescer(out).timeouts > timeouts)
+            return true;
+        usleep(1000);
+    }
+    return false;
+}
+
+/* bytes held back from an idle offload thread are written by the deadline */
+static void test_offload_coalesce_deadline(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    char buf[1024];
+
+    sim_test_set_config("audio_hal.offload_coalesce_ms", "20");
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+    out = open_offload(dev, NULL);
+    if (out == NULL)
+        goto done;
+
+    usleep(OFFLOAD_SETTLE_US);
+    memset(buf, 0, sizeof(buf));
+    SIM_CHECK_EQ(out->write(out, buf, sizeof(buf)), sizeof(buf));
+    SIM_CHECK_EQ(coalescer(out).fill, sizeof(buf));
+    SIM_CHECK(wait_coalesce_timeout(out, 0, 500));
+    SIM_CHECK_EQ(coalescer(out).fill, 0);
+    SIM_CHECK_EQ(coalescer(out).flushes, 1);
+
+    dev->close_output_stream(dev, out);
+done:
+    sim_test_close_device(dev);
+}
+
+/* held bytes are timed again once a pause is over */
+static void test_offload_coalesce_resume(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    uint32_t timeouts;
+    char small[1024];
+    void *buf;
+    int i;
+
+    sim_test_set_config("audio_hal.offload_coalesce_ms", "20");
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+    out = open_offload(dev, NULL);
+    if (out == NULL)
+        goto done;
+
+    /*
+     * Three fragments fill the DSP, which consumes nothing until the virtual
+     * clock moves, so the bytes written after them stay held over the pause.
+     */
+    buf = calloc(1, OFFLOAD_WRITE_SIZE);
+    for (i = 0; i < 3; i++)
+        SIM_CHECK_EQ(out->write(out, buf, OFFLOAD_WRITE_SIZE),
+                     OFFLOAD_WRITE_SIZE);
+    free(buf);
+    usleep(OFFLOAD_SETTLE_US);
+    memset(small, 0, sizeof(small));
+    SIM_CHECK_EQ(out->write(out, small, sizeof(small)), sizeof(small));
+    SIM_CHECK_EQ(out->pause(out), 0);
+    SIM_CHECK_EQ(coalescer(out).fill, sizeof(small));
+
+    /* nothing is flushed while paused, however long it lasts */
+    timeouts = coalescer(out).timeouts;
+    SIM_CHECK(!wait_coalesce_timeout(out, timeouts, 60));
+    SIM_CHECK_EQ(out->resume(out), 0);
+    SIM_CHECK(wait_coalesce_timeout(out, timeouts, 500));
+
+    dev->close_output_stream(dev, out);
+done:
+    sim_test_close_device(dev);
+}
+
+/* PCM offload of a client giving no channel mask is sized as the stream */
+static void test_pcm_offload_no_channel_mask(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_stream_out *out;
+    struct audio_config config;
+    uint32_t fragment_size;
+
+    if (dev == NULL)
+        return;
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = 48000;
+    config.format = AUDIO_FORMAT_PCM_24_BIT_PACKED;
+    config.offload_info = AUDIO_INFO_INITIALIZER;
+    config.offload_info.sample_rate = 48000;
+    config.offload_info.format = AUDIO_FORMAT_PCM_24_BIT_PACKED;
+    config.offload_info.has_video = true;
+    out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_DIRECT |
+                               AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD,
+                               AUDIO_DEVICE_OUT_SPEAKER, &config);
+    if (out == NULL)
+        goto done;
+
+    fragment_size = ((struct stream_out *)out)->compr_config.fragment_size;
+    SIM_CHECK(fragment_size > 0);
+    SIM_CHECK_EQ(fragment_size % (3 * 2), 0);
+    SIM_CHECK_EQ(out->common.get_channels(&out->common),
+                 AUDIO_CHANNEL_OUT_STEREO);
+
+    dev->close_output_stream(dev, out);
+done:
+    sim_test_close_device(dev);
+}
+
+#define COALESCE_BYTES      (4 * 1024 * 1024)
+#define COALESCE_WRITE      2048
+
+/*
+ * A player writing 2 KB at a time to a blocking offload output, without and
+ * with coalescing: compress writes, each of which wakes the DSP on a device,
+ * and the client write throughput on the virtual clock.
+ */
+static void bench_offload_coalesce(void)
+{
+    static const char *const coalesce_ms[] = { "0", "20" };
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    struct offload_coalescer co;
+    int64_t start_ns, elapsed_ns;
+    char buf[COALESCE_WRITE];
+    size_t done;
+    ssize_t ret;
+    unsigned int i;
+
+    if (skip_on_real_clock())
+        return;
+    memset(buf, 0, sizeof(buf));
+    for (i = 0; i < sizeof(coalesce_ms) / sizeof(coalesce_ms[0]); i++) {
+        sim_test_set_config("audio_hal.offload_coalesce_ms", coalesce_ms[i]);
+        dev = sim_test_open_device();
+        if (dev == NULL)
+            return;
+        out = open_offload(dev, NULL);
+        if (out == NULL) {
+            sim_test_close_device(dev);
+            return;
+        }
+
+        start_ns = sim_test_now_ns();
+        for (done = 0; done < COALESCE_BYTES; done += ret) {
+            ret = out->write(out, buf, sizeof(buf));
+            if (ret <= 0) {
+                sim_test_fail(__FILE__, __LINE__, "write: %zd", ret);
+                break;
+            }
+        }
+        elapsed_ns = sim_test_now_ns() - start_ns;
+        co = coalescer(out);
+        /* without coalescing each write goes to the driver as it is */
+        if (co.writes == 0)
+            co.flushes = COALESCE_BYTES / COALESCE_WRITE;
+        printf("  coalesce %s ms: %u writes, %u compress writes, %.1f MB/s\n",
+               coalesce_ms[i], COALESCE_BYTES / COALESCE_WRITE, co.flushes,
+               (double)COALESCE_BYTES * 1000 / elapsed_ns);
+
+        dev->close_output_stream(dev, out);
+        sim_test_close_device(dev);
+    }
+}
+
+#define AP_CPU_AUDIO_S      60
+#define AP_CPU_MP3_BYTES_S  16000   /* 128 kbit/s */
+/* a compress device that no other usecase of the simulated card opens */
+#define AP_CPU_OFFLOAD2_ID  40
+
+/* gives the second offload session a device, as a target's xml would */
+static bool write_offload2_info(void)
+{
+    char xml[PROPERTY_VALUE_MAX - 4], cache[PROPERTY_VALUE_MAX - 4];
+    const char *dir = getenv("TMPDIR");
+    FILE *fp;
+
+    snprintf(xml, sizeof(xml), "%s/offload2.xml", dir ? dir : "/tmp");
+    snprintf(cache, sizeof(cache), "%s/offload2.cache", dir ? dir : "/tmp");
+    unlink(cache);
+    fp = fopen(xml, "w");
+    if (fp == NULL)
+        return false;
+    fprintf(fp, "<audio_platform_info>\n<pcm_ids>\n"
+            "<usecase name=\"USECASE_AUDIO_PLAYBACK_OFFLOAD2\" type=\"out\" "
+            "id=\"%d\"/>\n</pcm_ids>\n</audio_platform_info>\n",
+            AP_CPU_OFFLOAD2_ID);
+    if (fclose(fp) != 0)
+        return false;
+    sim_test_set_config("audio.sim.platform_info_xml", xml);
+    sim_test_set_config("audio.sim.platform_info_cache", cache);
+    return true;
+}
+
+static void write_all(struct audio_stream_out *out, const void *buf,
+                      size_t bytes)
+{
+    size_t done;
+    ssize_t ret;
+
+    for (done = 0; done < bytes; done += ret) {
+        ret = out->write(out, (const char *)buf + done, bytes - done);
+        if (ret <= 0) {
+            sim_test_fail(__FILE__, __LINE__, "write: %zd", ret);
+            return;
+        }
+    }
+}
+
+/* what AudioFlinger's mixer does to two tracks */
+static void mix(int16_t *dst, const int16_t *a, const int16_t *b,
+                size_t samples)
+{
+    int32_t sum;
+    size_t i;
+
+    for (i = 0; i < samples; i++) {
+        sum = (int32_t)a[i] + b[i];
+        dst[i] = sum > INT16_MAX ? INT16_MAX : sum < INT16_MIN ? INT16_MIN : sum;
+    }
+}
+
+static void report_ap_cpu(const char *what, int writes, int64_t cpu_ns)
+{
+    printf("  %s: %d writes, %.1f us AP CPU per second of audio\n", what,
+           writes, (double)cpu_ns / 1000 / AP_CPU_AUDIO_S);
+}
+
+/*
+ * A foreground music player and a background podcast, AP_CPU_AUDIO_S
+ * seconds each, on two offload sessions and then mixed on the AP into the
+ * deep buffer output, as AudioFlinger does when no second session is left.
+ * The CPU time is that of all threads of the process. Decoding, which the
+ * AP path adds and the simulator has no model of, is left out.
+ */
+static void bench_offload_ap_cpu(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_out *music = NULL, *podcast = NULL, *out;
+    struct audio_config config;
+    int16_t *tracks[2], *mixed;
+    size_t bytes, samples;
+    int64_t cpu_ns;
+    void *buf;
+    int i, writes;
+
+    if (skip_on_real_clock())
+        return;
+    if (!write_offload2_info()) {
+        sim_test_fail(__FILE__, __LINE__, "cannot write the platform info");
+        return;
+    }
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+
+    music = open_offload(dev, NULL);
+    podcast = open_offload(dev, NULL);
+    if (music == NULL || podcast == NULL)
+        goto done;
+    SIM_CHECK(((struct stream_out *)music)->usecase !=
+              ((struct stream_out *)podcast)->usecase);
+    buf = calloc(1, OFFLOAD_WRITE_SIZE);
+    writes = AP_CPU_AUDIO_S * AP_CPU_MP3_BYTES_S / OFFLOAD_WRITE_SIZE;
+    cpu_ns = sim_test_process_cpu_ns();
+    for (i = 0; i < writes; i++) {
+        write_all(music, buf, OFFLOAD_WRITE_SIZE);
+        write_all(podcast, buf, OFFLOAD_WRITE_SIZE);
+    }
+    report_ap_cpu("2 offload sessions", 2 * writes,
+                  sim_test_process_cpu_ns() - cpu_ns);
+    free(buf);
+    dev->close_output_stream(dev, podcast);
+    dev->close_output_stream(dev, music);
+    podcast = music = NULL;
+
+    sim_test_pcm_config(&config);
+    out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                               AUDIO_DEVICE_OUT_SPEAKER, &config);
+    if (out == NULL)
+        goto done;
+    bytes = out->common.get_buffer_size(&out->common);
+    samples = bytes / sizeof(int16_t);
+    tracks[0] = malloc(bytes);
+    tracks[1] = malloc(bytes);
+    mixed = malloc(bytes);
+    for (i = 0; i < (int)samples; i++) {
+        tracks[0][i] = (int16_t)(i * 97);
+        tracks[1][i] = (int16_t)(i * -61);
+    }
+    writes = (int)((int64_t)AP_CPU_AUDIO_S * 48000 * 4 / bytes);
+    cpu_ns = sim_test_process_cpu_ns();
+    for (i = 0; i < writes; i++) {
+        mix(mixed, tracks[0], tracks[1], samples);
+        write_all(out, mixed, bytes);
+    }
+    report_ap_cpu("AP mixer, deep buffer", writes,
+                  sim_test_process_cpu_ns() - cpu_ns);
+    free(mixed);
+    free(tracks[1]);
+    free(tracks[0]);
+    dev->close_output_stream(dev, out);
+
+done:
+    if (podcast != NULL)
+        dev->close_output_stream(dev, podcast);
+    if (music != NULL)
+        dev->close_output_stream(dev, music);
+    sim_test_close_device(dev);
+}
+
+const struct sim_test sim_offload_tests[] = {
+    SIM_TEST(test_offload_close_full_ring),
+    SIM_TEST(test_offload_sender_waits),
+    SIM_TEST(test_offload_coalesce_deadline),
+    SIM_TEST(test_offload_coalesce_resume),
+    SIM_TEST(test_pcm_offload_no_channel_mask),
+    SIM_BENCH(bench_offload_write_ready),
+    SIM_BENCH(bench_offload_cmd_ring),
+    SIM_BENCH(bench_offload_coalesce),
+    SIM_BENCH(bench_offload_ap_cpu),
+    SIM_TEST_END
+};
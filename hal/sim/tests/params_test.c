@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <cutils/str_parms.h>
+
+#include "audio_hw.h"
+#include "sim.h"
+#include "sim_test.h"
+
+struct param_setter {
+    struct audio_hw_device *dev;
+    const char *kvpairs;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+    int ret;
+};
+
+static void *param_setter_loop(void *context)
+{
+    struct param_setter *setter = context;
+    int ret = setter->dev->set_parameters(setter->dev, setter->kvpairs);
+
+    pthread_mutex_lock(&setter->lock);
+    setter->ret = ret;
+    setter->done = true;
+    pthread_cond_broadcast(&setter->cond);
+    pthread_mutex_unlock(&setter->lock);
+    return NULL;
+}
+
+/* whether kvpairs went through while this thread held adev->lock */
+static bool set_while_locked(struct audio_hw_device *dev, const char *kvpairs)
+{
+    struct audio_device *adev = (struct audio_device *)dev;
+    struct param_setter setter;
+    struct timespec ts;
+    pthread_t thread;
+    bool done;
+
+    memset(&setter, 0, sizeof(setter));
+    setter.dev = dev;
+    setter.kvpairs = kvpairs;
+    pthread_mutex_init(&setter.lock, NULL);
+    pthread_cond_init(&setter.cond, NULL);
+
+    pthread_mutex_lock(&adev->lock);
+    pthread_create(&thread, NULL, param_setter_loop, &setter);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 1;
+    pthread_mutex_lock(&setter.lock);
+    while (!setter.done &&
+           pthread_cond_timedwait(&setter.cond, &setter.lock, &ts) == 0)
+        ;
+    done = setter.done;
+    pthread_mutex_unlock(&setter.lock);
+    pthread_mutex_unlock(&adev->lock);
+
+    pthread_join(thread, NULL);
+    pthread_cond_destroy(&setter.cond);
+    pthread_mutex_destroy(&setter.lock);
+    return done && setter.ret == 0;
+}
+
+/*
+ * Screen and BT NREC updates do not wait for adev->lock, keys nobody owns
+ * return at once, and rotation still routes under the lock.
+ */
+static void test_param_dispatch(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_device *adev = (struct audio_device *)dev;
+    int32_t calls, unmatched, locked;
+
+    if (dev == NULL)
+        return;
+    SIM_CHECK_EQ(adev->bluetooth_nrec, 1);
+    SIM_CHECK_EQ(adev->screen_off, 0);
+    SIM_CHECK(set_while_locked(dev, "screen_state=off;"
+                               AUDIO_PARAMETER_KEY_BT_NREC "=off"));
+    SIM_CHECK_EQ(adev->screen_off, 1);
+    SIM_CHECK_EQ(adev->bluetooth_nrec, 0);
+    SIM_CHECK(set_while_locked(dev, "screen_state=on"));
+    SIM_CHECK_EQ(adev->screen_off, 0);
+
+    calls = adev->param_stats.calls;
+    unmatched = adev->param_stats.unmatched;
+    locked = adev->param_stats.locked;
+    SIM_CHECK_EQ(dev->set_parameters(dev, "no_such_key=1"), 0);
+    SIM_CHECK_EQ(adev->param_stats.unmatched, unmatched + 1);
+    SIM_CHECK_EQ(dev->set_parameters(dev, "rotation=270"), 0);
+    SIM_CHECK(adev->speaker_lr_swap);
+    SIM_CHECK_EQ(dev->set_parameters(dev, "rotation=0"), 0);
+    SIM_CHECK(!adev->speaker_lr_swap);
+    SIM_CHECK(dev->set_parameters(dev, "rotation=45") != 0);
+    SIM_CHECK_EQ(adev->param_stats.calls, calls + 4);
+    SIM_CHECK_EQ(adev->param_stats.locked, locked + 3);
+
+    sim_test_close_device(dev);
+}
+
+/* whether the reply to keys carries each of the keys asked for */
+static bool reply_has_keys(char *str, const char *const *keys, size_t count)
+{
+    struct str_parms *reply;
+    char value[512];
+    bool found = true;
+    size_t i;
+
+    if (str == NULL)
+        return false;
+    reply = str_parms_create_str(str);
+    free(str);
+    if (reply == NULL)
+        return false;
+    for (i = 0; i < count; i++)
+        found = found && str_parms_get_str(reply, keys[i], value,
+                                           sizeof(value)) >= 0;
+    str_parms_destroy(reply);
+    return found;
+}
+
+/* hal_stats is answered alongside the other keys of the same query */
+static void test_param_stats_query(void)
+{
+    static const char *const adev_keys[] = {
+        AUDIO_PARAMETER_KEY_HAL_STATS, "st_enable",
+    };
+    static const char *const out_keys[] = {
+        AUDIO_PARAMETER_KEY_HAL_STATS, AUDIO_PARAMETER_STREAM_SUP_FORMATS,
+    };
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_stream_out *out;
+    struct audio_config config;
+
+    if (dev == NULL)
+        return;
+    SIM_CHECK(reply_has_keys(dev->get_parameters(dev,
+                             AUDIO_PARAMETER_KEY_HAL_STATS ";st_enable"),
+                             adev_keys, 2));
+    sim_test_pcm_config(&config);
+    out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                               AUDIO_DEVICE_OUT_SPEAKER, &config);
+    if (out != NULL) {
+        SIM_CHECK(reply_has_keys(out->common.get_parameters(&out->common,
+                                 AUDIO_PARAMETER_KEY_HAL_STATS ";"
+                                 AUDIO_PARAMETER_STREAM_SUP_FORMATS),
+                                 out_keys, 2));
+        dev->close_output_stream(dev, out);
+    }
+    sim_test_close_device(dev);
+}
+
+#define PARAM_CALLS         20000
+#define PARAM_CONTENDED     1000
+#define PARAM_INTERVAL_US   200
+
+struct router {
+    struct audio_stream_out *out;
+    volatile int32_t exit;
+};
+
+/* reroutes the output as fast as it can, each time under adev->lock */
+static void *router_loop(void *context)
+{
+    struct router *router = context;
+    unsigned int i;
+
+    for (i = 0; !android_atomic_acquire_load(&router->exit); i++)
+        router->out->common.set_parameters(&router->out->common,
+                (i & 1) ? "routing=2" : "routing=8");
+    return NULL;
+}
+
+/*
+ * set_parameters() calls per second for keys the framework sends often,
+ * then, on the real clock, the time each call takes while another thread
+ * keeps rerouting an active output with control writes costing 50 us: a
+ * lock free key does not wait for the routing in progress, rotation does.
+ */
+static void bench_param_dispatch(void)
+{
+    static const char *const kvpairs[] = {
+        "screen_state=on", AUDIO_PARAMETER_KEY_BT_NREC "=on", "rotation=0",
+        "no_such_key=1",
+    };
+    struct audio_hw_device *dev;
+    struct audio_device *adev;
+    struct audio_config config;
+    struct router router;
+    char value[PROPERTY_VALUE_MAX];
+    struct sim_samples samples;
+    pthread_t thread;
+    int64_t start_ns;
+    size_t bytes;
+    unsigned int i, n;
+    void *buf;
+
+    sim_test_set_config("audio.sim.ctl_write_us", "50");
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+    adev = (struct audio_device *)dev;
+    for (i = 0; i < sizeof(kvpairs) / sizeof(kvpairs[0]); i++) {
+        start_ns = sim_test_thread_cpu_ns();
+        for (n = 0; n < PARAM_CALLS; n++)
+            dev->set_parameters(dev, kvpairs[i]);
+        printf("  %-16s %8.0f calls/s\n", kvpairs[i], (double)PARAM_CALLS *
+               1e9 / (sim_test_thread_cpu_ns() - start_ns));
+    }
+
+    /* the control writes only take time on the real clock */
+    sim_get_config("audio.sim.clock", value, "real");
+    if (!strcmp(value, "virtual")) {
+        printf("  contended calls skipped on the virtual clock\n");
+        goto done;
+    }
+    sim_test_pcm_config(&config);
+    router.out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                                      AUDIO_DEVICE_OUT_SPEAKER, &config);
+    if (router.out == NULL)
+        goto done;
+    bytes = router.out->common.get_buffer_size(&router.out->common);
+    buf = calloc(1, bytes);
+    router.out->write(router.out, buf, bytes);
+    free(buf);
+    router.exit = 0;
+    pthread_create(&thread, NULL, router_loop, &router);
+    for (i = 0; i < 3; i++) {
+        sim_samples_init(&samples, PARAM_CONTENDED);
+        for (n = 0; n < PARAM_CONTENDED; n++) {
+            start_ns = sim_test_now_ns();
+            dev->set_parameters(dev, kvpairs[i]);
+            sim_samples_add(&samples, sim_test_now_ns() - start_ns);
+            /* the framework does not send them back to back */
+            usleep(PARAM_INTERVAL_US);
+        }
+        sim_samples_report(&samples, kvpairs[i]);
+        sim_samples_free(&samples);
+    }
+    android_atomic_release_store(1, &router.exit);
+    pthread_join(thread, NULL);
+    printf("  %d of %d calls took adev->lock\n", adev->param_stats.locked,
+           adev->param_stats.calls);
+    dev->close_output_stream(dev, router.out);
+
+done:
+    sim_test_close_device(dev);
+}
+
+const struct sim_test sim_params_tests[] = {
+    SIM_TEST(test_param_dispatch),
+    SIM_TEST(test_param_stats_query),
+    SIM_BENCH(bench_param_dispatch),
+    SIM_TEST_END
+};
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cutils/properties.h>
+
+#include "audio_hw.h"
+#include "platform.h"
+#include "platform_api.h"
+#include "name_index.h"
+#include "sim_test.h"
+
+#define LOOKUP_TABLE_SIZE   120
+#define LOOKUP_CALLS        200000
+#define PARSE_RUNS          20
+
+/* names every platform knows */
+static const struct name_to_index devices[] = {
+    {TO_NAME_INDEX(SND_DEVICE_OUT_HANDSET)},
+    {TO_NAME_INDEX(SND_DEVICE_OUT_SPEAKER)},
+    {TO_NAME_INDEX(SND_DEVICE_OUT_HEADPHONES)},
+    {TO_NAME_INDEX(SND_DEVICE_OUT_SPEAKER_AND_HEADPHONES)},
+    {TO_NAME_INDEX(SND_DEVICE_OUT_VOICE_HANDSET)},
+    {TO_NAME_INDEX(SND_DEVICE_OUT_VOICE_SPEAKER)},
+    {TO_NAME_INDEX(SND_DEVICE_OUT_HDMI)},
+    {TO_NAME_INDEX(SND_DEVICE_OUT_BT_SCO)},
+    {TO_NAME_INDEX(SND_DEVICE_IN_HANDSET_MIC)},
+    {TO_NAME_INDEX(SND_DEVICE_IN_SPEAKER_MIC)},
+    {TO_NAME_INDEX(SND_DEVICE_IN_HEADSET_MIC)},
+};
+
+static const struct name_to_index usecases[] = {
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_DEEP_BUFFER)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_LOW_LATENCY)},
+    {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_OFFLOAD)},
+    {TO_NAME_INDEX(USECASE_AUDIO_RECORD)},
+    {TO_NAME_INDEX(USECASE_VOICE_CALL)},
+};
+
+/* what find_index() did before the hash, without the empty name quirk */
+static int scan_index(const struct name_to_index *table, int32_t len,
+                      const char *name)
+{
+    int32_t i;
+
+    for (i = 0; i < len; i++) {
+        if (table[i].name[0] != '\0' && !strcmp(table[i].name, name))
+            return table[i].index;
+    }
+    return -ENODEV;
+}
+
+/* names, with gaps and duplicates */
+static void lookup_table(struct name_to_index *table, int32_t len)
+{
+    int32_t i;
+
+    memset(table, 0, sizeof(*table) * len);
+    for (i = 0; i < len; i++) {
+        table[i].index = i * 3 + 1;
+        if (i % 17 == 5)
+            continue;
+        snprintf(table[i].name, sizeof(table[i].name), "SND_DEVICE_%s_%d",
+                 i % 2 ? "OUT" : "IN", i % 29 == 7 ? i - 7 : i);
+    }
+}
+
+static void lookup_query(char *name, size_t size,
+                         const struct name_to_index *table, int32_t len,
+                         unsigned int n)
+{
+    const char *base = table[n % len].name;
+
+    switch (n % 4) {
+    case 0:
+        snprintf(name, size, "%s", base);
+        break;
+    case 1:
+        /* a prefix of a name */
+        snprintf(name, size, "%.*s", (int)(strlen(base) / 2), base);
+        break;
+    case 2:
+        snprintf(name, size, "%s_X", base);
+        break;
+    default:
+        snprintf(name, size, "SND_DEVICE_%u", n * 2654435761u);
+        break;
+    }
+}
+
+/* the hash finds what a scan of the table finds */
+static void test_name_index_find(void)
+{
+    struct name_to_index table[LOOKUP_TABLE_SIZE];
+    struct name_index_hash hash;
+    char name[128];
+    unsigned int n;
+
+    lookup_table(table, LOOKUP_TABLE_SIZE);
+    memset(&hash, 0, sizeof(hash));
+    for (n = 0; n < 4 * LOOKUP_TABLE_SIZE * 8; n++) {
+        lookup_query(name, sizeof(name), table, LOOKUP_TABLE_SIZE, n);
+        if (name[0] == '\0')
+            continue;
+        SIM_CHECK_EQ(name_index_find(&hash, table, LOOKUP_TABLE_SIZE, name),
+                     scan_index(table, LOOKUP_TABLE_SIZE, name));
+    }
+    SIM_CHECK_EQ(name_index_find(&hash, table, LOOKUP_TABLE_SIZE, ""), -ENODEV);
+    SIM_CHECK_EQ(name_index_find(&hash, table, LOOKUP_TABLE_SIZE, NULL), -ENODEV);
+
+    for (n = 0; n < ARRAY_SIZE(devices); n++)
+        SIM_CHECK_EQ(platform_get_snd_device_index((char *)devices[n].name),
+                     devices[n].index);
+    for (n = 0; n < ARRAY_SIZE(usecases); n++)
+        SIM_CHECK_EQ(platform_get_usecase_index(usecases[n].name),
+                     usecases[n].index);
+}
+
+static void info_paths(char *xml, char *cache, size_t size, const char *name)
+{
+    const char *dir = getenv("TMPDIR");
+
+    snprintf(xml, size, "%s/%s.xml", dir ? dir : "/tmp", name);
+    snprintf(cache, size, "%s/%s.cache", dir ? dir : "/tmp", name);
+    unlink(cache);
+    sim_test_set_config("audio.sim.platform_info_xml", xml);
+    sim_test_set_config("audio.sim.platform_info_cache", cache);
+}
+
+/*
+ * count elements per section, cycling through the names every platform
+ * knows, with the values the platform already has so that parsing changes
+ * nothing but the render latency of latency_device.
+ */
+static bool write_info(const char *path, unsigned int count,
+                       snd_device_t latency_device, int64_t latency_us)
+{
+    snd_device_t device;
+    int64_t us;
+    unsigned int i;
+    FILE *fp = fopen(path, "w");
+
+    if (fp == NULL)
+        return false;
+    fprintf(fp, "<audio_platform_info>\n<acdb_ids>\n");
+    for (i = 0; i < count; i++) {
+        device = devices[i % ARRAY_SIZE(devices)].index;
+        fprintf(fp, "<device name=\"%s\" acdb_id=\"%d\"/>\n",
+                devices[i % ARRAY_SIZE(devices)].name,
+                platform_get_snd_device_acdb_id(device));
+    }
+    fprintf(fp, "</acdb_ids>\n<pcm_ids>\n");
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "<usecase name=\"%s\" type=\"%s\" id=\"%d\"/>\n",
+                usecases[i % ARRAY_SIZE(usecases)].name, i % 2 ? "in" : "out",
+                platform_get_pcm_device_id(usecases[i % ARRAY_SIZE(usecases)].index,
+                                           i % 2 ? PCM_CAPTURE : PCM_PLAYBACK));
+    }
+    fprintf(fp, "</pcm_ids>\n<render_latencies>\n");
+    for (i = 0; i < count; i++) {
+        device = devices[i % ARRAY_SIZE(devices)].index;
+        us = device == latency_device ? latency_us :
+                platform_get_snd_device_render_latency(device);
+        fprintf(fp, "<device name=\"%s\" latency_us=\"%lld\"/>\n",
+                devices[i % ARRAY_SIZE(devices)].name, (long long)us);
+    }
+    fprintf(fp, "</render_latencies>\n</audio_platform_info>\n");
+    return fclose(fp) == 0;
+}
+
+/*
+ * The cache is replayed while the xml file is the one it was written for,
+ * and parsing takes over when the file changes or the cache is corrupt.
+ */
+static void test_platform_info_cache(void)
+{
+    char xml[PROPERTY_VALUE_MAX - 4], cache[PROPERTY_VALUE_MAX - 4];
+    int64_t saved = platform_get_snd_device_render_latency(SND_DEVICE_OUT_SPEAKER);
+    struct timeval times[2];
+    struct stat st;
+    FILE *fp;
+    int byte;
+
+    info_paths(xml, cache, sizeof(xml), "audio_sim_platform_info");
+    sim_test_set_config("audio_hal.platform_info_cache", "true");
+    if (!write_info(xml, 20, SND_DEVICE_OUT_SPEAKER, 11111)) {
+        sim_test_fail(__FILE__, __LINE__, "cannot write %s", xml);
+        return;
+    }
+
+    SIM_CHECK_EQ(platform_info_init(), 0);
+    SIM_CHECK_EQ(platform_get_snd_device_render_latency(SND_DEVICE_OUT_SPEAKER),
+                 11111);
+    SIM_CHECK(access(cache, F_OK) == 0);
+
+    /* same size, mtime and inode: the cache is replayed, not the file */
+    SIM_CHECK_EQ(stat(xml, &st), 0);
+    write_info(xml, 20, SND_DEVICE_OUT_SPEAKER, 22222);
+    times[0].tv_sec = times[1].tv_sec = st.st_mtime;
+    times[0].tv_usec = times[1].tv_usec = 0;
+    utimes(xml, times);
+    SIM_CHECK_EQ(platform_info_init(), 0);
+    SIM_CHECK_EQ(platform_get_snd_device_render_latency(SND_DEVICE_OUT_SPEAKER),
+                 11111);
+
+    /* a corrupt cache falls back to the file */
+    fp = fopen(cache, "r+");
+    SIM_CHECK(fp != NULL);
+    if (fp != NULL) {
+        fseek(fp, -1, SEEK_END);
+        byte = fgetc(fp);
+        fseek(fp, -1, SEEK_END);
+        fputc(byte ^ 0x5a, fp);
+        fclose(fp);
+    }
+    SIM_CHECK_EQ(platform_info_init(), 0);
+    SIM_CHECK_EQ(platform_get_snd_device_render_latency(SND_DEVICE_OUT_SPEAKER),
+                 22222);
+
+    /* a file of another size is parsed again */
+    write_info(xml, 20, SND_DEVICE_OUT_SPEAKER, 333333);
+    SIM_CHECK_EQ(platform_info_init(), 0);
+    SIM_CHECK_EQ(platform_get_snd_device_render_latency(SND_DEVICE_OUT_SPEAKER),
+                 333333);
+
+    platform_set_snd_device_render_latency(SND_DEVICE_OUT_SPEAKER, saved);
+    unlink(xml);
+    unlink(cache);
+}
+
+/*
+ * The hash against the scan it replaced, on a table of platform size, for
+ * names which are in the table as those of a platform info file are.
+ */
+static void bench_name_index_find(void)
+{
+    struct name_to_index table[LOOKUP_TABLE_SIZE];
+    struct name_index_hash hash;
+    int64_t start, hash_ns, scan_ns;
+    volatile int sink;
+    const char *name;
+    unsigned int i, n = 0;
+
+    lookup_table(table, LOOKUP_TABLE_SIZE);
+    memset(&hash, 0, sizeof(hash));
+
+    start = sim_test_thread_cpu_ns();
+    for (i = 0; i < LOOKUP_CALLS; i++) {
+        name = table[i % LOOKUP_TABLE_SIZE].name;
+        if (name[0] != '\0')
+            sink = scan_index(table, LOOKUP_TABLE_SIZE, name);
+    }
+    scan_ns = sim_test_thread_cpu_ns() - start;
+
+    start = sim_test_thread_cpu_ns();
+    for (i = 0; i < LOOKUP_CALLS; i++) {
+        name = table[i % LOOKUP_TABLE_SIZE].name;
+        if (name[0] != '\0') {
+            sink = name_index_find(&hash, table, LOOKUP_TABLE_SIZE, name);
+            n++;
+        }
+    }
+    hash_ns = sim_test_thread_cpu_ns() - start;
+    (void)sink;
+
+    printf("  scan: %.1f ns per lookup\n", (double)scan_ns / n);
+    printf("  hash: %.1f ns per lookup\n", (double)hash_ns / n);
+}
+
+static double parse_ms(void)
+{
+    int64_t start = sim_test_now_ns();
+    unsigned int i;
+
+    for (i = 0; i < PARSE_RUNS; i++)
+        platform_info_init();
+    return (double)(sim_test_now_ns() - start) / (PARSE_RUNS * 1000000.0);
+}
+
+/* startup time of synthetic platform info files, parsed and from the cache */
+static void bench_platform_info_init(void)
+{
+    static const unsigned int counts[] = { 20, 500 };
+    char xml[PROPERTY_VALUE_MAX - 4], cache[PROPERTY_VALUE_MAX - 4];
+    int64_t saved = platform_get_snd_device_render_latency(SND_DEVICE_OUT_SPEAKER);
+    double xml_ms, cache_ms;
+    unsigned int c;
+
+    for (c = 0; c < ARRAY_SIZE(counts); c++) {
+        info_paths(xml, cache, sizeof(xml), "audio_sim_platform_info_bench");
+        if (!write_info(xml, counts[c], SND_DEVICE_OUT_SPEAKER, saved)) {
+            sim_test_fail(__FILE__, __LINE__, "cannot write %s", xml);
+            return;
+        }
+        sim_test_set_config("audio_hal.platform_info_cache", "false");
+        xml_ms = parse_ms();
+        sim_test_set_config("audio_hal.platform_info_cache", "true");
+        SIM_CHECK_EQ(platform_info_init(), 0);
+        SIM_CHECK(access(cache, F_OK) == 0);
+        cache_ms = parse_ms();
+        printf("  %u elements per section: xml %.3f ms, cache %.3f ms\n",
+               counts[c], xml_ms, cache_ms);
+        unlink(xml);
+        unlink(cache);
+    }
+}
+
+const struct sim_test sim_platform_info_tests[] = {
+    SIM_TEST(test_name_index_find),
+    SIM_TEST(test_platform_info_cache),
+    SIM_BENCH(bench_name_index_find),
+    SIM_BENCH(bench_platform_info_init),
+    SIM_TEST_END
+};
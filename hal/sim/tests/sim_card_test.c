@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_hw.h"
+#include "sim.h"
+#include "sim_test.h"
+
+/* an output plays in real time once its buffer is full */
+static void test_output_paced(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_stream_out *out;
+    struct audio_config config;
+    struct timespec ts;
+    uint64_t frames = 0;
+    int64_t start_ns, played_ns;
+    size_t bytes;
+    void *buf;
+    int i;
+
+    if (dev == NULL)
+        return;
+    sim_test_pcm_config(&config);
+    out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                               AUDIO_DEVICE_OUT_SPEAKER, &config);
+    if (out == NULL)
+        goto done;
+
+    bytes = out->common.get_buffer_size(&out->common);
+    buf = calloc(1, bytes);
+    /* the first writes only fill the ring */
+    for (i = 0; i < 8; i++)
+        SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+    start_ns = sim_clock_now_ns();
+    for (i = 0; i < 20; i++)
+        SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+    played_ns = sim_clock_now_ns() - start_ns;
+    free(buf);
+
+    /* 20 buffers of bytes / 4 frames at 48 kHz */
+    SIM_CHECK(played_ns > (int64_t)(20 * bytes / 4) * 1000000 / 48 * 9 / 10);
+    SIM_CHECK(out->get_presentation_position(out, &frames, &ts) == 0);
+    SIM_CHECK(frames > 0 && frames <= 28 * bytes / 4);
+
+    dev->close_output_stream(dev, out);
+done:
+    sim_test_close_device(dev);
+}
+
+static int card_status(struct audio_hw_device *dev)
+{
+    char value[16];
+
+    if (sim_test_get_parameter(dev, "SND_CARD_STATUS", value,
+                               sizeof(value)) != 0)
+        return -1;
+    return atoi(value);
+}
+
+/*
+ * A card going offline fails I/O, which the HAL hides from the client by
+ * pacing it, until it is told the card is back.
+ */
+static void test_card_offline(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_stream_out *out;
+    struct audio_config config;
+    struct timespec ts;
+    uint64_t before, after;
+    size_t bytes;
+    void *buf;
+
+    if (dev == NULL)
+        return;
+    sim_test_pcm_config(&config);
+    out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                               AUDIO_DEVICE_OUT_SPEAKER, &config);
+    if (out == NULL)
+        goto done;
+
+    bytes = out->common.get_buffer_size(&out->common);
+    buf = calloc(1, bytes);
+    SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+    SIM_CHECK_EQ(card_status(dev), 1);
+
+    sim_card_set_online(false);
+    SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+    SIM_CHECK_EQ(card_status(dev), 0);
+    sim_test_set_parameters(dev, "SND_CARD_STATUS=%u,OFFLINE",
+                            sim_card_number());
+    SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+
+    sim_card_set_online(true);
+    sim_test_set_parameters(dev, "SND_CARD_STATUS=%u,ONLINE",
+                            sim_card_number());
+    SIM_CHECK_EQ(card_status(dev), 1);
+    SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+    SIM_CHECK(out->get_presentation_position(out, &before, &ts) == 0);
+    SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+    SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+    SIM_CHECK(out->get_presentation_position(out, &after, &ts) == 0);
+    SIM_CHECK(after > before);
+    free(buf);
+
+    dev->close_output_stream(dev, out);
+done:
+    sim_card_set_online(true);
+    sim_test_close_device(dev);
+}
+
+static void wait_ssr_recovery(struct audio_device *adev, uint32_t recoveries)
+{
+    pthread_mutex_lock(&adev->lock);
+    while (adev->ssr.recoveries == recoveries)
+        pthread_cond_wait(&adev->ssr.cond, &adev->lock);
+    pthread_mutex_unlock(&adev->lock);
+}
+
+/*
+ * A subsystem restart under three clients: one that keeps writing through
+ * it, one that went idle and an offload session. Only the first is restarted
+ * when the card comes back, the idle one is left for its next write and the
+ * offload session for AudioFlinger to reopen.
+ */
+static void test_ssr_restarts_active_clients(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_device *adev = (struct audio_device *)dev;
+    struct audio_stream_out *active = NULL, *idle = NULL, *offload = NULL;
+    struct stream_out *out;
+    struct audio_config config;
+    uint32_t recoveries;
+    size_t bytes;
+    int64_t buffer_ns;
+    void *buf = NULL;
+    int i, writes;
+
+    if (dev == NULL)
+        return;
+    sim_test_pcm_config(&config);
+    active = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                                  AUDIO_DEVICE_OUT_SPEAKER, &config);
+    sim_test_pcm_config(&config);
+    idle = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_FAST,
+                                AUDIO_DEVICE_OUT_SPEAKER, &config);
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = 44100;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = AUDIO_FORMAT_MP3;
+    config.offload_info = AUDIO_INFO_INITIALIZER;
+    config.offload_info.sample_rate = 44100;
+    config.offload_info.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.offload_info.format = AUDIO_FORMAT_MP3;
+    config.offload_info.bit_rate = 128000;
+    offload = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_DIRECT |
+                                   AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD,
+                                   AUDIO_DEVICE_OUT_SPEAKER, &config);
+    if (active == NULL || idle == NULL || offload == NULL)
+        goto done;
+
+    bytes = active->common.get_buffer_size(&active->common);
+    if (idle->common.get_buffer_size(&idle->common) > bytes)
+        bytes = idle->common.get_buffer_size(&idle->common);
+    buf = calloc(1, bytes);
+    SIM_CHECK_EQ(active->write(active, buf, bytes), bytes);
+    SIM_CHECK_EQ(idle->write(idle, buf, bytes), bytes);
+    SIM_CHECK_EQ(offload->write(offload, buf, bytes), bytes);
+
+    sim_card_set_online(false);
+    sim_test_set_parameters(dev, "SND_CARD_STATUS=%u,OFFLINE",
+                            sim_card_number());
+    SIM_CHECK_EQ(offload->write(offload, buf, bytes), -ENETRESET);
+    SIM_CHECK_EQ(idle->write(idle, buf, bytes), bytes);
+
+    /* the HAL paces offline writes on the real clock, past the idle limit */
+    buffer_ns = (int64_t)(bytes / 4) * 1000000000LL / 48000;
+    writes = (int)(300000000LL / buffer_ns) + 2;
+    for (i = 0; i < writes; i++)
+        SIM_CHECK_EQ(active->write(active, buf, bytes), bytes);
+
+    pthread_mutex_lock(&adev->lock);
+    recoveries = adev->ssr.recoveries;
+    pthread_mutex_unlock(&adev->lock);
+    sim_card_set_online(true);
+    sim_test_set_parameters(dev, "SND_CARD_STATUS=%u,ONLINE",
+                            sim_card_number());
+    wait_ssr_recovery(adev, recoveries);
+
+    out = (struct stream_out *)active;
+    SIM_CHECK_EQ(out->ssr.recoveries, 1);
+    SIM_CHECK(!out->standby);
+    out = (struct stream_out *)idle;
+    SIM_CHECK_EQ(out->ssr.recoveries, 0);
+    SIM_CHECK(out->standby && out->ssr.pending);
+    out = (struct stream_out *)offload;
+    SIM_CHECK_EQ(out->ssr.recoveries, 0);
+    SIM_CHECK(out->standby && list_empty(&out->ssr.node));
+
+    /* the idle client restarts its stream itself when it comes back */
+    SIM_CHECK_EQ(idle->write(idle, buf, bytes), bytes);
+    out = (struct stream_out *)idle;
+    SIM_CHECK(!out->standby && !out->ssr.pending);
+    SIM_CHECK_EQ(active->write(active, buf, bytes), bytes);
+
+done:
+    free(buf);
+    if (offload != NULL)
+        dev->close_output_stream(dev, offload);
+    if (idle != NULL)
+        dev->close_output_stream(dev, idle);
+    if (active != NULL)
+        dev->close_output_stream(dev, active);
+    sim_card_set_online(true);
+    sim_test_close_device(dev);
+}
+
+const struct sim_test sim_card_tests[] = {
+    SIM_TEST(test_output_paced),
+    SIM_TEST(test_card_offline),
+    SIM_TEST(test_ssr_restarts_active_clients),
+    SIM_TEST_END
+};
@@ -0,0 +1,444 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_sim_tests"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <cutils/str_parms.h>
+#include <hardware/hardware.h>
+
+#include "sim.h"
+#include "sim_test.h"
+
+#define SIM_TEST_MAX_CONFIG     32
+#define SIM_TEST_MIXER_PATHS    "/system/etc/mixer_paths.xml"
+
+extern struct audio_module HAL_MODULE_INFO_SYM;
+
+static const struct sim_test *sim_suites[] = {
+    sim_card_tests,
+    sim_usecase_tests,
+    sim_offload_tests,
+    sim_latency_tests,
+    sim_stream_tests,
+    sim_tuner_tests,
+    sim_platform_info_tests,
+    sim_mixer_ctl_tests,
+    sim_params_tests,
+    sim_boot_tests,
+    sim_snd_card_tests,
+    sim_cal_tests,
+};
+
+static const char *sim_test_name;
+static bool sim_test_has_failed;
+static bool sim_test_was_skipped;
+static char sim_test_config[SIM_TEST_MAX_CONFIG][PROPERTY_KEY_MAX];
+static unsigned int sim_test_num_config;
+
+void sim_test_fail(const char *file, int line, const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "%s:%d: %s: check failed: ", file, line, sim_test_name);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    sim_test_has_failed = true;
+}
+
+bool sim_test_failed(void)
+{
+    return sim_test_has_failed;
+}
+
+bool sim_test_on_clock(const char *clock)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    sim_get_config("audio.sim.clock", value, "real");
+    if (!strcmp(value, clock))
+        return true;
+    printf("  needs the %s clock\n", clock);
+    sim_test_was_skipped = true;
+    return false;
+}
+
+void sim_test_set_config(const char *key, const char *value)
+{
+    unsigned int i;
+
+    for (i = 0; i < sim_test_num_config; i++) {
+        if (!strcmp(sim_test_config[i], key))
+            break;
+    }
+    if (i == sim_test_num_config && i < SIM_TEST_MAX_CONFIG)
+        snprintf(sim_test_config[sim_test_num_config++], PROPERTY_KEY_MAX,
+                 "%s", key);
+    property_set(key, value);
+}
+
+static void sim_test_clear_config(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < sim_test_num_config; i++)
+        property_set(sim_test_config[i], "");
+    sim_test_num_config = 0;
+}
+
+struct audio_hw_device *sim_test_open_device(void)
+{
+    struct hw_device_t *device;
+    int ret;
+
+    ret = HAL_MODULE_INFO_SYM.common.methods->open(&HAL_MODULE_INFO_SYM.common,
+                                                   AUDIO_HARDWARE_INTERFACE,
+                                                   &device);
+    if (ret != 0) {
+        sim_test_fail(__FILE__, __LINE__, "adev_open: %d", ret);
+        return NULL;
+    }
+    return (struct audio_hw_device *)device;
+}
+
+void sim_test_close_device(struct audio_hw_device *dev)
+{
+    if (dev != NULL)
+        dev->common.close(&dev->common);
+}
+
+static audio_io_handle_t sim_test_next_handle = 1;
+
+void sim_test_pcm_config(struct audio_config *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->sample_rate = 48000;
+    config->channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config->format = AUDIO_FORMAT_PCM_16_BIT;
+}
+
+struct audio_stream_out *sim_test_open_output(struct audio_hw_device *dev,
+                                              audio_output_flags_t flags,
+                                              audio_devices_t devices,
+                                              struct audio_config *config)
+{
+    struct audio_stream_out *out = NULL;
+    int ret;
+
+    ret = dev->open_output_stream(dev, sim_test_next_handle++, devices, flags,
+                                  config, &out, "");
+    if (ret != 0) {
+        sim_test_fail(__FILE__, __LINE__, "open_output_stream(%#x, %#x): %d",
+                      flags, devices, ret);
+        return NULL;
+    }
+    return out;
+}
+
+struct audio_stream_in *sim_test_open_input(struct audio_hw_device *dev,
+                                            audio_devices_t devices,
+                                            audio_source_t source,
+                                            struct audio_config *config)
+{
+    struct audio_stream_in *in = NULL;
+    int ret;
+
+    ret = dev->open_input_stream(dev, sim_test_next_handle++, devices, config,
+                                 &in, AUDIO_INPUT_FLAG_NONE, "", source);
+    if (ret != 0) {
+        sim_test_fail(__FILE__, __LINE__, "open_input_stream(%#x, %d): %d",
+                      devices, source, ret);
+        return NULL;
+    }
+    return in;
+}
+
+int sim_test_set_parameters(struct audio_hw_device *dev, const char *fmt, ...)
+{
+    char kv_pairs[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(kv_pairs, sizeof(kv_pairs), fmt, ap);
+    va_end(ap);
+    return dev->set_parameters(dev, kv_pairs);
+}
+
+int sim_test_get_parameter(struct audio_hw_device *dev, const char *key,
+                           char *value, size_t size)
+{
+    struct str_parms *reply;
+    char *str;
+    int ret;
+
+    str = dev->get_parameters(dev, key);
+    if (str == NULL)
+        return -ENOENT;
+    reply = str_parms_create_str(str);
+    free(str);
+    if (reply == NULL)
+        return -ENOMEM;
+    ret = str_parms_get_str(reply, key, value, size);
+    str_parms_destroy(reply);
+    return ret < 0 ? -ENOENT : 0;
+}
+
+int64_t sim_test_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * SIM_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+int64_t sim_test_thread_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * SIM_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+int64_t sim_test_process_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * SIM_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+void sim_samples_init(struct sim_samples *samples, size_t max)
+{
+    samples->ns = calloc(max, sizeof(int64_t));
+    samples->count = 0;
+    samples->max = samples->ns ? max : 0;
+}
+
+void sim_samples_add(struct sim_samples *samples, int64_t ns)
+{
+    if (samples->count < samples->max)
+        samples->ns[samples->count++] = ns;
+}
+
+static int sim_samples_compare(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+int64_t sim_samples_percentile(struct sim_samples *samples, unsigned int pct)
+{
+    size_t rank;
+
+    if (samples->count == 0)
+        return 0;
+    qsort(samples->ns, samples->count, sizeof(int64_t), sim_samples_compare);
+    rank = (samples->count * pct + 99) / 100;
+    return samples->ns[rank > 0 ? rank - 1 : 0];
+}
+
+void sim_samples_report(struct sim_samples *samples, const char *what)
+{
+    printf("  %-40s n %6zu  p50 %9.1f  p90 %9.1f  p99 %9.1f  max %9.1f us\n",
+           what, samples->count,
+           sim_samples_percentile(samples, 50) / 1000.0,
+           sim_samples_percentile(samples, 90) / 1000.0,
+           sim_samples_percentile(samples, 99) / 1000.0,
+           sim_samples_percentile(samples, 100) / 1000.0);
+}
+
+void sim_samples_free(struct sim_samples *samples)
+{
+    free(samples->ns);
+    samples->ns = NULL;
+    samples->count = samples->max = 0;
+}
+
+/*
+ * Hosts have no mixer_paths.xml. This one has the usual controls of the
+ * paths tests go through, so that routing does some mixer work.
+ */
+static const char sim_test_mixer_paths[] =
+    "<mixer>\n"
+    "<ctl name=\"SLIMBUS_0_RX Audio Mixer MultiMedia1\" value=\"0\" />\n"
+    "<ctl name=\"SLIMBUS_0_RX Audio Mixer MultiMedia4\" value=\"0\" />\n"
+    "<ctl name=\"SLIMBUS_0_RX Audio Mixer MultiMedia5\" value=\"0\" />\n"
+    "<ctl name=\"SLIMBUS_0_RX Audio Mixer MultiMedia7\" value=\"0\" />\n"
+    "<ctl name=\"MultiMedia1 Mixer SLIM_0_TX\" value=\"0\" />\n"
+    "<ctl name=\"SLIM_0_RX Channels\" value=\"One\" />\n"
+    "<ctl name=\"RX1 MIX1 INP1\" value=\"ZERO\" />\n"
+    "<ctl name=\"RX2 MIX1 INP1\" value=\"ZERO\" />\n"
+    "<ctl name=\"RX7 MIX1 INP1\" value=\"ZERO\" />\n"
+    "<ctl name=\"RX1 Digital Volume\" value=\"0\" />\n"
+    "<ctl name=\"RX2 Digital Volume\" value=\"0\" />\n"
+    "<ctl name=\"RX7 Digital Volume\" value=\"0\" />\n"
+    "<ctl name=\"HPHL DAC Switch\" value=\"0\" />\n"
+    "<ctl name=\"SPK DAC Switch\" value=\"0\" />\n"
+    "<ctl name=\"DEC1 MUX\" value=\"ZERO\" />\n"
+    "<ctl name=\"ADC1 Volume\" value=\"0\" />\n"
+    "<ctl name=\"AUDIO_REF_EC_UL1 MUX\" value=\"ZERO\" />\n"
+    "<path name=\"deep-buffer-playback\">\n"
+    "  <ctl name=\"SLIMBUS_0_RX Audio Mixer MultiMedia1\" value=\"1\" />\n"
+    "</path>\n"
+    "<path name=\"low-latency-playback\">\n"
+    "  <ctl name=\"SLIMBUS_0_RX Audio Mixer MultiMedia5\" value=\"1\" />\n"
+    "</path>\n"
+    "<path name=\"compress-offload-playback\">\n"
+    "  <ctl name=\"SLIMBUS_0_RX Audio Mixer MultiMedia4\" value=\"1\" />\n"
+    "</path>\n"
+    "<path name=\"multi-channel-playback\">\n"
+    "  <ctl name=\"SLIMBUS_0_RX Audio Mixer MultiMedia7\" value=\"1\" />\n"
+    "</path>\n"
+    "<path name=\"audio-record\">\n"
+    "  <ctl name=\"MultiMedia1 Mixer SLIM_0_TX\" value=\"1\" />\n"
+    "</path>\n"
+    "<path name=\"speaker\">\n"
+    "  <ctl name=\"RX7 MIX1 INP1\" value=\"RX1\" />\n"
+    "  <ctl name=\"RX7 Digital Volume\" value=\"84\" />\n"
+    "  <ctl name=\"SPK DAC Switch\" value=\"1\" />\n"
+    "</path>\n"
+    "<path name=\"headphones\">\n"
+    "  <ctl name=\"SLIM_0_RX Channels\" value=\"Two\" />\n"
+    "  <ctl name=\"RX1 MIX1 INP1\" value=\"RX1\" />\n"
+    "  <ctl name=\"RX2 MIX1 INP1\" value=\"RX2\" />\n"
+    "  <ctl name=\"RX1 Digital Volume\" value=\"84\" />\n"
+    "  <ctl name=\"RX2 Digital Volume\" value=\"84\" />\n"
+    "  <ctl name=\"HPHL DAC Switch\" value=\"1\" />\n"
+    "</path>\n"
+    "<path name=\"handset\">\n"
+    "  <ctl name=\"RX1 MIX1 INP1\" value=\"RX1\" />\n"
+    "  <ctl name=\"RX1 Digital Volume\" value=\"84\" />\n"
+    "</path>\n"
+    "<path name=\"handset-mic\">\n"
+    "  <ctl name=\"DEC1 MUX\" value=\"ADC1\" />\n"
+    "  <ctl name=\"ADC1 Volume\" value=\"4\" />\n"
+    "</path>\n"
+    "<path name=\"speaker-mic\">\n"
+    "  <path name=\"handset-mic\" />\n"
+    "</path>\n"
+    "<path name=\"echo-reference\">\n"
+    "  <ctl name=\"AUDIO_REF_EC_UL1 MUX\" value=\"SLIM_RX\" />\n"
+    "</path>\n"
+    "</mixer>\n";
+
+/* hosts have no mixer_paths.xml, the one above is used instead */
+static void sim_test_default_mixer_paths(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    static char path[PATH_MAX];
+    const char *tmp = getenv("TMPDIR");
+    FILE *file;
+
+    if (sim_get_config("audio.sim.mixer_paths", value, NULL) > 0 ||
+            access(SIM_TEST_MIXER_PATHS, R_OK) == 0)
+        return;
+
+    snprintf(path, sizeof(path), "%s/audio_sim_mixer_paths.xml",
+             tmp ? tmp : "/data/local/tmp");
+    file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "cannot create %s: %s\n", path, strerror(errno));
+        return;
+    }
+    fputs(sim_test_mixer_paths, file);
+    fclose(file);
+    setenv("AUDIO_SIM_MIXER_PATHS", path, 1);
+}
+
+static bool sim_test_selected(const struct sim_test *test, bool bench,
+                              int argc, char **argv)
+{
+    int i;
+
+    if (argc == 0)
+        return bench || !test->bench;
+    for (i = 0; i < argc; i++) {
+        if (!strncmp(test->name, argv[i], strlen(argv[i])))
+            return bench || !test->bench || !strcmp(test->name, argv[i]);
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    bool bench = false, list = false;
+    unsigned int run = 0, failed = 0, skipped = 0;
+    const struct sim_test *test;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bl")) != -1) {
+        switch (opt) {
+        case 'b':
+            bench = true;
+            break;
+        case 'l':
+            list = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-b] [-l] [name...]\n", argv[0]);
+            return 2;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    sim_test_default_mixer_paths();
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    for (i = 0; i < sizeof(sim_suites) / sizeof(sim_suites[0]); i++) {
+        for (test = sim_suites[i]; test->name != NULL; test++) {
+            if (!sim_test_selected(test, bench, argc, argv))
+                continue;
+            if (list) {
+                printf("%s%s\n", test->name, test->bench ? " (benchmark)" : "");
+                continue;
+            }
+
+            printf("[ RUN  ] %s\n", test->name);
+            sim_test_name = test->name;
+            sim_test_has_failed = false;
+            sim_test_was_skipped = false;
+            test->run();
+            sim_test_clear_config();
+            printf("[ %s ] %s\n", sim_test_has_failed ? "FAIL" :
+                   sim_test_was_skipped ? "SKIP" : " OK ", test->name);
+            run++;
+            if (sim_test_has_failed)
+                failed++;
+            else if (sim_test_was_skipped)
+                skipped++;
+        }
+    }
+
+    if (!list)
+        printf("%u run, %u failed, %u skipped\n", run, failed, skipped);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_SIM_TEST_H
+#define AUDIO_SIM_TEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hardware/audio.h>
+
+/*
+ * Tests and benchmarks of the HAL running on the simulated sound card. The
+ * audio_sim_tests executable is built from the same sources and flags as the
+ * HAL module, so tests can reach the HAL internals as well as its public
+ * interface:
+ *
+ *   audio_sim_tests [-b] [-l] [name...]
+ *
+ * runs the tests, and with -b the benchmarks too, whose name starts with one
+ * of the names given. -l lists them. The exit status is non-zero when a test
+ * failed. Benchmarks only fail when what they measure is broken, timings are
+ * reported for comparison between builds.
+ *
+ * Each test sets the simulator and HAL properties it depends on through
+ * sim_test_set_config(); they are cleared before the next test runs. The
+ * clock is chosen once for the process, so tests that need the other one
+ * are reported as skipped: run again with AUDIO_SIM_CLOCK=virtual (or the
+ * audio.sim.clock property) to cover them.
+ */
+
+struct sim_test {
+    const char *name;
+    void (*run)(void);
+    bool bench;
+};
+
+#define SIM_TEST(fn)        { #fn, fn, false }
+#define SIM_BENCH(fn)       { #fn, fn, true }
+#define SIM_TEST_END        { NULL, NULL, false }
+
+/* suites, one per file, terminated by SIM_TEST_END */
+extern const struct sim_test sim_card_tests[];
+extern const struct sim_test sim_usecase_tests[];
+extern const struct sim_test sim_offload_tests[];
+extern const struct sim_test sim_latency_tests[];
+extern const struct sim_test sim_stream_tests[];
+extern const struct sim_test sim_tuner_tests[];
+extern const struct sim_test sim_platform_info_tests[];
+extern const struct sim_test sim_mixer_ctl_tests[];
+extern const struct sim_test sim_params_tests[];
+extern const struct sim_test sim_boot_tests[];
+extern const struct sim_test sim_snd_card_tests[];
+extern const struct sim_test sim_cal_tests[];
+
+/* marks the running test failed and carries on */
+#define SIM_CHECK(cond) \
+    do { \
+        if (!(cond)) \
+            sim_test_fail(__FILE__, __LINE__, "%s", #cond); \
+    } while (0)
+
+#define SIM_CHECK_EQ(a, b) \
+    do { \
+        long long _a = (long long)(a), _b = (long long)(b); \
+        if (_a != _b) \
+            sim_test_fail(__FILE__, __LINE__, "%s == %s: %lld != %lld", \
+                          #a, #b, _a, _b); \
+    } while (0)
+
+void sim_test_fail(const char *file, int line, const char *fmt, ...)
+        __attribute__((format(printf, 3, 4)));
+bool sim_test_failed(void);
+
+/* whether the simulator runs on clock, "real" or "virtual"; if not, the
+ * running test is reported as skipped */
+bool sim_test_on_clock(const char *clock);
+
+/* property, or simulator setting, until the end of the test */
+void sim_test_set_config(const char *key, const char *value);
+
+/* the HAL opened through its module entry point, NULL on failure */
+struct audio_hw_device *sim_test_open_device(void);
+void sim_test_close_device(struct audio_hw_device *dev);
+
+/* output or input with the given flags on devices, NULL on failure */
+struct audio_stream_out *sim_test_open_output(struct audio_hw_device *dev,
+                                              audio_output_flags_t flags,
+                                              audio_devices_t devices,
+                                              struct audio_config *config);
+struct audio_stream_in *sim_test_open_input(struct audio_hw_device *dev,
+                                            audio_devices_t devices,
+                                            audio_source_t source,
+                                            struct audio_config *config);
+
+/* a 48 kHz stereo 16 bit configuration */
+void sim_test_pcm_config(struct audio_config *config);
+
+/* formats kv_pairs and passes them to set_parameters() */
+int sim_test_set_parameters(struct audio_hw_device *dev, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+/* value of key in the get_parameters() reply, -ENOENT if it is not there */
+int sim_test_get_parameter(struct audio_hw_device *dev, const char *key,
+                           char *value, size_t size);
+
+/* monotonic time, and CPU time of the calling thread or all threads, in ns */
+int64_t sim_test_now_ns(void);
+int64_t sim_test_thread_cpu_ns(void);
+int64_t sim_test_process_cpu_ns(void);
+
+/* latency samples, reported as percentiles */
+struct sim_samples {
+    int64_t *ns;
+    size_t count;
+    size_t max;
+};
+
+void sim_samples_init(struct sim_samples *samples, size_t max);
+void sim_samples_add(struct sim_samples *samples, int64_t ns);
+int64_t sim_samples_percentile(struct sim_samples *samples, unsigned int pct);
+/* prints count, p50, p90, p99 and max in us */
+void sim_samples_report(struct sim_samples *samples, const char *what);
+void sim_samples_free(struct sim_samples *samples);
+
+#endif /* AUDIO_SIM_TEST_H */
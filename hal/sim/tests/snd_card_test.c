@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cutils/properties.h>
+#include <tinyalsa/asoundlib.h>
+
+#include "sim.h"
+#include "sim_test.h"
+#include "snd_card.h"
+
+/* what platform_init() looked through before snd_card_discover() */
+#define OLD_RETRY_NUMBER    10
+#define OLD_RETRY_US        500000
+#define OLD_MAX_SND_CARD    8
+
+/* the card the platform knows, as hw_info_init() would */
+static bool match_known_card(int card __unused, const char *name,
+                             void *arg __unused)
+{
+    return !strcmp(name, SIM_CARD_NAME);
+}
+
+/* the card with its registration delay starting over */
+static void sim_card_boot(unsigned int card, unsigned int delay_ms,
+                          const char *name)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    snprintf(value, sizeof(value), "%u", card);
+    sim_test_set_config("audio.sim.card", value);
+    snprintf(value, sizeof(value), "%u", delay_ms);
+    sim_test_set_config("audio.sim.card_delay_ms", value);
+    sim_test_set_config("audio.sim.card_name", name);
+    sim_card_reboot();
+}
+
+/* platform_init()'s loop before snd_card_discover(), on the sim clock */
+static int old_card_loop(void)
+{
+    struct mixer *mixer;
+    int card, retry;
+
+    for (card = 0; card < OLD_MAX_SND_CARD; card++) {
+        mixer = mixer_open(card);
+        for (retry = 0; !mixer && retry < OLD_RETRY_NUMBER; retry++) {
+            sim_clock_sleep_until(sim_clock_now_ns() + OLD_RETRY_US * 1000LL);
+            mixer = mixer_open(card);
+        }
+        if (!mixer)
+            continue;
+        if (match_known_card(card, mixer_get_name(mixer), NULL)) {
+            mixer_close(mixer);
+            return card;
+        }
+        mixer_close(mixer);
+    }
+    return -ENODEV;
+}
+
+/*
+ * The card is found as soon as it registers, whatever its number, and a
+ * card nobody knows is given up on after audio_hal.snd_card_wait_ms.
+ */
+static void test_snd_card_discover(void)
+{
+    int64_t start_ns, elapsed_ms;
+
+    sim_test_set_config(SND_CARD_WAIT_PROPERTY, "300");
+
+    sim_card_boot(0, 0, SIM_CARD_NAME);
+    start_ns = sim_clock_now_ns();
+    SIM_CHECK_EQ(snd_card_discover(match_known_card, NULL, 8), 0);
+    SIM_CHECK((sim_clock_now_ns() - start_ns) / 1000000 < 50);
+
+    sim_card_boot(2, 100, SIM_CARD_NAME);
+    start_ns = sim_clock_now_ns();
+    SIM_CHECK_EQ(snd_card_discover(match_known_card, NULL, 8), 2);
+    elapsed_ms = (sim_clock_now_ns() - start_ns) / 1000000;
+    SIM_CHECK(elapsed_ms >= 100 && elapsed_ms < 250);
+
+    /* beyond max_card */
+    sim_card_boot(2, 0, SIM_CARD_NAME);
+    SIM_CHECK_EQ(snd_card_discover(match_known_card, NULL, 2), -ENODEV);
+
+    sim_card_boot(1, 0, "unknown-snd-card");
+    start_ns = sim_clock_now_ns();
+    SIM_CHECK_EQ(snd_card_discover(match_known_card, NULL, 8), -ENODEV);
+    elapsed_ms = (sim_clock_now_ns() - start_ns) / 1000000;
+    SIM_CHECK(elapsed_ms >= 300 && elapsed_ms < 450);
+
+    /* later tests get the card back as it was */
+    sim_card_reboot();
+}
+
+/*
+ * Time to find the card, the old retry loop against snd_card_discover(),
+ * for a card that is there, one that registers late and one nobody knows.
+ */
+static void bench_snd_card_discover(void)
+{
+    static const struct {
+        const char *name;
+        unsigned int card;
+        unsigned int delay_ms;
+        const char *card_name;
+    } cases[] = {
+        { "card 0 present", 0, 0, SIM_CARD_NAME },
+        { "card 0 registers 1.2 s late", 0, 1200, SIM_CARD_NAME },
+        { "card 1, no card 0", 1, 0, SIM_CARD_NAME },
+        { "card 2 registers 1.2 s late", 2, 1200, SIM_CARD_NAME },
+        { "no known card", 0, 0, "unknown-snd-card" },
+    };
+    int64_t start_ns, old_ns, new_ns;
+    int old_card, new_card;
+    unsigned int i;
+
+    /* the old loop sleeps for up to 40 s */
+    if (!sim_test_on_clock("virtual"))
+        return;
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        sim_card_boot(cases[i].card, cases[i].delay_ms, cases[i].card_name);
+        start_ns = sim_clock_now_ns();
+        old_card = old_card_loop();
+        old_ns = sim_clock_now_ns() - start_ns;
+
+        sim_card_boot(cases[i].card, cases[i].delay_ms, cases[i].card_name);
+        start_ns = sim_clock_now_ns();
+        new_card = snd_card_discover(match_known_card, NULL,
+                                     OLD_MAX_SND_CARD);
+        new_ns = sim_clock_now_ns() - start_ns;
+
+        SIM_CHECK_EQ(new_card, old_card);
+        printf("  %-30s %6lld ms -> %6lld ms\n", cases[i].name,
+               (long long)(old_ns / 1000000), (long long)(new_ns / 1000000));
+    }
+    sim_card_reboot();
+}
+
+const struct sim_test sim_snd_card_tests[] = {
+    SIM_TEST(test_snd_card_discover),
+    SIM_BENCH(bench_snd_card_discover),
+    SIM_TEST_END
+};
@@ -0,0 +1,668 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/properties.h>
+#include <cutils/str_parms.h>
+
+#include "audio_hw.h"
+#include "sim.h"
+#include "sim_test.h"
+
+static struct stream_in *active_input(struct audio_device *adev)
+{
+    struct stream_in *in;
+
+    pthread_mutex_lock(&adev->lock);
+    in = adev->active_input;
+    pthread_mutex_unlock(&adev->lock);
+    return in;
+}
+
+/*
+ * An input failing to start because its usecase is taken leaves the input
+ * which holds it active, so that routing still follows that one.
+ */
+static void test_input_busy_usecase(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_device *adev = (struct audio_device *)dev;
+    struct audio_stream_in *first, *second;
+    struct audio_config config;
+    size_t bytes;
+    void *buf;
+
+    if (dev == NULL)
+        return;
+    sim_test_pcm_config(&config);
+    config.channel_mask = AUDIO_CHANNEL_IN_MONO;
+    first = sim_test_open_input(dev, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                                AUDIO_SOURCE_MIC, &config);
+    second = sim_test_open_input(dev, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                                 AUDIO_SOURCE_MIC, &config);
+    if (first == NULL || second == NULL)
+        goto done;
+
+    bytes = first->common.get_buffer_size(&first->common);
+    buf = calloc(1, bytes);
+    SIM_CHECK_EQ(first->read(first, buf, bytes), bytes);
+    SIM_CHECK(active_input(adev) == (struct stream_in *)first);
+    /* reads silence, the usecase belongs to the first input */
+    SIM_CHECK_EQ(second->read(second, buf, bytes), bytes);
+    SIM_CHECK(active_input(adev) == (struct stream_in *)first);
+    second->common.standby(&second->common);
+    SIM_CHECK(active_input(adev) == (struct stream_in *)first);
+    SIM_CHECK_EQ(first->read(first, buf, bytes), bytes);
+    first->common.standby(&first->common);
+    SIM_CHECK(active_input(adev) == NULL);
+    free(buf);
+
+done:
+    if (second != NULL)
+        dev->close_input_stream(dev, second);
+    if (first != NULL)
+        dev->close_input_stream(dev, first);
+    sim_test_close_device(dev);
+}
+
+/*
+ * The EDID the HDMI sink reports, as audio.sim.hdmi_channels only applies
+ * to the mixer created by the first device opened in the process.
+ */
+static void set_hdmi_channels(struct audio_device *adev, unsigned int channels)
+{
+    struct mixer_ctl *ctl = mixer_get_ctl_by_name(adev->mixer, "HDMI EDID");
+    unsigned char edid[3] = {
+        (1 << 3) | (channels - 1),  /* LPCM */
+        0x07,                       /* 32, 44.1 and 48 kHz */
+        0x01,                       /* 16 bit */
+    };
+
+    SIM_CHECK(ctl != NULL);
+    if (ctl != NULL)
+        SIM_CHECK_EQ(mixer_ctl_set_array(ctl, edid, sizeof(edid)), 0);
+}
+
+/* a 16 bit multichannel output on the HDMI sink */
+static struct audio_stream_out *open_multi_ch(struct audio_hw_device *dev,
+                                              audio_channel_mask_t mask)
+{
+    struct audio_config config;
+
+    sim_test_pcm_config(&config);
+    config.channel_mask = mask;
+    return sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_DIRECT,
+                                AUDIO_DEVICE_OUT_AUX_DIGITAL, &config);
+}
+
+static bool sw_gain_buf_is_zero(struct audio_stream_out *stream, size_t bytes)
+{
+    struct stream_out *out = (struct stream_out *)stream;
+    bool zero = out->sw_gain_buf != NULL;
+    size_t i;
+
+    pthread_mutex_lock(&out->lock);
+    for (i = 0; zero && i < bytes / sizeof(int16_t); i++)
+        zero = out->sw_gain_buf[i] == 0;
+    pthread_mutex_unlock(&out->lock);
+    return zero;
+}
+
+#define OVERRUN_STALL_MS    300
+#define OVERRUN_POLLS       30
+
+/* whether (frames, time) did not go back from *last, which it then becomes */
+static bool capture_position_forward(struct audio_stream_in *in,
+                                     int64_t last[2])
+{
+    int64_t frames, time;
+
+    if (in->get_capture_position(in, &frames, &time) != 0)
+        return false;
+    if (frames < last[0] || time < last[1])
+        return false;
+    last[0] = frames;
+    last[1] = time;
+    return true;
+}
+
+/*
+ * The reader stalls long enough for the capture engine to drop periods:
+ * the frames the counter skips once reading resumes are those reported
+ * lost, and the capture position never goes back meanwhile.
+ */
+static void test_capture_overrun(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_in *in;
+    struct audio_config config;
+    int64_t last[2] = { 0, 0 };
+    uint32_t skipped = 0;
+    uint16_t expected;
+    size_t frames, i;
+    unsigned int n, reads;
+    int16_t *buf;
+
+    /* on the virtual clock the engine thread never waits for the reader */
+    if (!sim_test_on_clock("real"))
+        return;
+    sim_test_set_config("audio.sim.capture_counter", "true");
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+    sim_test_pcm_config(&config);
+    config.channel_mask = AUDIO_CHANNEL_IN_MONO;
+    in = sim_test_open_input(dev, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                             AUDIO_SOURCE_MIC, &config);
+    if (in == NULL)
+        goto done;
+    frames = in->common.get_buffer_size(&in->common) /
+             audio_stream_in_frame_size(in);
+    buf = malloc(frames * sizeof(*buf));
+
+    SIM_CHECK_EQ(in->read(in, buf, frames * sizeof(*buf)),
+                 frames * sizeof(*buf));
+    SIM_CHECK(((struct stream_in *)in)->engine.running);
+    SIM_CHECK_EQ(in->get_input_frames_lost(in), 0);
+    SIM_CHECK(capture_position_forward(in, last));
+    expected = (uint16_t)(buf[frames - 1] + 1);
+
+    for (n = 0; n < OVERRUN_POLLS; n++) {
+        usleep(OVERRUN_STALL_MS * 1000 / OVERRUN_POLLS);
+        SIM_CHECK(capture_position_forward(in, last));
+    }
+
+    /* what the ring held, then a little more */
+    reads = ((struct stream_in *)in)->engine.ring_frames / frames + 2;
+    for (n = 0; n < reads; n++) {
+        SIM_CHECK_EQ(in->read(in, buf, frames * sizeof(*buf)),
+                     frames * sizeof(*buf));
+        skipped += (uint16_t)(buf[0] - expected);
+        for (i = 1; i < frames; i++) {
+            if (buf[i] != (int16_t)(buf[i - 1] + 1))
+                break;
+        }
+        SIM_CHECK_EQ(i, frames);
+        expected = (uint16_t)(buf[frames - 1] + 1);
+        SIM_CHECK(capture_position_forward(in, last));
+    }
+    SIM_CHECK(skipped > 0);
+    SIM_CHECK_EQ(in->get_input_frames_lost(in), skipped);
+    SIM_CHECK_EQ(in->get_input_frames_lost(in), 0);
+
+    free(buf);
+    dev->close_input_stream(dev, in);
+done:
+    sim_test_close_device(dev);
+}
+
+/*
+ * A muted multichannel output stays muted when it is routed away from HDMI
+ * and back, without the client buffer being touched. Outputs mixed by
+ * AudioFlinger still leave the volume to it, wherever they are routed.
+ */
+static void test_multi_ch_mute_reroute(void)
+{
+    static const char *const routes[] = { "routing=2", "routing=1024" };
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out, *deep;
+    struct audio_config config;
+    int16_t *buf;
+    size_t bytes, i;
+
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+    set_hdmi_channels((struct audio_device *)dev, 6);
+    out = open_multi_ch(dev, AUDIO_CHANNEL_OUT_5POINT1);
+    sim_test_pcm_config(&config);
+    deep = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                                AUDIO_DEVICE_OUT_AUX_DIGITAL, &config);
+    if (out == NULL || deep == NULL)
+        goto done;
+
+    bytes = out->common.get_buffer_size(&out->common);
+    buf = malloc(bytes);
+    for (i = 0; i < bytes / sizeof(int16_t); i++)
+        buf[i] = 0x1000;
+    SIM_CHECK_EQ(out->set_volume(out, 0.0f, 0.0f), 0);
+    /* the first buffer ramps down, the next ones are silent */
+    SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+    for (i = 0; i < sizeof(routes) / sizeof(routes[0]); i++) {
+        SIM_CHECK_EQ(out->common.set_parameters(&out->common, routes[i]), 0);
+        SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+        SIM_CHECK(sw_gain_buf_is_zero(out, bytes));
+    }
+    SIM_CHECK_EQ(buf[0], 0x1000);
+    SIM_CHECK_EQ(buf[bytes / sizeof(int16_t) - 1], 0x1000);
+    free(buf);
+
+    SIM_CHECK_EQ(deep->set_volume(deep, 0.0f, 0.0f), -ENOSYS);
+    SIM_CHECK_EQ(deep->common.set_parameters(&deep->common, "routing=2"), 0);
+    SIM_CHECK_EQ(deep->set_volume(deep, 0.0f, 0.0f), -ENOSYS);
+
+done:
+    if (deep != NULL)
+        dev->close_output_stream(dev, deep);
+    if (out != NULL)
+        dev->close_output_stream(dev, out);
+    set_hdmi_channels((struct audio_device *)dev, 2);
+    sim_test_close_device(dev);
+}
+
+/* value of key in the output's get_parameters() reply, empty if missing */
+static void out_parameter(struct audio_stream_out *out, const char *key,
+                          char *value, size_t size)
+{
+    struct str_parms *reply;
+    char *str;
+
+    value[0] = '\0';
+    str = out->common.get_parameters(&out->common, key);
+    if (str == NULL)
+        return;
+    reply = str_parms_create_str(str);
+    free(str);
+    if (reply == NULL)
+        return;
+    if (str_parms_get_str(reply, key, value, size) < 0)
+        value[0] = '\0';
+    str_parms_destroy(reply);
+}
+
+/*
+ * The EDID is read once and kept until an HDMI sink is connected or
+ * disconnected; the multichannel output answers the supported rates from
+ * it and the supported channels from what it read when it was opened.
+ */
+static void test_edid_cache(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_device *adev;
+    struct audio_stream_out *out;
+    struct mixer_ctl *ctl;
+    unsigned char edid[3];
+    char value[256];
+    uint32_t reads, invalidations;
+
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+    adev = (struct audio_device *)dev;
+    set_hdmi_channels(adev, 6);
+    sim_test_set_parameters(dev, "disconnect=%u", AUDIO_DEVICE_OUT_AUX_DIGITAL);
+    reads = adev->edid.reads;
+
+    out = open_multi_ch(dev, AUDIO_CHANNEL_OUT_5POINT1);
+    if (out == NULL)
+        goto done;
+    SIM_CHECK_EQ(adev->edid.reads, reads + 1);
+    out_parameter(out, AUDIO_PARAMETER_STREAM_SUP_CHANNELS, value,
+                  sizeof(value));
+    SIM_CHECK(!strcmp(value, "AUDIO_CHANNEL_OUT_5POINT1"));
+    out_parameter(out, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES, value,
+                  sizeof(value));
+    SIM_CHECK(!strcmp(value, "32000|44100|48000"));
+    SIM_CHECK_EQ(adev->edid.reads, reads + 1);
+    dev->close_output_stream(dev, out);
+
+    /* a new sink: 7.1 up to 192 kHz, only seen once it is connected */
+    ctl = mixer_get_ctl_by_name(adev->mixer, "HDMI EDID");
+    edid[0] = (1 << 3) | 7;
+    edid[1] = 0x7f;
+    edid[2] = 0x01;
+    if (ctl != NULL)
+        mixer_ctl_set_array(ctl, edid, sizeof(edid));
+    out = open_multi_ch(dev, AUDIO_CHANNEL_OUT_5POINT1);
+    if (out == NULL)
+        goto done;
+    out_parameter(out, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES, value,
+                  sizeof(value));
+    SIM_CHECK(!strcmp(value, "32000|44100|48000"));
+    dev->close_output_stream(dev, out);
+
+    invalidations = adev->edid.invalidations;
+    sim_test_set_parameters(dev, "connect=%u", AUDIO_DEVICE_OUT_AUX_DIGITAL);
+    SIM_CHECK_EQ(adev->edid.invalidations, invalidations + 1);
+    SIM_CHECK(!adev->edid.valid);
+    out = open_multi_ch(dev, AUDIO_CHANNEL_OUT_7POINT1);
+    if (out == NULL)
+        goto done;
+    SIM_CHECK_EQ(adev->edid.reads, reads + 2);
+    out_parameter(out, AUDIO_PARAMETER_STREAM_SUP_CHANNELS, value,
+                  sizeof(value));
+    SIM_CHECK(!strcmp(value,
+                      "AUDIO_CHANNEL_OUT_5POINT1|AUDIO_CHANNEL_OUT_7POINT1"));
+    out_parameter(out, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES, value,
+                  sizeof(value));
+    SIM_CHECK(!strcmp(value,
+                      "32000|44100|48000|88200|96000|176400|192000"));
+    dev->close_output_stream(dev, out);
+
+    /* other devices leave the cache alone, disconnecting HDMI drops it */
+    sim_test_set_parameters(dev, "connect=%u", AUDIO_DEVICE_OUT_WIRED_HEADSET);
+    SIM_CHECK(adev->edid.valid);
+    sim_test_set_parameters(dev, "disconnect=%u", AUDIO_DEVICE_OUT_AUX_DIGITAL);
+    SIM_CHECK_EQ(adev->edid.invalidations, invalidations + 2);
+    SIM_CHECK(!adev->edid.valid);
+
+done:
+    set_hdmi_channels(adev, 2);
+    sim_test_close_device(dev);
+}
+
+#define STRESS_CYCLES       200
+#define STRESS_IO_PER_CYCLE 4
+
+struct stress_stream {
+    const char *name;
+    struct audio_stream_out *out;
+    struct audio_stream_in *in;
+    struct sim_samples resume;  /* first write or read after standby */
+    int errors;
+};
+
+static void *stress_loop(void *context)
+{
+    struct stress_stream *s = context;
+    struct audio_stream *common = s->out ? &s->out->common : &s->in->common;
+    size_t bytes = common->get_buffer_size(common);
+    void *buf = calloc(1, bytes);
+    int64_t start_ns;
+    ssize_t ret;
+    int i, j;
+
+    for (i = 0; i < STRESS_CYCLES && buf != NULL; i++) {
+        for (j = 0; j < STRESS_IO_PER_CYCLE; j++) {
+            start_ns = sim_test_now_ns();
+            if (s->out)
+                ret = s->out->write(s->out, buf, bytes);
+            else
+                ret = s->in->read(s->in, buf, bytes);
+            if (j == 0)
+                sim_samples_add(&s->resume, sim_test_now_ns() - start_ns);
+            if (ret != (ssize_t)bytes)
+                s->errors++;
+        }
+        common->standby(common);
+    }
+    free(buf);
+    return NULL;
+}
+
+/*
+ * Deep buffer and low latency playback and a recording, each leaving
+ * standby and going back to it in its own thread while a fourth thread
+ * reroutes the deep buffer output: the time to the first buffer after
+ * standby, which waited behind the others' routing and PCM opens. A read
+ * also waits for a period to be captured.
+ */
+static void bench_standby_exit_stress(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_device *adev = (struct audio_device *)dev;
+    struct stress_stream streams[3];
+    struct audio_config config;
+    struct sim_samples all;
+    pthread_t threads[3];
+    unsigned int i, n;
+
+    if (dev == NULL)
+        return;
+    /* the threads only contend on the real clock */
+    if (!sim_test_on_clock("real")) {
+        sim_test_close_device(dev);
+        return;
+    }
+    memset(streams, 0, sizeof(streams));
+    sim_test_pcm_config(&config);
+    streams[0].name = "deep buffer resume";
+    streams[0].out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                                          AUDIO_DEVICE_OUT_SPEAKER, &config);
+    streams[1].name = "low latency resume";
+    streams[1].out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_FAST,
+                                          AUDIO_DEVICE_OUT_SPEAKER, &config);
+    config.channel_mask = AUDIO_CHANNEL_IN_MONO;
+    streams[2].name = "record resume";
+    streams[2].in = sim_test_open_input(dev, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                                        AUDIO_SOURCE_MIC, &config);
+    if (!streams[0].out || !streams[1].out || !streams[2].in)
+        goto done;
+
+    for (i = 0; i < 3; i++) {
+        sim_samples_init(&streams[i].resume, STRESS_CYCLES);
+        pthread_create(&threads[i], NULL, stress_loop, &streams[i]);
+    }
+    for (i = 0; i < STRESS_CYCLES; i++)
+        streams[0].out->common.set_parameters(&streams[0].out->common,
+                (i & 1) ? "routing=2" : "routing=8");
+    for (i = 0; i < 3; i++)
+        pthread_join(threads[i], NULL);
+
+    sim_samples_init(&all, 3 * STRESS_CYCLES);
+    for (i = 0; i < 3; i++) {
+        for (n = 0; n < streams[i].resume.count; n++)
+            sim_samples_add(&all, streams[i].resume.ns[n]);
+        sim_samples_report(&streams[i].resume, streams[i].name);
+        SIM_CHECK_EQ(streams[i].errors, 0);
+        sim_samples_free(&streams[i].resume);
+    }
+    sim_samples_report(&all, "any resume");
+    sim_samples_free(&all);
+    SIM_CHECK(active_input(adev) == NULL);
+
+done:
+    if (streams[2].in != NULL)
+        dev->close_input_stream(dev, streams[2].in);
+    for (i = 0; i < 2; i++) {
+        if (streams[i].out != NULL)
+            dev->close_output_stream(dev, streams[i].out);
+    }
+    sim_test_close_device(dev);
+}
+
+#define GAIN_WRITES         500
+
+/*
+ * Thread CPU time of multichannel writes at unity gain, which hands the
+ * client buffer straight to the PCM, at a settled gain and ramping between
+ * two gains on every buffer, in samples per second on the virtual clock.
+ */
+static void bench_multi_ch_gain(void)
+{
+    static const audio_channel_mask_t masks[] = {
+        AUDIO_CHANNEL_OUT_5POINT1, AUDIO_CHANNEL_OUT_7POINT1,
+    };
+    static const char *const modes[] = { "unity", "settled", "ramp" };
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    double msamples[3];
+    int64_t start_ns;
+    size_t bytes;
+    unsigned int i, m, n;
+    void *buf;
+
+    if (!sim_test_on_clock("virtual"))
+        return;
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+    set_hdmi_channels((struct audio_device *)dev, 8);
+    for (i = 0; i < sizeof(masks) / sizeof(masks[0]); i++) {
+        out = open_multi_ch(dev, masks[i]);
+        if (out == NULL)
+            break;
+        bytes = out->common.get_buffer_size(&out->common);
+        buf = calloc(1, bytes);
+        for (m = 0; m < 3; m++) {
+            out->set_volume(out, m ? 0.5f : 1.0f, 0.0f);
+            out->write(out, buf, bytes);
+            start_ns = sim_test_thread_cpu_ns();
+            for (n = 0; n < GAIN_WRITES; n++) {
+                if (m == 2)
+                    out->set_volume(out, (n & 1) ? 0.5f : 0.25f, 0.0f);
+                out->write(out, buf, bytes);
+            }
+            msamples[m] = (double)GAIN_WRITES * (bytes / sizeof(int16_t)) *
+                    1000.0 / (double)(sim_test_thread_cpu_ns() - start_ns);
+        }
+        printf("  %u channels, Msamples/s:",
+               audio_channel_count_from_out_mask(masks[i]));
+        for (m = 0; m < 3; m++)
+            printf(" %s %.0f", modes[m], msamples[m]);
+        printf("\n");
+        free(buf);
+        dev->close_output_stream(dev, out);
+    }
+    set_hdmi_channels((struct audio_device *)dev, 2);
+    sim_test_close_device(dev);
+}
+
+/* warm standby is read at adev_open(), a cold device first */
+static struct stream_out *open_deep_buffer(struct audio_hw_device **dev,
+                                           const char *warm_standby_ms)
+{
+    struct audio_stream_out *out;
+    struct audio_config config;
+
+    sim_test_set_config("audio_hal.warm_standby_ms", warm_standby_ms);
+    *dev = sim_test_open_device();
+    if (*dev == NULL)
+        return NULL;
+    sim_test_pcm_config(&config);
+    out = sim_test_open_output(*dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                               AUDIO_DEVICE_OUT_SPEAKER, &config);
+    if (out == NULL) {
+        sim_test_close_device(*dev);
+        *dev = NULL;
+    }
+    return (struct stream_out *)out;
+}
+
+/*
+ * A warm standby keeps the PCM prepared for the next write, a second
+ * standby really stops it, and warm_up prepares a stream ahead of the write.
+ */
+static void test_warm_standby(void)
+{
+    struct audio_hw_device *dev;
+    struct stream_out *out = open_deep_buffer(&dev, "10000");
+    struct audio_stream_out *stream;
+    size_t bytes;
+    void *buf;
+    int i;
+
+    if (out == NULL)
+        return;
+    stream = &out->stream;
+    bytes = stream->common.get_buffer_size(&stream->common);
+    buf = calloc(1, bytes);
+
+    SIM_CHECK_EQ(stream->write(stream, buf, bytes), bytes);
+    SIM_CHECK_EQ(out->cold_resumes, 1);
+    stream->common.standby(&stream->common);
+    SIM_CHECK(out->standby && out->warm && out->pcm != NULL);
+    SIM_CHECK_EQ(stream->write(stream, buf, bytes), bytes);
+    SIM_CHECK_EQ(out->warm_resumes, 1);
+    SIM_CHECK(!out->warm);
+
+    stream->common.standby(&stream->common);
+    stream->common.standby(&stream->common);
+    SIM_CHECK(out->standby && !out->warm && out->pcm == NULL);
+
+    SIM_CHECK_EQ(stream->common.set_parameters(&stream->common, "warm_up=1"), 0);
+    for (i = 0; i < 1000; i++) {
+        pthread_mutex_lock(&out->lock);
+        if (out->warm) {
+            pthread_mutex_unlock(&out->lock);
+            break;
+        }
+        pthread_mutex_unlock(&out->lock);
+        usleep(1000);
+    }
+    SIM_CHECK(out->warm && out->pcm != NULL);
+    SIM_CHECK_EQ(stream->write(stream, buf, bytes), bytes);
+    SIM_CHECK_EQ(out->warm_resumes, 2);
+    SIM_CHECK_EQ(out->cold_resumes, 1);
+    free(buf);
+
+    dev->close_output_stream(dev, stream);
+    sim_test_close_device(dev);
+}
+
+#define WARM_CYCLES         200
+
+/*
+ * The time from the start of the first write after standby until the
+ * driver accepted it, on the deep buffer output, without and with warm
+ * standby. Control writes and ACDB fetches cost what they do on a device.
+ */
+static void bench_warm_standby_exit(void)
+{
+    static const char *const warm_standby_ms[] = { "0", "1000" };
+    struct audio_hw_device *dev;
+    struct stream_out *out;
+    struct audio_stream_out *stream;
+    struct sim_samples samples;
+    int64_t start_ns;
+    size_t bytes;
+    unsigned int i, n;
+    void *buf;
+
+    sim_test_set_config("audio.sim.ctl_write_us", "50");
+    for (i = 0; i < 2; i++) {
+        out = open_deep_buffer(&dev, warm_standby_ms[i]);
+        if (out == NULL)
+            return;
+        stream = &out->stream;
+        bytes = stream->common.get_buffer_size(&stream->common);
+        buf = calloc(1, bytes);
+        sim_samples_init(&samples, WARM_CYCLES);
+        /* the first write of the stream is always cold */
+        stream->write(stream, buf, bytes);
+        stream->common.standby(&stream->common);
+        for (n = 0; n < WARM_CYCLES; n++) {
+            start_ns = sim_clock_now_ns();
+            SIM_CHECK_EQ(stream->write(stream, buf, bytes), bytes);
+            sim_samples_add(&samples, sim_clock_now_ns() - start_ns);
+            stream->common.standby(&stream->common);
+        }
+        SIM_CHECK_EQ(out->warm_resumes, (i ? WARM_CYCLES : 0));
+        sim_samples_report(&samples, i ? "warm standby exit" : "cold standby exit");
+        sim_samples_free(&samples);
+        free(buf);
+        dev->close_output_stream(dev, stream);
+        sim_test_close_device(dev);
+    }
+}
+
+const struct sim_test sim_stream_tests[] = {
+    SIM_TEST(test_input_busy_usecase),
+    SIM_TEST(test_capture_overrun),
+    SIM_TEST(test_multi_ch_mute_reroute),
+    SIM_TEST(test_edid_cache),
+    SIM_TEST(test_warm_standby),
+    SIM_BENCH(bench_standby_exit_stress),
+    SIM_BENCH(bench_multi_ch_gain),
+    SIM_BENCH(bench_warm_standby_exit),
+    SIM_TEST_END
+};
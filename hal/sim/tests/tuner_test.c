@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cutils/properties.h>
+
+#include "sim.h"
+#include "sim_test.h"
+
+/* a standby that hangs kills the run rather than blocking it */
+#define TUNER_WATCHDOG_S    10
+/* a deep buffer session long enough to count, on the virtual clock */
+#define TUNER_SESSION_MS    2200
+/* the deep buffer output moves to longer periods within this many */
+#define TUNER_MAX_SESSIONS  8
+#define TUNER_FILE_MAGIC    0x50545531
+
+struct tuner_counts {
+    unsigned int moves;
+    unsigned int saves;
+};
+
+/* the counters from the period tuner line of the device dump */
+static struct tuner_counts tuner_counts(struct audio_hw_device *dev)
+{
+    struct tuner_counts counts = { 0, 0 };
+    char line[256];
+    FILE *fp = tmpfile();
+
+    if (fp == NULL)
+        return counts;
+    dev->dump(dev, fileno(fp));
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, " period tuner: %u level changes, %u saves",
+                   &counts.moves, &counts.saves) == 2)
+            break;
+    }
+    fclose(fp);
+    return counts;
+}
+
+/*
+ * Plays deep buffer sessions on devices until the tuner moves the output
+ * to another level, each standby under the watchdog. False if it never did.
+ */
+static bool run_until_move(struct audio_hw_device *dev, audio_devices_t devices)
+{
+    struct audio_stream_out *out;
+    struct audio_config config;
+    unsigned int moves = tuner_counts(dev).moves;
+    unsigned int i, n, writes;
+    size_t bytes;
+    bool moved = false;
+    void *buf;
+
+    sim_test_pcm_config(&config);
+    out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY, devices, &config);
+    if (out == NULL)
+        return false;
+    bytes = out->common.get_buffer_size(&out->common);
+    buf = calloc(1, bytes);
+    /* stereo 16 bit buffers */
+    writes = TUNER_SESSION_MS * config.sample_rate / 1000 /
+             (bytes / (2 * sizeof(int16_t))) + 1;
+    for (i = 0; i < TUNER_MAX_SESSIONS && !moved; i++) {
+        for (n = 0; n < writes; n++)
+            out->write(out, buf, bytes);
+        alarm(TUNER_WATCHDOG_S);
+        out->common.standby(&out->common);
+        alarm(0);
+        moved = tuner_counts(dev).moves != moves;
+    }
+    free(buf);
+    dev->close_output_stream(dev, out);
+    return moved;
+}
+
+static bool wait_saves(struct audio_hw_device *dev, unsigned int saves, int ms)
+{
+    for (; ms > 0; ms--) {
+        if (tuner_counts(dev).saves > saves)
+            return true;
+        usleep(1000);
+    }
+    return false;
+}
+
+static bool skip_on_real_clock(void)
+{
+    return !sim_test_on_clock("virtual");
+}
+
+static void tuner_paths(char *path, size_t size, char *tmp, const char *name)
+{
+    const char *dir = getenv("TMPDIR");
+
+    snprintf(path, size, "%s/%s", dir ? dir : "/tmp", name);
+    snprintf(tmp, size + 4, "%s.tmp", path);
+    unlink(path);
+    unlink(tmp);
+    sim_test_set_config("audio.sim.period_tuner_file", path);
+}
+
+/* what was learned is written to the file, by way of a synced temporary */
+static void test_period_tuner_save(void)
+{
+    char path[PROPERTY_VALUE_MAX - 4], tmp[PROPERTY_VALUE_MAX];
+    struct audio_hw_device *dev;
+    unsigned int saves;
+    uint32_t magic = 0;
+    FILE *fp;
+
+    if (skip_on_real_clock())
+        return;
+    tuner_paths(path, sizeof(path), tmp, "audio_sim_period_tuner.bin");
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        return;
+
+    saves = tuner_counts(dev).saves;
+    SIM_CHECK(run_until_move(dev, AUDIO_DEVICE_OUT_WIRED_HEADPHONE));
+    SIM_CHECK(wait_saves(dev, saves, 2000));
+    fp = fopen(path, "rb");
+    SIM_CHECK(fp != NULL);
+    if (fp != NULL) {
+        SIM_CHECK_EQ(fread(&magic, sizeof(magic), 1, fp), 1);
+        SIM_CHECK_EQ(magic, TUNER_FILE_MAGIC);
+        fclose(fp);
+    }
+    SIM_CHECK(access(tmp, F_OK) != 0);
+
+    sim_test_close_device(dev);
+    unlink(path);
+}
+
+/*
+ * The standby that moves a level returns while the file is still being
+ * written: a FIFO in place of the temporary file blocks the writer until
+ * it is read.
+ */
+static void test_period_tuner_save_off_standby(void)
+{
+    char path[PROPERTY_VALUE_MAX - 4], tmp[PROPERTY_VALUE_MAX];
+    struct audio_hw_device *dev;
+    unsigned int saves;
+    char buf[4096];
+    int fd, i;
+
+    if (skip_on_real_clock())
+        return;
+    tuner_paths(path, sizeof(path), tmp, "audio_sim_period_tuner_fifo.bin");
+    if (mkfifo(tmp, 0600) != 0) {
+        sim_test_fail(__FILE__, __LINE__, "mkfifo: %s", strerror(errno));
+        return;
+    }
+    dev = sim_test_open_device();
+    if (dev == NULL)
+        goto done;
+
+    saves = tuner_counts(dev).saves;
+    SIM_CHECK(run_until_move(dev, AUDIO_DEVICE_OUT_SPEAKER |
+                                  AUDIO_DEVICE_OUT_WIRED_HEADPHONE));
+    /* the writer is still waiting for a reader */
+    usleep(20000);
+    SIM_CHECK_EQ(tuner_counts(dev).saves, saves);
+    SIM_CHECK(access(tmp, F_OK) == 0);
+
+    /* let the writer through; a FIFO cannot be synced, so it gives up */
+    fd = open(tmp, O_RDONLY | O_NONBLOCK);
+    SIM_CHECK(fd >= 0);
+    for (i = 0; i < 2000 && access(tmp, F_OK) == 0; i++) {
+        if (fd >= 0)
+            while (read(fd, buf, sizeof(buf)) > 0)
+                ;
+        usleep(1000);
+    }
+    SIM_CHECK(access(tmp, F_OK) != 0);
+    SIM_CHECK(access(path, F_OK) != 0);
+    if (fd >= 0)
+        close(fd);
+
+    sim_test_close_device(dev);
+done:
+    unlink(tmp);
+}
+
+const struct sim_test sim_tuner_tests[] = {
+    SIM_TEST(test_period_tuner_save),
+    SIM_TEST(test_period_tuner_save_off_standby),
+    SIM_TEST_END
+};
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_hw.h"
+#include "platform.h"
+#include "sim_test.h"
+
+static void fake_usecase(struct audio_usecase *uc, audio_usecase_t id,
+                         usecase_type_t type, audio_devices_t devices,
+                         snd_device_t out_snd_device,
+                         snd_device_t in_snd_device)
+{
+    memset(uc, 0, sizeof(*uc));
+    uc->id = id;
+    uc->type = type;
+    uc->devices = devices;
+    uc->out_snd_device = out_snd_device;
+    uc->in_snd_device = in_snd_device;
+}
+
+static int list_position(struct audio_device *adev, struct audio_usecase *uc)
+{
+    struct listnode *node;
+    int pos = 0;
+
+    list_for_each(node, &adev->usecase_list) {
+        if (node_to_item(node, struct audio_usecase, list) == uc)
+            return pos;
+        pos++;
+    }
+    return -1;
+}
+
+/* the list keeps insertion order, lookups find the first usecase of an id */
+static void test_usecase_list_index(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_device *adev = (struct audio_device *)dev;
+    struct audio_usecase deep, fast, dup;
+
+    if (dev == NULL)
+        return;
+
+    fake_usecase(&deep, USECASE_AUDIO_PLAYBACK_DEEP_BUFFER, PCM_PLAYBACK,
+                 AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER,
+                 SND_DEVICE_NONE);
+    fake_usecase(&fast, USECASE_AUDIO_PLAYBACK_LOW_LATENCY, PCM_PLAYBACK,
+                 AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER,
+                 SND_DEVICE_NONE);
+    fake_usecase(&dup, USECASE_AUDIO_PLAYBACK_DEEP_BUFFER, PCM_PLAYBACK,
+                 AUDIO_DEVICE_OUT_WIRED_HEADPHONE, SND_DEVICE_OUT_HEADPHONES,
+                 SND_DEVICE_NONE);
+
+    pthread_mutex_lock(&adev->lock);
+    usecase_list_add(adev, &fast);
+    usecase_list_add(adev, &deep);
+    usecase_list_add(adev, &dup);
+    SIM_CHECK_EQ(list_position(adev, &fast), 0);
+    SIM_CHECK_EQ(list_position(adev, &deep), 1);
+    SIM_CHECK_EQ(list_position(adev, &dup), 2);
+    SIM_CHECK(get_usecase_from_list(adev, deep.id) == &deep);
+    SIM_CHECK(get_usecase_from_list(adev, fast.id) == &fast);
+    SIM_CHECK(adev->usecases.by_out_snd_device[SND_DEVICE_OUT_SPEAKER] ==
+              (USECASE_BIT(deep.id) | USECASE_BIT(fast.id)));
+
+    /* the duplicate takes over the id when the first goes */
+    usecase_list_remove(adev, &deep);
+    SIM_CHECK(get_usecase_from_list(adev, deep.id) == &dup);
+    SIM_CHECK(adev->usecases.by_out_snd_device[SND_DEVICE_OUT_HEADPHONES] ==
+              USECASE_BIT(dup.id));
+    SIM_CHECK(adev->usecases.by_out_snd_device[SND_DEVICE_OUT_SPEAKER] ==
+              USECASE_BIT(fast.id));
+
+    usecase_list_remove(adev, &dup);
+    usecase_list_remove(adev, &fast);
+    SIM_CHECK(list_empty(&adev->usecase_list));
+    SIM_CHECK_EQ(adev->usecases.by_type[PCM_PLAYBACK], 0);
+    SIM_CHECK_EQ(adev->usecases.codec_backend, 0);
+    SIM_CHECK_EQ(adev->usecases.by_out_snd_device[SND_DEVICE_OUT_SPEAKER], 0);
+    pthread_mutex_unlock(&adev->lock);
+
+    sim_test_close_device(dev);
+}
+
+/*
+ * During a call, playback takes the sound devices of the voice session
+ * started first, as with the list walk, not of the lowest usecase id.
+ */
+static void test_voice_usecase_first_started(void)
+{
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_device *adev = (struct audio_device *)dev;
+    struct audio_stream_out *out;
+    struct audio_usecase voice, voice2;
+    struct audio_usecase *uc;
+    struct audio_config config;
+    size_t bytes;
+    void *buf;
+
+    if (dev == NULL)
+        return;
+
+    fake_usecase(&voice2, USECASE_VOICE2_CALL, VOICE_CALL,
+                 AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_VOICE_SPEAKER,
+                 SND_DEVICE_IN_VOICE_SPEAKER_MIC);
+    fake_usecase(&voice, USECASE_VOICE_CALL, VOICE_CALL,
+                 AUDIO_DEVICE_OUT_EARPIECE, SND_DEVICE_OUT_VOICE_HANDSET,
+                 SND_DEVICE_IN_HANDSET_MIC);
+    pthread_mutex_lock(&adev->lock);
+    usecase_list_add(adev, &voice2);
+    usecase_list_add(adev, &voice);
+    adev->voice.in_call = true;
+    pthread_mutex_unlock(&adev->lock);
+
+    sim_test_pcm_config(&config);
+    out = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                               AUDIO_DEVICE_OUT_SPEAKER, &config);
+    if (out != NULL) {
+        bytes = out->common.get_buffer_size(&out->common);
+        buf = calloc(1, bytes);
+        SIM_CHECK_EQ(out->write(out, buf, bytes), bytes);
+        free(buf);
+
+        pthread_mutex_lock(&adev->lock);
+        uc = get_usecase_from_list(adev, ((struct stream_out *)out)->usecase);
+        SIM_CHECK(uc != NULL);
+        if (uc != NULL)
+            SIM_CHECK_EQ(uc->out_snd_device, SND_DEVICE_OUT_VOICE_SPEAKER);
+        pthread_mutex_unlock(&adev->lock);
+        out->common.standby(&out->common);
+    }
+
+    pthread_mutex_lock(&adev->lock);
+    adev->voice.in_call = false;
+    usecase_list_remove(adev, &voice);
+    usecase_list_remove(adev, &voice2);
+    pthread_mutex_unlock(&adev->lock);
+    if (out != NULL)
+        dev->close_output_stream(dev, out);
+    sim_test_close_device(dev);
+}
+
+/* what get_usecase_from_list() did before the index */
+static struct audio_usecase *walk_usecase_list(struct audio_device *adev,
+                                               audio_usecase_t uc_id)
+{
+    struct audio_usecase *usecase;
+    struct listnode *node;
+
+    list_for_each(node, &adev->usecase_list) {
+        usecase = node_to_item(node, struct audio_usecase, list);
+        if (usecase->id == uc_id)
+            return usecase;
+    }
+    return NULL;
+}
+
+#define ROUTING_LOOKUPS     1000000
+#define ROUTING_SWITCHES    2000
+
+/*
+ * Usecase lookups with a busy list, and routing switches of a deep buffer
+ * output while low latency playback and a recording share the backend.
+ */
+static void bench_routing(void)
+{
+    static const audio_usecase_t ids[] = {
+        USECASE_AUDIO_PLAYBACK_DEEP_BUFFER, USECASE_AUDIO_PLAYBACK_LOW_LATENCY,
+        USECASE_AUDIO_PLAYBACK_OFFLOAD, USECASE_AUDIO_RECORD,
+        USECASE_VOICE_CALL, USECASE_AUDIO_PLAYBACK_MULTI_CH,
+    };
+    struct audio_hw_device *dev = sim_test_open_device();
+    struct audio_device *adev = (struct audio_device *)dev;
+    struct audio_usecase fakes[8];
+    struct audio_stream_out *deep, *fast;
+    struct audio_stream_in *in;
+    struct audio_config config;
+    struct sim_samples samples;
+    volatile uintptr_t sink = 0;
+    int64_t start_ns, index_ns, walk_ns;
+    size_t i, bytes;
+    void *buf;
+
+    if (dev == NULL)
+        return;
+
+    /* lookups, the id looked for being last in the list half of the time */
+    pthread_mutex_lock(&adev->lock);
+    for (i = 0; i < 6; i++) {
+        fake_usecase(&fakes[i], ids[i], PCM_PLAYBACK, AUDIO_DEVICE_OUT_SPEAKER,
+                     SND_DEVICE_OUT_SPEAKER, SND_DEVICE_NONE);
+        usecase_list_add(adev, &fakes[i]);
+    }
+    start_ns = sim_test_now_ns();
+    for (i = 0; i < ROUTING_LOOKUPS; i++)
+        sink += (uintptr_t)get_usecase_from_list(adev, ids[(i & 1) ? 5 : 0]);
+    index_ns = sim_test_now_ns() - start_ns;
+    start_ns = sim_test_now_ns();
+    for (i = 0; i < ROUTING_LOOKUPS; i++)
+        sink += (uintptr_t)walk_usecase_list(adev, ids[(i & 1) ? 5 : 0]);
+    walk_ns = sim_test_now_ns() - start_ns;
+    for (i = 0; i < 6; i++)
+        usecase_list_remove(adev, &fakes[i]);
+    pthread_mutex_unlock(&adev->lock);
+    printf("  usecase lookup, 6 active: index %.1f ns, list walk %.1f ns\n",
+           (double)index_ns / ROUTING_LOOKUPS, (double)walk_ns / ROUTING_LOOKUPS);
+
+    sim_test_pcm_config(&config);
+    deep = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_PRIMARY,
+                                AUDIO_DEVICE_OUT_SPEAKER, &config);
+    fast = sim_test_open_output(dev, AUDIO_OUTPUT_FLAG_FAST,
+                                AUDIO_DEVICE_OUT_SPEAKER, &config);
+    config.channel_mask = AUDIO_CHANNEL_IN_MONO;
+    in = sim_test_open_input(dev, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                             AUDIO_SOURCE_MIC, &config);
+    if (deep == NULL || fast == NULL || in == NULL)
+        goto done;
+
+    bytes = deep->common.get_buffer_size(&deep->common);
+    buf = calloc(1, bytes);
+    deep->write(deep, buf, bytes);
+    fast->write(fast, buf, fast->common.get_buffer_size(&fast->common));
+    in->read(in, buf, in->common.get_buffer_size(&in->common));
+    free(buf);
+
+    sim_samples_init(&samples, ROUTING_SWITCHES);
+    for (i = 0; i < ROUTING_SWITCHES; i++) {
+        start_ns = sim_test_now_ns();
+        SIM_CHECK(deep->common.set_parameters(&deep->common, (i & 1) ?
+                  "routing=2" : "routing=8") == 0);
+        sim_samples_add(&samples, sim_test_now_ns() - start_ns);
+    }
+    sim_samples_report(&samples, "routing switch, 3 streams active");
+    sim_samples_free(&samples);
+
+done:
+    if (in != NULL)
+        dev->close_input_stream(dev, in);
+    if (fast != NULL)
+        dev->close_output_stream(dev, fast);
+    if (deep != NULL)
+        dev->close_output_stream(dev, deep);
+    sim_test_close_device(dev);
+}
+
+const struct sim_test sim_usecase_tests[] = {
+    SIM_TEST(test_usecase_list_index),
+    SIM_TEST(test_voice_usecase_first_started),
+    SIM_BENCH(bench_routing),
+    SIM_TEST_END
+};
@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_snd_card"
+/*#define LOG_NDEBUG 0*/
+#define LOG_NDDEBUG 0
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "snd_card.h"
+
+#ifdef AUDIO_SIMULATOR_ENABLED
+#include "sim/sim.h"
+#endif
+
+/*
+ * Cards are taken from /proc/asound/cards, which lists every card ALSA has
+ * registered, rather than by trying mixer_open() on each number in turn, so a
+ * missing card costs nothing. A card registered late, as when the ADSP boots
+ * after the HAL, shows up as its control node being created in /dev/snd:
+ * that is watched with inotify instead of sleeping between retries.
+ */
+#define SND_CARDS_PATH      "/proc/asound/cards"
+#define SND_DEV_DIR         "/dev/snd"
+#define SND_DEV_EVENTS      (IN_CREATE | IN_ATTRIB | IN_MOVED_TO)
+#define SND_CARDS_SIZE      4096
+#define SND_CARD_NAME_MAX   80
+#define SND_CARD_BITS       32
+/* only when inotify is not available */
+#define SND_CARD_POLL_MS    100
+
+struct snd_card_watch {
+    int fd;
+    bool dev_snd;   /* watching /dev/snd, rather than /dev until it exists */
+};
+
+#ifdef AUDIO_SIMULATOR_ENABLED
+/* the simulated card registers on the simulator clock and has no nodes */
+static int64_t snd_card_now_ns(void)
+{
+    return sim_clock_now_ns();
+}
+
+static int snd_card_read_list(char *buf, size_t size)
+{
+    return sim_snd_card_list(buf, size);
+}
+
+static bool snd_card_node_ready(int card __unused)
+{
+    return true;
+}
+
+static void snd_card_watch_open(struct snd_card_watch *watch)
+{
+    watch->fd = -1;
+    watch->dev_snd = false;
+}
+
+static void snd_card_watch_wait(struct snd_card_watch *watch __unused,
+                                int64_t until_ns)
+{
+    sim_snd_card_wait(until_ns);
+}
+#else
+static int64_t snd_card_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int snd_card_read_list(char *buf, size_t size)
+{
+    size_t len = 0;
+    ssize_t ret;
+    int fd;
+
+    fd = open(SND_CARDS_PATH, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("%s: cannot open %s: %s", __func__, SND_CARDS_PATH,
+              strerror(errno));
+        return -errno;
+    }
+    /* procfs files report no size, read until EOF */
+    while (len < size - 1) {
+        ret = read(fd, buf + len, size - 1 - len);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        len += ret;
+    }
+    close(fd);
+    buf[len] = '\0';
+    return len;
+}
+
+/* ueventd creates the node before it sets its owner and mode */
+static bool snd_card_node_ready(int card)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), SND_DEV_DIR "/controlC%d", card);
+    return access(path, R_OK | W_OK) == 0;
+}
+
+static void snd_card_watch_open(struct snd_card_watch *watch)
+{
+    watch->dev_snd = false;
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0) {
+        ALOGW("%s: inotify unavailable, polling: %s", __func__,
+              strerror(errno));
+        return;
+    }
+
+    if (inotify_add_watch(watch->fd, SND_DEV_DIR, SND_DEV_EVENTS) >= 0) {
+        watch->dev_snd = true;
+    } else if (inotify_add_watch(watch->fd, "/dev", IN_CREATE) < 0) {
+        ALOGW("%s: cannot watch %s, polling: %s", __func__, SND_DEV_DIR,
+              strerror(errno));
+        close(watch->fd);
+        watch->fd = -1;
+    }
+}
+
+/* sleeps until something changes in /dev/snd, or until until_ns */
+static void snd_card_watch_wait(struct snd_card_watch *watch, int64_t until_ns)
+{
+    char events[sizeof(struct inotify_event) * 8 + NAME_MAX + 1]
+            __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd;
+    int64_t ms;
+
+    ms = (until_ns - snd_card_now_ns() + 999999) / 1000000;
+    if (ms <= 0)
+        return;
+
+    if (watch->fd < 0) {
+        usleep((ms < SND_CARD_POLL_MS ? ms : SND_CARD_POLL_MS) * 1000);
+        return;
+    }
+
+    pfd.fd = watch->fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, (int)ms) > 0) {
+        /* which node changed does not matter, the list is read again */
+        while (read(watch->fd, events, sizeof(events)) > 0)
+            ;
+    }
+
+    if (!watch->dev_snd &&
+            inotify_add_watch(watch->fd, SND_DEV_DIR, SND_DEV_EVENTS) >= 0)
+        watch->dev_snd = true;
+}
+#endif
+
+static void snd_card_watch_close(struct snd_card_watch *watch)
+{
+    if (watch->fd >= 0)
+        close(watch->fd);
+}
+
+/*
+ * Lines of /proc/asound/cards describing a card look like
+ *  0 [msm8974taikomtp]: msm8974-taiko-m - msm8974-taiko-mtp-snd-card
+ * followed by a line with the long name, which is skipped.
+ */
+static const char *snd_card_parse_line(const char *line, int *card,
+                                       char *name, size_t size)
+{
+    const char *end = strchr(line, '\n');
+    const char *p = line;
+    const char *sep;
+    size_t len;
+
+    if (end == NULL)
+        end = line + strlen(line);
+
+    *card = -1;
+    while (p < end && *p == ' ')
+        p++;
+    if (p == end || !isdigit((unsigned char)*p))
+        goto next;
+
+    sep = strstr(p, "]: ");
+    if (sep == NULL || sep > end)
+        goto next;
+    sep = strstr(sep, " - ");
+    if (sep == NULL || sep > end)
+        goto next;
+    sep += 3;
+
+    len = end - sep;
+    if (len >= size)
+        len = size - 1;
+    memcpy(name, sep, len);
+    name[len] = '\0';
+    *card = atoi(p);
+
+next:
+    return *end ? end + 1 : end;
+}
+
+int snd_card_discover(snd_card_match_t match, void *arg, int max_card)
+{
+    char value[PROPERTY_VALUE_MAX];
+    char name[SND_CARD_NAME_MAX];
+    struct snd_card_watch watch;
+    uint32_t offered = 0;
+    int64_t start_ns, until_ns;
+    const char *line;
+    char *list;
+    int card;
+    int ret = -ENODEV;
+
+    if (max_card > SND_CARD_BITS)
+        max_card = SND_CARD_BITS;
+
+    list = malloc(SND_CARDS_SIZE);
+    if (list == NULL)
+        return -ENOMEM;
+
+    property_get(SND_CARD_WAIT_PROPERTY, value, "");
+    start_ns = snd_card_now_ns();
+    until_ns = start_ns + (int64_t)(value[0] ? atoi(value) : SND_CARD_WAIT_MS) *
+                          1000000;
+
+    /* watched before the list is read so that no registration is missed */
+    snd_card_watch_open(&watch);
+
+    for (;;) {
+        if (snd_card_read_list(list, SND_CARDS_SIZE) < 0)
+            break;
+
+        for (line = list; *line; ) {
+            line = snd_card_parse_line(line, &card, name, sizeof(name));
+            if (card < 0 || card >= max_card || (offered & (1u << card)))
+                continue;
+            if (!snd_card_node_ready(card)) {
+                ALOGV("%s: card %d '%s' is not ready", __func__, card, name);
+                continue;
+            }
+
+            offered |= 1u << card;
+            if (match(card, name, arg)) {
+                ret = card;
+                goto done;
+            }
+        }
+
+        if (snd_card_now_ns() >= until_ns)
+            break;
+        snd_card_watch_wait(&watch, until_ns);
+    }
+
+done:
+    if (ret >= 0)
+        ALOGD("%s: card %d '%s' after %lld ms", __func__, ret, name,
+              (long long)((snd_card_now_ns() - start_ns) / 1000000));
+    else
+        ALOGE("%s: no matching sound card after %lld ms", __func__,
+              (long long)((snd_card_now_ns() - start_ns) / 1000000));
+    snd_card_watch_close(&watch);
+    free(list);
+    return ret;
+}
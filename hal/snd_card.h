@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2026 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SND_CARD_H
+#define SND_CARD_H
+
+#include <stdbool.h>
+
+/* how long to wait for a card that is not registered yet, in ms */
+#define SND_CARD_WAIT_PROPERTY      "audio_hal.snd_card_wait_ms"
+#define SND_CARD_WAIT_MS            5000
+
+/*
+ * Offers every sound card below max_card to match(), in card order, once the
+ * card is registered with ALSA and its control node can be opened. Cards that
+ * are not there yet are waited for without polling, for up to
+ * SND_CARD_WAIT_PROPERTY ms. name is the short name of the card, which is
+ * what mixer_get_name() reports.
+ *
+ * Returns the card match() accepted, or -ENODEV.
+ */
+typedef bool (*snd_card_match_t)(int card, const char *name, void *arg);
+
+int snd_card_discover(snd_card_match_t match, void *arg, int max_card);
+
+#endif /* SND_CARD_H */
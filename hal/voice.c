@@ -98,7 +98,7 @@ int voice_stop_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
     disable_snd_device(adev, uc_info->out_snd_device);
     disable_snd_device(adev, uc_info->in_snd_device);
 
-    list_remove(&uc_info->list);
+    usecase_list_remove(adev, uc_info);
     free(uc_info);
 
     ALOGD("%s: exit: status(%d)", __func__, ret);
@@ -134,7 +134,7 @@ int voice_start_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
     uc_info->in_snd_device = SND_DEVICE_NONE;
     uc_info->out_snd_device = SND_DEVICE_NONE;
 
-    list_add_tail(&adev->usecase_list, &uc_info->list);
+    usecase_list_add(adev, uc_info);
 
     select_devices(adev, usecase_id);
 
@@ -403,6 +403,23 @@ void voice_get_parameters(struct audio_device *adev,
     voice_extn_get_parameters(adev, query, reply);
 }
 
+/* keys consumed by voice_set_parameters(), see adev_set_parameters() */
+const char * const voice_parameter_keys[] = {
+#ifdef MULTI_VOICE_SESSION_ENABLED
+    AUDIO_PARAMETER_KEY_VSID,
+    AUDIO_PARAMETER_KEY_CALL_STATE,
+    AUDIO_PARAMETER_KEY_DEVICE_MUTE,
+    AUDIO_PARAMETER_KEY_DIRECTION,
+#endif
+#ifdef COMPRESS_VOIP_ENABLED
+    AUDIO_PARAMETER_KEY_VOIP_RATE,
+    AUDIO_PARAMETER_KEY_VOIP_DTX_MODE,
+#endif
+    AUDIO_PARAMETER_KEY_TTY_MODE,
+    AUDIO_PARAMETER_KEY_INCALLMUSIC,
+    NULL,
+};
+
 int voice_set_parameters(struct audio_device *adev, struct str_parms *parms)
 {
     char *str;
@@ -492,17 +509,17 @@ void voice_init(struct audio_device *adev)
 
 void voice_update_devices_for_all_voice_usecases(struct audio_device *adev)
 {
-    struct listnode *node;
+    usecase_mask_t voice = adev->usecases.by_type[VOICE_CALL];
     struct audio_usecase *usecase;
-
-    list_for_each(node, &adev->usecase_list) {
-        usecase = node_to_item(node, struct audio_usecase, list);
-        if (usecase->type == VOICE_CALL) {
-            ALOGV("%s: updating device for usecase:%s", __func__,
-                  use_case_table[usecase->id]);
-            usecase->stream.out = adev->current_call_output;
-            select_devices(adev, usecase->id);
-        }
+    int id;
+
+    for (; voice; voice &= voice - 1) {
+        id = __builtin_ctzll(voice);
+        usecase = adev->usecases.by_id[id];
+        ALOGV("%s: updating device for usecase:%s", __func__,
+              use_case_table[usecase->id]);
+        usecase->stream.out = adev->current_call_output;
+        select_devices(adev, usecase->id);
     }
 }
 
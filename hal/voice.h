@@ -78,6 +78,7 @@ int voice_stop_usecase(struct audio_device *adev, audio_usecase_t usecase_id);
 int voice_start_call(struct audio_device *adev);
 int voice_stop_call(struct audio_device *adev);
 int voice_set_parameters(struct audio_device *adev, struct str_parms *parms);
+extern const char * const voice_parameter_keys[];
 void voice_get_parameters(struct audio_device *adev, struct str_parms *query,
                           struct str_parms *reply);
 void voice_init(struct audio_device *adev);
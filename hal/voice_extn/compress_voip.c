@@ -66,8 +66,6 @@ struct voip_data {
 
 #define MODE_PCM                0xC
 
-#define AUDIO_PARAMETER_KEY_VOIP_RATE               "voip_rate"
-#define AUDIO_PARAMETER_KEY_VOIP_DTX_MODE           "dtx_on"
 #define AUDIO_PARAMETER_VALUE_VOIP_TRUE             "true"
 #define AUDIO_PARAMETER_KEY_VOIP_CHECK              "voip_flag"
 #define AUDIO_PARAMETER_KEY_VOIP_OUT_STREAM_COUNT   "voip_out_stream_count"
@@ -118,7 +116,7 @@ static int voip_set_volume(struct audio_device *adev, int volume)
     vol_index = (int)percent_to_index(volume, MIN_VOL_INDEX, MAX_VOL_INDEX);
     set_values[0] = vol_index;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -142,7 +140,7 @@ static int voip_set_mic_mute(struct audio_device *adev, bool state)
 
     if (adev->mode == AUDIO_MODE_IN_COMMUNICATION) {
         set_values[0] = state;
-        ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+        ctl = get_mixer_ctl(adev, mixer_ctl_name);
         if (!ctl) {
             ALOGE("%s: Could not get ctl for mixer cmd - %s",
                   __func__, mixer_ctl_name);
@@ -168,7 +166,7 @@ static int voip_set_mode(struct audio_device *adev, int format)
     ALOGD("%s: Derived mode = %d", __func__, mode);
 
     set_values[0] = mode;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
                __func__, mixer_ctl_name);
@@ -189,7 +187,7 @@ static int voip_set_rate(struct audio_device *adev, int rate)
     ALOGD("%s: enter, rate=%d", __func__, rate);
 
     set_values[0] = rate;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
                __func__, mixer_ctl_name);
@@ -210,7 +208,7 @@ static int voip_set_dtx(struct audio_device *adev, bool enable)
     ALOGD("%s: enter, enable=%d", __func__, enable);
 
     set_values[0] = enable;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = get_mixer_ctl(adev, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
                __func__, mixer_ctl_name);
@@ -255,7 +253,7 @@ static int voip_stop_call(struct audio_device *adev)
         disable_snd_device(adev, uc_info->out_snd_device);
         disable_snd_device(adev, uc_info->in_snd_device);
 
-        list_remove(&uc_info->list);
+        usecase_list_remove(adev, uc_info);
         free(uc_info);
         voip_data.sample_rate = 0;
     } else
@@ -295,7 +293,7 @@ static int voip_start_call(struct audio_device *adev,
         uc_info->in_snd_device = SND_DEVICE_NONE;
         uc_info->out_snd_device = SND_DEVICE_NONE;
 
-        list_add_tail(&adev->usecase_list, &uc_info->list);
+        usecase_list_add(adev, uc_info);
 
         select_devices(adev, USECASE_COMPRESS_VOIP_CALL);
 
@@ -507,6 +505,7 @@ int voice_extn_compress_voip_start_output_stream(struct stream_out *out)
     if (uc_info) {
         uc_info->stream.out = out;
         uc_info->devices = out->devices;
+        usecase_index_update(adev, uc_info);
     } else {
         ret = -EINVAL;
         ALOGE("%s: exit(%d): failed to get use case info", __func__, ret);
@@ -20,6 +20,13 @@
 #ifndef VOICE_EXTN_H
 #define VOICE_EXTN_H
 
+#define AUDIO_PARAMETER_KEY_VSID                "vsid"
+#define AUDIO_PARAMETER_KEY_CALL_STATE          "call_state"
+#define AUDIO_PARAMETER_KEY_DEVICE_MUTE         "device_mute"
+#define AUDIO_PARAMETER_KEY_DIRECTION           "direction"
+#define AUDIO_PARAMETER_KEY_VOIP_RATE           "voip_rate"
+#define AUDIO_PARAMETER_KEY_VOIP_DTX_MODE       "dtx_on"
+
 #ifdef MULTI_VOICE_SESSION_ENABLED
 int voice_extn_start_call(struct audio_device *adev);
 int voice_extn_stop_call(struct audio_device *adev);
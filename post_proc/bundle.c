@@ -70,6 +70,8 @@ struct listnode active_outputs_list;
  */
 pthread_mutex_t lock;
 
+/* sound card of the audio HAL, see offload_effects_bundle_hal_set_snd_card() */
+static int snd_card = SOUND_CARD;
 
 /*
  *  Local functions
@@ -181,6 +183,19 @@ bool effects_enabled()
 /*
  * Interface from audio HAL
  */
+
+/* called by the HAL with the card it discovered, before any output starts */
+__attribute__ ((visibility ("default")))
+void offload_effects_bundle_hal_set_snd_card(int card)
+{
+    if (lib_init() != 0)
+        return;
+
+    pthread_mutex_lock(&lock);
+    snd_card = card;
+    pthread_mutex_unlock(&lock);
+}
+
 __attribute__ ((visibility ("default")))
 int offload_effects_bundle_hal_start_output(audio_io_handle_t output, int pcm_id)
 {
@@ -213,7 +228,7 @@ int offload_effects_bundle_hal_start_output(audio_io_handle_t output, int pcm_id
     /* populate the mixer control to send offload parameters */
     snprintf(mixer_string, sizeof(mixer_string),
              "%s %d", "Audio Effects Config", out_ctxt->pcm_device_id);
-    out_ctxt->mixer = mixer_open(MIXER_CARD);
+    out_ctxt->mixer = mixer_open(snd_card);
     if (!out_ctxt->mixer) {
         ALOGE("Failed to open mixer");
         out_ctxt->ctl = NULL;
@@ -24,11 +24,7 @@
 #include <sound/audio_effects.h>
 #include "effect_api.h"
 
-/* Retry for delay for mixer open */
-#define RETRY_NUMBER 10
-#define RETRY_US 500000
-
-#define MIXER_CARD 0
+/* card used until the audio HAL reports the one it found */
 #define SOUND_CARD 0
 
 extern const struct effect_interface_s effect_interface;
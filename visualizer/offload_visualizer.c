@@ -163,14 +163,13 @@ int thread_status;
 
 #define DSP_OUTPUT_LATENCY_MS 0 /* Fudge factor for latency after capture point in audio DSP */
 
-/* Retry for delay for mixer open */
-#define RETRY_NUMBER 10
-#define RETRY_US 500000
-
-#define MIXER_CARD 0
+/* card used until the audio HAL reports the one it found */
 #define SOUND_CARD 0
 #define CAPTURE_DEVICE 8
 
+/* sound card of the audio HAL, see visualizer_hal_set_snd_card() */
+static int snd_card = SOUND_CARD;
+
 /* Proxy port supports only MMAP read and those fixed parameters*/
 #define AUDIO_CAPTURE_CHANNEL_COUNT 2
 #define AUDIO_CAPTURE_SMP_RATE 48000
@@ -316,7 +315,6 @@ void *capture_thread_loop(void *arg __unused)
     struct mixer *mixer;
     struct pcm *pcm = NULL;
     int ret;
-    int retry_num = 0;
 
     ALOGD("thread enter");
 
@@ -324,13 +322,10 @@ void *capture_thread_loop(void *arg __unused)
 
     pthread_mutex_lock(&lock);
 
-    mixer = mixer_open(MIXER_CARD);
-    while (mixer == NULL && retry_num < RETRY_NUMBER) {
-        usleep(RETRY_US);
-        mixer = mixer_open(MIXER_CARD);
-        retry_num++;
-    }
+    /* the HAL has the card open already, there is nothing to wait for */
+    mixer = mixer_open(snd_card);
     if (mixer == NULL) {
+        ALOGE("%s: cannot open mixer of card %d", __func__, snd_card);
         pthread_mutex_unlock(&lock);
         return NULL;
     }
@@ -343,7 +338,7 @@ void *capture_thread_loop(void *arg __unused)
             if (!capture_enabled) {
                 ret = configure_proxy_capture(mixer, 1);
                 if (ret == 0) {
-                    pcm = pcm_open(SOUND_CARD, CAPTURE_DEVICE,
+                    pcm = pcm_open(snd_card, CAPTURE_DEVICE,
                                    PCM_IN|PCM_MMAP|PCM_NOIRQ, &pcm_config_capture);
                     if (pcm && !pcm_is_ready(pcm)) {
                         ALOGW("%s: %s", __func__, pcm_get_error(pcm));
@@ -412,6 +407,17 @@ void *capture_thread_loop(void *arg __unused)
  * Interface from audio HAL
  */
 
+/* called by the HAL with the card it discovered, before any output starts */
+__attribute__ ((visibility ("default")))
+void visualizer_hal_set_snd_card(int card) {
+    if (lib_init() != 0)
+        return;
+
+    pthread_mutex_lock(&lock);
+    snd_card = card;
+    pthread_mutex_unlock(&lock);
+}
+
 __attribute__ ((visibility ("default")))
 int visualizer_hal_start_output(audio_io_handle_t output, int pcm_id) {
     int ret = 0;